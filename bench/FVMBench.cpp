@@ -0,0 +1,265 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "FVM.h"
+#include "lang/Compiler.h"
+#include "lang/Lexer.h"
+#include "FVMTestUtils.h"
+
+/**
+ * Interpreter and assembler microbenchmarks.
+ * Instruction counts are reported as items per second, compiler throughput
+ * as bytes of funasm per second.
+ */
+
+/* Copies of one instruction stepped through before the PC is reset */
+static constexpr size_t STEP_COPIES = 256;
+static constexpr uint16_t DATA_ADDRESS = 0x8000;
+
+/**
+ * Encodes one instance of an opcode with benign operands: REG_0 and REG_1,
+ * a literal of 1 and DATA_ADDRESS. Jumps target the following instruction
+ * so taken and not taken branches both move on.
+ */
+static void emitInstruction(std::vector<uint8_t>& bytecode, const BYTECODE_INFO::BYTECODE_OBJECT& object){
+    size_t next = bytecode.size() + object.length;
+    bool branch = object.bytecode >= BYTECODE::JUMP && object.bytecode <= BYTECODE::JUMPGTE;
+
+    bytecode << object.bytecode;
+    bool firstRegister = true;
+    for(size_t i = 0; i < object.argCount; i++){
+        switch(object.args[i]){
+            case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
+                bytecode << (firstRegister ? BYTECODE::REG_0 : BYTECODE::REG_1);
+                firstRegister = false;
+                break;
+            case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
+                bytecode << uint16_t(1);
+                break;
+            case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
+                bytecode << (branch ? static_cast<uint16_t>(next) : DATA_ADDRESS);
+                break;
+            case BYTECODE_INFO::ARGUMENT_TYPE::NONE:
+                break;
+        }
+    }
+}
+
+static void resetRegisters(FVM& vm){
+    vm.registers.fill(0);
+    vm.getRegister(BYTECODE::REG_0) = DATA_ADDRESS;
+    vm.getRegister(BYTECODE::REG_1) = 3;
+}
+
+/* Cost of decoding and dispatching one instruction through FVM::step() */
+static void BM_StepOpcode(benchmark::State& state, const BYTECODE_INFO::BYTECODE_OBJECT* object){
+    std::vector<uint8_t> bytecode;
+    for(size_t i = 0; i < STEP_COPIES; i++){
+        emitInstruction(bytecode, *object);
+    }
+
+    FVM vm(0x20000);
+    vm.init();
+    vm.loadBytecode(0, bytecode);
+    resetRegisters(vm);
+
+    for(auto _ : state){
+        for(size_t i = 0; i < STEP_COPIES; i++){
+            benchmark::DoNotOptimize(vm.step());
+        }
+        resetRegisters(vm);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * STEP_COPIES));
+}
+
+/* REG_0 counts down from the argument: MOVELR, DECREMENT, COMPARE and a conditional jump */
+static std::vector<uint8_t> countdownLoop(const uint16_t count, uint64_t& executed){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << count << BYTECODE::REG_0;               // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                         // 0x0D
+    bytecode << BYTECODE::HALT;                                             // 0x10
+    executed = 3 + 3 * static_cast<uint64_t>(count);
+    return bytecode;
+}
+
+/* Sums DATA_ADDRESS.. through loads, indirect loads, stores and ALU operations */
+static std::vector<uint8_t> memoryLoop(const uint16_t count, uint64_t& executed){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << count << BYTECODE::REG_0;               // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::MOVELR << DATA_ADDRESS << BYTECODE::REG_2;        // 0x08
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_2 << BYTECODE::REG_3;    // 0x0C
+    bytecode << BYTECODE::MOVEMR << DATA_ADDRESS << BYTECODE::REG_4;        // 0x0F
+    bytecode << BYTECODE::ADD << BYTECODE::REG_4 << BYTECODE::REG_3;        // 0x13
+    bytecode << BYTECODE::XOR << BYTECODE::REG_0 << BYTECODE::REG_3;        // 0x16
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_4 << DATA_ADDRESS;        // 0x19
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                     // 0x1D
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x1F
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x21
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x0C);                         // 0x24
+    bytecode << BYTECODE::HALT;                                             // 0x27
+    executed = 4 + 9 * static_cast<uint64_t>(count);
+    return bytecode;
+}
+
+/* Multiplies, divides and shifts, including DIVIDE which native code leaves to the interpreter */
+static std::vector<uint8_t> arithmeticLoop(const uint16_t count, uint64_t& executed){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << count << BYTECODE::REG_0;               // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_2;         // 0x08
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_3;     // 0x0C
+    bytecode << BYTECODE::MULTIPLY << BYTECODE::REG_2 << BYTECODE::REG_3;   // 0x0F
+    bytecode << BYTECODE::SHIFTLEFT << BYTECODE::REG_3 << uint16_t(2);      // 0x12
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_4;         // 0x16
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_3 << BYTECODE::REG_4;     // 0x1A
+    bytecode << BYTECODE::SUBTRACT << BYTECODE::REG_2 << BYTECODE::REG_4;   // 0x1D
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x20
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x22
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x0C);                         // 0x25
+    bytecode << BYTECODE::HALT;                                             // 0x28
+    executed = 4 + 9 * static_cast<uint64_t>(count);
+    return bytecode;
+}
+
+/* An inner loop of 100 with a branch on its parity, inside an outer loop of count / 100 */
+static std::vector<uint8_t> nestedLoop(const uint16_t count, uint64_t& executed){
+    const uint16_t outer = std::max<uint16_t>(count / 100, 1);
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << outer << BYTECODE::REG_0;               // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_6;         // 0x08
+    bytecode << BYTECODE::MOVELR << uint16_t(100) << BYTECODE::REG_2;       // 0x0C
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_2 << BYTECODE::REG_5;     // 0x10
+    bytecode << BYTECODE::AND << BYTECODE::REG_6 << BYTECODE::REG_5;        // 0x13
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_5 << BYTECODE::REG_1;    // 0x16
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x22);                         // 0x19
+    bytecode << BYTECODE::ADD << BYTECODE::REG_2 << BYTECODE::REG_3;        // 0x1C
+    bytecode << BYTECODE::JUMP << uint16_t(0x25);                           // 0x1F
+    bytecode << BYTECODE::XOR << BYTECODE::REG_2 << BYTECODE::REG_3;        // 0x22
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_2;                     // 0x25
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_2 << BYTECODE::REG_1;    // 0x27
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x10);                         // 0x2A
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x2D
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x2F
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x0C);                         // 0x32
+    bytecode << BYTECODE::HALT;                                             // 0x35
+    executed = 4 + 854 * static_cast<uint64_t>(outer);
+    return bytecode;
+}
+
+/* Throughput of FVM::run() on a loop. Arguments: iteration count, JIT on or off */
+static void BM_Run(benchmark::State& state, std::vector<uint8_t> (*program)(const uint16_t, uint64_t&)){
+    uint64_t executed = 0;
+    std::vector<uint8_t> bytecode = program(static_cast<uint16_t>(state.range(0)), executed);
+
+    FVM vm(0x10000);
+    vm.init();
+    vm.loadBytecode(0, bytecode);
+    vm.jitEnabled = state.range(1) != 0;
+
+    for(auto _ : state){
+        vm.registers.fill(0);
+        benchmark::DoNotOptimize(vm.run());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * executed));
+}
+
+/* Latency of init() plus loading a small program. Arguments: MEMORY_SIZE, sparse or dense backing */
+static void BM_InitLoad(benchmark::State& state){
+    uint64_t executed = 0;
+    std::vector<uint8_t> bytecode = countdownLoop(10, executed);
+    GuestMemory::BACKING backing = state.range(1) != 0 ? GuestMemory::BACKING::SPARSE : GuestMemory::BACKING::DENSE;
+
+    FVM vm(static_cast<size_t>(state.range(0)), backing);
+    vm.init();
+    for(auto _ : state){
+        vm.init();
+        benchmark::DoNotOptimize(vm.loadBytecode(0, bytecode));
+        benchmark::ClobberMemory();
+    }
+}
+
+/* Assembler throughput on a generated funasm file. Arguments: lines, threads */
+static void BM_Compile(benchmark::State& state){
+    std::filesystem::path asmPath = std::filesystem::temp_directory_path() / ("FVMBench" + std::to_string(state.range(0)) + ".funasm");
+    {
+        std::ofstream asmStream(asmPath);
+        asmStream << "start:\n";
+        for(int64_t i = 0; i < state.range(0); i++){
+            asmStream << "    MOVELR " << std::hex << (i & 0xFFFF) << std::dec << " REG_0\n";
+            asmStream << "    ADD REG_0 REG_1 ; accumulate\n";
+            asmStream << "    COMPARE REG_1 REG_2\n";
+            asmStream << "    JUMPLT start\n";
+        }
+        asmStream << "    HALT\n";
+    }
+    int64_t bytes = static_cast<int64_t>(std::filesystem::file_size(asmPath));
+
+    Compiler compiler(static_cast<size_t>(state.range(1)));
+    for(auto _ : state){
+        benchmark::DoNotOptimize(compiler.compileFunasmToBytecode(asmPath));
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+
+    std::filesystem::path fbcPath = asmPath;
+    fbcPath.replace_extension(".fbc");
+    std::filesystem::remove(asmPath);
+    std::filesystem::remove(fbcPath);
+}
+
+/* Lexer throughput on generated funlang. Arguments: statements */
+static void BM_Tokenize(benchmark::State& state){
+    std::string source = "var total = 0;\n";
+    for(int64_t i = 0; i < state.range(0); i++){
+        source += "var value_" + std::to_string(i) + " = mem[0x" + std::to_string(i & 0xFFF) + "] * 3 + total; // step\n";
+        source += "if (value_" + std::to_string(i) + " >= 100) {\n    total = total + (value_" + std::to_string(i) + " >> 2);\n}\n";
+    }
+
+    Lexer lexer;
+    for(auto _ : state){
+        benchmark::DoNotOptimize(lexer.tokenize(source));
+        benchmark::DoNotOptimize(lexer.getTokens().data());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(source.size()));
+}
+
+BENCHMARK_CAPTURE(BM_Run, Countdown, countdownLoop)->ArgsProduct({{10000}, {0, 1}});
+BENCHMARK_CAPTURE(BM_Run, Memory, memoryLoop)->ArgsProduct({{10000}, {0, 1}});
+BENCHMARK_CAPTURE(BM_Run, Arithmetic, arithmeticLoop)->ArgsProduct({{10000}, {0, 1}});
+BENCHMARK_CAPTURE(BM_Run, Nested, nestedLoop)->ArgsProduct({{10000}, {0, 1}});
+BENCHMARK(BM_InitLoad)->ArgsProduct({benchmark::CreateRange(4 << 10, 16 << 20, 16), {0, 1}});
+BENCHMARK(BM_Compile)->ArgsProduct({{10000, 100000}, {1}});
+BENCHMARK(BM_Tokenize)->Arg(100000);
+
+int main(int argc, char** argv){
+    spdlog::set_level(spdlog::level::off);
+
+    for(const BYTECODE_INFO::BYTECODE_OBJECT& object : BYTECODE_INFO::OBJECTS){
+        if(!object.isRegister){
+            benchmark::RegisterBenchmark(("BM_StepOpcode/" + std::string(object.name)).c_str(), BM_StepOpcode, &object);
+        }
+    }
+
+    // Parallel assembly on every core, next to the single threaded runs registered above
+    int64_t cores = std::thread::hardware_concurrency();
+    if(cores > 1){
+        benchmark::RegisterBenchmark("BM_Compile", BM_Compile)->ArgsProduct({{10000, 100000}, {cores}});
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)){
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,68 @@
+import argparse
+import json
+import os
+import struct
+import sys
+
+# Mirrors TraceBuffer::writeTo in src/Trace.cpp
+FILE_MAGIC = b"FVMTRACE"
+HEADER_FORMAT = "<8sIIQQ"
+ENTRY_FORMAT = "<HBBBBHHH"
+
+def load_bytecodes(json_path):
+	with open(json_path, 'r') as f:
+		return json.load(f)["bytecode"]
+
+def register_name(bytecodes, index):
+	first_register = next(i for i, bytecode in enumerate(bytecodes) if bytecode.get("register", False))
+	position = first_register + index
+	return bytecodes[position]["name"] if position < len(bytecodes) else f"REG_?{index}"
+
+def format_entry(bytecodes, entry):
+	pc, opcode, reg_a, reg_b, _, literal, address, flags = entry
+
+	if opcode >= len(bytecodes):
+		return f"0x{pc:04x}  UNKNOWN(0x{opcode:02x})  flags=0x{flags:02x}"
+
+	bytecode = bytecodes[opcode]
+	operands = []
+	registers = [reg_a, reg_b]
+	for arg in bytecode["args"]:
+		if arg == "REGISTER":
+			operands.append(register_name(bytecodes, registers.pop(0)))
+		elif arg == "LITERAL":
+			operands.append(f"0x{literal:04x}")
+		elif arg == "ADDRESS":
+			operands.append(f"0x{address:04x}")
+
+	return f"0x{pc:04x}  {' '.join([bytecode['name']] + operands)}  flags=0x{flags:02x}"
+
+def decode_trace(trace_path, bytecodes, last):
+	with open(trace_path, 'rb') as f:
+		header = f.read(struct.calcsize(HEADER_FORMAT))
+		magic, version, entry_size, total, count = struct.unpack(HEADER_FORMAT, header)
+
+		if magic != FILE_MAGIC or version != 1 or entry_size != struct.calcsize(ENTRY_FORMAT):
+			raise ValueError(f"{trace_path} is not a version 1 FVM trace")
+
+		entries = [struct.unpack(ENTRY_FORMAT, f.read(entry_size)) for _ in range(count)]
+
+	print(f"{total} instructions recorded, showing the last {min(last, count)}")
+	for entry in entries[-last:]:
+		print(format_entry(bytecodes, entry))
+
+
+if __name__ == "__main__":
+	base_dir = os.path.dirname(__file__)
+
+	parser = argparse.ArgumentParser(description="Print the last instructions of an FVM execution trace")
+	parser.add_argument("trace", help="trace file written by the VM")
+	parser.add_argument("-n", "--last", type=int, default=32, help="number of instructions to print")
+	parser.add_argument("--bytecode", default=os.path.join(base_dir, '..', 'src', 'bytecode.json'), help="path to bytecode.json")
+	args = parser.parse_args()
+
+	try:
+		decode_trace(args.trace, load_bytecodes(args.bytecode), args.last)
+	except (IOError, ValueError, struct.error) as e:
+		print(f"Error: {e}")
+		sys.exit(1)
@@ -19,10 +19,25 @@ DEFINITION_MACROS = """
 
 HEADER_FILES = """
 #include <stdint.h>
-#include <string>
-#include <unordered_map>
+#include <array>
+#include <cstddef>
+#include <string_view>
 \n"""
 
+# Operand sizes in bytes, registers are a single byte and literals/addresses are little endian words
+ARGUMENT_SIZES = {
+	"REGISTER": 1,
+	"LITERAL": 2,
+	"ADDRESS": 2,
+}
+
+MAX_ARGS = 2
+
+# Mnemonic lookup uses a perfect hash: FNV-1a over the name mixed with a seed and finalised
+# searched here so that every mnemonic lands in its own slot of the table
+NAME_HASH_BITS = 7
+NAME_HASH_EMPTY = 0xFF
+
 ENDIF_MACRO = """
 #endif
 """
@@ -44,39 +59,122 @@ def generate_bytecode_enum(bytecode_dict):
 	bytecode_enum_str = BYTECODE_ENUM_TYPE + "".join(formatted_bytecodes) + indent(0) + "};\n"
 	return bytecode_enum_str
 		
-OBJECT_FROM_NAME_TYPE = """
-	const std::unordered_map<std::string, BYTECODE_OBJECT> OBJECT_FROM_NAME_MAP = {
+def name_hash(name, seed):
+	h = (2166136261 ^ seed) & 0xFFFFFFFF
+	for c in name.encode("ascii"):
+		h ^= c
+		h = (h * 16777619) & 0xFFFFFFFF
+	h ^= h >> 15
+	h = (h * 0x2C1B3C6D) & 0xFFFFFFFF
+	h ^= h >> 12
+	return h >> (32 - NAME_HASH_BITS)
+
+def find_name_hash_seed(bytecode_dict):
+	names = [bytecode["name"] for bytecode in bytecode_dict["bytecode"]]
+	for seed in range(1 << 20):
+		slots = {name_hash(name, seed) for name in names}
+		if len(slots) == len(names):
+			return seed
+	raise ValueError("No perfect hash seed found, increase NAME_HASH_BITS")
+
+def opcode_count(bytecode_dict):
+	return sum(1 for bytecode in bytecode_dict["bytecode"] if not bytecode.get("register", False))
+
+# FNV-1a over everything that decides the encoding (names, order, operands), but not the comments,
+# so anything caching compiled bytecode can tell when the table it was compiled against changed
+def table_hash(bytecode_dict):
+	encoding = json.dumps([[bytecode["name"], bytecode["args"], bytecode.get("register", False)] for bytecode in bytecode_dict["bytecode"]])
+	hash = 2166136261
+	for c in encoding.encode():
+		hash = ((hash ^ c) * 16777619) & 0xFFFFFFFF
+	return hash
+
+def generate_counts(bytecode_dict):
+	counts_str = "\n"
+	counts_str += f"{indent(1)}// Every bytecode, opcodes first and registers after them\n"
+	counts_str += f"{indent(1)}inline constexpr size_t BYTECODE_COUNT = {len(bytecode_dict['bytecode'])};\n"
+	counts_str += f"{indent(1)}inline constexpr size_t OPCODE_COUNT = {opcode_count(bytecode_dict)};\n"
+	counts_str += f"{indent(1)}inline constexpr size_t MAX_ARGS = {MAX_ARGS};\n\n"
+	counts_str += f"{indent(1)}// Hash of the opcode encoding, changes whenever bytecode compiled against an older table is invalid\n"
+	counts_str += f"{indent(1)}inline constexpr uint32_t TABLE_HASH = 0x{table_hash(bytecode_dict):08X};\n"
+	return counts_str
+
+OBJECTS_TYPE = """
+	inline constexpr std::array<BYTECODE_OBJECT, BYTECODE_COUNT> OBJECTS = {{
 """
-def generate_object_from_name_map(bytecode_dict):
-	object_from_name_map_str = OBJECT_FROM_NAME_TYPE
+def generate_objects(bytecode_dict):
+	objects_str = OBJECTS_TYPE
+	unimplemented = opcode_count(bytecode_dict)
 
 	for bytecode in bytecode_dict["bytecode"]:
-		args_formatted = ", ".join([f"ARGUMENT_TYPE::{arg}" for arg in bytecode["args"]])
+		args = bytecode["args"]
+		if len(args) > MAX_ARGS:
+			raise ValueError(f"{bytecode['name']} has more than {MAX_ARGS} arguments")
 
-		bytecode_line = f"{indent(2)}{{\"{bytecode['name']}\", {{BYTECODE::{bytecode['name']}, \"{bytecode['name']}\", {{{args_formatted}}}}}}},\n"
+		is_register = bytecode.get("register", False)
+		length = 1 + sum(ARGUMENT_SIZES[arg] for arg in args)
+		padded_args = [f"ARGUMENT_TYPE::{arg}" for arg in args] + ["ARGUMENT_TYPE::NONE"] * (MAX_ARGS - len(args))
+		handler = unimplemented if is_register else f"static_cast<uint8_t>(BYTECODE::{bytecode['name']})"
 
-		object_from_name_map_str += bytecode_line
+		objects_str += (f"{indent(2)}{{BYTECODE::{bytecode['name']}, \"{bytecode['name']}\", "
+						f"{length}, {len(args)}, {{{', '.join(padded_args)}}}, {handler}, "
+						f"{'true' if is_register else 'false'}}},\n")
 
-	object_from_name_map_str += f"{indent(1)}}};\n"
+	objects_str += f"{indent(1)}}}}};\n"
+	return objects_str
 
-	return object_from_name_map_str
+def generate_name_hash_table(bytecode_dict):
+	seed = find_name_hash_seed(bytecode_dict)
+	table = [NAME_HASH_EMPTY] * (1 << NAME_HASH_BITS)
+	for i, bytecode in enumerate(bytecode_dict["bytecode"]):
+		table[name_hash(bytecode["name"], seed)] = i
 
-NAME_FROM_VALUE_TYPE = """
-	const std::unordered_map<BYTECODE, std::string> NAME_FROM_VALUE_MAP = {
-"""
-def generate_name_from_value_map(bytecode_dict):
-	name_from_value_map_str = NAME_FROM_VALUE_TYPE
-	for bytecode in bytecode_dict["bytecode"]:
-     
-		bytecode_line = f"{indent(2)}{{BYTECODE::{bytecode['name']}, \"{bytecode['name']}\"}},\n"
+	table_str = "\n"
+	table_str += f"{indent(1)}inline constexpr uint32_t NAME_HASH_SEED = {seed};\n"
+	table_str += f"{indent(1)}inline constexpr uint32_t NAME_HASH_BITS = {NAME_HASH_BITS};\n"
+	table_str += f"{indent(1)}inline constexpr uint8_t NAME_HASH_EMPTY = 0x{NAME_HASH_EMPTY:02X};\n\n"
+	table_str += f"{indent(1)}// Slot -> index into OBJECTS, generated so no two mnemonics collide\n"
+	table_str += f"{indent(1)}inline constexpr std::array<uint8_t, 1 << NAME_HASH_BITS> NAME_HASH_TABLE = {{{{\n"
+	for row in range(0, len(table), 16):
+		table_str += indent(2) + ", ".join(f"0x{slot:02X}" for slot in table[row:row + 16]) + ",\n"
+	table_str += f"{indent(1)}}}}};\n"
+	return table_str
+
+LOOKUP_FUNCTIONS = """
+	constexpr uint32_t nameHash(std::string_view name){
+		uint32_t hash = 2166136261u ^ NAME_HASH_SEED;
+		for(char c : name){
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 16777619u;
+		}
+		hash ^= hash >> 15;
+		hash *= 0x2C1B3C6Du;
+		hash ^= hash >> 12;
+		return hash >> (32 - NAME_HASH_BITS);
+	}
 
-		name_from_value_map_str += bytecode_line
+	// Returns the bytecode with the given mnemonic, or nullptr if there is none
+	constexpr const BYTECODE_OBJECT* objectFromName(std::string_view name){
+		uint8_t index = NAME_HASH_TABLE[nameHash(name)];
+		if(index == NAME_HASH_EMPTY || OBJECTS[index].name != name){
+			return nullptr;
+		}
+		return &OBJECTS[index];
+	}
+
+	// Returns the bytecode for a raw byte value, or nullptr if the byte is not a bytecode
+	constexpr const BYTECODE_OBJECT* objectFromValue(uint8_t value){
+		return value < BYTECODE_COUNT ? &OBJECTS[value] : nullptr;
+	}
 
-	name_from_value_map_str += f"{indent(1)}}};\n"
+	constexpr std::string_view nameFromValue(uint8_t value){
+		return value < BYTECODE_COUNT ? OBJECTS[value].name : std::string_view("UNKNOWN");
+	}
 
-	return name_from_value_map_str
+	static_assert(objectFromName(OBJECTS[0].name) == &OBJECTS[0]);
+	static_assert(objectFromName(OBJECTS[BYTECODE_COUNT - 1].name) == &OBJECTS[BYTECODE_COUNT - 1]);
+"""
  
-  
 BYTECODE_INFO_NAMESPACE = """
 namespace BYTECODE_INFO {
 """
@@ -87,6 +185,7 @@ ARGUMENT_TYPE_ENUM = """
 		REGISTER,
 		LITERAL,
 		ADDRESS,
+		NONE,
 	};
 
 \n"""
@@ -94,16 +193,15 @@ ARGUMENT_TYPE_ENUM = """
 BYTECODE_OBJECT_STRUCT = """
 	struct BYTECODE_OBJECT
 	{
-		BYTECODE_OBJECT(BYTECODE bytecode,
-						std::string name,
-						std::vector<ARGUMENT_TYPE> args) : bytecode(bytecode),
-														   name(name),
-														   args(args)
-		{
-		}
 		BYTECODE bytecode;
-		std::string name;
-		std::vector<ARGUMENT_TYPE> args;
+		std::string_view name;
+		// Instruction length in bytes, opcode included
+		uint8_t length;
+		uint8_t argCount;
+		std::array<ARGUMENT_TYPE, MAX_ARGS> args;
+		// Dispatch slot of the handler in FVM::execute, OPCODE_COUNT for non-opcodes
+		uint8_t handler;
+		bool isRegister;
 	};
 \n"""
 def generate_bytecode_info_namespace(bytecode_dict):
@@ -111,10 +209,12 @@ def generate_bytecode_info_namespace(bytecode_dict):
 	
 	bytecode_info_namespace += BYTECODE_INFO_NAMESPACE
 	bytecode_info_namespace	+= ARGUMENT_TYPE_ENUM
+	bytecode_info_namespace += generate_counts(bytecode_dict)
 	bytecode_info_namespace += BYTECODE_OBJECT_STRUCT
  
-	bytecode_info_namespace += generate_object_from_name_map(bytecode_dict)
-	bytecode_info_namespace += generate_name_from_value_map(bytecode_dict)
+	bytecode_info_namespace += generate_objects(bytecode_dict)
+	bytecode_info_namespace += generate_name_hash_table(bytecode_dict)
+	bytecode_info_namespace += LOOKUP_FUNCTIONS
  
 	bytecode_info_namespace += "}"
  
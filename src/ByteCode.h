@@ -12,8 +12,9 @@
 
 
 #include <stdint.h>
-#include <string>
-#include <unordered_map>
+#include <array>
+#include <cstddef>
+#include <string_view>
 
 
 enum class BYTECODE : uint8_t {
@@ -173,107 +174,122 @@ namespace BYTECODE_INFO {
 		REGISTER,
 		LITERAL,
 		ADDRESS,
+		NONE,
 	};
 
 
 
+	// Every bytecode, opcodes first and registers after them
+	inline constexpr size_t BYTECODE_COUNT = 39;
+	inline constexpr size_t OPCODE_COUNT = 29;
+	inline constexpr size_t MAX_ARGS = 2;
+
+	// Hash of the opcode encoding, changes whenever bytecode compiled against an older table is invalid
+	inline constexpr uint32_t TABLE_HASH = 0x9A5BBC8D;
+
 	struct BYTECODE_OBJECT
 	{
-		BYTECODE_OBJECT(BYTECODE bytecode,
-						std::string name,
-						std::vector<ARGUMENT_TYPE> args) : bytecode(bytecode),
-														   name(name),
-														   args(args)
-		{
-		}
 		BYTECODE bytecode;
-		std::string name;
-		std::vector<ARGUMENT_TYPE> args;
+		std::string_view name;
+		// Instruction length in bytes, opcode included
+		uint8_t length;
+		uint8_t argCount;
+		std::array<ARGUMENT_TYPE, MAX_ARGS> args;
+		// Dispatch slot of the handler in FVM::execute, OPCODE_COUNT for non-opcodes
+		uint8_t handler;
+		bool isRegister;
 	};
 
 
-	const std::unordered_map<std::string, BYTECODE_OBJECT> OBJECT_FROM_NAME_MAP = {
-		{"HALT", {BYTECODE::HALT, "HALT", {}}},
-		{"COMPARE", {BYTECODE::COMPARE, "COMPARE", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"JUMP", {BYTECODE::JUMP, "JUMP", {ARGUMENT_TYPE::ADDRESS}}},
-		{"JUMPEQ", {BYTECODE::JUMPEQ, "JUMPEQ", {ARGUMENT_TYPE::ADDRESS}}},
-		{"JUMPLT", {BYTECODE::JUMPLT, "JUMPLT", {ARGUMENT_TYPE::ADDRESS}}},
-		{"JUMPGT", {BYTECODE::JUMPGT, "JUMPGT", {ARGUMENT_TYPE::ADDRESS}}},
-		{"JUMPLTE", {BYTECODE::JUMPLTE, "JUMPLTE", {ARGUMENT_TYPE::ADDRESS}}},
-		{"JUMPGTE", {BYTECODE::JUMPGTE, "JUMPGTE", {ARGUMENT_TYPE::ADDRESS}}},
-		{"MOVELR", {BYTECODE::MOVELR, "MOVELR", {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::REGISTER}}},
-		{"MOVERR", {BYTECODE::MOVERR, "MOVERR", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"MOVELM", {BYTECODE::MOVELM, "MOVELM", {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::ADDRESS}}},
-		{"MOVERM", {BYTECODE::MOVERM, "MOVERM", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::ADDRESS}}},
-		{"MOVEMR", {BYTECODE::MOVEMR, "MOVEMR", {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::REGISTER}}},
-		{"MOVELIR", {BYTECODE::MOVELIR, "MOVELIR", {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::REGISTER}}},
-		{"MOVEIRR", {BYTECODE::MOVEIRR, "MOVEIRR", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"MOVEIRM", {BYTECODE::MOVEIRM, "MOVEIRM", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::ADDRESS}}},
-		{"MOVEIMR", {BYTECODE::MOVEIMR, "MOVEIMR", {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::REGISTER}}},
-		{"ADD", {BYTECODE::ADD, "ADD", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"SUBTRACT", {BYTECODE::SUBTRACT, "SUBTRACT", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"MULTIPLY", {BYTECODE::MULTIPLY, "MULTIPLY", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"DIVIDE", {BYTECODE::DIVIDE, "DIVIDE", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"INCREMENT", {BYTECODE::INCREMENT, "INCREMENT", {ARGUMENT_TYPE::REGISTER}}},
-		{"DECREMENT", {BYTECODE::DECREMENT, "DECREMENT", {ARGUMENT_TYPE::REGISTER}}},
-		{"AND", {BYTECODE::AND, "AND", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"OR", {BYTECODE::OR, "OR", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"XOR", {BYTECODE::XOR, "XOR", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}}},
-		{"NOT", {BYTECODE::NOT, "NOT", {ARGUMENT_TYPE::REGISTER}}},
-		{"SHIFTLEFT", {BYTECODE::SHIFTLEFT, "SHIFTLEFT", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::LITERAL}}},
-		{"SHIFTRIGHT", {BYTECODE::SHIFTRIGHT, "SHIFTRIGHT", {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::LITERAL}}},
-		{"REG_0", {BYTECODE::REG_0, "REG_0", {}}},
-		{"REG_1", {BYTECODE::REG_1, "REG_1", {}}},
-		{"REG_2", {BYTECODE::REG_2, "REG_2", {}}},
-		{"REG_3", {BYTECODE::REG_3, "REG_3", {}}},
-		{"REG_4", {BYTECODE::REG_4, "REG_4", {}}},
-		{"REG_5", {BYTECODE::REG_5, "REG_5", {}}},
-		{"REG_6", {BYTECODE::REG_6, "REG_6", {}}},
-		{"REG_7", {BYTECODE::REG_7, "REG_7", {}}},
-		{"REG_PC", {BYTECODE::REG_PC, "REG_PC", {}}},
-		{"REG_FLAGS", {BYTECODE::REG_FLAGS, "REG_FLAGS", {}}},
-	};
+	inline constexpr std::array<BYTECODE_OBJECT, BYTECODE_COUNT> OBJECTS = {{
+		{BYTECODE::HALT, "HALT", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::HALT), false},
+		{BYTECODE::COMPARE, "COMPARE", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::COMPARE), false},
+		{BYTECODE::JUMP, "JUMP", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMP), false},
+		{BYTECODE::JUMPEQ, "JUMPEQ", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMPEQ), false},
+		{BYTECODE::JUMPLT, "JUMPLT", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMPLT), false},
+		{BYTECODE::JUMPGT, "JUMPGT", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMPGT), false},
+		{BYTECODE::JUMPLTE, "JUMPLTE", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMPLTE), false},
+		{BYTECODE::JUMPGTE, "JUMPGTE", 3, 1, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::JUMPGTE), false},
+		{BYTECODE::MOVELR, "MOVELR", 4, 2, {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVELR), false},
+		{BYTECODE::MOVERR, "MOVERR", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVERR), false},
+		{BYTECODE::MOVELM, "MOVELM", 5, 2, {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::ADDRESS}, static_cast<uint8_t>(BYTECODE::MOVELM), false},
+		{BYTECODE::MOVERM, "MOVERM", 4, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::ADDRESS}, static_cast<uint8_t>(BYTECODE::MOVERM), false},
+		{BYTECODE::MOVEMR, "MOVEMR", 4, 2, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVEMR), false},
+		{BYTECODE::MOVELIR, "MOVELIR", 4, 2, {ARGUMENT_TYPE::LITERAL, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVELIR), false},
+		{BYTECODE::MOVEIRR, "MOVEIRR", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVEIRR), false},
+		{BYTECODE::MOVEIRM, "MOVEIRM", 4, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::ADDRESS}, static_cast<uint8_t>(BYTECODE::MOVEIRM), false},
+		{BYTECODE::MOVEIMR, "MOVEIMR", 4, 2, {ARGUMENT_TYPE::ADDRESS, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MOVEIMR), false},
+		{BYTECODE::ADD, "ADD", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::ADD), false},
+		{BYTECODE::SUBTRACT, "SUBTRACT", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::SUBTRACT), false},
+		{BYTECODE::MULTIPLY, "MULTIPLY", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::MULTIPLY), false},
+		{BYTECODE::DIVIDE, "DIVIDE", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::DIVIDE), false},
+		{BYTECODE::INCREMENT, "INCREMENT", 2, 1, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::INCREMENT), false},
+		{BYTECODE::DECREMENT, "DECREMENT", 2, 1, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::DECREMENT), false},
+		{BYTECODE::AND, "AND", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::AND), false},
+		{BYTECODE::OR, "OR", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::OR), false},
+		{BYTECODE::XOR, "XOR", 3, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::REGISTER}, static_cast<uint8_t>(BYTECODE::XOR), false},
+		{BYTECODE::NOT, "NOT", 2, 1, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::NONE}, static_cast<uint8_t>(BYTECODE::NOT), false},
+		{BYTECODE::SHIFTLEFT, "SHIFTLEFT", 4, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::LITERAL}, static_cast<uint8_t>(BYTECODE::SHIFTLEFT), false},
+		{BYTECODE::SHIFTRIGHT, "SHIFTRIGHT", 4, 2, {ARGUMENT_TYPE::REGISTER, ARGUMENT_TYPE::LITERAL}, static_cast<uint8_t>(BYTECODE::SHIFTRIGHT), false},
+		{BYTECODE::REG_0, "REG_0", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_1, "REG_1", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_2, "REG_2", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_3, "REG_3", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_4, "REG_4", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_5, "REG_5", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_6, "REG_6", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_7, "REG_7", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_PC, "REG_PC", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+		{BYTECODE::REG_FLAGS, "REG_FLAGS", 1, 0, {ARGUMENT_TYPE::NONE, ARGUMENT_TYPE::NONE}, 29, true},
+	}};
+
+	inline constexpr uint32_t NAME_HASH_SEED = 421;
+	inline constexpr uint32_t NAME_HASH_BITS = 7;
+	inline constexpr uint8_t NAME_HASH_EMPTY = 0xFF;
+
+	// Slot -> index into OBJECTS, generated so no two mnemonics collide
+	inline constexpr std::array<uint8_t, 1 << NAME_HASH_BITS> NAME_HASH_TABLE = {{
+		0xFF, 0xFF, 0x1B, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x21, 0x22, 0xFF, 0xFF,
+		0xFF, 0xFF, 0x08, 0xFF, 0x0A, 0x20, 0xFF, 0xFF, 0x0C, 0xFF, 0xFF, 0xFF, 0xFF, 0x25, 0xFF, 0x02,
+		0xFF, 0x18, 0xFF, 0xFF, 0xFF, 0xFF, 0x17, 0x05, 0x24, 0xFF, 0xFF, 0x0E, 0xFF, 0xFF, 0x15, 0xFF,
+		0x23, 0xFF, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x16, 0x10,
+		0xFF, 0xFF, 0xFF, 0xFF, 0x19, 0xFF, 0xFF, 0x00, 0xFF, 0x12, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+		0x1F, 0xFF, 0xFF, 0x1D, 0x1A, 0xFF, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x11, 0x0D,
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0B, 0xFF, 0xFF, 0xFF, 0xFF, 0x26, 0xFF, 0xFF, 0x04, 0xFF,
+		0x1C, 0x13, 0xFF, 0x03, 0xFF, 0xFF, 0xFF, 0xFF, 0x06, 0xFF, 0x1E, 0x14, 0xFF, 0xFF, 0xFF, 0xFF,
+	}};
+
+	constexpr uint32_t nameHash(std::string_view name){
+		uint32_t hash = 2166136261u ^ NAME_HASH_SEED;
+		for(char c : name){
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 16777619u;
+		}
+		hash ^= hash >> 15;
+		hash *= 0x2C1B3C6Du;
+		hash ^= hash >> 12;
+		return hash >> (32 - NAME_HASH_BITS);
+	}
+
+	// Returns the bytecode with the given mnemonic, or nullptr if there is none
+	constexpr const BYTECODE_OBJECT* objectFromName(std::string_view name){
+		uint8_t index = NAME_HASH_TABLE[nameHash(name)];
+		if(index == NAME_HASH_EMPTY || OBJECTS[index].name != name){
+			return nullptr;
+		}
+		return &OBJECTS[index];
+	}
 
-	const std::unordered_map<BYTECODE, std::string> NAME_FROM_VALUE_MAP = {
-		{BYTECODE::HALT, "HALT"},
-		{BYTECODE::COMPARE, "COMPARE"},
-		{BYTECODE::JUMP, "JUMP"},
-		{BYTECODE::JUMPEQ, "JUMPEQ"},
-		{BYTECODE::JUMPLT, "JUMPLT"},
-		{BYTECODE::JUMPGT, "JUMPGT"},
-		{BYTECODE::JUMPLTE, "JUMPLTE"},
-		{BYTECODE::JUMPGTE, "JUMPGTE"},
-		{BYTECODE::MOVELR, "MOVELR"},
-		{BYTECODE::MOVERR, "MOVERR"},
-		{BYTECODE::MOVELM, "MOVELM"},
-		{BYTECODE::MOVERM, "MOVERM"},
-		{BYTECODE::MOVEMR, "MOVEMR"},
-		{BYTECODE::MOVELIR, "MOVELIR"},
-		{BYTECODE::MOVEIRR, "MOVEIRR"},
-		{BYTECODE::MOVEIRM, "MOVEIRM"},
-		{BYTECODE::MOVEIMR, "MOVEIMR"},
-		{BYTECODE::ADD, "ADD"},
-		{BYTECODE::SUBTRACT, "SUBTRACT"},
-		{BYTECODE::MULTIPLY, "MULTIPLY"},
-		{BYTECODE::DIVIDE, "DIVIDE"},
-		{BYTECODE::INCREMENT, "INCREMENT"},
-		{BYTECODE::DECREMENT, "DECREMENT"},
-		{BYTECODE::AND, "AND"},
-		{BYTECODE::OR, "OR"},
-		{BYTECODE::XOR, "XOR"},
-		{BYTECODE::NOT, "NOT"},
-		{BYTECODE::SHIFTLEFT, "SHIFTLEFT"},
-		{BYTECODE::SHIFTRIGHT, "SHIFTRIGHT"},
-		{BYTECODE::REG_0, "REG_0"},
-		{BYTECODE::REG_1, "REG_1"},
-		{BYTECODE::REG_2, "REG_2"},
-		{BYTECODE::REG_3, "REG_3"},
-		{BYTECODE::REG_4, "REG_4"},
-		{BYTECODE::REG_5, "REG_5"},
-		{BYTECODE::REG_6, "REG_6"},
-		{BYTECODE::REG_7, "REG_7"},
-		{BYTECODE::REG_PC, "REG_PC"},
-		{BYTECODE::REG_FLAGS, "REG_FLAGS"},
-	};
+	// Returns the bytecode for a raw byte value, or nullptr if the byte is not a bytecode
+	constexpr const BYTECODE_OBJECT* objectFromValue(uint8_t value){
+		return value < BYTECODE_COUNT ? &OBJECTS[value] : nullptr;
+	}
+
+	constexpr std::string_view nameFromValue(uint8_t value){
+		return value < BYTECODE_COUNT ? OBJECTS[value].name : std::string_view("UNKNOWN");
+	}
+
+	static_assert(objectFromName(OBJECTS[0].name) == &OBJECTS[0]);
+	static_assert(objectFromName(OBJECTS[BYTECODE_COUNT - 1].name) == &OBJECTS[BYTECODE_COUNT - 1]);
 }
 #endif
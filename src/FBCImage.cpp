@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <fstream>
+
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#include "spdlog/spdlog.h"
+#include "FBCImage.h"
+#include "Files.h"
+#include "Hash.h"
+
+static void putUInt16(std::vector<uint8_t>& out, const size_t at, const uint16_t value){
+	out[at] = static_cast<uint8_t>(value & 0xFF);
+	out[at + 1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void putUInt32(std::vector<uint8_t>& out, const size_t at, const uint32_t value){
+	putUInt16(out, at, static_cast<uint16_t>(value & 0xFFFF));
+	putUInt16(out, at + 2, static_cast<uint16_t>(value >> 16));
+}
+
+static uint16_t getUInt16(const uint8_t* in){
+	return static_cast<uint16_t>(in[0] | in[1] << 8);
+}
+
+static uint32_t getUInt32(const uint8_t* in){
+	return static_cast<uint32_t>(getUInt16(in)) | static_cast<uint32_t>(getUInt16(in + 2)) << 16;
+}
+
+uint32_t FBCImage::hash(const uint8_t* data, const size_t size, uint32_t seed){
+	return fnv1a<uint32_t>(data, size, seed);
+}
+
+/**
+ * Checks whether a file starts with the container MAGIC.
+ * @param path The file to check.
+ * @return True for a container, false for raw bytecode or an unreadable file.
+ */
+bool FBCImage::isImage(const std::filesystem::path& path){
+	std::ifstream fileStream(path, std::ios::binary);
+	std::array<uint8_t, MAGIC.size()> magic{};
+	fileStream.read(reinterpret_cast<char*>(magic.data()), static_cast<std::streamsize>(magic.size()));
+	return fileStream.good() && magic == MAGIC;
+}
+
+/**
+ * Reads and validates the header and section table of a container, and the
+ * BLOCKS section if there is one. CODE and DATA payloads are left in the file
+ * for the loader, verify() checks them once they are loaded.
+ * @param path The .fbc file to read.
+ * @return RESULT_CODE SUCCESS, FILE_NOT_FOUND if the file cannot be read, or
+ * BAD_IMAGE if it is not a well-formed container of this version.
+ */
+RESULT FBCImage::read(const std::filesystem::path& path){
+	std::ifstream fileStream(path, std::ios::binary);
+	if(!fileStream.is_open()){
+		SPDLOG_ERROR("Could not open program: " + path.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(path, error);
+	if(error){
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	std::vector<uint8_t> header(HEADER_SIZE);
+	fileStream.read(reinterpret_cast<char*>(header.data()), static_cast<std::streamsize>(header.size()));
+	if(!fileStream.good() || !std::equal(MAGIC.begin(), MAGIC.end(), header.begin())){
+		SPDLOG_ERROR(path.filename().string() + " is not an fbc image");
+		return RESULT_CODE::BAD_IMAGE;
+	}
+
+	uint16_t version = getUInt16(&header[4]);
+	if(version != VERSION){
+		SPDLOG_ERROR(path.filename().string() + " has unsupported fbc version " + std::to_string(version));
+		return RESULT_CODE::BAD_IMAGE;
+	}
+
+	uint16_t sectionCount = getUInt16(&header[6]);
+	entry = getUInt16(&header[8]);
+	memorySize = getUInt32(&header[12]);
+	checksum = getUInt32(&header[16]);
+
+	std::vector<uint8_t> table(sectionCount * SECTION_ENTRY_SIZE);
+	fileStream.read(reinterpret_cast<char*>(table.data()), static_cast<std::streamsize>(table.size()));
+	if(!fileStream.good()){
+		SPDLOG_ERROR(path.filename().string() + " has a truncated section table");
+		return RESULT_CODE::BAD_IMAGE;
+	}
+
+	putUInt32(header, 16, 0);
+	tableHash = hash(table.data(), table.size(), hash(header.data(), header.size()));
+
+	sections.clear();
+	blocks.clear();
+	for(size_t i = 0; i < sectionCount; i++){
+		const uint8_t* entryBytes = &table[i * SECTION_ENTRY_SIZE];
+		Section section;
+		section.type = static_cast<SECTION_TYPE>(getUInt16(entryBytes));
+		section.address = getUInt32(entryBytes + 4);
+		section.fileOffset = getUInt32(entryBytes + 8);
+		section.size = getUInt32(entryBytes + 12);
+
+		if(static_cast<uint64_t>(section.fileOffset) + section.size > fileSize){
+			SPDLOG_ERROR(path.filename().string() + " has a section past the end of the file");
+			return RESULT_CODE::BAD_IMAGE;
+		}
+
+		switch(section.type){
+			case SECTION_TYPE::CODE:
+			case SECTION_TYPE::DATA:
+				break;
+			case SECTION_TYPE::BLOCKS:
+				section.payload.resize(section.size);
+				fileStream.seekg(static_cast<std::streamoff>(section.fileOffset));
+				fileStream.read(reinterpret_cast<char*>(section.payload.data()), static_cast<std::streamsize>(section.size));
+				if(!fileStream.good() || section.size % 2 != 0){
+					SPDLOG_ERROR(path.filename().string() + " has a malformed BLOCKS section");
+					return RESULT_CODE::BAD_IMAGE;
+				}
+				for(size_t at = 0; at < section.size; at += 2){
+					blocks.push_back(getUInt16(&section.payload[at]));
+				}
+				break;
+			default:
+				SPDLOG_ERROR(path.filename().string() + " has an unknown section type");
+				return RESULT_CODE::BAD_IMAGE;
+		}
+		sections.push_back(std::move(section));
+	}
+
+	if(!std::is_sorted(blocks.begin(), blocks.end())){
+		std::sort(blocks.begin(), blocks.end());
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Checks the checksum against the loaded CODE and DATA sections.
+ * @param memory The memory the sections were loaded into.
+ * @param offset The offset the image was loaded at.
+ * @return Whether the image is intact.
+ */
+bool FBCImage::verify(const GuestMemory& memory, const size_t offset) const {
+	uint32_t result = tableHash;
+	for(const Section& section : sections){
+		if(section.type == SECTION_TYPE::BLOCKS){
+			result = hash(section.payload.data(), section.payload.size(), result);
+		}else{
+			result = hash(memory.data() + offset + section.address, section.size, result);
+		}
+	}
+	return result == checksum;
+}
+
+/**
+ * Adds a section to be written.
+ * @param type The section type.
+ * @param address The load address, ignored for BLOCKS.
+ * @param payload The section contents.
+ */
+void FBCImage::addSection(const SECTION_TYPE type, const uint32_t address, std::vector<uint8_t> payload){
+	Section section;
+	section.type = type;
+	section.address = address;
+	section.size = static_cast<uint32_t>(payload.size());
+	section.payload = std::move(payload);
+	sections.push_back(std::move(section));
+}
+
+/**
+ * Replaces the BLOCKS section with a set of block start addresses.
+ * @param starts The block starts, in any order and with duplicates.
+ */
+void FBCImage::setBlocks(std::vector<uint16_t> starts){
+	std::sort(starts.begin(), starts.end());
+	starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+	std::erase_if(sections, [](const Section& section){ return section.type == SECTION_TYPE::BLOCKS; });
+
+	std::vector<uint8_t> payload(starts.size() * 2);
+	for(size_t i = 0; i < starts.size(); i++){
+		putUInt16(payload, i * 2, starts[i]);
+	}
+	addSection(SECTION_TYPE::BLOCKS, 0, std::move(payload));
+	blocks = std::move(starts);
+}
+
+std::vector<uint8_t> FBCImage::encodeTable() const {
+	std::vector<uint8_t> out(HEADER_SIZE + sections.size() * SECTION_ENTRY_SIZE);
+	std::copy(MAGIC.begin(), MAGIC.end(), out.begin());
+	putUInt16(out, 4, VERSION);
+	putUInt16(out, 6, static_cast<uint16_t>(sections.size()));
+	putUInt16(out, 8, entry);
+	putUInt32(out, 12, memorySize);
+	putUInt32(out, 16, checksum);
+
+	for(size_t i = 0; i < sections.size(); i++){
+		size_t at = HEADER_SIZE + i * SECTION_ENTRY_SIZE;
+		putUInt16(out, at, static_cast<uint16_t>(sections[i].type));
+		putUInt32(out, at + 4, sections[i].address);
+		putUInt32(out, at + 8, sections[i].fileOffset);
+		putUInt32(out, at + 12, sections[i].size);
+	}
+	return out;
+}
+
+/**
+ * Lays out the sections added with addSection(), computes the checksum and writes the container.
+ * An existing file is replaced by renaming over it, VMs that have it mapped keep the old contents.
+ * @param path The .fbc file to write.
+ * @return RESULT_CODE SUCCESS, or FILE_NOT_FOUND if the file cannot be written.
+ */
+RESULT FBCImage::write(const std::filesystem::path& path){
+	size_t fileOffset = HEADER_SIZE + sections.size() * SECTION_ENTRY_SIZE;
+	for(Section& section : sections){
+		bool mappable = section.type != SECTION_TYPE::BLOCKS && section.size >= PAGE_ALIGNMENT && section.address % PAGE_ALIGNMENT == 0;
+		size_t alignment = mappable ? PAGE_ALIGNMENT : PAYLOAD_ALIGNMENT;
+		fileOffset = (fileOffset + alignment - 1) / alignment * alignment;
+
+		section.size = static_cast<uint32_t>(section.payload.size());
+		section.fileOffset = static_cast<uint32_t>(fileOffset);
+		fileOffset += section.size;
+	}
+
+	checksum = 0;
+	std::vector<uint8_t> table = encodeTable();
+	checksum = hash(table.data(), table.size());
+	for(const Section& section : sections){
+		checksum = hash(section.payload.data(), section.payload.size(), checksum);
+	}
+	putUInt32(table, 16, checksum);
+
+	RESULT result = replaceFile(path, [&](const std::filesystem::path& temporary){
+		std::ofstream fileStream(temporary, std::ios::binary);
+		if(!fileStream.is_open()){
+			return RESULT_CODE::FILE_NOT_FOUND;
+		}
+		fileStream.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size()));
+		size_t end = table.size();
+		for(const Section& section : sections){
+			std::vector<char> padding(section.fileOffset - end, 0);
+			fileStream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+			fileStream.write(reinterpret_cast<const char*>(section.payload.data()), static_cast<std::streamsize>(section.payload.size()));
+			end = section.fileOffset + section.size;
+		}
+		fileStream.flush();
+		return fileStream.good() ? RESULT_CODE::SUCCESS : RESULT_CODE::FILE_NOT_FOUND;
+	});
+	if(result != RESULT_CODE::SUCCESS){
+		SPDLOG_ERROR("Could not write program: " + path.string());
+	}
+	return result;
+}
@@ -0,0 +1,89 @@
+#ifndef FBC_IMAGE_H
+#define FBC_IMAGE_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "ResultCode.h"
+#include "GuestMemory.h"
+#include "Hash.h"
+
+/**
+ * The .fbc container format.
+ *
+ * All fields are little endian:
+ *   Header    MAGIC, version (u16), section count (u16), entry PC (u16),
+ *             reserved (u16), memory size hint (u32), checksum (u32)
+ *   Sections  one entry per section: type (u16), reserved (u16),
+ *             load address (u32), file offset (u32), size (u32)
+ *   Payloads  the section contents, at their file offsets
+ *
+ * CODE and DATA sections are loaded into guest memory at their load address.
+ * Payloads of at least one page with a page aligned load address start on a
+ * page boundary in the file, so they can be mapped instead of read, see
+ * GuestMemory::loadFile(). The optional BLOCKS section is never loaded, it
+ * lists the start address (u16) of every basic block of the code sections in
+ * ascending order: the entry, every jump target and every address following
+ * a JUMP, JUMPxx or HALT.
+ *
+ * The checksum is FNV-1a over the header with a zero checksum field, the
+ * section table and then every payload in table order.
+ *
+ * Raw bytecode files without a header are still valid programs. They never
+ * start with MAGIC because 'F' is not an opcode.
+ */
+class FBCImage {
+	public:
+		static constexpr std::array<uint8_t, 4> MAGIC = {'F', 'B', 'C', 0x1A};
+		static constexpr uint16_t VERSION = 1;
+		static constexpr size_t HEADER_SIZE = 20;
+		static constexpr size_t SECTION_ENTRY_SIZE = 16;
+		static constexpr size_t PAYLOAD_ALIGNMENT = 16;
+		static constexpr size_t PAGE_ALIGNMENT = 4096;
+
+		enum class SECTION_TYPE : uint16_t {
+			CODE = 1,
+			DATA = 2,
+			BLOCKS = 3,
+		};
+
+		struct Section {
+			SECTION_TYPE type;
+			uint32_t address = 0;
+			uint32_t fileOffset = 0;
+			uint32_t size = 0;
+			/* The contents when writing. read() only fills it for BLOCKS */
+			std::vector<uint8_t> payload;
+		};
+
+		uint16_t entry = 0;
+		/* Guest memory the program needs, 0 if the image does not say */
+		uint32_t memorySize = 0;
+		uint32_t checksum = 0;
+		std::vector<Section> sections;
+
+		/* Block start addresses from the BLOCKS section, empty if there is none */
+		std::vector<uint16_t> blocks;
+
+		static bool isImage(const std::filesystem::path& path);
+
+		RESULT read(const std::filesystem::path& path);
+		RESULT write(const std::filesystem::path& path);
+
+		void addSection(const SECTION_TYPE type, const uint32_t address, std::vector<uint8_t> payload);
+		void setBlocks(std::vector<uint16_t> starts);
+
+		bool verify(const GuestMemory& memory, const size_t offset) const;
+
+		/* Continues an FNV-1a hash over more bytes */
+		static uint32_t hash(const uint8_t* data, const size_t size, uint32_t seed = FNV<uint32_t>::OFFSET);
+
+	private:
+		/* Hash of the header and section table, the start of the checksum */
+		uint32_t tableHash = FNV<uint32_t>::OFFSET;
+
+		std::vector<uint8_t> encodeTable() const;
+};
+
+#endif
@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <cstdlib>
-#include <functional>
 #include <iomanip>  // for std::setw and std::setfill
 #include <sstream> 
 #include <format>
@@ -10,15 +9,82 @@
 #include "FVM.h"
 #include "ResultCode.h"
 #include "ByteCode.h"
+#include "FBCImage.h"
+
+#ifdef FVM_JIT
+	#include "jit/JIT.h"
+#endif
+
+#ifdef FVM_AOT
+	#include "aot/NativeProgram.h"
+#endif
+
+/* Native code skips the per-instruction trace and profile hooks, so those builds stay interpreted */
+#if defined(FVM_JIT) && !defined(FVM_TRACE) && !defined(FVM_PROFILE)
+	#define FVM_JIT_DISPATCH
+#endif
+#if defined(FVM_AOT) && !defined(FVM_TRACE) && !defined(FVM_PROFILE)
+	#define FVM_AOT_DISPATCH
+#endif
+
+/* Threaded dispatch through computed goto where the compiler supports labels as values */
+#ifndef FVM_COMPUTED_GOTO
+	#if defined(__GNUC__) || defined(__clang__)
+		#define FVM_COMPUTED_GOTO 1
+	#else
+		#define FVM_COMPUTED_GOTO 0
+	#endif
+#endif
+
+/* Fuse hot instruction pairs into superinstructions after decoding */
+#ifndef FVM_FUSION
+	#define FVM_FUSION 1
+#endif
+
+/**
+ * The REG_FLAGS value COMPARE produces for two operands, computed without branches.
+ * @param regA The first operand.
+ * @param regB The second operand.
+ * @return The EQ, LT, LTE, GT and GTE bits describing regA relative to regB.
+ */
+static inline uint16_t compareFlags(const uint16_t regA, const uint16_t regB){
+	uint16_t equal = regA == regB;
+	uint16_t less = regA < regB;
+	uint16_t greater = regA > regB;
+	return static_cast<uint16_t>(equal * (FVM::FLAG::EQ | FVM::FLAG::LTE | FVM::FLAG::GTE)
+							   | less * (FVM::FLAG::LT | FVM::FLAG::LTE)
+							   | greater * (FVM::FLAG::GT | FVM::FLAG::GTE));
+}
+
+/**
+ * The REG_FLAGS bit a conditional jump tests.
+ * @param opcode The opcode of the jump.
+ * @return The flag, or 0 when opcode is not a conditional jump.
+ */
+static inline uint16_t branchFlag(const uint8_t opcode){
+	switch(static_cast<BYTECODE>(opcode)){
+		case BYTECODE::JUMPEQ:  return FVM::FLAG::EQ;
+		case BYTECODE::JUMPLT:  return FVM::FLAG::LT;
+		case BYTECODE::JUMPGT:  return FVM::FLAG::GT;
+		case BYTECODE::JUMPLTE: return FVM::FLAG::LTE;
+		case BYTECODE::JUMPGTE: return FVM::FLAG::GTE;
+		default: return 0;
+	}
+}
 
 /**
  * Constructor for the FVM class.
  * Initializes the FVM with a specified memory size.
  * @param MEMORY_SIZE The size of the memory for the FVM.
+ * @param backing How memory is allocated, see GuestMemory.
  */
-FVM::FVM(size_t MEMORY_SIZE) : MEMORY_SIZE(MEMORY_SIZE){
+FVM::FVM(size_t MEMORY_SIZE, const GuestMemory::BACKING backing) : MEMORY_SIZE(MEMORY_SIZE), memory(backing){
 }
 
+FVM::~FVM() = default;
+FVM::FVM(FVM&&) noexcept = default;
+FVM& FVM::operator=(FVM&&) noexcept = default;
+
 /**
  * Initializes the virtual machine (VM).
  * Sets up the memory and registers to their initial state.
@@ -27,20 +93,27 @@ FVM::FVM(size_t MEMORY_SIZE) : MEMORY_SIZE(MEMORY_SIZE){
 RESULT FVM::init(){
 	/* Initialize the VM */
 
-	/* Initialize memory and registers */
-	memory = std::vector<uint8_t>(MEMORY_SIZE);
-	std::fill(memory.begin(), memory.end(), static_cast<uint8_t>(0));
+	/* Initialize memory and registers, reusing the allocation when the size is unchanged */
+	RESULT result = memory.allocate(MEMORY_SIZE);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
 	
-	REG_0 = 0;
-	REG_1 = 0;
-	REG_2 = 0;
-	REG_3 = 0;
-	REG_5 = 0;
-	REG_6 = 0;
-	REG_7 = 0;
-
-	REG_PC = 0;
-	REG_FLAGS = 0;
+	registers.fill(0);
+
+	pageDirty.assign((MEMORY_SIZE + PAGE_SIZE - 1) / PAGE_SIZE, 0);
+	dirtyPages.clear();
+	saved.reset();
+
+	programBlocks.clear();
+	decodeProgram(0, 0);
+
+#ifdef FVM_TRACE
+	trace.clear();
+#endif
+#ifdef FVM_PROFILE
+	profile.clear();
+#endif
 	return RESULT_CODE::SUCCESS;
 }
 
@@ -60,18 +133,13 @@ std::string FVM::dumpState() const {
 	
 	// Dump registers
 	state << "Registers:\n";
-	state << "REG_0: 0x" << std::hex << REG_0 << "\n";
-	state << "REG_1: 0x" << std::hex << REG_1 << "\n";
-	state << "REG_2: 0x" << std::hex << REG_2 << "\n";
-	state << "REG_3: 0x" << std::hex << REG_3 << "\n";
-	state << "REG_4: 0x" << std::hex << REG_4 << "\n";
-	state << "REG_5: 0x" << std::hex << REG_5 << "\n";
-	state << "REG_6: 0x" << std::hex << REG_6 << "\n";
-	state << "REG_7: 0x" << std::hex << REG_7 << "\n";
+	for(size_t i = 0; i < REGISTER_PC; i++){
+		state << "REG_" << i << ": 0x" << std::hex << registers[i] << std::dec << "\n";
+	}
 	
 	// Dump program counter and flags
-	state << "Program Counter (PC): 0x" << std::hex << REG_PC << "\n";
-	state << "Flags: 0x" << std::hex << REG_FLAGS << "\n";
+	state << "Program Counter (PC): 0x" << std::hex << registers[REGISTER_PC] << "\n";
+	state << "Flags: 0x" << std::hex << registers[REGISTER_FLAGS] << "\n";
 
 	// Dump memory state
 	state << "Memory:\n" << memoryToHexString();
@@ -82,24 +150,14 @@ std::string FVM::dumpState() const {
 /**
  * Retrieves a reference to a register based on the provided bytecode.
  * @param bytecode The bytecode enum indicating the register to access.
- * @return Reference to the selected register.
+ * @return Reference to the selected register, or REG_0 if the bytecode is not a register.
  */
 uint16_t& FVM::getRegister(const enum BYTECODE bytecode) {
-	switch(bytecode){
-		default:
-			{
-				SPDLOG_ERROR("Expected Register, got: " + BYTECODE_INFO::NAME_FROM_VALUE_MAP.at(bytecode));
-			}
-		case BYTECODE::REG_0:      return REG_0;
-		case BYTECODE::REG_1:      return REG_1;
-		case BYTECODE::REG_2:      return REG_2;
-		case BYTECODE::REG_3:      return REG_3;
-		case BYTECODE::REG_4:      return REG_4;
-		case BYTECODE::REG_6:      return REG_6;
-		case BYTECODE::REG_7:      return REG_7;
-		case BYTECODE::REG_PC:     return REG_PC;
-		case BYTECODE::REG_FLAGS:  return REG_FLAGS;
+	if(!isRegister(static_cast<uint8_t>(bytecode))){
+		SPDLOG_ERROR("Expected Register, got: " + std::string(BYTECODE_INFO::nameFromValue(static_cast<uint8_t>(bytecode))));
+		return registers[0];
 	}
+	return registers[registerIndex(static_cast<uint8_t>(bytecode))];
 }
 
 /**
@@ -124,6 +182,18 @@ uint16_t FVM::readUInt16(const size_t address) const {
 	return static_cast<uint16_t>(lowByte | highByte << 8);
 }
 
+/**
+ * Records that the page holding an address differs from the snapshot.
+ * @param address The memory address that was written.
+ */
+void FVM::markDirty(const size_t address){
+	size_t page = address / PAGE_SIZE;
+	if(!pageDirty[page]){
+		pageDirty[page] = 1;
+		dirtyPages.push_back(static_cast<uint32_t>(page));
+	}
+}
+
 /**
  * Writes an 8-bit unsigned integer to the specified memory address.
  * @param address The memory address to write to.
@@ -131,6 +201,10 @@ uint16_t FVM::readUInt16(const size_t address) const {
  */
 void FVM::writeUInt8(const size_t address, const uint8_t value){
 	memory[address] = value;
+	markDirty(address);
+	if(address >= programBegin && address < programEnd){
+		programStale = true;
+	}
 }
 
 /**
@@ -144,15 +218,34 @@ void FVM::writeUInt16(const size_t address, const uint16_t value){
 	uint8_t highByte = value >> 8;
 	memory[address] = lowByte;
 	memory[address + 1] = highByte;
+	markDirty(address);
+	markDirty(address + 1);
+	if(address + 1 >= programBegin && address < programEnd){
+		programStale = true;
+	}
 }
 
 /**
- * Binds a register reference to a specified register based on the program counter offset.
- * @param regRef The reference to the register to bind.
- * @param PCOffset The offset from the program counter to determine the register.
+ * Resolves a register operand byte to its index in the register file.
+ * Bytes that do not name a register resolve to REG_0 like getRegister() does.
+ * @param operand The operand byte read from memory.
+ * @return Index of the selected register.
  */
-void FVM::bindReg(std::reference_wrapper<uint16_t>& regRef, const size_t PCOffset){
-	regRef = std::ref(getRegister(static_cast<BYTECODE>(memory[REG_PC + PCOffset])));
+uint8_t FVM::decodeRegister(const uint8_t operand) const {
+	return isRegister(operand) ? registerIndex(operand) : 0;
+}
+
+/**
+ * Whether the instruction at an address, operands included, lies inside guest memory.
+ * @param address The address of the instruction.
+ * @return False if decoding it would read past MEMORY_SIZE.
+ */
+bool FVM::isFetchable(const size_t address) const {
+	if(address >= MEMORY_SIZE){
+		return false;
+	}
+	const BYTECODE_INFO::BYTECODE_OBJECT* object = BYTECODE_INFO::objectFromValue(memory[address]);
+	return object == nullptr || address + object->length <= MEMORY_SIZE;
 }
 
 /**
@@ -161,7 +254,7 @@ void FVM::bindReg(std::reference_wrapper<uint16_t>& regRef, const size_t PCOffse
  * @return The 16-bit address value retrieved from memory.
  */
 uint16_t FVM::getAddressArgument(const size_t PCOffset) const {
-	return readUInt16(REG_PC + PCOffset);
+	return readUInt16(registers[REGISTER_PC] + PCOffset);
 }
 
 /**
@@ -170,7 +263,78 @@ uint16_t FVM::getAddressArgument(const size_t PCOffset) const {
  * @return The 16-bit literal value retrieved from memory.
  */
 uint16_t FVM::getLiteralArgument(const size_t PCOffset) const {
-	return readUInt16(REG_PC + PCOffset);
+	return readUInt16(registers[REGISTER_PC] + PCOffset);
+}
+
+/**
+ * Captures the registers, memory and loaded program so restore() can return to them.
+ * Memory is copied once here. From then on writes are tracked per page and
+ * restore() only copies back the pages written since.
+ * Writes that bypass writeUInt8/writeUInt16/loadBytecode, e.g. to the public
+ * memory member, are not tracked.
+ */
+void FVM::snapshot(){
+	if(saved == nullptr){
+		saved = std::make_unique<Snapshot>();
+		saved->memory = GuestMemory(memory.backing());
+	}
+	saved->registers = registers;
+
+	// Pages that are still zero stay uncommitted in the copy as well
+	saved->memory.allocate(memory.size());
+	for(size_t begin = 0; begin < memory.size(); begin += PAGE_SIZE){
+		const uint8_t* page = memory.data() + begin;
+		const uint8_t* pageEnd = memory.data() + std::min(begin + PAGE_SIZE, memory.size());
+		if(std::any_of(page, pageEnd, [](uint8_t byte){ return byte != 0; })){
+			std::copy(page, pageEnd, saved->memory.data() + begin);
+		}
+	}
+	saved->programBegin = programBegin;
+	saved->programEnd = programEnd;
+	saved->programBlocks = programBlocks;
+
+	for(uint32_t page : dirtyPages){
+		pageDirty[page] = 0;
+	}
+	dirtyPages.clear();
+}
+
+/**
+ * Returns the VM to the last snapshot(), copying back only the dirty pages.
+ * The program is re-decoded only if a restored page overlaps it.
+ * @return RESULT_CODE SUCCESS, or NO_SNAPSHOT if snapshot() was not called since init().
+ */
+RESULT FVM::restore(){
+	if(saved == nullptr){
+		SPDLOG_ERROR("No snapshot to restore");
+		return RESULT_CODE::NO_SNAPSHOT;
+	}
+
+	bool programTouched = false;
+	for(uint32_t page : dirtyPages){
+		size_t begin = static_cast<size_t>(page) * PAGE_SIZE;
+		size_t end = std::min(begin + PAGE_SIZE, memory.size());
+		std::copy(saved->memory.begin() + begin, saved->memory.begin() + end, memory.begin() + begin);
+		pageDirty[page] = 0;
+
+		if(begin < saved->programEnd && end > saved->programBegin){
+			programTouched = true;
+		}
+	}
+	dirtyPages.clear();
+
+	registers = saved->registers;
+
+	if(programTouched || programStale || programBegin != saved->programBegin || programEnd != saved->programEnd || programBlocks != saved->programBlocks){
+		programBlocks = saved->programBlocks;
+		decodeProgram(saved->programBegin, saved->programEnd);
+	}
+
+	return RESULT_CODE::SUCCESS;
+}
+
+bool FVM::hasSnapshot() const {
+	return saved != nullptr;
 }
 
 /**
@@ -180,50 +344,799 @@ uint16_t FVM::getLiteralArgument(const size_t PCOffset) const {
  * @return RESULT_CODE The result of the execution, indicating success or failure.
  */
 RESULT FVM::loadBytecode(const size_t offset, const std::vector<uint8_t>& bytecode){
-	SPDLOG_INFO("Loading bytecode into memory");
+	// Debug only, FVMBatch and FVMPool load the same bytecode into many VMs
+	SPDLOG_DEBUG("Loading bytecode into memory");
+
+	RESULT result = checkLoad(offset, bytecode.size());
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	std::copy(bytecode.begin(), bytecode.end(), memory.data() + offset);
+
+	finishLoad(offset, bytecode.size());
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Loads an .fbc file into memory without reading it into an intermediate buffer.
+ * With sparse memory and a page aligned offset the file is mapped copy-on-write
+ * straight into the address space, so VMs running the same file share its
+ * pages until they write to them. The file must not change while it is mapped.
+ * Containers are loaded section by section, see loadImage(). Anything else is
+ * loaded as raw bytecode.
+ * @param offset The offset from position 0 to load the memory into.
+ * @param programPath The .fbc file to load.
+ * @return RESULT_CODE The result of the load, FILE_NOT_FOUND if the file cannot be read.
+ */
+RESULT FVM::loadBytecode(const size_t offset, const std::filesystem::path& programPath){
+	SPDLOG_INFO("Loading bytecode from " + programPath.filename().string());
+
+	if(FBCImage::isImage(programPath)){
+		return loadImage(offset, programPath);
+	}
+
+	std::error_code error;
+	size_t size = static_cast<size_t>(std::filesystem::file_size(programPath, error));
+	if(error){
+		SPDLOG_ERROR("Could not open program: " + programPath.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	RESULT result = checkLoad(offset, size);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	result = memory.loadFile(programPath, offset, size);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
 
-	if(bytecode.size() > MEMORY_SIZE){
+	finishLoad(offset, size);
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Checks that an image of a given size fits into memory at an offset.
+ * @param offset The offset the image is loaded at.
+ * @param size The size of the image.
+ * @return RESULT_CODE SUCCESS, OUT_OF_MEMORY or BAD_OFFSET.
+ */
+RESULT FVM::checkLoad(const size_t offset, const size_t size) const {
+	if(size > MEMORY_SIZE){
 		SPDLOG_ERROR("Bytecode is too large");	
 		return RESULT_CODE::OUT_OF_MEMORY;
 	}
 
-	if(offset >= MEMORY_SIZE - bytecode.size()){
+	if(offset >= MEMORY_SIZE - size){
 		SPDLOG_ERROR("Offset is too large");
 		return RESULT_CODE::BAD_OFFSET;
 	}
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Loads an .fbc container. Every CODE and DATA section is loaded at offset
+ * plus its load address, the checksum is verified against what was loaded and
+ * the PC is set to the entry point. The program spans the CODE sections and
+ * is decoded along the image's BLOCKS section when it has one.
+ * If the image asks for more memory than the VM has, the VM is re-initialized
+ * with that much memory first.
+ * @param offset The offset added to every load address and the entry point.
+ * @param programPath The .fbc file to load.
+ * @return RESULT_CODE The result of the load, BAD_IMAGE for a malformed or
+ * corrupt image. Memory may already be partly overwritten when loading fails.
+ */
+RESULT FVM::loadImage(const size_t offset, const std::filesystem::path& programPath){
+	FBCImage image;
+	RESULT result = image.read(programPath);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
 
-	std::copy(bytecode.begin(), bytecode.end(), memory.data() + offset);
+	if(offset + image.memorySize > MEMORY_SIZE){
+		SPDLOG_INFO("Growing memory to " + std::to_string(offset + image.memorySize) + " bytes for " + programPath.filename().string());
+		MEMORY_SIZE = offset + image.memorySize;
+		result = init();
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+	}
+
+	size_t codeBegin = SIZE_MAX;
+	size_t codeEnd = 0;
+	for(const FBCImage::Section& section : image.sections){
+		if(section.type == FBCImage::SECTION_TYPE::BLOCKS){
+			continue;
+		}
+
+		size_t address = offset + section.address;
+		result = checkLoad(address, section.size);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+
+		result = memory.loadFile(programPath, address, section.size, section.fileOffset);
+		markLoaded(address, section.size);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+
+		if(section.type == FBCImage::SECTION_TYPE::CODE){
+			codeBegin = std::min(codeBegin, address);
+			codeEnd = std::max(codeEnd, address + section.size);
+		}
+	}
+
+	if(!image.verify(memory, offset)){
+		SPDLOG_ERROR(programPath.filename().string() + " failed its checksum");
+		return RESULT_CODE::BAD_IMAGE;
+	}
+
+	if(codeBegin > codeEnd){
+		codeBegin = codeEnd = 0;
+	}
+
+	programBlocks.clear();
+	for(uint16_t block : image.blocks){
+		programBlocks.push_back(offset + block);
+	}
+	decodeProgram(codeBegin, codeEnd);
+
+	registers[REGISTER_PC] = static_cast<uint16_t>(offset + image.entry);
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Marks a freshly loaded range dirty.
+ * @param offset The offset the range was loaded at.
+ * @param size The size of the range.
+ */
+void FVM::markLoaded(const size_t offset, const size_t size){
+	for(size_t address = offset; address < offset + size; address += PAGE_SIZE){
+		markDirty(address);
+	}
+	if(size > 0){
+		markDirty(offset + size - 1);
+	}
+}
+
+/**
+ * Marks a freshly loaded raw image dirty and decodes it.
+ * @param offset The offset the image was loaded at.
+ * @param size The size of the image.
+ */
+void FVM::finishLoad(const size_t offset, const size_t size){
+	markLoaded(offset, size);
 	
-	SPDLOG_DEBUG("Loaded memory: {}", memoryToHexString());
+	if(spdlog::should_log(spdlog::level::debug)){
+		SPDLOG_DEBUG("Loaded memory: {}", memoryToHexString());
+	}
+
+	programBlocks.clear();
+	decodeProgram(offset, offset + size);
+}
+
+/**
+ * Decodes the instruction at an address into its handler and operands.
+ * The operand layout comes from the generated BYTECODE_INFO tables. Literals
+ * and addresses are assembled from their little endian bytes and register
+ * operands are resolved so the handlers never touch the raw bytes.
+ * @param address The memory address of the instruction.
+ * @return The decoded instruction. Its next and target indices are left unlinked.
+ */
+FVM::DecodedInstruction FVM::decodeInstruction(const size_t address) const {
+	DecodedInstruction instruction{};
+	instruction.next = PROGRAM_UNLINKED;
+	instruction.target = PROGRAM_UNLINKED;
+
+	const BYTECODE_INFO::BYTECODE_OBJECT* object = isFetchable(address) ? BYTECODE_INFO::objectFromValue(memory[address]) : nullptr;
+	if(object == nullptr){
+		instruction.opcode = DISPATCH_UNIMPLEMENTED;
+		instruction.nextPC = static_cast<uint16_t>(address + 1);
+		return instruction;
+	}
+
+	instruction.opcode = object->handler;
+
+	size_t operand = address + 1;
+	bool firstRegister = true;
+	for(size_t i = 0; i < object->argCount; i++){
+		switch(object->args[i]){
+			case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
+				(firstRegister ? instruction.regA : instruction.regB) = decodeRegister(memory[operand]);
+				firstRegister = false;
+				operand += 1;
+				break;
+			case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
+				instruction.literal = readUInt16(operand);
+				operand += 2;
+				break;
+			case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
+				instruction.address = readUInt16(operand);
+				operand += 2;
+				break;
+			case BYTECODE_INFO::ARGUMENT_TYPE::NONE:
+				break;
+		}
+	}
+
+	instruction.nextPC = static_cast<uint16_t>(address + object->length);
+	return instruction;
+}
+
+/**
+ * Looks up the decoded instruction starting at an address.
+ * @param address The address to look up.
+ * @return The index into the decoded program, or the resolve entry when the
+ * address is not the start of a decoded instruction.
+ */
+uint32_t FVM::programLookup(const size_t address) const {
+	if(address < programBegin || address >= programEnd){
+		return programResolve;
+	}
+	uint32_t index = programIndex[address - programBegin];
+	return index == PROGRAM_UNLINKED ? programResolve : index;
+}
+
+/**
+ * Decodes a loaded bytecode image into the dense instruction stream run() executes.
+ * The image is swept linearly and every decoded instruction is linked to its
+ * fall through and jump target. Anything that leaves the stream, or writes
+ * REG_PC or REG_FLAGS through a register operand, links to the trailing
+ * resolve entry which re-synchronises with the program counter.
+ * With block starts from an .fbc image the sweep restarts at every block
+ * start and skips whatever follows a JUMP or HALT up to the next one, so
+ * data inside the code is never decoded as instructions.
+ * @param begin The first address of the image.
+ * @param end One past the last address of the image.
+ */
+void FVM::decodeProgram(const size_t begin, const size_t end){
+	programBegin = begin;
+	programEnd = end;
+	programStale = false;
+
+	program.clear();
+	programIndex.assign(end - begin, PROGRAM_UNLINKED);
+
+	std::vector<size_t>::const_iterator nextBlock = std::upper_bound(programBlocks.begin(), programBlocks.end(), begin);
+	for(size_t address = begin; address < end;){
+		while(nextBlock != programBlocks.end() && *nextBlock <= address){
+			nextBlock++;
+		}
+		size_t blockEnd = nextBlock != programBlocks.end() ? std::min(*nextBlock, end) : end;
+
+		DecodedInstruction instruction = decodeInstruction(address);
+		size_t length = static_cast<uint16_t>(instruction.nextPC - address);
+		if(address + length > blockEnd){
+			if(blockEnd == end){
+				break;
+			}
+			address = blockEnd;
+			continue;
+		}
+		programIndex[address - begin] = static_cast<uint32_t>(program.size());
+		program.push_back(instruction);
+		address += length;
+
+		bool terminator = instruction.opcode == static_cast<uint8_t>(BYTECODE::JUMP) || instruction.opcode == static_cast<uint8_t>(BYTECODE::HALT);
+		if(terminator && !programBlocks.empty()){
+			address = blockEnd;
+		}
+	}
+
+	DecodedInstruction resolve{};
+	resolve.opcode = DISPATCH_RESOLVE;
+	program.push_back(resolve);
+	programResolve = static_cast<uint32_t>(program.size() - 1);
+
+	for(uint32_t i = 0; i < programResolve; i++){
+		DecodedInstruction& instruction = program[i];
+		instruction.next = programLookup(instruction.nextPC);
+		instruction.target = programLookup(instruction.address);
 
+		if(instruction.regA >= REGISTER_PC || instruction.regB >= REGISTER_PC){
+			instruction.next = programResolve;
+		}
+	}
+	program[programResolve].next = programResolve;
+	program[programResolve].target = programResolve;
+
+	programVerified = verifyProgram();
+
+#if FVM_FUSION
+	fuseProgram();
+#endif
+
+#ifdef FVM_JIT
+	if(jit != nullptr){
+		jit->reset(*this);
+	}
+#endif
+
+#ifdef FVM_AOT
+	nativeCurrent = native != nullptr && native->hash() == NativeProgram::imageHash(*this);
+#endif
+}
+
+#ifdef FVM_JIT
+/**
+ * Hands a jump target to the JIT. Its code cache costs a mapping and a few
+ * system calls, so it is only created once run() has taken as many jumps as
+ * the first target needs to get hot. VMs that never loop never pay for it.
+ * @param index The decoded program index of the target.
+ * @return True if native code ran, see JIT::execute().
+ */
+bool FVM::jitExecute(const uint32_t index){
+	if(jit == nullptr){
+		if(++jitJumps < std::min(JIT::HOT_THRESHOLD, JIT::TRACE_THRESHOLD)){
+			return false;
+		}
+		jit = std::make_unique<JIT>();
+		jit->reset(*this);
+	}
+	return jit->execute(*this, index);
+}
+#endif
+
+size_t FVM::jitTraceCount() const {
+#ifdef FVM_JIT
+	return jit != nullptr ? jit->traceCount() : 0;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Attaches native code for the loaded program, replacing any attached before.
+ * It stays attached across loads but only runs while the program it was
+ * built from is the one loaded, see NativeProgram.
+ * @param soPath A shared object from NativeProgram::build().
+ * @return RESULT_CODE SUCCESS, or why NativeProgram::open() refused it.
+ */
+RESULT FVM::attachNative(const std::filesystem::path& soPath){
+#ifdef FVM_AOT
+	// Closed first, dlopen() would hand back the old object for a rebuilt file at the same path
+	native.reset();
+	nativeCurrent = false;
+
+	std::unique_ptr<NativeProgram> opened = std::make_unique<NativeProgram>();
+	RESULT result = opened->open(*this, soPath);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+	native = std::move(opened);
+	nativeCurrent = !programStale;
 	return RESULT_CODE::SUCCESS;
+#else
+	SPDLOG_ERROR("Built without FVM_AOT, cannot attach " + soPath.string());
+	return RESULT_CODE::UNSPECIFIED_FAILURE;
+#endif
+}
+
+/**
+ * Checks the freshly decoded program so run() can execute it without checking
+ * operand addresses. Every instruction in the stream must have a known opcode
+ * and valid register operand bytes, every jump must target the start of an
+ * instruction in the stream or leave the image altogether and every address
+ * operand of a memory instruction must leave room for a 16-bit access inside
+ * MEMORY_SIZE. Anything that leaves the stream at run time goes through the
+ * resolve entry, which runs it with every check. Runs before fusion, on plain
+ * opcodes.
+ * @return True if the whole stream is safe to run unchecked.
+ */
+bool FVM::verifyProgram() const {
+	if(programResolve == 0){
+		return false;
+	}
+
+	for(size_t address = programBegin; address < programEnd; address++){
+		uint32_t index = programIndex[address - programBegin];
+		if(index == PROGRAM_UNLINKED){
+			continue;
+		}
+
+		const DecodedInstruction& instruction = program[index];
+		const BYTECODE_INFO::BYTECODE_OBJECT* object = BYTECODE_INFO::objectFromValue(memory[address]);
+		if(object == nullptr || object->isRegister || instruction.opcode == DISPATCH_UNIMPLEMENTED){
+			SPDLOG_DEBUG("Not verified, unknown opcode at {:#06x}", address);
+			return false;
+		}
+
+		bool branch = object->bytecode >= BYTECODE::JUMP && object->bytecode <= BYTECODE::JUMPGTE;
+		size_t operand = address + 1;
+		for(size_t i = 0; i < object->argCount; i++){
+			switch(object->args[i]){
+				case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
+					if(!isRegister(memory[operand])){
+						SPDLOG_DEBUG("Not verified, bad register operand at {:#06x}", address);
+						return false;
+					}
+					operand += 1;
+					break;
+				case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
+					operand += 2;
+					break;
+				case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
+					if(branch && instruction.target == programResolve && instruction.address >= programBegin && instruction.address < programEnd){
+						SPDLOG_DEBUG("Not verified, jump at {:#06x} targets the middle of an instruction", address);
+						return false;
+					}
+					if(!branch && static_cast<size_t>(instruction.address) + 1 >= MEMORY_SIZE){
+						SPDLOG_DEBUG("Not verified, address operand at {:#06x} is outside memory", address);
+						return false;
+					}
+					operand += 2;
+					break;
+				case BYTECODE_INFO::ARGUMENT_TYPE::NONE:
+					break;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Rewrites hot instruction pairs in the decoded program into superinstructions.
+ * Only the first entry of a pair changes its dispatch slot, the second keeps
+ * its own so jumps into the middle of a pair still land on a plain handler.
+ * A pair is only fused when the first instruction falls through to the second
+ * inside the stream, which rules out PC and FLAGS operands.
+ * COMPARE + JUMPxx stores the flag the jump tests in the otherwise unused literal.
+ */
+void FVM::fuseProgram(){
+	for(uint32_t i = 0; i + 1 < programResolve; i++){
+		DecodedInstruction& first = program[i];
+		const DecodedInstruction& second = program[i + 1];
+		if(first.next != i + 1){
+			continue;
+		}
+
+		switch(static_cast<BYTECODE>(first.opcode)){
+			case BYTECODE::COMPARE:
+				if(branchFlag(second.opcode) == 0){
+					continue;
+				}
+				first.literal = branchFlag(second.opcode);
+				first.opcode = DISPATCH_COMPARE_JUMP;
+				break;
+			case BYTECODE::INCREMENT:
+				if(second.opcode == static_cast<uint8_t>(BYTECODE::COMPARE) && second.next != programResolve){
+					first.opcode = DISPATCH_INCREMENT_COMPARE;
+				}
+				break;
+			case BYTECODE::MOVEMR:
+				if(second.opcode == static_cast<uint8_t>(BYTECODE::ADD) && second.next != programResolve){
+					first.opcode = DISPATCH_MOVEMR_ADD;
+				}
+				break;
+			default:
+				break;
+		}
+	}
 }
 
 /**
- * Runs the virtual machine, executing each bytecode in sequence.
- * @param bytecode The vector of bytecodes to be executed.
+ * Executes a single instruction at the program counter.
+ * Shares its opcode handlers with run() through execute().
  * @return RESULT_CODE The result of the execution, indicating success or failure.
  */
 RESULT FVM::step(){
-	
-	/* Set Vars */
+	return execute<true, false, false>(0);
+}
+
+/**
+ * Runs the virtual machine until a HALT instruction or an error.
+ * Dispatches directly from one opcode handler to the next without returning per instruction.
+ * @return RESULT_CODE The result of the execution, indicating success or failure.
+ */
+RESULT FVM::run(){
+#ifdef FVM_AOT_DISPATCH
+	if(nativeCurrent && programVerified){
+		return runNative();
+	}
+#endif
+	return programVerified ? execute<false, false, true>(0) : execute<false, false, false>(0);
+}
+
+#ifdef FVM_AOT
+/**
+ * run() with native code attached. Native code returns wherever it leaves
+ * an instruction to the interpreter, which single steps it, and after any
+ * write into the loaded image, which is re-decoded. Once the image no longer
+ * matches the native code the rest of the run is interpreted.
+ * @return RESULT_CODE The result of the execution, indicating success or failure.
+ */
+RESULT FVM::runNative(){
+	while((registers[REGISTER_FLAGS] & FLAG::HLT) == 0){
+		if(programStale){
+			decodeProgram(programBegin, programEnd);
+		}
+		if(!nativeCurrent || !programVerified){
+			return programVerified ? execute<false, false, true>(0) : execute<false, false, false>(0);
+		}
+
+		RESULT result = native->run(*this);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+		if((registers[REGISTER_FLAGS] & FLAG::HLT) != 0 || programStale){
+			continue;
+		}
+
+		result = step();
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+	}
+	return RESULT_CODE::SUCCESS;
+}
+#endif
 
-	regARef = REG_0;
-	regBRef = REG_0;
+/**
+ * Runs the virtual machine until a HALT instruction, an error or until
+ * maxInstructions have executed, whichever comes first.
+ * The program counter then points at the next instruction, so calling run()
+ * again simply continues. Budgeted runs stay in the interpreter, native code
+ * from the JIT does not count instructions.
+ * @param maxInstructions The most instructions to execute.
+ * @return RESULT_CODE SUCCESS once halted, BUDGET_EXHAUSTED if the budget ran out first, otherwise the failure.
+ */
+RESULT FVM::run(const uint64_t maxInstructions){
+	return programVerified ? execute<false, true, true>(maxInstructions) : execute<false, true, false>(maxInstructions);
+}
 
-	/* Begin Execution */
-	BYTECODE currInstruction = static_cast<BYTECODE>(memory[REG_PC]);
-	SPDLOG_DEBUG("Current instruction: " + BYTECODE_INFO::NAME_FROM_VALUE_MAP.at(currInstruction));
-	switch(currInstruction){
-		default:
+/**
+ * The interpreter core shared by step() and run().
+ * run() executes the stream decoded at load time, following each handler's
+ * next and target links. Addresses outside the stream go through the resolve
+ * handler, which decodes them on the fly. step() always decodes the single
+ * instruction at the program counter.
+ * With computed goto every handler jumps straight to the handler of the next
+ * instruction, otherwise a switch inside a loop is used.
+ * Every memory access is bounds checked, except that the VERIFIED variant
+ * trusts the address operands verifyProgram() already checked. It only runs
+ * the verified stream, instructions outside it are executed one at a time by
+ * step() before it returns to the stream.
+ * @param budget Instructions a BUDGETED run may execute before it returns BUDGET_EXHAUSTED.
+ * @return RESULT_CODE The result of the execution, indicating success or failure.
+ */
+template<bool SINGLE_STEP, bool BUDGETED, bool VERIFIED>
+RESULT FVM::execute(uint64_t budget){
+
+	DecodedInstruction scratch;
+	const DecodedInstruction* instruction = &scratch;
+
+	uint16_t& REG_PC = registers[REGISTER_PC];
+	uint16_t& REG_FLAGS = registers[REGISTER_FLAGS];
+
+	/* Records the instruction about to execute, compiled out unless FVM_TRACE is defined */
+#ifdef FVM_TRACE
+	#define TRACE_INSTRUCTION() \
+		do { \
+			if(instruction->opcode != DISPATCH_RESOLVE){ \
+				trace.record({REG_PC, memory[REG_PC], instruction->regA, instruction->regB, 0, \
+							  instruction->literal, instruction->address, REG_FLAGS}); \
+			} \
+		} while(0)
+#else
+	#define TRACE_INSTRUCTION() do {} while(0)
+#endif
+
+	/* Counts the instruction about to execute and whether a conditional jump
+	   will be taken, compiled out unless FVM_PROFILE is defined */
+#ifdef FVM_PROFILE
+	#define PROFILE_INSTRUCTION() \
+		do { \
+			if(instruction->opcode != DISPATCH_RESOLVE){ \
+				uint8_t opcode = memory[REG_PC]; \
+				profile.record(REG_PC, opcode); \
+				uint16_t flag = branchFlag(opcode); \
+				if(flag != 0){ \
+					profile.branch(REG_PC, (REG_FLAGS & flag) != 0); \
+				} \
+			} \
+		} while(0)
+#else
+	#define PROFILE_INSTRUCTION() do {} while(0)
+#endif
+
+	/* Charges budgeted runs for the instruction about to execute. PC and FLAGS
+	   already describe it, so returning here leaves the VM ready to resume */
+	#define BEFORE_INSTRUCTION() \
+		do { \
+			if constexpr(BUDGETED){ \
+				if(instruction->opcode != DISPATCH_RESOLVE){ \
+					if(budget == 0){ \
+						return RESULT_CODE::BUDGET_EXHAUSTED; \
+					} \
+					budget--; \
+				} \
+			} \
+			TRACE_INSTRUCTION(); \
+			PROFILE_INSTRUCTION(); \
+		} while(0)
+
+#if FVM_COMPUTED_GOTO
+	static void* const DISPATCH_TABLE[] = {
+		&&HANDLER_HALT,
+		&&HANDLER_COMPARE,
+		&&HANDLER_JUMP,
+		&&HANDLER_JUMPEQ,
+		&&HANDLER_JUMPLT,
+		&&HANDLER_JUMPGT,
+		&&HANDLER_JUMPLTE,
+		&&HANDLER_JUMPGTE,
+		&&HANDLER_MOVELR,
+		&&HANDLER_MOVERR,
+		&&HANDLER_MOVELM,
+		&&HANDLER_MOVERM,
+		&&HANDLER_MOVEMR,
+		&&HANDLER_MOVELIR,
+		&&HANDLER_MOVEIRR,
+		&&HANDLER_MOVEIRM,
+		&&HANDLER_MOVEIMR,
+		&&HANDLER_ADD,
+		&&HANDLER_SUBTRACT,
+		&&HANDLER_MULTIPLY,
+		&&HANDLER_DIVIDE,
+		&&HANDLER_INCREMENT,
+		&&HANDLER_DECREMENT,
+		&&HANDLER_AND,
+		&&HANDLER_OR,
+		&&HANDLER_XOR,
+		&&HANDLER_NOT,
+		&&HANDLER_SHIFTLEFT,
+		&&HANDLER_SHIFTRIGHT,
+		&&HANDLER_UNIMPLEMENTED,
+		&&HANDLER_RESOLVE,
+		&&FUSED_HANDLER_COMPARE_JUMP,
+		&&FUSED_HANDLER_INCREMENT_COMPARE,
+		&&FUSED_HANDLER_MOVEMR_ADD,
+	};
+
+	#define HANDLER(name) HANDLER_##name
+	#define FUSED_HANDLER(name) FUSED_HANDLER_##name
+	#define UNIMPLEMENTED_HANDLER HANDLER_UNIMPLEMENTED
+	#define RESOLVE_HANDLER HANDLER_RESOLVE
+	#define DISPATCH_INSTRUCTION() \
+		do { \
+			BEFORE_INSTRUCTION(); \
+			goto *DISPATCH_TABLE[instruction->opcode]; \
+		} while(0)
+#else
+	#define HANDLER(name) case static_cast<uint8_t>(BYTECODE::name)
+	#define FUSED_HANDLER(name) case DISPATCH_##name
+	#define UNIMPLEMENTED_HANDLER default
+	#define RESOLVE_HANDLER case DISPATCH_RESOLVE
+	#define DISPATCH_INSTRUCTION() goto dispatch
+#endif
+
+	/* Follows a link into the decoded program, or returns when single stepping */
+	#define DISPATCH(index) \
+		do { \
+			if constexpr(SINGLE_STEP){ return RESULT_CODE::SUCCESS; } \
+			instruction = program.data() + (index); \
+			DISPATCH_INSTRUCTION(); \
+		} while(0)
+
+	/* Taken jumps give the JIT a chance to run the target block natively */
+#ifdef FVM_JIT_DISPATCH
+	#define DISPATCH_JUMP(index) \
+		do { \
+			if constexpr(!SINGLE_STEP && !BUDGETED && VERIFIED){ \
+				if(jitEnabled && (index) != programResolve && jitExecute(index)){ \
+					instruction = program.data() + programResolve; \
+					DISPATCH_INSTRUCTION(); \
+				} \
+			} \
+			DISPATCH(index); \
+		} while(0)
+#else
+	#define DISPATCH_JUMP(index) DISPATCH(index)
+#endif
+
+	/* Faults unless a 16-bit access at an address computed at run time lies inside memory */
+	#define CHECK_ADDRESS(address) \
+		do { \
+			if(static_cast<size_t>(address) + 1 >= MEMORY_SIZE){ \
+				SPDLOG_ERROR("Memory access outside guest memory: " + std::to_string(address)); \
+				return RESULT_CODE::BAD_ADDRESS; \
+			} \
+		} while(0)
+
+	/* Address operands of verified programs are already known to be inside memory */
+	#define CHECK_OPERAND_ADDRESS(address) \
+		do { \
+			if constexpr(!VERIFIED){ \
+				CHECK_ADDRESS(address); \
+			} \
+		} while(0)
+
+	if constexpr(SINGLE_STEP){
+		if(!isFetchable(REG_PC)){
+			SPDLOG_ERROR("Program counter outside guest memory: " + std::to_string(REG_PC));
+			return RESULT_CODE::BAD_ADDRESS;
+		}
+		scratch = decodeInstruction(REG_PC);
+	}else{
+		if(program.empty()){
+			decodeProgram(0, 0);
+		}
+		instruction = program.data() + programResolve;
+	}
+
+#if FVM_COMPUTED_GOTO
+	DISPATCH_INSTRUCTION();
+	{
+#else
+	dispatch:
+	BEFORE_INSTRUCTION();
+	switch(instruction->opcode){
+#endif
+
+		UNIMPLEMENTED_HANDLER:
 			{
-				SPDLOG_ERROR("Unimplemented instruction: " + BYTECODE_INFO::NAME_FROM_VALUE_MAP.at(currInstruction));
+				SPDLOG_ERROR("Unimplemented instruction: " + std::string(BYTECODE_INFO::nameFromValue(memory[REG_PC])));
 				return RESULT_CODE::UNIMPLEMENTED_INSTRUCTION;
 			}
 
+		// Re-synchronises the decoded program with the program counter.
+		// Checks for HLT, re-decodes the image if it was written to and
+		// decodes on the fly when the program counter is outside the stream.
+		RESOLVE_HANDLER:
+			{
+				if((REG_FLAGS & FLAG::HLT) == FLAG::HLT){
+					return RESULT_CODE::SUCCESS;
+				}
+
+				if(programStale){
+					decodeProgram(programBegin, programEnd);
+				}
+
+				uint32_t index = programLookup(REG_PC);
+				if constexpr(VERIFIED){
+					if(!programVerified){
+						return execute<SINGLE_STEP, BUDGETED, false>(budget);
+					}
+					if(index == programResolve){
+						// Nothing outside the stream is verified, it runs checked one instruction at a time
+						if constexpr(BUDGETED){
+							if(budget == 0){
+								return RESULT_CODE::BUDGET_EXHAUSTED;
+							}
+							budget--;
+						}
+						RESULT result = step();
+						if(result != RESULT_CODE::SUCCESS){
+							return result;
+						}
+						instruction = program.data() + programResolve;
+						DISPATCH_INSTRUCTION();
+					}
+				}
+
+				if(index != programResolve){
+					// Coming back from native code or stepped instructions is as good a place to enter the JIT as a jump
+					DISPATCH_JUMP(index);
+				}else{
+					if(!isFetchable(REG_PC)){
+						SPDLOG_ERROR("Program counter outside guest memory: " + std::to_string(REG_PC));
+						return RESULT_CODE::BAD_ADDRESS;
+					}
+					scratch = decodeInstruction(REG_PC);
+					scratch.next = programResolve;
+					scratch.target = programResolve;
+					instruction = &scratch;
+				}
+				DISPATCH_INSTRUCTION();
+			}
+
 		// HALT -> [REG_FLAGS]
 		// Sets the REG_FLAGS with a bit corresponding to HLT
-		case(BYTECODE::HALT):
+		HANDLER(HALT):
 			{
 				REG_FLAGS = REG_FLAGS | FLAG::HLT;
 
@@ -232,463 +1145,370 @@ RESULT FVM::step(){
 
 		// COMPARE <regA> <regB> -> [REG_FLAGS]
 		// Sets the REG_FLAGS with a bit corresponding to <, >, <=, >= and = 
-		case(BYTECODE::COMPARE):
+		HANDLER(COMPARE):
 			{
-				// Bind regA and regB
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				// Clear the flag register
-				REG_FLAGS = REG_FLAGS & 0;	
-
-
-				if(regA == regB){
-					REG_FLAGS = REG_FLAGS | FLAG::EQ;
-				}
-				
-				if(regA < regB){
-					REG_FLAGS = REG_FLAGS | FLAG::LT;
-				}
-				
-				if(regA > regB){
-					REG_FLAGS = REG_FLAGS | FLAG::GT;
-				}
-				
-				if(regA <= regB){
-					REG_FLAGS = REG_FLAGS | FLAG::LTE;
-				} 
-				
-				if(regA >= regB){
-					REG_FLAGS = REG_FLAGS | FLAG::GTE;
-				}
+				uint16_t regA = registers[instruction->regA];
+				uint16_t regB = registers[instruction->regB];
 
-				REG_PC += 3;
-				break;
+				REG_PC = instruction->nextPC;
+				REG_FLAGS = compareFlags(regA, regB);
+				DISPATCH(instruction->next);
 			}
 
 		// JUMP <addr> -> []
 		// Sets the PC to a particular address in memory
-		case(BYTECODE::JUMP):
+		HANDLER(JUMP):
 			{
-				uint16_t addr = getAddressArgument(1);
-				REG_PC = addr;
-				break;
+				REG_PC = instruction->address;
+				DISPATCH_JUMP(instruction->target);
 			}
 
 		// JUMPE <addr> -> []
 		// Sets the PC to a particular address in memory if EQ flag is set
-		case(BYTECODE::JUMPEQ):
+		HANDLER(JUMPEQ):
 			{
 				if((REG_FLAGS & FLAG::EQ) == FLAG::EQ){
-					uint16_t addr = getAddressArgument(1);
-					REG_PC = addr;
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
 				}
-				break;
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
 
 		// JUMPLT <addr> -> []
 		// Sets the PC to a particular address in memory if LT flag is set
-		case(BYTECODE::JUMPLT):
+		HANDLER(JUMPLT):
 			{
 				if((REG_FLAGS & FLAG::LT) == FLAG::LT){
-					uint16_t addr = getAddressArgument(1);
-					REG_PC = addr;
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
 				}
-				break;
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
 
 		// JUMPGT <addr> -> []
 		// Sets the PC to a particular address in memory if GT flag is set
-		case(BYTECODE::JUMPGT):
+		HANDLER(JUMPGT):
 			{
 				if((REG_FLAGS & FLAG::GT) == FLAG::GT){
-					uint16_t addr = getAddressArgument(1);
-					REG_PC = addr;
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
 				}
-				break;
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
 
 		// JUMPLTE <addr> -> []
 		// Sets the PC to a particular address in memory if LTE flag is set
-		case(BYTECODE::JUMPLTE):
+		HANDLER(JUMPLTE):
 			{
 				if((REG_FLAGS & FLAG::LTE) == FLAG::LTE){
-					uint16_t addr = getAddressArgument(1);
-					REG_PC = addr;
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
 				}
-				break;
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
 			
 		// JUMPGTE <addr> -> []
 		// Sets the PC to a particular address in memory if GTE flag is set
-		case(BYTECODE::JUMPGTE):
+		HANDLER(JUMPGTE):
 			{
 				if((REG_FLAGS & FLAG::GTE) == FLAG::GTE){
-					uint16_t addr = getAddressArgument(1);
-					REG_PC = addr;
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
 				}
-				break;
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
 			
 		/* MOVING */
 
 		// MOVELR <literal> <regA> -> []
 		// Moves a literal into register A
-		case(BYTECODE::MOVELR):
+		HANDLER(MOVELR):
 			{
-				uint16_t literal = getLiteralArgument(1);
-				bindReg(regARef, 3);
-				auto& regA = regARef.get();
-				regA = literal;
-
-				REG_PC += 4;
-
-				break;
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = instruction->literal;
+				DISPATCH(instruction->next);
 			}
 		
 		// MOVERR <regA> <regB> -> []
 		// Moves the contents of register A into register B
-		case(BYTECODE::MOVERR):
+		HANDLER(MOVERR):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-				auto& regA = regARef.get();
-				auto& regB = regARef.get();
-
-				regB = regA;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t regA = registers[instruction->regA];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = regA;
+				DISPATCH(instruction->next);
 			}
 		
-		// MOVELR <literal> <addr> -> []
+		// MOVELM <literal> <addr> -> []
 		// Moves a literal into memory
-		case(BYTECODE::MOVELM):
+		HANDLER(MOVELM):
 			{
-				uint16_t literal = getLiteralArgument(1);
-				uint16_t address = getAddressArgument(3);
-				writeUInt16(address, literal);
-
-				REG_PC += 4;
-
-				break;
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				REG_PC = instruction->nextPC;
+				writeUInt16(instruction->address, instruction->literal);
+				DISPATCH(programStale ? programResolve : instruction->next);
 			}
 
 		// Moves the contents of register A into memory
 		// MOVERM <regA> <addr> -> []
-		case(BYTECODE::MOVERM):
+		HANDLER(MOVERM):
 			{
-				bindReg(regARef, 1);
-				auto& regA = regARef.get();
-
-				uint16_t address = getAddressArgument(2);
-
-				writeUInt16(address, regA);
-
-				REG_PC += 4;
-
-				break;
-
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				uint16_t regA = registers[instruction->regA];
+				REG_PC = instruction->nextPC;
+				writeUInt16(instruction->address, regA);
+				DISPATCH(programStale ? programResolve : instruction->next);
 			}
 
 		// Moves the contents of memory into register A
 		// MOVEMR <addr> <regA> -> []
-		case(BYTECODE::MOVEMR):
+		HANDLER(MOVEMR):
 			{
-				uint16_t address = getAddressArgument(1);
-
-				bindReg(regARef, 3);
-				auto& regA = regARef.get();
-
-				regA = readUInt16(address);
-
-				REG_PC += 4;
-				
-				break;
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				uint16_t contents = readUInt16(instruction->address);
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = contents;
+				DISPATCH(instruction->next);
 			}
 
 		// Moves a literal into memory at the address inside register A
 		// MOVELIR <literal> <regA> -> []
-		case(BYTECODE::MOVELIR):
+		HANDLER(MOVELIR):
 			{
-				uint16_t literal = getLiteralArgument(1);
-
-				bindReg(regARef, 3);
-				auto& address = regARef.get();
-
-				writeUInt16(address, literal);
-
-				REG_PC += 4;
-				
-				break;
-
+				uint16_t address = registers[instruction->regA];
+				CHECK_ADDRESS(address);
+				REG_PC = instruction->nextPC;
+				writeUInt16(address, instruction->literal);
+				DISPATCH(programStale ? programResolve : instruction->next);
 			}
 
 		// Moves the contents of memory at the address inside register A to register B
 		// MOVEIRR <regA> <regB> -> []
-		case(BYTECODE::MOVEIRR):
+		HANDLER(MOVEIRR):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& address = regARef.get();
-				auto& regB = regBRef.get();	
-
-				uint16_t contents = readUInt16(address);
-				regB = contents;
-
-				REG_PC += 3;
-				
-				break;
+				CHECK_ADDRESS(registers[instruction->regA]);
+				uint16_t contents = readUInt16(registers[instruction->regA]);
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = contents;
+				DISPATCH(instruction->next);
 			}
 
 		// Moves the contents of memory at the address inside register A to memory
 		// MOVEIRM <regA> <addr> -> []
-		case(BYTECODE::MOVEIRM):
+		HANDLER(MOVEIRM):
 			{
-				bindReg(regARef, 1);
-				auto& address = regARef.get();
-
-				uint16_t contents = readUInt16(address);
-				writeUInt16(address, contents);
-
-				REG_PC += 4;
-				
-				break;
+				CHECK_ADDRESS(registers[instruction->regA]);
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				uint16_t contents = readUInt16(registers[instruction->regA]);
+				REG_PC = instruction->nextPC;
+				writeUInt16(instruction->address, contents);
+				DISPATCH(programStale ? programResolve : instruction->next);
 			}
 
-
 		// Moves contents of memory at the address inside memory to register A
 		// MOVEIMR <addr> <regA> -> []
-		case(BYTECODE::MOVEIMR):
+		HANDLER(MOVEIMR):
 			{
-				uint16_t address = getAddressArgument(1);
-
-				bindReg(regARef, 3);
-				auto& regA = regARef.get();
-
-				uint16_t contents = readUInt16(address);
-
-				regA = contents;
-
-				REG_PC += 4;
-				
-				break;
-
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				uint16_t pointer = readUInt16(instruction->address);
+				CHECK_ADDRESS(pointer);
+				uint16_t contents = readUInt16(pointer);
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = contents;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA + RegisterB -> RegisterB
 		// ADD <regA> <regB> -> [regB]
-		case(BYTECODE::ADD):
+		HANDLER(ADD):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA + regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] + registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA - RegisterB -> RegisterB
 		// SUBTRACT <regA> <regB> -> [regB]
-		case(BYTECODE::SUBTRACT):
+		HANDLER(SUBTRACT):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA - regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] - registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA * RegisterB -> RegisterB
 		// MULTIPLY <regA> <regB> -> [regB]
-		case(BYTECODE::MULTIPLY):
+		HANDLER(MULTIPLY):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA * regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] * registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA / RegisterB -> RegisterB
 		// DIVIDE <regA> <regB> -> [regB]
-		case(BYTECODE::DIVIDE):
+		HANDLER(DIVIDE):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA / regB;
-
-				REG_PC += 3;
-
-				break;
+				if(registers[instruction->regB] == 0){
+					SPDLOG_ERROR("Divide by zero at " + std::to_string(REG_PC));
+					return RESULT_CODE::DIVIDE_BY_ZERO;
+				}
+				uint16_t result = registers[instruction->regA] / registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA + 1 -> RegisterA
 		// INCREMENT <regA> -> [regA]
-		case(BYTECODE::INCREMENT):
+		HANDLER(INCREMENT):
 			{
-				bindReg(regARef, 1);
-
-				auto& regA = regARef.get();
-
-				regA += 1;
-
-				REG_PC += 2;
-
-				break;
+				uint16_t result = registers[instruction->regA] + 1;
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA - 1 -> RegisterA
 		// DECREMENT <regA> -> [regA]
-		case(BYTECODE::DECREMENT):
+		HANDLER(DECREMENT):
 			{
-				bindReg(regARef, 1);
-
-				auto& regA = regARef.get();
-
-				regA -= 1;
-
-				REG_PC += 2;
-
-				break;
+				uint16_t result = registers[instruction->regA] - 1;
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA AND RegisterB -> RegisterB
 		// AND <regA> <regB> -> [regB]
-		case(BYTECODE::AND):
+		HANDLER(AND):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA & regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] & registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA OR RegisterB -> RegisterB
 		// OR <regA> <regB> -> [regB]
-		case(BYTECODE::OR):
+		HANDLER(OR):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA | regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] | registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA XOR RegisterB -> RegisterB
 		// XOR <regA> <regB> -> [regB]
-		case(BYTECODE::XOR):
+		HANDLER(XOR):
 			{
-				bindReg(regARef, 1);
-				bindReg(regBRef, 2);
-
-				auto& regA = regARef.get();
-				auto& regB = regBRef.get();
-
-				regB = regA ^ regB;
-
-				REG_PC += 3;
-
-				break;
+				uint16_t result = registers[instruction->regA] ^ registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regB] = result;
+				DISPATCH(instruction->next);
 			}
 
 		// RegisterA -> !RegisterA
 		// NOT <regA> -> [regA]
-		case(BYTECODE::NOT):
+		HANDLER(NOT):
 			{
-				bindReg(regARef, 1);
-
-				auto& regA = regARef.get();
-
-				regA = ~regA;
-
-				REG_PC += 2;
-
-				break;
+				uint16_t result = ~registers[instruction->regA];
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = result;
+				DISPATCH(instruction->next);
 			}
 
-		// RegisterA << literal -> RegisterA
+		// RegisterA << literal -> RegisterA, shifting by 16 or more clears RegisterA
 		// SHIFTLEFT <regA> <literal> -> [regA]
-		case(BYTECODE::SHIFTLEFT):
+		HANDLER(SHIFTLEFT):
 			{
-				bindReg(regARef, 1);
-
-				uint16_t literal = getLiteralArgument(2);
-
-				auto& regA = regARef.get();
-
-				regA = regA << literal;
-
-				REG_PC += 4;
-
-				break;
+				uint16_t result = instruction->literal < 16 ? registers[instruction->regA] << instruction->literal : 0;
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = result;
+				DISPATCH(instruction->next);
 			}
 
-		// RegisterA >> literal  -> RegisterA
+		// RegisterA >> literal  -> RegisterA, shifting by 16 or more clears RegisterA
 		// SHIFTRIGHT <regA> <literal> -> [regA]
-		case(BYTECODE::SHIFTRIGHT):
+		HANDLER(SHIFTRIGHT):
 			{
-				bindReg(regARef, 1);
-
-				uint16_t literal = getLiteralArgument(2);
-
-				auto& regA = regARef.get();
+				uint16_t result = instruction->literal < 16 ? registers[instruction->regA] >> instruction->literal : 0;
+				REG_PC = instruction->nextPC;
+				registers[instruction->regA] = result;
+				DISPATCH(instruction->next);
+			}
 
-				regA = regA >> literal;
+		/* SUPERINSTRUCTIONS */
+		// Each runs its own entry, then the following entry without a dispatch in
+		// between. PC and FLAGS are updated exactly as the separate handlers would.
 
-				REG_PC += 4;
+		// COMPARE <regA> <regB> + JUMPxx <addr> -> [REG_FLAGS]
+		// The jump's flag is in literal
+		FUSED_HANDLER(COMPARE_JUMP):
+			{
+				uint16_t mask = instruction->literal;
+				REG_FLAGS = compareFlags(registers[instruction->regA], registers[instruction->regB]);
+				REG_PC = instruction->nextPC;
+
+				instruction = instruction + 1;
+				BEFORE_INSTRUCTION();
+				if(REG_FLAGS & mask){
+					REG_PC = instruction->address;
+					DISPATCH_JUMP(instruction->target);
+				}
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
+			}
 
-				break;
+		// INCREMENT <regA> + COMPARE <regA> <regB> -> [regA, REG_FLAGS]
+		FUSED_HANDLER(INCREMENT_COMPARE):
+			{
+				registers[instruction->regA] = registers[instruction->regA] + 1;
+				REG_PC = instruction->nextPC;
+
+				instruction = instruction + 1;
+				BEFORE_INSTRUCTION();
+				REG_FLAGS = compareFlags(registers[instruction->regA], registers[instruction->regB]);
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
 			}
-	}	
-	
-	return RESULT_CODE::SUCCESS;
-}
 
-RESULT FVM::run(){
-	while(!((REG_FLAGS & FLAG::HLT) == FLAG::HLT)){
-		RESULT result = step();
-		if(result != RESULT_CODE::SUCCESS){
-			return result;
-		}
+		// MOVEMR <addr> <regA> + ADD <regA> <regB> -> [regA, regB]
+		FUSED_HANDLER(MOVEMR_ADD):
+			{
+				CHECK_OPERAND_ADDRESS(instruction->address);
+				registers[instruction->regA] = readUInt16(instruction->address);
+				REG_PC = instruction->nextPC;
+
+				instruction = instruction + 1;
+				BEFORE_INSTRUCTION();
+				registers[instruction->regB] = registers[instruction->regA] + registers[instruction->regB];
+				REG_PC = instruction->nextPC;
+				DISPATCH(instruction->next);
+			}
 	}
 
-	return RESULT_CODE::SUCCESS;
+	#undef HANDLER
+	#undef FUSED_HANDLER
+	#undef UNIMPLEMENTED_HANDLER
+	#undef RESOLVE_HANDLER
+	#undef DISPATCH_INSTRUCTION
+	#undef DISPATCH
+	#undef DISPATCH_JUMP
+	#undef TRACE_INSTRUCTION
+	#undef PROFILE_INSTRUCTION
+	#undef BEFORE_INSTRUCTION
+	#undef CHECK_ADDRESS
+	#undef CHECK_OPERAND_ADDRESS
+
+	return RESULT_CODE::UNSPECIFIED_FAILURE;
 }
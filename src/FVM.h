@@ -1,9 +1,31 @@
+#ifndef FVM_H
+#define FVM_H
 
 
-#include <functional>
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <vector>
 #include "ResultCode.h"
 #include "ByteCode.h"
+#include "GuestMemory.h"
+
+#ifdef FVM_TRACE
+	#include "Trace.h"
+#endif
+
+#ifdef FVM_PROFILE
+	#include "Profile.h"
+#endif
+
+class JIT;
+class NativeProgram;
+
+#ifndef FVM_PAGE_SIZE
+	#define FVM_PAGE_SIZE 4096
+#endif
 
 
 
@@ -20,28 +42,87 @@ class FVM{
 			HLT = 0x20,
 		};
 
-		FVM(const size_t MEMORY_SIZE);
+		/* Dispatch slots: one per opcode, followed by the unimplemented and resolve handlers */
+		static constexpr uint8_t OPCODE_COUNT = static_cast<uint8_t>(BYTECODE_INFO::OPCODE_COUNT);
+		static constexpr uint8_t DISPATCH_UNIMPLEMENTED = OPCODE_COUNT;
+		static constexpr uint8_t DISPATCH_RESOLVE = OPCODE_COUNT + 1;
+
+		/* Superinstruction slots, each runs its entry and the one after it, see fuseProgram() */
+		static constexpr uint8_t DISPATCH_COMPARE_JUMP = OPCODE_COUNT + 2;
+		static constexpr uint8_t DISPATCH_INCREMENT_COMPARE = OPCODE_COUNT + 3;
+		static constexpr uint8_t DISPATCH_MOVEMR_ADD = OPCODE_COUNT + 4;
+
+		/* The opcode of the first instruction a dispatch slot executes */
+		static constexpr uint8_t unfusedOpcode(const uint8_t slot){
+			switch(slot){
+				case DISPATCH_COMPARE_JUMP: return static_cast<uint8_t>(BYTECODE::COMPARE);
+				case DISPATCH_INCREMENT_COMPARE: return static_cast<uint8_t>(BYTECODE::INCREMENT);
+				case DISPATCH_MOVEMR_ADD: return static_cast<uint8_t>(BYTECODE::MOVEMR);
+				default: return slot;
+			}
+		}
+
+		/* An instruction decoded once at load time, see decodeProgram() */
+		struct DecodedInstruction {
+			uint8_t opcode;
+			uint8_t regA;
+			uint8_t regB;
+			uint16_t literal;
+			uint16_t address;
+			uint16_t nextPC;
+			uint32_t next;
+			uint32_t target;
+		};
+
+		FVM(const size_t MEMORY_SIZE, const GuestMemory::BACKING backing = GuestMemory::DEFAULT_BACKING);
+		~FVM();
+		FVM(FVM&&) noexcept;
+		FVM& operator=(FVM&&) noexcept;
 		RESULT init();
 		RESULT loadBytecode(const size_t offset, const std::vector<uint8_t>& bytecode);
+		RESULT loadBytecode(const size_t offset, const std::filesystem::path& programPath);
 		RESULT step();
 		RESULT run();
+		RESULT run(const uint64_t maxInstructions);
+
+		/* Whether the loaded program passed verifyProgram() and runs without operand address checks */
+		bool isVerified() const { return programVerified; }
+
+		/* Number of hot loops the JIT compiled to traces since the program was last decoded */
+		size_t jitTraceCount() const;
+
+		/* Runs the loaded program through a shared object from NativeProgram::build(), built with FVM_AOT */
+		RESULT attachNative(const std::filesystem::path& soPath);
+		/* Whether run() uses attached native code for the program loaded now */
+		bool hasNative() const { return nativeCurrent; }
+
+		/* Snapshot of registers and memory that restore() returns to, see snapshot() */
+		static constexpr size_t PAGE_SIZE = FVM_PAGE_SIZE;
+		static_assert((PAGE_SIZE & (PAGE_SIZE - 1)) == 0, "FVM_PAGE_SIZE must be a power of two");
+
+		void snapshot();
+		RESULT restore();
+		bool hasSnapshot() const;
 
 
 		size_t MEMORY_SIZE;
 		
-		std::vector<uint8_t> memory;
+		GuestMemory memory;
 		
-		uint16_t REG_0;
-		uint16_t REG_1;
-		uint16_t REG_2;
-		uint16_t REG_3;
-		uint16_t REG_4;
-		uint16_t REG_5;
-		uint16_t REG_6;
-		uint16_t REG_7;
-
-		uint16_t REG_PC;
-		uint16_t REG_FLAGS;
+		/* Register file indexed by operand byte - BYTECODE::REG_0, REG_PC and REG_FLAGS last */
+		static constexpr size_t REGISTER_COUNT = static_cast<size_t>(BYTECODE::REG_FLAGS) - static_cast<size_t>(BYTECODE::REG_0) + 1;
+		static constexpr size_t REGISTER_PC = static_cast<size_t>(BYTECODE::REG_PC) - static_cast<size_t>(BYTECODE::REG_0);
+		static constexpr size_t REGISTER_FLAGS = static_cast<size_t>(BYTECODE::REG_FLAGS) - static_cast<size_t>(BYTECODE::REG_0);
+
+		std::array<uint16_t, REGISTER_COUNT> registers{};
+
+		static constexpr bool isRegister(const uint8_t operand){
+			return operand >= static_cast<uint8_t>(BYTECODE::REG_0) && operand <= static_cast<uint8_t>(BYTECODE::REG_FLAGS);
+		}
+
+		static constexpr uint8_t registerIndex(const uint8_t operand){
+			return static_cast<uint8_t>(operand - static_cast<uint8_t>(BYTECODE::REG_0));
+		}
 
 		uint8_t readUInt8(const size_t address) const;
 		uint16_t readUInt16(const size_t address) const;
@@ -58,11 +139,80 @@ class FVM{
 		std::string memoryToHexString() const;
 		std::string dumpState() const;
 
-	private:
-		void bindReg(std::reference_wrapper<uint16_t>& regRef, const size_t PCOffset);
+#ifdef FVM_TRACE
+		/* The most recently executed instructions, see Trace.h */
+		TraceBuffer trace;
+#endif
 
-		std::reference_wrapper<uint16_t> regARef = REG_0;
-		std::reference_wrapper<uint16_t> regBRef = REG_0;
+#ifdef FVM_PROFILE
+		/* Execution counts since init(), see Profile.h */
+		ProfileCounters profile;
+#endif
+
+		/* Lets run() hand hot blocks to the JIT when built with FVM_JIT */
+		bool jitEnabled = true;
+
+		DecodedInstruction decodeInstruction(const size_t address) const;
+
+	private:
+		friend class JIT;
+		friend class NativeProgram;
+
+		static constexpr uint32_t PROGRAM_UNLINKED = UINT32_MAX;
+
+		template<bool SINGLE_STEP, bool BUDGETED, bool VERIFIED>
+		RESULT execute(uint64_t budget);
+
+		uint8_t decodeRegister(const uint8_t operand) const;
+		bool isFetchable(const size_t address) const;
+		RESULT checkLoad(const size_t offset, const size_t size) const;
+		void markLoaded(const size_t offset, const size_t size);
+		void finishLoad(const size_t offset, const size_t size);
+		RESULT loadImage(const size_t offset, const std::filesystem::path& programPath);
+		void decodeProgram(const size_t begin, const size_t end);
+		void fuseProgram();
+		bool verifyProgram() const;
+		uint32_t programLookup(const size_t address) const;
+
+		/* Decoded instruction stream of the loaded image, terminated by the resolve entry */
+		std::vector<DecodedInstruction> program;
+		std::vector<uint32_t> programIndex;
+		size_t programBegin = 0;
+		size_t programEnd = 0;
+		/* Sorted basic block starts from the loaded .fbc image, empty if it had none */
+		std::vector<size_t> programBlocks;
+		uint32_t programResolve = 0;
+		bool programStale = false;
+		bool programVerified = false;
+
+#ifdef FVM_JIT
+		/* Only created once run() has taken enough jumps for a target to be hot, see jitExecute() */
+		std::unique_ptr<JIT> jit;
+		uint32_t jitJumps = 0;
+		bool jitExecute(const uint32_t index);
+#endif
+
+		/* Set while the decoded program is the one native was built from */
+		bool nativeCurrent = false;
+#ifdef FVM_AOT
+		std::unique_ptr<NativeProgram> native;
+		RESULT runNative();
+#endif
+
+		/* Pages written since init() or the last snapshot()/restore() */
+		std::vector<uint8_t> pageDirty;
+		std::vector<uint32_t> dirtyPages;
+		void markDirty(const size_t address);
+
+		struct Snapshot {
+			std::array<uint16_t, REGISTER_COUNT> registers;
+			GuestMemory memory;
+			size_t programBegin;
+			size_t programEnd;
+			std::vector<size_t> programBlocks;
+		};
+		std::unique_ptr<Snapshot> saved;
 
 };
 
+#endif
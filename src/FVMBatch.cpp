@@ -0,0 +1,466 @@
+#include <algorithm>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#include "spdlog/spdlog.h"
+#include "FVMBatch.h"
+
+/* Lane-wise operations on 16-bit lanes. Masks are 0xFFFF or 0 per lane */
+namespace {
+
+#if defined(__AVX2__)
+	using Vector = __m256i;
+	constexpr size_t VECTOR_LANES = 16;
+
+	inline Vector load(const uint16_t* lanes){ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes)); }
+	inline void store(uint16_t* lanes, const Vector v){ _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), v); }
+	inline Vector splat(const uint16_t value){ return _mm256_set1_epi16(static_cast<short>(value)); }
+	inline Vector add(const Vector a, const Vector b){ return _mm256_add_epi16(a, b); }
+	inline Vector sub(const Vector a, const Vector b){ return _mm256_sub_epi16(a, b); }
+	inline Vector mul(const Vector a, const Vector b){ return _mm256_mullo_epi16(a, b); }
+	inline Vector bitAnd(const Vector a, const Vector b){ return _mm256_and_si256(a, b); }
+	inline Vector bitOr(const Vector a, const Vector b){ return _mm256_or_si256(a, b); }
+	inline Vector bitXor(const Vector a, const Vector b){ return _mm256_xor_si256(a, b); }
+	/* ~a & b */
+	inline Vector andNot(const Vector a, const Vector b){ return _mm256_andnot_si256(a, b); }
+	inline Vector equal(const Vector a, const Vector b){ return _mm256_cmpeq_epi16(a, b); }
+	inline Vector less(const Vector a, const Vector b){
+		const Vector bias = splat(0x8000);
+		return _mm256_cmpgt_epi16(bitXor(b, bias), bitXor(a, bias));
+	}
+	inline Vector minimum(const Vector a, const Vector b){ return _mm256_min_epu16(a, b); }
+	/* Shifts of 16 or more clear the lane, matching the interpreter */
+	inline Vector shiftLeft(const Vector a, const uint16_t count){ return _mm256_sll_epi16(a, _mm_cvtsi32_si128(count)); }
+	inline Vector shiftRight(const Vector a, const uint16_t count){ return _mm256_srl_epi16(a, _mm_cvtsi32_si128(count)); }
+#elif defined(__SSE2__)
+	using Vector = __m128i;
+	constexpr size_t VECTOR_LANES = 8;
+
+	inline Vector load(const uint16_t* lanes){ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes)); }
+	inline void store(uint16_t* lanes, const Vector v){ _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v); }
+	inline Vector splat(const uint16_t value){ return _mm_set1_epi16(static_cast<short>(value)); }
+	inline Vector add(const Vector a, const Vector b){ return _mm_add_epi16(a, b); }
+	inline Vector sub(const Vector a, const Vector b){ return _mm_sub_epi16(a, b); }
+	inline Vector mul(const Vector a, const Vector b){ return _mm_mullo_epi16(a, b); }
+	inline Vector bitAnd(const Vector a, const Vector b){ return _mm_and_si128(a, b); }
+	inline Vector bitOr(const Vector a, const Vector b){ return _mm_or_si128(a, b); }
+	inline Vector bitXor(const Vector a, const Vector b){ return _mm_xor_si128(a, b); }
+	/* ~a & b */
+	inline Vector andNot(const Vector a, const Vector b){ return _mm_andnot_si128(a, b); }
+	inline Vector equal(const Vector a, const Vector b){ return _mm_cmpeq_epi16(a, b); }
+	/* SSE2 only compares signed lanes, flipping the sign bit makes that unsigned */
+	inline Vector less(const Vector a, const Vector b){
+		const Vector bias = splat(0x8000);
+		return _mm_cmplt_epi16(bitXor(a, bias), bitXor(b, bias));
+	}
+	inline Vector minimum(const Vector a, const Vector b){
+		const Vector bias = splat(0x8000);
+		return bitXor(_mm_min_epi16(bitXor(a, bias), bitXor(b, bias)), bias);
+	}
+	/* Shifts of 16 or more clear the lane, matching the interpreter */
+	inline Vector shiftLeft(const Vector a, const uint16_t count){ return _mm_sll_epi16(a, _mm_cvtsi32_si128(count)); }
+	inline Vector shiftRight(const Vector a, const uint16_t count){ return _mm_srl_epi16(a, _mm_cvtsi32_si128(count)); }
+#else
+	using Vector = uint16_t;
+	constexpr size_t VECTOR_LANES = 1;
+
+	inline Vector load(const uint16_t* lanes){ return *lanes; }
+	inline void store(uint16_t* lanes, const Vector v){ *lanes = v; }
+	inline Vector splat(const uint16_t value){ return value; }
+	inline Vector add(const Vector a, const Vector b){ return static_cast<Vector>(a + b); }
+	inline Vector sub(const Vector a, const Vector b){ return static_cast<Vector>(a - b); }
+	inline Vector mul(const Vector a, const Vector b){ return static_cast<Vector>(a * b); }
+	inline Vector bitAnd(const Vector a, const Vector b){ return static_cast<Vector>(a & b); }
+	inline Vector bitOr(const Vector a, const Vector b){ return static_cast<Vector>(a | b); }
+	inline Vector bitXor(const Vector a, const Vector b){ return static_cast<Vector>(a ^ b); }
+	/* ~a & b */
+	inline Vector andNot(const Vector a, const Vector b){ return static_cast<Vector>(~a & b); }
+	inline Vector equal(const Vector a, const Vector b){ return a == b ? 0xFFFF : 0; }
+	inline Vector less(const Vector a, const Vector b){ return a < b ? 0xFFFF : 0; }
+	inline Vector minimum(const Vector a, const Vector b){ return std::min(a, b); }
+	inline Vector shiftLeft(const Vector a, const uint16_t count){ return count < 16 ? static_cast<Vector>(a << count) : 0; }
+	inline Vector shiftRight(const Vector a, const uint16_t count){ return count < 16 ? static_cast<Vector>(a >> count) : 0; }
+#endif
+
+	/* Lanes of a where the mask is set, lanes of b elsewhere */
+	inline Vector select(const Vector mask, const Vector a, const Vector b){ return bitOr(bitAnd(mask, a), andNot(mask, b)); }
+
+	inline uint16_t readLaneUInt16(const uint8_t* memory, const size_t address){
+		return static_cast<uint16_t>(memory[address] | memory[address + 1] << 8);
+	}
+
+	inline void writeLaneUInt16(uint8_t* memory, const size_t address, const uint16_t value){
+		memory[address] = static_cast<uint8_t>(value & 0xFF);
+		memory[address + 1] = static_cast<uint8_t>(value >> 8);
+	}
+}
+
+/**
+ * Constructor for the FVMBatch class.
+ * @param LANES The number of FVM instances run together.
+ * @param MEMORY_SIZE The size of each instance's memory.
+ */
+FVMBatch::FVMBatch(const size_t LANES, const size_t MEMORY_SIZE)
+	: LANES(LANES), MEMORY_SIZE(MEMORY_SIZE),
+	  paddedLanes((LANES + VECTOR_LANES - 1) / VECTOR_LANES * VECTOR_LANES),
+	  image(MEMORY_SIZE){
+}
+
+/**
+ * Clears the registers and memory of every lane and unloads the program.
+ * @return RESULT_CODE The result of the initialization operation, indicating success or failure.
+ */
+RESULT FVMBatch::init(){
+	registers.assign(FVM::REGISTER_COUNT * paddedLanes, 0);
+	RESULT result = memory.allocate(LANES * MEMORY_SIZE);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+	active.assign(paddedLanes, 0);
+	mask.assign(paddedLanes, 0);
+	results.assign(LANES, RESULT_CODE::SUCCESS);
+
+	imageBegin = 0;
+	imageEnd = 0;
+	decoded.clear();
+	decodedValid.clear();
+
+	return image.init();
+}
+
+/**
+ * Loads the same bytecode into the memory of every lane.
+ * @param offset The offset from position 0 to load the memory into.
+ * @param bytecode The vector of bytecodes to be loaded.
+ * @return RESULT_CODE The result of the load, as FVM::loadBytecode() reports it.
+ */
+RESULT FVMBatch::loadBytecode(const size_t offset, const std::vector<uint8_t>& bytecode){
+	RESULT result = image.loadBytecode(offset, bytecode);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	for(size_t lane = 0; lane < LANES; lane++){
+		std::copy(bytecode.begin(), bytecode.end(), laneMemory(lane) + offset);
+	}
+
+	imageBegin = offset;
+	imageEnd = offset + bytecode.size();
+	decoded.assign(bytecode.size(), FVM::DecodedInstruction{});
+	decodedValid.assign(bytecode.size(), false);
+
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Retrieves a reference to a register of one lane.
+ * @param lane The lane to access.
+ * @param bytecode The bytecode enum indicating the register to access.
+ * @return Reference to the selected register, or REG_0 if the bytecode is not a register.
+ */
+uint16_t& FVMBatch::getRegister(const size_t lane, const enum BYTECODE bytecode){
+	if(!FVM::isRegister(static_cast<uint8_t>(bytecode))){
+		SPDLOG_ERROR("Expected Register, got: " + std::string(BYTECODE_INFO::nameFromValue(static_cast<uint8_t>(bytecode))));
+		return registerLanes(0)[lane];
+	}
+	return registerLanes(FVM::registerIndex(static_cast<uint8_t>(bytecode)))[lane];
+}
+
+uint8_t* FVMBatch::laneMemory(const size_t lane){
+	return memory.data() + lane * MEMORY_SIZE;
+}
+
+const RESULT& FVMBatch::laneResult(const size_t lane) const {
+	return results[lane];
+}
+
+uint16_t* FVMBatch::registerLanes(const size_t index){
+	return registers.data() + index * paddedLanes;
+}
+
+/**
+ * Picks the next instruction to execute: the lowest program counter among the
+ * running lanes. Fills mask with the lanes sitting at it.
+ * @param pc Set to the address of the instruction to execute.
+ * @return False once no lane is running.
+ */
+bool FVMBatch::schedule(uint16_t& pc){
+	const uint16_t* PC = registerLanes(FVM::REGISTER_PC);
+	const Vector none = splat(0xFFFF);
+
+	Vector lowest = none;
+	Vector running = splat(0);
+	for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+		Vector lanes = load(active.data() + v);
+		lowest = minimum(lowest, select(lanes, load(PC + v), none));
+		running = bitOr(running, lanes);
+	}
+
+	uint16_t lowestLanes[VECTOR_LANES];
+	uint16_t runningLanes[VECTOR_LANES];
+	store(lowestLanes, lowest);
+	store(runningLanes, running);
+
+	bool any = false;
+	pc = 0xFFFF;
+	for(size_t i = 0; i < VECTOR_LANES; i++){
+		any = any || runningLanes[i] != 0;
+		pc = std::min(pc, lowestLanes[i]);
+	}
+	if(!any){
+		return false;
+	}
+
+	const Vector at = splat(pc);
+	for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+		store(mask.data() + v, bitAnd(load(active.data() + v), equal(load(PC + v), at)));
+	}
+	return true;
+}
+
+/**
+ * Finishes one lane on a scalar FVM and copies its final state back.
+ * @param lane The lane to move off the batch.
+ */
+void FVMBatch::runScalar(const size_t lane){
+	uint8_t* laneMem = laneMemory(lane);
+
+	FVM vm(MEMORY_SIZE);
+	vm.init();
+	std::copy(laneMem, laneMem + MEMORY_SIZE, vm.memory.begin());
+	vm.loadBytecode(imageBegin, std::vector<uint8_t>(laneMem + imageBegin, laneMem + imageEnd));
+	for(size_t r = 0; r < FVM::REGISTER_COUNT; r++){
+		vm.registers[r] = registerLanes(r)[lane];
+	}
+
+	results[lane] = vm.run();
+
+	std::copy(vm.memory.begin(), vm.memory.end(), laneMem);
+	for(size_t r = 0; r < FVM::REGISTER_COUNT; r++){
+		registerLanes(r)[lane] = vm.registers[r];
+	}
+	active[lane] = 0;
+}
+
+void FVMBatch::runScalarMasked(){
+	for(size_t lane = 0; lane < LANES; lane++){
+		if(mask[lane]){
+			runScalar(lane);
+		}
+	}
+}
+
+/**
+ * Runs every lane until it halts or fails.
+ * @return RESULT_CODE SUCCESS if every lane halted, otherwise the first failing lane's result.
+ */
+RESULT FVMBatch::run(){
+	uint16_t* PC = registerLanes(FVM::REGISTER_PC);
+	uint16_t* FLAGS = registerLanes(FVM::REGISTER_FLAGS);
+
+	for(size_t lane = 0; lane < LANES; lane++){
+		active[lane] = (FLAGS[lane] & FVM::FLAG::HLT) ? 0 : 0xFFFF;
+	}
+
+	uint16_t pc;
+	while(schedule(pc)){
+		// Lanes outside the shared program continue on their own
+		if(pc < imageBegin || pc >= imageEnd){
+			runScalarMasked();
+			continue;
+		}
+
+		size_t offset = pc - imageBegin;
+		if(!decodedValid[offset]){
+			decoded[offset] = image.decodeInstruction(pc);
+			decodedValid[offset] = true;
+		}
+		const FVM::DecodedInstruction& instruction = decoded[offset];
+
+		if(instruction.opcode >= FVM::OPCODE_COUNT || instruction.nextPC > imageEnd ||
+		   instruction.regA >= FVM::REGISTER_PC || instruction.regB >= FVM::REGISTER_PC){
+			runScalarMasked();
+			continue;
+		}
+
+		uint16_t* A = registerLanes(instruction.regA);
+		uint16_t* B = registerLanes(instruction.regB);
+		const Vector nextPC = splat(instruction.nextPC);
+
+		// Applies body(v, m) to every vector of lanes, then advances the masked lanes' PC
+		auto lanewise = [&](auto&& body){
+			for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+				Vector m = load(mask.data() + v);
+				body(v, m);
+				store(PC + v, select(m, nextPC, load(PC + v)));
+			}
+		};
+
+		// B = op(A, B) in the masked lanes
+		auto binary = [&](auto&& op){
+			lanewise([&](size_t v, Vector m){
+				Vector b = load(B + v);
+				store(B + v, select(m, op(load(A + v), b), b));
+			});
+		};
+
+		// A = op(A) in the masked lanes
+		auto unary = [&](auto&& op){
+			lanewise([&](size_t v, Vector m){
+				Vector a = load(A + v);
+				store(A + v, select(m, op(a), a));
+			});
+		};
+
+		// Scalar fallback for instructions that touch each lane's own memory. Lanes the
+		// instruction faults in are handed to a scalar FVM, which reports the fault as FVM::run() does
+		auto perLane = [&](auto&& faults, auto&& body){
+			for(size_t lane = 0; lane < LANES; lane++){
+				if(mask[lane]){
+					uint8_t* laneMem = laneMemory(lane);
+					if(faults(lane, laneMem)){
+						runScalar(lane);
+						continue;
+					}
+					PC[lane] = instruction.nextPC;
+					body(lane, laneMem);
+				}
+			}
+		};
+
+		// Whether a 16-bit access stays inside a lane's memory, the same check as the interpreter's
+		auto outside = [&](size_t address){ return address + 1 >= MEMORY_SIZE; };
+
+		// Writes that land inside the loaded image hand the lane to a scalar FVM
+		auto write = [&](size_t lane, uint8_t* laneMem, uint16_t address, uint16_t value){
+			writeLaneUInt16(laneMem, address, value);
+			if(static_cast<size_t>(address) + 1 >= imageBegin && address < imageEnd){
+				runScalar(lane);
+			}
+		};
+
+		auto conditionalJump = [&](uint16_t flag){
+			const Vector bit = splat(flag);
+			const Vector target = splat(instruction.address);
+			for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+				Vector m = load(mask.data() + v);
+				Vector taken = andNot(equal(bitAnd(load(FLAGS + v), bit), splat(0)), m);
+				store(PC + v, select(m, select(taken, target, nextPC), load(PC + v)));
+			}
+		};
+
+		switch(static_cast<BYTECODE>(instruction.opcode)){
+			case BYTECODE::HALT:
+				for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+					Vector m = load(mask.data() + v);
+					store(FLAGS + v, bitOr(load(FLAGS + v), bitAnd(m, splat(FVM::FLAG::HLT))));
+					store(active.data() + v, andNot(m, load(active.data() + v)));
+				}
+				break;
+
+			case BYTECODE::COMPARE:
+				lanewise([&](size_t v, Vector m){
+					Vector a = load(A + v);
+					Vector b = load(B + v);
+					Vector flags = bitOr(bitOr(
+						bitAnd(equal(a, b), splat(FVM::FLAG::EQ | FVM::FLAG::LTE | FVM::FLAG::GTE)),
+						bitAnd(less(a, b), splat(FVM::FLAG::LT | FVM::FLAG::LTE))),
+						bitAnd(less(b, a), splat(FVM::FLAG::GT | FVM::FLAG::GTE)));
+					store(FLAGS + v, select(m, flags, load(FLAGS + v)));
+				});
+				break;
+
+			case BYTECODE::JUMP:
+				for(size_t v = 0; v < paddedLanes; v += VECTOR_LANES){
+					store(PC + v, select(load(mask.data() + v), splat(instruction.address), load(PC + v)));
+				}
+				break;
+
+			case BYTECODE::JUMPEQ:  conditionalJump(FVM::FLAG::EQ);  break;
+			case BYTECODE::JUMPLT:  conditionalJump(FVM::FLAG::LT);  break;
+			case BYTECODE::JUMPGT:  conditionalJump(FVM::FLAG::GT);  break;
+			case BYTECODE::JUMPLTE: conditionalJump(FVM::FLAG::LTE); break;
+			case BYTECODE::JUMPGTE: conditionalJump(FVM::FLAG::GTE); break;
+
+			/* MOVING */
+
+			case BYTECODE::MOVELR:
+				unary([&](Vector){ return splat(instruction.literal); });
+				break;
+			case BYTECODE::MOVERR:
+				binary([](Vector a, Vector){ return a; });
+				break;
+			case BYTECODE::MOVELM:
+				perLane([&](size_t, uint8_t*){ return outside(instruction.address); },
+				        [&](size_t lane, uint8_t* laneMem){ write(lane, laneMem, instruction.address, instruction.literal); });
+				break;
+			case BYTECODE::MOVERM:
+				perLane([&](size_t, uint8_t*){ return outside(instruction.address); },
+				        [&](size_t lane, uint8_t* laneMem){ write(lane, laneMem, instruction.address, A[lane]); });
+				break;
+			case BYTECODE::MOVEMR:
+				perLane([&](size_t, uint8_t*){ return outside(instruction.address); },
+				        [&](size_t lane, uint8_t* laneMem){ A[lane] = readLaneUInt16(laneMem, instruction.address); });
+				break;
+			case BYTECODE::MOVELIR:
+				perLane([&](size_t lane, uint8_t*){ return outside(A[lane]); },
+				        [&](size_t lane, uint8_t* laneMem){ write(lane, laneMem, A[lane], instruction.literal); });
+				break;
+			case BYTECODE::MOVEIRR:
+				perLane([&](size_t lane, uint8_t*){ return outside(A[lane]); },
+				        [&](size_t lane, uint8_t* laneMem){ B[lane] = readLaneUInt16(laneMem, A[lane]); });
+				break;
+			case BYTECODE::MOVEIRM:
+				perLane([&](size_t lane, uint8_t*){ return outside(A[lane]) || outside(instruction.address); },
+				        [&](size_t lane, uint8_t* laneMem){
+					write(lane, laneMem, instruction.address, readLaneUInt16(laneMem, A[lane]));
+				});
+				break;
+			case BYTECODE::MOVEIMR:
+				perLane([&](size_t, uint8_t* laneMem){
+					return outside(instruction.address) || outside(readLaneUInt16(laneMem, instruction.address));
+				}, [&](size_t lane, uint8_t* laneMem){
+					A[lane] = readLaneUInt16(laneMem, readLaneUInt16(laneMem, instruction.address));
+				});
+				break;
+
+			/* ARITHMETIC */
+
+			case BYTECODE::ADD:      binary([](Vector a, Vector b){ return add(a, b); }); break;
+			case BYTECODE::SUBTRACT: binary([](Vector a, Vector b){ return sub(a, b); }); break;
+			case BYTECODE::MULTIPLY: binary([](Vector a, Vector b){ return mul(a, b); }); break;
+			case BYTECODE::DIVIDE:
+				perLane([&](size_t lane, uint8_t*){ return B[lane] == 0; },
+				        [&](size_t lane, uint8_t*){ B[lane] = static_cast<uint16_t>(A[lane] / B[lane]); });
+				break;
+			case BYTECODE::INCREMENT: unary([](Vector a){ return add(a, splat(1)); }); break;
+			case BYTECODE::DECREMENT: unary([](Vector a){ return sub(a, splat(1)); }); break;
+			case BYTECODE::AND: binary([](Vector a, Vector b){ return bitAnd(a, b); }); break;
+			case BYTECODE::OR:  binary([](Vector a, Vector b){ return bitOr(a, b); }); break;
+			case BYTECODE::XOR: binary([](Vector a, Vector b){ return bitXor(a, b); }); break;
+			case BYTECODE::NOT: unary([](Vector a){ return bitXor(a, splat(0xFFFF)); }); break;
+			case BYTECODE::SHIFTLEFT:
+				unary([&](Vector a){ return shiftLeft(a, instruction.literal); });
+				break;
+			case BYTECODE::SHIFTRIGHT:
+				unary([&](Vector a){ return shiftRight(a, instruction.literal); });
+				break;
+
+			default:
+				runScalarMasked();
+				break;
+		}
+	}
+
+	for(size_t lane = 0; lane < LANES; lane++){
+		if(results[lane] != RESULT_CODE::SUCCESS){
+			return results[lane];
+		}
+	}
+	return RESULT_CODE::SUCCESS;
+}
@@ -0,0 +1,75 @@
+#ifndef FVM_BATCH_H
+#define FVM_BATCH_H
+
+#include <cstdint>
+#include <vector>
+#include "ResultCode.h"
+#include "ByteCode.h"
+#include "FVM.h"
+#include "GuestMemory.h"
+
+/**
+ * Runs many FVM instances over the same program in lockstep.
+ *
+ * Every lane has its own registers and memory, but lanes share the decoded
+ * program. Registers are kept in structure-of-arrays form, one contiguous
+ * array of lanes per register, so ALU instructions run as SSE2 operations on
+ * eight 16-bit lanes at a time, or sixteen when built with AVX2.
+ *
+ * Each step executes the instruction at the lowest program counter among the
+ * running lanes, for every lane sitting at that address. Lanes that branch
+ * differently simply wait until the others catch up, which reconverges loops
+ * and if/else shapes without any explicit stack.
+ *
+ * Lanes that leave the shared program, use REG_PC or REG_FLAGS as an operand,
+ * write into the loaded image, access memory outside their own or divide by
+ * zero are moved to a scalar FVM and finished there, so results always match
+ * FVM::run().
+ */
+class FVMBatch{
+
+	public:
+		FVMBatch(const size_t LANES, const size_t MEMORY_SIZE);
+
+		RESULT init();
+		RESULT loadBytecode(const size_t offset, const std::vector<uint8_t>& bytecode);
+		RESULT run();
+
+		const size_t LANES;
+		const size_t MEMORY_SIZE;
+
+		uint16_t& getRegister(const size_t lane, const enum BYTECODE bytecode);
+		uint8_t* laneMemory(const size_t lane);
+
+		/* Outcome of each lane after run(), SUCCESS for lanes that halted */
+		const RESULT& laneResult(const size_t lane) const;
+
+	private:
+		/* Lanes rounded up to whole vectors, the padding lanes never run */
+		size_t paddedLanes;
+
+		/* Register r of lane l is registers[r * paddedLanes + l] */
+		std::vector<uint16_t> registers;
+		/* Lane l's memory starts at l * MEMORY_SIZE */
+		GuestMemory memory;
+		std::vector<RESULT> results;
+
+		/* 0xFFFF for lanes still running, 0 otherwise */
+		std::vector<uint16_t> active;
+		/* Lanes executing the current instruction, same encoding as active */
+		std::vector<uint16_t> mask;
+
+		/* The loaded program, decoded on first use */
+		FVM image;
+		size_t imageBegin = 0;
+		size_t imageEnd = 0;
+		std::vector<FVM::DecodedInstruction> decoded;
+		std::vector<bool> decodedValid;
+
+		uint16_t* registerLanes(const size_t index);
+		bool schedule(uint16_t& pc);
+		void runScalar(const size_t lane);
+		void runScalarMasked();
+};
+
+#endif
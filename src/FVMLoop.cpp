@@ -0,0 +1,195 @@
+#include <utility>
+#include "FVMLoop.h"
+
+FVMLoop::Task::Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+FVMLoop::Task& FVMLoop::Task::operator=(Task&& other) noexcept {
+	if(this != &other){
+		if(handle){
+			handle.destroy();
+		}
+		handle = std::exchange(other.handle, nullptr);
+	}
+	return *this;
+}
+
+FVMLoop::Task::~Task(){
+	if(handle){
+		handle.destroy();
+	}
+}
+
+bool FVMLoop::Task::done() const {
+	return handle && handle.done();
+}
+
+RESULT FVMLoop::Task::result() const {
+	return handle.promise().result;
+}
+
+/**
+ * Starts the awaited task on the awaiting task's turn of the loop.
+ * @param awaiting The task to resume once this one finishes.
+ * @return The coroutine to transfer to, this task.
+ */
+std::coroutine_handle<> FVMLoop::Task::await_suspend(std::coroutine_handle<> awaiting) noexcept {
+	handle.promise().continuation = awaiting;
+	return handle;
+}
+
+/**
+ * Hands control back to the awaiting task, or reports a spawned task as finished.
+ * @param finishing The task that just returned.
+ * @return The coroutine to transfer to, a no-op one when nothing awaits the task.
+ */
+std::coroutine_handle<> FVMLoop::Task::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> finishing) noexcept {
+	promise_type& promise = finishing.promise();
+	if(promise.continuation){
+		return promise.continuation;
+	}
+
+	if(promise.loop != nullptr){
+		std::lock_guard<std::mutex> guard(promise.loop->lock);
+		promise.loop->live--;
+		promise.loop->wake.notify_all();
+	}
+	return std::noop_coroutine();
+}
+
+/**
+ * Marks the operation complete and queues every task waiting for it.
+ * Safe to call from any thread.
+ */
+void FVMLoop::Event::set(){
+	std::vector<std::coroutine_handle<>> resumed;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		signalled = true;
+		resumed.swap(waiting);
+	}
+
+	for(std::coroutine_handle<> handle : resumed){
+		loop.post(handle);
+	}
+}
+
+void FVMLoop::Event::reset(){
+	std::lock_guard<std::mutex> guard(lock);
+	signalled = false;
+}
+
+bool FVMLoop::Event::isSet() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return signalled;
+}
+
+/**
+ * Parks the awaiting task until set(), unless the event was set in the meantime.
+ * @param awaiting The task to park.
+ * @return False if the task should continue right away.
+ */
+bool FVMLoop::Event::await_suspend(std::coroutine_handle<> awaiting){
+	std::lock_guard<std::mutex> guard(lock);
+	if(signalled){
+		return false;
+	}
+	waiting.push_back(awaiting);
+	return true;
+}
+
+/**
+ * Constructor for the FVMLoop class.
+ * @param SLICE The number of instructions execute() runs before the task is suspended.
+ */
+FVMLoop::FVMLoop(const size_t SLICE) : SLICE(SLICE > 0 ? SLICE : 1) {}
+
+void FVMLoop::spawn(Task& task){
+	task.handle.promise().loop = this;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		live++;
+	}
+	post(task.handle);
+}
+
+/**
+ * Runs a VM from its current program counter until it halts or faults.
+ * Every slice that runs out of budget suspends the task, so other tasks on
+ * the loop get their turn in between.
+ * @param vm The VM to run, it has to outlive the task.
+ * @return The task to await. It completes with FVM::run()'s result.
+ */
+FVMLoop::Task FVMLoop::execute(FVM& vm){
+	RESULT result = vm.run(SLICE);
+	while(result == RESULT_CODE::BUDGET_EXHAUSTED){
+		co_await yield();
+		result = vm.run(SLICE);
+	}
+	co_return result;
+}
+
+/**
+ * Resumes tasks until every spawned task has finished, sleeping while all of
+ * them wait for events.
+ */
+void FVMLoop::run(){
+	for(std::coroutine_handle<> handle = next(true); handle; handle = next(true)){
+		handle.resume();
+	}
+}
+
+/**
+ * Resumes the tasks that are ready right now without waiting for events, for
+ * driving the loop from another event loop.
+ * @return The number of tasks resumed.
+ */
+size_t FVMLoop::poll(){
+	size_t resumed = 0;
+	size_t count;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		count = ready.size();
+	}
+
+	// Tasks queued while polling wait for the next call
+	for(; resumed < count; resumed++){
+		std::coroutine_handle<> handle = next(false);
+		if(!handle){
+			break;
+		}
+		handle.resume();
+	}
+	return resumed;
+}
+
+size_t FVMLoop::pending() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return live;
+}
+
+void FVMLoop::post(std::coroutine_handle<> handle){
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		ready.push_back(handle);
+	}
+	wake.notify_one();
+}
+
+/**
+ * Takes the oldest ready task.
+ * @param wait Whether to sleep until a task is ready while spawned tasks are still running.
+ * @return The task, or an empty handle if there is none.
+ */
+std::coroutine_handle<> FVMLoop::next(const bool wait){
+	std::unique_lock<std::mutex> guard(lock);
+	if(wait){
+		wake.wait(guard, [this]{ return !ready.empty() || live == 0; });
+	}
+	if(ready.empty()){
+		return nullptr;
+	}
+
+	std::coroutine_handle<> handle = ready.front();
+	ready.pop_front();
+	return handle;
+}
@@ -0,0 +1,153 @@
+#ifndef FVM_LOOP_H
+#define FVM_LOOP_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include "ResultCode.h"
+#include "FVM.h"
+
+/**
+ * Runs guest programs as C++20 coroutines on a single-threaded event loop.
+ *
+ * A Task is a coroutine returning RESULT. `co_await loop.execute(vm)` runs a
+ * VM in slices of at most SLICE instructions through FVM::run(maxInstructions)
+ * and suspends the task each time a slice runs out, putting it at the back of
+ * the loop's ready queue. Thousands of guests can therefore share one host
+ * thread, each making progress in turn.
+ *
+ * Host operations a task has to wait for, such as I/O done on behalf of the
+ * guest, are modelled with Event: the task co_awaits the event between
+ * slices and whoever completes the operation calls set(), from any thread.
+ * The task is then queued again and resumed by the loop.
+ *
+ *   FVMLoop::Task guest(FVMLoop& loop, FVM& vm, FVMLoop::Event& input){
+ *       RESULT result = co_await loop.execute(vm);
+ *       co_await input;
+ *       ...
+ *       co_return co_await loop.execute(vm);
+ *   }
+ *
+ * Tasks start suspended. spawn() queues a task on the loop, awaiting it from
+ * another task starts it inline. A task object owns its coroutine frame and
+ * has to outlive its execution.
+ */
+class FVMLoop{
+
+	public:
+		static constexpr size_t DEFAULT_SLICE = 10000;
+
+		class Task{
+			public:
+				struct promise_type {
+					RESULT result = RESULT_CODE::UNSPECIFIED_FAILURE;
+					/* The task awaiting this one, resumed when it finishes */
+					std::coroutine_handle<> continuation;
+					/* The loop a spawned task reports its completion to */
+					FVMLoop* loop = nullptr;
+
+					Task get_return_object(){ return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+					std::suspend_always initial_suspend() noexcept { return {}; }
+					auto final_suspend() noexcept { return FinalAwaiter{}; }
+					void return_value(const RESULT& value){ result = value; }
+					void unhandled_exception(){ std::terminate(); }
+				};
+
+				Task(Task&& other) noexcept;
+				Task& operator=(Task&& other) noexcept;
+				Task(const Task&) = delete;
+				Task& operator=(const Task&) = delete;
+				~Task();
+
+				bool done() const;
+
+				/* What the coroutine returned, valid once done() */
+				RESULT result() const;
+
+				/* Starts the task inline and resumes the awaiting coroutine with its result */
+				bool await_ready() const noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+				RESULT await_resume() const { return handle.promise().result; }
+
+			private:
+				friend class FVMLoop;
+
+				struct FinalAwaiter {
+					bool await_ready() const noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finishing) noexcept;
+					void await_resume() const noexcept {}
+				};
+
+				explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+				std::coroutine_handle<promise_type> handle;
+		};
+
+		/* Suspends the awaiting task and queues it behind everything already ready */
+		struct Yield {
+			FVMLoop& loop;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> awaiting){ loop.post(awaiting); }
+			void await_resume() const noexcept {}
+		};
+
+		/**
+		 * Completion of a host operation. Tasks awaiting an event that is not set
+		 * are suspended until set() is called, from the loop thread or any other.
+		 * The event stays set until reset().
+		 */
+		class Event{
+			public:
+				explicit Event(FVMLoop& loop) : loop(loop) {}
+
+				void set();
+				void reset();
+				bool isSet() const;
+
+				bool await_ready() const { return isSet(); }
+				bool await_suspend(std::coroutine_handle<> awaiting);
+				void await_resume() const noexcept {}
+
+			private:
+				FVMLoop& loop;
+				mutable std::mutex lock;
+				bool signalled = false;
+				std::vector<std::coroutine_handle<>> waiting;
+		};
+
+		explicit FVMLoop(const size_t SLICE = DEFAULT_SLICE);
+
+		FVMLoop(const FVMLoop&) = delete;
+		FVMLoop& operator=(const FVMLoop&) = delete;
+
+		/* Queues a task to start on the next turn of the loop */
+		void spawn(Task& task);
+
+		/* Runs a VM to completion, suspending the awaiting task after every slice */
+		Task execute(FVM& vm);
+
+		Yield yield(){ return Yield{*this}; }
+
+		void run();
+		size_t poll();
+
+		/* Spawned tasks that have not finished yet */
+		size_t pending() const;
+
+		const size_t SLICE;
+
+	private:
+		mutable std::mutex lock;
+		std::condition_variable wake;
+		std::deque<std::coroutine_handle<>> ready;
+		size_t live = 0;
+
+		void post(std::coroutine_handle<> handle);
+		std::coroutine_handle<> next(const bool wait);
+};
+
+#endif
@@ -0,0 +1,211 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#include "spdlog/spdlog.h"
+#include "FVMPool.h"
+
+struct FVMPool::Task::Job {
+	std::unique_ptr<FVM> vm;
+	std::promise<RESULT> promise;
+	std::shared_future<RESULT> result;
+};
+
+/**
+ * Waits for the program to halt or fail.
+ * @return RESULT_CODE SUCCESS once the program halted, otherwise the failure it ran into.
+ */
+RESULT FVMPool::Task::await() const {
+	return job->result.get();
+}
+
+bool FVMPool::Task::ready() const {
+	return job->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+FVM& FVMPool::Task::vm() const {
+	return *job->vm;
+}
+
+/**
+ * Constructor for the FVMPool class, starts the worker threads.
+ * @param WORKERS The number of worker threads, at least one.
+ * @param SLICE The number of instructions a VM runs before the worker moves on.
+ */
+FVMPool::FVMPool(const size_t WORKERS, const size_t SLICE)
+	: WORKERS(WORKERS > 0 ? WORKERS : 1), SLICE(SLICE > 0 ? SLICE : 1){
+	for(size_t i = 0; i < this->WORKERS; i++){
+		workers.push_back(std::make_unique<Worker>());
+	}
+	for(size_t i = 0; i < this->WORKERS; i++){
+		threads.emplace_back(&FVMPool::work, this, i);
+	}
+}
+
+/**
+ * Stops the workers after their current slice. Programs that have not
+ * finished by then complete with CANCELLED.
+ */
+FVMPool::~FVMPool(){
+	stopping = true;
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+	}
+	idle.notify_all();
+
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+
+	for(std::unique_ptr<Worker>& worker : workers){
+		for(std::shared_ptr<Task::Job>& job : worker->jobs){
+			job->promise.set_value(RESULT_CODE::CANCELLED);
+		}
+	}
+}
+
+/**
+ * Queues an initialized VM, it starts from its current program counter.
+ * @param vm The VM to run.
+ * @return The task to await.
+ */
+FVMPool::Task FVMPool::submit(std::unique_ptr<FVM> vm){
+	Task task;
+	task.job = std::make_shared<Task::Job>();
+	task.job->vm = std::move(vm);
+	task.job->result = task.job->promise.get_future().share();
+
+	push(nextWorker++ % WORKERS, task.job);
+	return task;
+}
+
+/**
+ * Loads bytecode into a new VM at address 0 and queues it.
+ * @param bytecode The program to run.
+ * @param MEMORY_SIZE The memory size of the new VM.
+ * @return The task to await. It is already complete if the bytecode could not be loaded.
+ */
+FVMPool::Task FVMPool::submit(const std::vector<uint8_t>& bytecode, const size_t MEMORY_SIZE){
+	std::unique_ptr<FVM> vm = std::make_unique<FVM>(MEMORY_SIZE);
+	vm->init();
+
+	RESULT result = vm->loadBytecode(0, bytecode);
+	if(result != RESULT_CODE::SUCCESS){
+		return completed(std::move(vm), result);
+	}
+
+	return submit(std::move(vm));
+}
+
+/**
+ * Maps an .fbc file into a new VM at address 0 and queues it, see FVM::loadBytecode().
+ * @param programPath The .fbc file to run.
+ * @param MEMORY_SIZE The memory size of the new VM.
+ * @return The task to await. It completes with FILE_NOT_FOUND if the file cannot be read.
+ */
+FVMPool::Task FVMPool::submit(const std::filesystem::path& programPath, const size_t MEMORY_SIZE){
+	std::unique_ptr<FVM> vm = std::make_unique<FVM>(MEMORY_SIZE);
+	vm->init();
+
+	RESULT result = vm->loadBytecode(0, programPath);
+	if(result != RESULT_CODE::SUCCESS){
+		return completed(std::move(vm), result);
+	}
+
+	return submit(std::move(vm));
+}
+
+/* A task that finished without running, e.g. because its program could not be loaded */
+FVMPool::Task FVMPool::completed(std::unique_ptr<FVM> vm, const RESULT& result){
+	Task task;
+	task.job = std::make_shared<Task::Job>();
+	task.job->vm = std::move(vm);
+	task.job->result = task.job->promise.get_future().share();
+	task.job->promise.set_value(result);
+	return task;
+}
+
+void FVMPool::push(const size_t worker, std::shared_ptr<Task::Job> job){
+	// Counted under the deque lock, pop() and steal() decrement under it too and must never see the job first
+	{
+		std::lock_guard<std::mutex> guard(workers[worker]->lock);
+		workers[worker]->jobs.push_back(std::move(job));
+		queued++;
+	}
+
+	if(sleeping > 0){
+		{
+			std::lock_guard<std::mutex> guard(idleLock);
+		}
+		idle.notify_one();
+	}
+}
+
+/* Takes the oldest job from a worker's own deque */
+std::shared_ptr<FVMPool::Task::Job> FVMPool::pop(const size_t worker){
+	std::lock_guard<std::mutex> guard(workers[worker]->lock);
+	if(workers[worker]->jobs.empty()){
+		return nullptr;
+	}
+	std::shared_ptr<Task::Job> job = std::move(workers[worker]->jobs.front());
+	workers[worker]->jobs.pop_front();
+	queued--;
+	return job;
+}
+
+/* Takes the newest job from the first other worker that has one */
+std::shared_ptr<FVMPool::Task::Job> FVMPool::steal(const size_t worker){
+	for(size_t i = 1; i < WORKERS; i++){
+		Worker& victim = *workers[(worker + i) % WORKERS];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if(!victim.jobs.empty()){
+			std::shared_ptr<Task::Job> job = std::move(victim.jobs.back());
+			victim.jobs.pop_back();
+			queued--;
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Worker thread loop: runs slices of local or stolen jobs, sleeping while
+ * there is nothing queued anywhere.
+ * A job that is not finished after its slice goes back to the worker's own
+ * deque without waking anyone, other workers only sleep while no job is queued.
+ * @param worker The index of this worker.
+ */
+void FVMPool::work(const size_t worker){
+	while(!stopping){
+		std::shared_ptr<Task::Job> job = pop(worker);
+		if(job == nullptr){
+			job = steal(worker);
+		}
+
+		if(job == nullptr){
+			std::unique_lock<std::mutex> guard(idleLock);
+			sleeping++;
+			idle.wait(guard, [this]{ return queued > 0 || stopping; });
+			sleeping--;
+			continue;
+		}
+
+		if(!runSlice(*job)){
+			std::lock_guard<std::mutex> guard(workers[worker]->lock);
+			workers[worker]->jobs.push_back(std::move(job));
+			queued++;
+		}
+	}
+}
+
+/**
+ * Runs a job for at most SLICE instructions.
+ * @param job The job to run.
+ * @return True if the program halted or failed and its task was completed.
+ */
+bool FVMPool::runSlice(Task::Job& job){
+	RESULT result = job.vm->run(SLICE);
+	if(result == RESULT_CODE::BUDGET_EXHAUSTED){
+		return false;
+	}
+
+	job.promise.set_value(result);
+	return true;
+}
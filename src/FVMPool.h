@@ -0,0 +1,85 @@
+#ifndef FVM_POOL_H
+#define FVM_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ResultCode.h"
+#include "FVM.h"
+
+/**
+ * Runs many FVM instances on a fixed set of worker threads.
+ *
+ * Every worker owns a deque of VMs. A worker takes the VM at the front of its
+ * own deque, runs it for one time slice of at most SLICE instructions and, if
+ * it has not finished, puts it back at the end. Workers with an empty deque
+ * steal from the back of another worker's deque before going to sleep. No VM
+ * waits for more than a bounded number of slices, so one long-running guest
+ * cannot hold up the rest.
+ */
+class FVMPool{
+
+	public:
+		static constexpr size_t DEFAULT_SLICE = 10000;
+
+		/* A submitted program. await() blocks until it halts or fails */
+		class Task{
+			public:
+				RESULT await() const;
+				bool ready() const;
+
+				/* The VM the program ran on, valid once await() has returned */
+				FVM& vm() const;
+
+			private:
+				friend class FVMPool;
+				struct Job;
+				std::shared_ptr<Job> job;
+		};
+
+		FVMPool(const size_t WORKERS = std::thread::hardware_concurrency(), const size_t SLICE = DEFAULT_SLICE);
+		~FVMPool();
+
+		FVMPool(const FVMPool&) = delete;
+		FVMPool& operator=(const FVMPool&) = delete;
+
+		Task submit(std::unique_ptr<FVM> vm);
+		Task submit(const std::vector<uint8_t>& bytecode, const size_t MEMORY_SIZE);
+		Task submit(const std::filesystem::path& programPath, const size_t MEMORY_SIZE);
+
+		const size_t WORKERS;
+		const size_t SLICE;
+
+	private:
+		struct Worker {
+			std::mutex lock;
+			std::deque<std::shared_ptr<Task::Job>> jobs;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
+
+		/* Jobs sitting in any deque, workers sleep while this is 0 */
+		std::atomic<size_t> queued = 0;
+		std::atomic<size_t> sleeping = 0;
+		std::atomic<size_t> nextWorker = 0;
+		std::atomic<bool> stopping = false;
+		std::mutex idleLock;
+		std::condition_variable idle;
+
+		Task completed(std::unique_ptr<FVM> vm, const RESULT& result);
+		void push(const size_t worker, std::shared_ptr<Task::Job> job);
+		std::shared_ptr<Task::Job> pop(const size_t worker);
+		std::shared_ptr<Task::Job> steal(const size_t worker);
+		void work(const size_t worker);
+		bool runSlice(Task::Job& job);
+};
+
+#endif
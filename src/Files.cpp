@@ -0,0 +1,41 @@
+#include <atomic>
+#include <string>
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+#include "Files.h"
+
+/* Process ID and a count of calls, so no two writers ever share a temporary */
+static std::string uniqueSuffix(){
+	static std::atomic<uint64_t> calls{0};
+#ifdef _WIN32
+	const long process = _getpid();
+#else
+	const long process = getpid();
+#endif
+	return "." + std::to_string(process) + "." + std::to_string(calls++) + ".tmp";
+}
+
+RESULT replaceFile(const std::filesystem::path& path, const std::function<RESULT(const std::filesystem::path&)>& write){
+	std::filesystem::path temporary = path.parent_path() / path.stem();
+	temporary += uniqueSuffix();
+	temporary += path.extension();
+
+	RESULT result = write(temporary);
+	if(result == RESULT_CODE::SUCCESS){
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		if(error){
+			result = RESULT_CODE::FILE_NOT_FOUND;
+		}
+	}
+	if(result != RESULT_CODE::SUCCESS){
+		std::error_code ignored;
+		std::filesystem::remove(temporary, ignored);
+	}
+	return result;
+}
@@ -0,0 +1,21 @@
+#ifndef FILES_H
+#define FILES_H
+
+#include <filesystem>
+#include <functional>
+#include "ResultCode.h"
+
+/**
+ * Replaces a file as a whole. The new contents are written to a temporary
+ * next to it, named uniquely per process and call and keeping the extension,
+ * and then renamed over it. Readers see either the old or the new file, and
+ * VMs that have the old one mapped keep their pages, rewriting it in place
+ * would fault them.
+ * @param path The file to replace or create.
+ * @param write Writes the new contents to the path it is given.
+ * @return RESULT_CODE SUCCESS, the failure write returned, or FILE_NOT_FOUND
+ * if the rename failed. Nothing is left behind on failure.
+ */
+RESULT replaceFile(const std::filesystem::path& path, const std::function<RESULT(const std::filesystem::path&)>& write);
+
+#endif
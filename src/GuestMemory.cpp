@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#include "spdlog/spdlog.h"
+#include "GuestMemory.h"
+
+#ifdef FVM_SPARSE_MEMORY
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+
+static size_t hostPageSize(){
+	static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return pageSize;
+}
+
+/**
+ * Maps fresh zero pages, at a fixed address when one is given.
+ * @param address The address to replace, or nullptr for anywhere.
+ * @param size The size of the mapping in bytes, a multiple of the host page size.
+ * @return The mapping, or nullptr if it could not be created.
+ */
+static uint8_t* mapZeroPages(void* address, const size_t size){
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+	#endif
+	if(address != nullptr){
+		flags |= MAP_FIXED;
+	}
+
+	void* mapping = mmap(address, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	return mapping == MAP_FAILED ? nullptr : static_cast<uint8_t*>(mapping);
+}
+#endif
+
+GuestMemory::GuestMemory(const BACKING backing) : kind(backing){
+#ifndef FVM_SPARSE_MEMORY
+	kind = BACKING::DENSE;
+#endif
+}
+
+GuestMemory::~GuestMemory(){
+	release();
+}
+
+GuestMemory::GuestMemory(GuestMemory&& other) noexcept
+	: kind(other.kind), bytes(other.bytes), length(other.length), mapped(other.mapped){
+	other.bytes = nullptr;
+	other.length = 0;
+	other.mapped = 0;
+}
+
+GuestMemory& GuestMemory::operator=(GuestMemory&& other) noexcept {
+	if(this != &other){
+		release();
+		kind = other.kind;
+		bytes = other.bytes;
+		length = other.length;
+		mapped = other.mapped;
+		other.bytes = nullptr;
+		other.length = 0;
+		other.mapped = 0;
+	}
+	return *this;
+}
+
+/**
+ * Allocates zeroed memory, reusing the current block when the size is unchanged.
+ * @param size The size in bytes.
+ * @return RESULT_CODE SUCCESS, or OUT_OF_MEMORY if the block could not be allocated.
+ */
+RESULT GuestMemory::allocate(const size_t size){
+	if(bytes != nullptr && size == length){
+		reset();
+		return RESULT_CODE::SUCCESS;
+	}
+
+	release();
+	if(size == 0){
+		return RESULT_CODE::SUCCESS;
+	}
+
+#ifdef FVM_SPARSE_MEMORY
+	if(kind == BACKING::SPARSE){
+		size_t pageSize = hostPageSize();
+		size_t rounded = (size + pageSize - 1) / pageSize * pageSize;
+		bytes = mapZeroPages(nullptr, rounded);
+		if(bytes == nullptr){
+			SPDLOG_ERROR("Could not reserve " + std::to_string(size) + " bytes of guest memory");
+			return RESULT_CODE::OUT_OF_MEMORY;
+		}
+		length = size;
+		mapped = rounded;
+		return RESULT_CODE::SUCCESS;
+	}
+#endif
+
+	bytes = new (std::nothrow) uint8_t[size]();
+	if(bytes == nullptr){
+		SPDLOG_ERROR("Could not allocate " + std::to_string(size) + " bytes of guest memory");
+		return RESULT_CODE::OUT_OF_MEMORY;
+	}
+	length = size;
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Zeroes the whole block. SPARSE memory maps fresh zero pages over the
+ * reservation, which also returns every committed page to the host.
+ */
+void GuestMemory::reset(){
+	if(bytes == nullptr){
+		return;
+	}
+
+#ifdef FVM_SPARSE_MEMORY
+	if(kind == BACKING::SPARSE){
+		if(mapZeroPages(bytes, mapped) != nullptr){
+			return;
+		}
+		SPDLOG_WARN("Could not remap guest memory, clearing it instead");
+	}
+#endif
+
+	std::memset(bytes, 0, length);
+}
+
+void GuestMemory::release(){
+	if(bytes == nullptr){
+		return;
+	}
+
+#ifdef FVM_SPARSE_MEMORY
+	if(kind == BACKING::SPARSE){
+		munmap(bytes, mapped);
+	}else{
+		delete[] bytes;
+	}
+#else
+	delete[] bytes;
+#endif
+
+	bytes = nullptr;
+	length = 0;
+	mapped = 0;
+}
+
+/**
+ * Fills part of memory with a range of a file.
+ * SPARSE memory maps every whole host page of the range MAP_PRIVATE over the
+ * reservation, so nothing is copied and unmodified pages stay shared with
+ * every other mapping of the file. A trailing partial page, or the whole
+ * range when the offsets are not page aligned or memory is DENSE, is read in
+ * place instead.
+ * @param path The file to load.
+ * @param offset Where in memory the range starts.
+ * @param size The size of the range, which must fit at offset.
+ * @param fileOffset Where in the file the range starts.
+ * @return RESULT_CODE SUCCESS, or FILE_NOT_FOUND if the file cannot be read.
+ */
+RESULT GuestMemory::loadFile(const std::filesystem::path& path, const size_t offset, const size_t size, const size_t fileOffset){
+	size_t mappedBytes = 0;
+
+#ifdef FVM_SPARSE_MEMORY
+	size_t pageSize = hostPageSize();
+	if(kind == BACKING::SPARSE && offset % pageSize == 0 && fileOffset % pageSize == 0 && size >= pageSize){
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0){
+			SPDLOG_ERROR("Could not open program: " + path.string());
+			return RESULT_CODE::FILE_NOT_FOUND;
+		}
+
+		size_t wholePages = size / pageSize * pageSize;
+		void* mapping = mmap(bytes + offset, wholePages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, static_cast<off_t>(fileOffset));
+		close(fd);
+
+		if(mapping != MAP_FAILED){
+			mappedBytes = wholePages;
+		}else{
+			SPDLOG_WARN("Could not map " + path.string() + ", reading it instead");
+		}
+	}
+#endif
+
+	if(mappedBytes == size){
+		return RESULT_CODE::SUCCESS;
+	}
+
+	std::ifstream fileStream(path, std::ios::binary);
+	if(!fileStream.is_open()){
+		SPDLOG_ERROR("Could not open program: " + path.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	fileStream.seekg(static_cast<std::streamoff>(fileOffset + mappedBytes));
+	size_t remaining = size - mappedBytes;
+	fileStream.read(reinterpret_cast<char*>(bytes + offset + mappedBytes), static_cast<std::streamsize>(remaining));
+	if(static_cast<size_t>(fileStream.gcount()) != remaining){
+		SPDLOG_ERROR("Could not read program: " + path.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+bool GuestMemory::operator==(const GuestMemory& other) const {
+	return length == other.length && (length == 0 || std::memcmp(bytes, other.bytes, length) == 0);
+}
+
+size_t GuestMemory::residentBytes() const {
+#ifdef FVM_SPARSE_MEMORY
+	if(kind == BACKING::SPARSE && bytes != nullptr){
+		size_t pageSize = hostPageSize();
+	#ifdef __APPLE__
+		std::vector<char> resident(mapped / pageSize);
+	#else
+		std::vector<unsigned char> resident(mapped / pageSize);
+	#endif
+		if(mincore(bytes, mapped, resident.data()) != 0){
+			return length;
+		}
+		size_t pages = static_cast<size_t>(std::count_if(resident.begin(), resident.end(), [](auto page){ return (page & 1) != 0; }));
+		return std::min(pages * pageSize, length);
+	}
+#endif
+	return length;
+}
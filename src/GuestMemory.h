@@ -0,0 +1,77 @@
+#ifndef GUEST_MEMORY_H
+#define GUEST_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include "ResultCode.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define FVM_SPARSE_MEMORY
+#endif
+
+/**
+ * The flat byte array behind an FVM's address space.
+ *
+ * Memory is always one contiguous block so the interpreter indexes it
+ * directly. With the SPARSE backing the block is an anonymous mmap
+ * reservation: nothing is committed up front, untouched pages read as zero
+ * from the kernel's shared zero page and a page is only backed by real memory
+ * the first time it is written. reset() drops every committed page again.
+ * The DENSE backing is an ordinary zero-filled heap allocation and is the
+ * only one available without mmap.
+ */
+class GuestMemory {
+	public:
+		enum class BACKING {
+			DENSE,
+			SPARSE,
+		};
+
+#ifdef FVM_SPARSE_MEMORY
+		static constexpr BACKING DEFAULT_BACKING = BACKING::SPARSE;
+#else
+		static constexpr BACKING DEFAULT_BACKING = BACKING::DENSE;
+#endif
+
+		GuestMemory(const BACKING backing = DEFAULT_BACKING);
+		~GuestMemory();
+
+		GuestMemory(const GuestMemory&) = delete;
+		GuestMemory& operator=(const GuestMemory&) = delete;
+		GuestMemory(GuestMemory&& other) noexcept;
+		GuestMemory& operator=(GuestMemory&& other) noexcept;
+
+		RESULT allocate(const size_t size);
+		void reset();
+		void release();
+
+		RESULT loadFile(const std::filesystem::path& path, const size_t offset, const size_t size, const size_t fileOffset = 0);
+
+		size_t size() const { return length; }
+		BACKING backing() const { return kind; }
+
+		uint8_t* data() { return bytes; }
+		const uint8_t* data() const { return bytes; }
+		uint8_t* begin() { return bytes; }
+		uint8_t* end() { return bytes + length; }
+		const uint8_t* begin() const { return bytes; }
+		const uint8_t* end() const { return bytes + length; }
+
+		uint8_t& operator[](const size_t address) { return bytes[address]; }
+		const uint8_t& operator[](const size_t address) const { return bytes[address]; }
+
+		bool operator==(const GuestMemory& other) const;
+
+		/* Bytes actually backed by host memory, size() for DENSE */
+		size_t residentBytes() const;
+
+	private:
+		BACKING kind;
+		uint8_t* bytes = nullptr;
+		size_t length = 0;
+		/* length rounded up to whole host pages for SPARSE */
+		size_t mapped = 0;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Offset basis and prime of FNV-1a at the widths it is used at */
+template<typename T> struct FNV;
+
+template<> struct FNV<uint32_t> {
+	static constexpr uint32_t OFFSET = 2166136261u;
+	static constexpr uint32_t PRIME = 16777619u;
+};
+
+template<> struct FNV<uint64_t> {
+	static constexpr uint64_t OFFSET = 14695981039346656037ull;
+	static constexpr uint64_t PRIME = 1099511628211ull;
+};
+
+/**
+ * FNV-1a over a run of bytes.
+ * @param data The bytes to hash.
+ * @param size The number of bytes.
+ * @param seed The hash of the bytes before these, to continue it.
+ * @return The hash, 32 or 64 bits wide.
+ */
+template<typename T = uint64_t>
+inline T fnv1a(const void* data, const size_t size, T seed = FNV<T>::OFFSET){
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for(size_t i = 0; i < size; i++){
+		seed = static_cast<T>((seed ^ bytes[i]) * FNV<T>::PRIME);
+	}
+	return seed;
+}
+
+#endif
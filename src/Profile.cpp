@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "Profile.h"
+#include "ByteCode.h"
+
+void ProfileCounters::clear(){
+	opcodes.fill(0);
+	std::fill(addresses.begin(), addresses.end(), ProfileEntry{});
+	executed = 0;
+}
+
+/* Share of part in whole as a percentage, for the report columns */
+static double percent(const uint64_t part, const uint64_t whole){
+	return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+}
+
+/**
+ * Formats the profile as three tables: the hottest program counters, the
+ * opcode mix and the bias of the most executed conditional jumps. Every
+ * table is sorted by execution count, highest first.
+ * @param count The maximum number of rows in the program counter and branch tables.
+ * @return The formatted report.
+ */
+std::string ProfileCounters::report(const size_t count) const {
+	std::stringstream report;
+	report << std::fixed << std::setprecision(1);
+	report << "Profile of " << executed << " instructions\n";
+
+	std::vector<uint16_t> hot;
+	std::vector<uint16_t> branches;
+	for(size_t pc = 0; pc < ADDRESS_COUNT; pc++){
+		if(addresses[pc].executed != 0){
+			hot.push_back(static_cast<uint16_t>(pc));
+		}
+		if(addresses[pc].taken + addresses[pc].notTaken != 0){
+			branches.push_back(static_cast<uint16_t>(pc));
+		}
+	}
+
+	auto hotter = [this](const uint16_t a, const uint16_t b){
+		return addresses[a].executed != addresses[b].executed ? addresses[a].executed > addresses[b].executed : a < b;
+	};
+	size_t hotCount = std::min(count, hot.size());
+	std::partial_sort(hot.begin(), hot.begin() + hotCount, hot.end(), hotter);
+
+	report << "Hottest PCs:\n";
+	for(size_t i = 0; i < hotCount; i++){
+		const ProfileEntry& entry = addresses[hot[i]];
+		report << "  0x" << std::hex << std::setfill('0') << std::setw(4) << hot[i] << std::dec << std::setfill(' ')
+			   << "  " << std::left << std::setw(12) << BYTECODE_INFO::nameFromValue(entry.opcode) << std::right
+			   << std::setw(14) << entry.executed << std::setw(7) << percent(entry.executed, executed) << "%\n";
+	}
+
+	std::vector<uint8_t> mix;
+	for(size_t opcode = 0; opcode < opcodes.size(); opcode++){
+		if(opcodes[opcode] != 0){
+			mix.push_back(static_cast<uint8_t>(opcode));
+		}
+	}
+	std::sort(mix.begin(), mix.end(), [this](const uint8_t a, const uint8_t b){
+		return opcodes[a] != opcodes[b] ? opcodes[a] > opcodes[b] : a < b;
+	});
+
+	report << "Opcode mix:\n";
+	for(const uint8_t opcode : mix){
+		report << "  " << std::left << std::setw(12) << BYTECODE_INFO::nameFromValue(opcode) << std::right
+			   << std::setw(14) << opcodes[opcode] << std::setw(7) << percent(opcodes[opcode], executed) << "%\n";
+	}
+
+	size_t branchCount = std::min(count, branches.size());
+	std::partial_sort(branches.begin(), branches.begin() + branchCount, branches.end(), hotter);
+
+	report << "Branch bias:\n";
+	for(size_t i = 0; i < branchCount; i++){
+		const ProfileEntry& entry = addresses[branches[i]];
+		report << "  0x" << std::hex << std::setfill('0') << std::setw(4) << branches[i] << std::dec << std::setfill(' ')
+			   << "  " << std::left << std::setw(12) << BYTECODE_INFO::nameFromValue(entry.opcode) << std::right
+			   << "  taken " << entry.taken << ", not taken " << entry.notTaken
+			   << " (" << percent(entry.taken, entry.taken + entry.notTaken) << "% taken)\n";
+	}
+
+	return report.str();
+}
@@ -0,0 +1,64 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Execution profile support, compiled in with FVM_PROFILE.
+ * The interpreter counts every dispatched instruction per opcode and per
+ * program counter, and for each conditional jump whether it was taken.
+ * Counting is a handful of increments, everything is sorted and formatted
+ * afterwards by report().
+ */
+
+/* Counters kept for one program counter */
+struct ProfileEntry {
+	uint64_t executed;
+	uint64_t taken;
+	uint64_t notTaken;
+	/* The opcode last executed at this address */
+	uint8_t opcode;
+};
+
+class ProfileCounters {
+	public:
+		/* The program counter is 16 bits wide, so every address gets an entry */
+		static constexpr size_t ADDRESS_COUNT = 0x10000;
+
+		ProfileCounters() : addresses(ADDRESS_COUNT) {}
+
+		inline void record(const uint16_t pc, const uint8_t opcode){
+			opcodes[opcode]++;
+			addresses[pc].executed++;
+			addresses[pc].opcode = opcode;
+			executed++;
+		}
+
+		inline void branch(const uint16_t pc, const bool taken){
+			if(taken){
+				addresses[pc].taken++;
+			}else{
+				addresses[pc].notTaken++;
+			}
+		}
+
+		void clear();
+
+		/* Instructions counted since the last clear */
+		uint64_t total() const { return executed; }
+
+		uint64_t opcodeCount(const uint8_t opcode) const { return opcodes[opcode]; }
+		const ProfileEntry& at(const uint16_t pc) const { return addresses[pc]; }
+
+		std::string report(const size_t count) const;
+
+	private:
+		std::array<uint64_t, 256> opcodes{};
+		std::vector<ProfileEntry> addresses;
+		uint64_t executed = 0;
+};
+
+#endif
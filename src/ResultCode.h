@@ -30,6 +30,17 @@ namespace RESULT_CODE{
 	const RESULT INCORRECT_NUM_ARGS = RESULT(5, "INCORRECT_NUM_ARGS");
 	const RESULT UNIMPLEMENTED_INSTRUCTION = RESULT(6, "UNIMPLEMENTED_INSTRUCTION");
 	const RESULT BAD_OFFSET = RESULT(7, "BAD_OFFSET");
+	const RESULT UNKNOWN_INSTRUCTION = RESULT(8, "UNKNOWN_INSTRUCTION");
+	const RESULT INVALID_ARGUMENT = RESULT(9, "INVALID_ARGUMENT");
+	const RESULT CANCELLED = RESULT(10, "CANCELLED");
+	const RESULT NO_SNAPSHOT = RESULT(11, "NO_SNAPSHOT");
+	const RESULT BAD_IMAGE = RESULT(12, "BAD_IMAGE");
+	const RESULT UNDEFINED_LABEL = RESULT(13, "UNDEFINED_LABEL");
+	const RESULT BUDGET_EXHAUSTED = RESULT(14, "BUDGET_EXHAUSTED");
+	const RESULT BAD_ADDRESS = RESULT(15, "BAD_ADDRESS");
+	const RESULT NATIVE_BUILD_FAILED = RESULT(16, "NATIVE_BUILD_FAILED");
+	const RESULT NATIVE_MISMATCH = RESULT(17, "NATIVE_MISMATCH");
+	const RESULT DIVIDE_BY_ZERO = RESULT(18, "DIVIDE_BY_ZERO");
 
 }
 
@@ -0,0 +1,78 @@
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "Trace.h"
+#include "ByteCode.h"
+
+/**
+ * Writes the buffered entries to a binary trace file, oldest first.
+ * Layout: FILE_MAGIC, FILE_VERSION (u32), sizeof(TraceEntry) (u32),
+ * total recorded (u64), entry count (u64), then the entries.
+ * @param path The file to write.
+ * @return Whether the file was written completely.
+ */
+bool TraceBuffer::writeTo(const std::filesystem::path& path) const {
+	std::ofstream out(path, std::ios::binary);
+	if(!out.is_open()){
+		return false;
+	}
+
+	uint32_t version = FILE_VERSION;
+	uint32_t entrySize = sizeof(TraceEntry);
+	uint64_t count = size();
+
+	out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(&entrySize), sizeof(entrySize));
+	out.write(reinterpret_cast<const char*>(&recorded), sizeof(recorded));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	for(size_t i = size(); i > 0; i--){
+		out.write(reinterpret_cast<const char*>(&fromNewest(i - 1)), sizeof(TraceEntry));
+	}
+
+	return out.good();
+}
+
+/**
+ * Formats the newest entries as one line per instruction, oldest first.
+ * @param count The maximum number of entries to format.
+ * @return The formatted trace.
+ */
+std::string TraceBuffer::toString(const size_t count) const {
+	std::stringstream trace;
+	size_t shown = count < size() ? count : size();
+
+	for(size_t i = shown; i > 0; i--){
+		const TraceEntry& entry = fromNewest(i - 1);
+		trace << std::hex << std::setfill('0') << "0x" << std::setw(4) << entry.pc << "  "
+			  << BYTECODE_INFO::nameFromValue(entry.opcode);
+
+		const BYTECODE_INFO::BYTECODE_OBJECT* object = BYTECODE_INFO::objectFromValue(entry.opcode);
+		bool firstRegister = true;
+		for(size_t arg = 0; object != nullptr && arg < object->argCount; arg++){
+			switch(object->args[arg]){
+				case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
+					{
+						uint8_t index = firstRegister ? entry.regA : entry.regB;
+						trace << " " << BYTECODE_INFO::nameFromValue(static_cast<uint8_t>(BYTECODE::REG_0) + index);
+						firstRegister = false;
+						break;
+					}
+				case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
+					trace << " 0x" << std::setw(4) << entry.literal;
+					break;
+				case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
+					trace << " 0x" << std::setw(4) << entry.address;
+					break;
+				case BYTECODE_INFO::ARGUMENT_TYPE::NONE:
+					break;
+			}
+		}
+
+		trace << "  flags=0x" << std::setw(2) << entry.flags << "\n";
+	}
+
+	return trace.str();
+}
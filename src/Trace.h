@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * Execution trace support, compiled in with FVM_TRACE.
+ * The interpreter records one TraceEntry per dispatched instruction into a
+ * fixed-size ring buffer. Nothing is formatted while the program runs, the
+ * buffer is written out in binary and decoded afterwards with
+ * scripts/decode_trace.py, or formatted in-process with toString().
+ */
+
+#ifndef FVM_TRACE_CAPACITY
+	#define FVM_TRACE_CAPACITY 4096
+#endif
+
+/* Machine state captured before an instruction executes */
+struct TraceEntry {
+	uint16_t pc;
+	uint8_t opcode;
+	uint8_t regA;
+	uint8_t regB;
+	uint8_t reserved;
+	uint16_t literal;
+	uint16_t address;
+	uint16_t flags;
+};
+
+static_assert(sizeof(TraceEntry) == 12, "TraceEntry is written to disk as-is");
+
+class TraceBuffer {
+	public:
+		static constexpr size_t CAPACITY = FVM_TRACE_CAPACITY;
+		static_assert((CAPACITY & (CAPACITY - 1)) == 0, "FVM_TRACE_CAPACITY must be a power of two");
+
+		/* Magic and version at the start of a trace file */
+		static constexpr char FILE_MAGIC[8] = {'F', 'V', 'M', 'T', 'R', 'A', 'C', 'E'};
+		static constexpr uint32_t FILE_VERSION = 1;
+
+		inline void record(const TraceEntry& entry){
+			entries[recorded & (CAPACITY - 1)] = entry;
+			recorded++;
+		}
+
+		void clear(){ recorded = 0; }
+
+		/* Number of entries currently held, at most CAPACITY */
+		size_t size() const { return recorded < CAPACITY ? static_cast<size_t>(recorded) : CAPACITY; }
+
+		/* Number of entries recorded since the last clear, including overwritten ones */
+		uint64_t total() const { return recorded; }
+
+		/* Entry i counted back from the newest one, 0 being the last executed instruction */
+		const TraceEntry& fromNewest(const size_t i) const { return entries[(recorded - 1 - i) & (CAPACITY - 1)]; }
+
+		bool writeTo(const std::filesystem::path& path) const;
+		std::string toString(const size_t count) const;
+
+	private:
+		std::array<TraceEntry, CAPACITY> entries{};
+		uint64_t recorded = 0;
+};
+
+#endif
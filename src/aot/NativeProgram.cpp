@@ -0,0 +1,403 @@
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "spdlog/spdlog.h"
+
+#include "NativeProgram.h"
+#include "../FVM.h"
+#include "../Files.h"
+#include "../Hash.h"
+
+/* posix_spawnp() hands the compiler our environment, so FVM_CC and PATH apply as usual */
+extern char** environ;
+
+static std::string hex(const uint64_t value){
+	char text[24];
+	std::snprintf(text, sizeof(text), "0x%llx", static_cast<unsigned long long>(value));
+	return text;
+}
+
+/* The REG_FLAGS bit a conditional jump tests */
+static uint16_t branchFlag(const BYTECODE opcode){
+	switch(opcode){
+		case BYTECODE::JUMPEQ:  return FVM::FLAG::EQ;
+		case BYTECODE::JUMPLT:  return FVM::FLAG::LT;
+		case BYTECODE::JUMPGT:  return FVM::FLAG::GT;
+		case BYTECODE::JUMPLTE: return FVM::FLAG::LTE;
+		case BYTECODE::JUMPGTE: return FVM::FLAG::GTE;
+		default: return 0;
+	}
+}
+
+static std::string label(const size_t address){
+	char text[16];
+	std::snprintf(text, sizeof(text), "L_%04zx", address);
+	return text;
+}
+
+/* Everything the translated program needs besides its instructions */
+static constexpr const char* PRELUDE = R"(#include <stdint.h>
+
+typedef struct {
+	uint16_t* registers;
+	uint8_t* memory;
+	uint64_t memorySize;
+	const uint8_t* pageDirty;
+	void* vm;
+	uint32_t (*write)(void* vm, uint32_t address, uint32_t value);
+} FVMNativeContext;
+
+#define LOAD(address) ((uint16_t)(memory[(address)] | memory[(address) + 1] << 8))
+#define EXIT(address) do { PC = (address); goto leave; } while(0)
+/* Faults return their status with REG_PC at the faulting instruction, like the interpreter */
+#define FAULT(address, status) do { fault = (status); EXIT(address); } while(0)
+/* Addresses computed at run time leave the fault to the interpreter */
+#define CHECK(address, pc) do { if((uint64_t)(address) + 1 >= memorySize) EXIT(pc); } while(0)
+/* Stores to clean pages or into the image go through FVM::writeUInt16, leaving if the image changed */
+#define STORE(address, value, nextPC) do { \
+		uint32_t store_ = (address); \
+		uint16_t value_ = (value); \
+		if(dirty[store_ >> PAGE_SHIFT] && dirty[(store_ + 1) >> PAGE_SHIFT] && !(store_ + 1 >= IMAGE_BEGIN && store_ < IMAGE_END)){ \
+			memory[store_] = (uint8_t)value_; \
+			memory[store_ + 1] = (uint8_t)(value_ >> 8); \
+		}else if(context->write(context->vm, store_, value_)){ \
+			EXIT(nextPC); \
+		} \
+	} while(0)
+)";
+
+uint64_t NativeProgram::imageHash(const FVM& vm){
+	const uint64_t layout[] = {ABI_VERSION, FVM::PAGE_SIZE, vm.programBegin, vm.programEnd};
+	uint64_t value = fnv1a(layout, sizeof(layout));
+	value = fnv1a(vm.programBlocks.data(), vm.programBlocks.size() * sizeof(size_t), value);
+	return fnv1a(vm.memory.data() + vm.programBegin, vm.programEnd - vm.programBegin, value);
+}
+
+/**
+ * Translates the program loaded in a VM to C, see the class comment.
+ * @param vm The VM, its program verified.
+ * @param source Receives the C source.
+ * @return RESULT_CODE SUCCESS, or INVALID_ARGUMENT if the loaded program is not verified.
+ */
+RESULT NativeProgram::translate(const FVM& vm, std::string& source){
+	if(!vm.programVerified || vm.programStale){
+		SPDLOG_ERROR("Only verified programs can be translated to native code");
+		return RESULT_CODE::INVALID_ARGUMENT;
+	}
+
+	auto isInstruction = [&](const size_t address){
+		return address >= vm.programBegin && address < vm.programEnd && vm.programIndex[address - vm.programBegin] != FVM::PROGRAM_UNLINKED;
+	};
+	auto reg = [](const uint8_t index){
+		return "r" + std::to_string(index);
+	};
+	// Native code continues at an instruction of the program, anything else is left to the interpreter
+	auto jumpTo = [&](const size_t address){
+		return isInstruction(address) ? "goto " + label(address) + ";" : "EXIT(" + hex(address) + ");";
+	};
+
+	std::vector<size_t> addresses;
+	for(size_t address = vm.programBegin; address < vm.programEnd; address++){
+		if(isInstruction(address)){
+			addresses.push_back(address);
+		}
+	}
+
+	source = PRELUDE;
+	source += "\n#define PAGE_SHIFT " + std::to_string(std::countr_zero(FVM::PAGE_SIZE)) + "\n";
+	source += "#define IMAGE_BEGIN " + hex(vm.programBegin) + "u\n";
+	source += "#define IMAGE_END " + hex(vm.programEnd) + "u\n\n";
+	source += "const uint32_t fvm_native_abi = " + std::to_string(ABI_VERSION) + ";\n";
+	source += "const uint64_t fvm_native_image = " + hex(imageHash(vm)) + "ull;\n\n";
+
+	source += "uint32_t fvm_native_run(FVMNativeContext* context){\n";
+	source += "\tuint16_t* const registers = context->registers;\n";
+	source += "\tuint8_t* const memory = context->memory;\n";
+	source += "\tconst uint64_t memorySize = context->memorySize;\n";
+	source += "\tconst uint8_t* const dirty = context->pageDirty;\n";
+	for(uint8_t i = 0; i < FVM::REGISTER_PC; i++){
+		source += "\tuint16_t " + reg(i) + " = registers[" + std::to_string(i) + "];\n";
+	}
+	source += "\tuint16_t flags = registers[" + std::to_string(FVM::REGISTER_FLAGS) + "];\n";
+	source += "\tuint16_t PC = registers[" + std::to_string(FVM::REGISTER_PC) + "];\n";
+	source += "\tuint32_t fault = 0;\n";
+	source += "\t(void)memorySize;\n\t(void)dirty;\n\n";
+
+	// The label table native code is entered through
+	source += "\tswitch(PC){\n";
+	for(size_t address : addresses){
+		source += "\t\tcase " + hex(address) + ": goto " + label(address) + ";\n";
+	}
+	source += "\t\tdefault: goto leave;\n\t}\n\n";
+
+	for(size_t i = 0; i < addresses.size(); i++){
+		const size_t address = addresses[i];
+		const FVM::DecodedInstruction instruction = vm.decodeInstruction(address);
+		const BYTECODE opcode = static_cast<BYTECODE>(instruction.opcode);
+		const std::string pc = hex(address);
+		const std::string nextPC = hex(instruction.nextPC);
+		const std::string literal = std::to_string(instruction.literal) + "u";
+		const std::string operand = hex(instruction.address) + "u";
+		const std::string a = reg(instruction.regA);
+		const std::string b = reg(instruction.regB);
+
+		source += label(address) + ": /* " + std::string(BYTECODE_INFO::nameFromValue(instruction.opcode)) + " */\n";
+
+		// REG_PC and REG_FLAGS operands are left to the interpreter
+		if(instruction.regA >= FVM::REGISTER_PC || instruction.regB >= FVM::REGISTER_PC){
+			source += "\tEXIT(" + pc + ");\n";
+			continue;
+		}
+
+		bool fallsThrough = true;
+		switch(opcode){
+			case BYTECODE::HALT:
+				source += "\tflags |= " + std::to_string(FVM::FLAG::HLT) + ";\n\tEXIT(" + pc + ");\n";
+				fallsThrough = false;
+				break;
+			case BYTECODE::COMPARE:
+				source += "\tflags = " + a + " == " + b + " ? " + std::to_string(FVM::FLAG::EQ | FVM::FLAG::LTE | FVM::FLAG::GTE)
+						+ " : " + a + " < " + b + " ? " + std::to_string(FVM::FLAG::LT | FVM::FLAG::LTE)
+						+ " : " + std::to_string(FVM::FLAG::GT | FVM::FLAG::GTE) + ";\n";
+				break;
+			case BYTECODE::JUMP:
+				source += "\t" + jumpTo(instruction.address) + "\n";
+				fallsThrough = false;
+				break;
+			case BYTECODE::JUMPEQ:
+			case BYTECODE::JUMPLT:
+			case BYTECODE::JUMPGT:
+			case BYTECODE::JUMPLTE:
+			case BYTECODE::JUMPGTE:
+				source += "\tif(flags & " + std::to_string(branchFlag(opcode)) + ") " + jumpTo(instruction.address) + "\n";
+				break;
+			case BYTECODE::MOVELR:
+				source += "\t" + a + " = " + literal + ";\n";
+				break;
+			case BYTECODE::MOVERR:
+				source += "\t" + b + " = " + a + ";\n";
+				break;
+			case BYTECODE::MOVELM:
+				source += "\tSTORE(" + operand + ", " + literal + ", " + nextPC + ");\n";
+				break;
+			case BYTECODE::MOVERM:
+				source += "\tSTORE(" + operand + ", " + a + ", " + nextPC + ");\n";
+				break;
+			case BYTECODE::MOVEMR:
+				source += "\t" + a + " = LOAD(" + operand + ");\n";
+				break;
+			case BYTECODE::MOVELIR:
+				source += "\tCHECK(" + a + ", " + pc + ");\n\tSTORE(" + a + ", " + literal + ", " + nextPC + ");\n";
+				break;
+			case BYTECODE::MOVEIRR:
+				source += "\tCHECK(" + a + ", " + pc + ");\n\t" + b + " = LOAD(" + a + ");\n";
+				break;
+			case BYTECODE::MOVEIRM:
+				source += "\tCHECK(" + a + ", " + pc + ");\n\tSTORE(" + operand + ", LOAD(" + a + "), " + nextPC + ");\n";
+				break;
+			case BYTECODE::MOVEIMR:
+				source += "\t{\n\t\tuint16_t pointer = LOAD(" + operand + ");\n\t\tCHECK(pointer, " + pc + ");\n\t\t" + a + " = LOAD(pointer);\n\t}\n";
+				break;
+			case BYTECODE::ADD:
+				source += "\t" + b + " = (uint16_t)(" + a + " + " + b + ");\n";
+				break;
+			case BYTECODE::SUBTRACT:
+				source += "\t" + b + " = (uint16_t)(" + a + " - " + b + ");\n";
+				break;
+			case BYTECODE::MULTIPLY:
+				source += "\t" + b + " = (uint16_t)((uint32_t)" + a + " * " + b + ");\n";
+				break;
+			case BYTECODE::DIVIDE:
+				source += "\tif(" + b + " == 0) FAULT(" + pc + ", " + std::to_string(FAULT_DIVIDE_BY_ZERO) + ");\n\t" + b + " = (uint16_t)(" + a + " / " + b + ");\n";
+				break;
+			case BYTECODE::INCREMENT:
+				source += "\t" + a + " = (uint16_t)(" + a + " + 1);\n";
+				break;
+			case BYTECODE::DECREMENT:
+				source += "\t" + a + " = (uint16_t)(" + a + " - 1);\n";
+				break;
+			case BYTECODE::AND:
+				source += "\t" + b + " = " + a + " & " + b + ";\n";
+				break;
+			case BYTECODE::OR:
+				source += "\t" + b + " = " + a + " | " + b + ";\n";
+				break;
+			case BYTECODE::XOR:
+				source += "\t" + b + " = " + a + " ^ " + b + ";\n";
+				break;
+			case BYTECODE::NOT:
+				source += "\t" + a + " = (uint16_t)~" + a + ";\n";
+				break;
+			case BYTECODE::SHIFTLEFT:
+				source += "\t" + a + " = " + (instruction.literal < 16 ? "(uint16_t)(" + a + " << " + std::to_string(instruction.literal) + ")" : "0") + ";\n";
+				break;
+			case BYTECODE::SHIFTRIGHT:
+				source += "\t" + a + " = " + (instruction.literal < 16 ? "(uint16_t)(" + a + " >> " + std::to_string(instruction.literal) + ")" : "0") + ";\n";
+				break;
+			default:
+				source += "\tEXIT(" + pc + ");\n";
+				fallsThrough = false;
+				break;
+		}
+
+		// Instructions are laid out in address order, gaps need an explicit jump
+		bool followed = i + 1 < addresses.size() && addresses[i + 1] == instruction.nextPC;
+		if(fallsThrough && !followed){
+			source += "\t" + jumpTo(instruction.nextPC) + "\n";
+		}
+	}
+
+	source += "\nleave:\n";
+	for(uint8_t i = 0; i < FVM::REGISTER_PC; i++){
+		source += "\tregisters[" + std::to_string(i) + "] = " + reg(i) + ";\n";
+	}
+	source += "\tregisters[" + std::to_string(FVM::REGISTER_FLAGS) + "] = flags;\n";
+	source += "\tregisters[" + std::to_string(FVM::REGISTER_PC) + "] = PC;\n";
+	source += "\treturn fault;\n";
+	source += "}\n";
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Writes C source and compiles it into a shared object.
+ * @param source The C source.
+ * @param sourcePath Where to write the source.
+ * @param soPath Where the compiler puts the shared object.
+ * @return RESULT_CODE SUCCESS, FILE_NOT_FOUND if the source cannot be written or NATIVE_BUILD_FAILED.
+ */
+static RESULT compile(const std::string& source, const std::filesystem::path& sourcePath, const std::filesystem::path& soPath){
+	{
+		std::ofstream file(sourcePath, std::ios::binary);
+		if(!file || !(file << source) || !file.flush()){
+			SPDLOG_ERROR("Could not write " + sourcePath.string());
+			return RESULT_CODE::FILE_NOT_FOUND;
+		}
+	}
+
+	const char* compiler = std::getenv("FVM_CC");
+	std::vector<std::string> arguments = {compiler != nullptr && *compiler != '\0' ? compiler : "cc",
+										  "-O2", "-shared", "-fPIC", "-o", soPath.string(), sourcePath.string()};
+	std::vector<char*> argv;
+	std::string command;
+	for(std::string& argument : arguments){
+		argv.push_back(argument.data());
+		command += (command.empty() ? "" : " ") + argument;
+	}
+	argv.push_back(nullptr);
+
+	SPDLOG_INFO("Building native code: " + command);
+	pid_t child = 0;
+	int status = 0;
+	if(posix_spawnp(&child, argv[0], nullptr, nullptr, argv.data(), environ) != 0
+	   || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		SPDLOG_ERROR("Native build failed: " + command);
+		return RESULT_CODE::NATIVE_BUILD_FAILED;
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Translates the program loaded in a VM and compiles it into a shared object
+ * with the C compiler named by FVM_CC, cc by default. FVM_CC names a single
+ * program, it is run directly and not through a shell.
+ * @param vm The VM, its program verified.
+ * @param soPath Where to put the shared object. The C source is kept next to it as soPath.c.
+ * @return RESULT_CODE SUCCESS, INVALID_ARGUMENT if the program cannot be translated, FILE_NOT_FOUND if the source cannot be written or NATIVE_BUILD_FAILED.
+ */
+RESULT NativeProgram::build(const FVM& vm, const std::filesystem::path& soPath){
+	std::string source;
+	RESULT result = translate(vm, source);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	std::filesystem::path sourcePath = soPath;
+	sourcePath += ".c";
+
+	// Both are built under temporaries and renamed into place, so a failed build never leaves half a
+	// shared object. The source is kept for reading only, a failure to keep it does not fail the build.
+	return replaceFile(soPath, [&](const std::filesystem::path& temporary){
+		RESULT built = RESULT_CODE::FILE_NOT_FOUND;
+		replaceFile(sourcePath, [&](const std::filesystem::path& temporarySource){
+			built = compile(source, temporarySource, temporary);
+			return built;
+		});
+		return built;
+	});
+}
+
+NativeProgram::~NativeProgram(){
+	if(handle != nullptr){
+		dlclose(handle);
+	}
+}
+
+/**
+ * Loads a shared object from build().
+ * @param vm The VM it is going to run in, with the program it was built from loaded.
+ * @param soPath The shared object.
+ * @return RESULT_CODE SUCCESS, FILE_NOT_FOUND if it cannot be loaded, or NATIVE_MISMATCH if it was built from another program or by another version.
+ */
+RESULT NativeProgram::open(const FVM& vm, const std::filesystem::path& soPath){
+	// Not built yet is the usual reason, callers build it then
+	std::error_code error;
+	if(!std::filesystem::exists(soPath, error)){
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	// dlopen() searches the library path for names without a slash
+	std::filesystem::path absolute = std::filesystem::absolute(soPath, error);
+	void* opened = error ? nullptr : dlopen(absolute.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if(opened == nullptr){
+		const char* reason = dlerror();
+		SPDLOG_ERROR("Could not load native code " + soPath.string() + ": " + (reason != nullptr ? reason : error.message()));
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+	const uint32_t* abi = static_cast<const uint32_t*>(dlsym(opened, "fvm_native_abi"));
+	const uint64_t* imageSymbol = static_cast<const uint64_t*>(dlsym(opened, "fvm_native_image"));
+	Entry run = reinterpret_cast<Entry>(dlsym(opened, "fvm_native_run"));
+	if(abi == nullptr || imageSymbol == nullptr || run == nullptr || *abi != ABI_VERSION || *imageSymbol != imageHash(vm)){
+		SPDLOG_WARN("Native code " + soPath.string() + " was not built from the loaded program");
+		dlclose(opened);
+		return RESULT_CODE::NATIVE_MISMATCH;
+	}
+
+	if(handle != nullptr){
+		dlclose(handle);
+	}
+	handle = opened;
+	entry = run;
+	image = *imageSymbol;
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Called from native code for stores it does not do itself.
+ * @return Non-zero if the write landed inside the loaded image.
+ */
+uint32_t NativeProgram::writeUInt16(void* vm, uint32_t address, uint32_t value){
+	FVM* fvm = static_cast<FVM*>(vm);
+	fvm->writeUInt16(address, static_cast<uint16_t>(value));
+	return fvm->programStale ? 1 : 0;
+}
+
+/**
+ * Runs native code from REG_PC until it returns, see the class comment.
+ * @return RESULT_CODE SUCCESS, also when an instruction was left to the interpreter, or DIVIDE_BY_ZERO.
+ */
+RESULT NativeProgram::run(FVM& vm) const {
+	FVMNativeContext context{vm.registers.data(), vm.memory.data(), vm.MEMORY_SIZE, vm.pageDirty.data(), &vm, &NativeProgram::writeUInt16};
+	if(entry(&context) == FAULT_DIVIDE_BY_ZERO){
+		SPDLOG_ERROR("Divide by zero at " + std::to_string(vm.registers[FVM::REGISTER_PC]));
+		return RESULT_CODE::DIVIDE_BY_ZERO;
+	}
+	return RESULT_CODE::SUCCESS;
+}
@@ -0,0 +1,84 @@
+#ifndef NATIVE_PROGRAM_H
+#define NATIVE_PROGRAM_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "../ResultCode.h"
+
+class FVM;
+
+/**
+ * State handed to a native program, laid out exactly like the struct the
+ * translated C declares. write is FVM::writeUInt16, returning non-zero if the
+ * write landed inside the loaded image.
+ */
+struct FVMNativeContext {
+	uint16_t* registers;
+	uint8_t* memory;
+	uint64_t memorySize;
+	const uint8_t* pageDirty;
+	void* vm;
+	uint32_t (*write)(void* vm, uint32_t address, uint32_t value);
+};
+
+/**
+ * Ahead-of-time translation of a loaded program to a native shared object,
+ * compiled in with FVM_AOT.
+ *
+ * translate() turns every instruction of the decoded program into a few
+ * lines of C: guest registers become locals, jumps become gotos and a switch
+ * over the instruction addresses is the label table native code is entered
+ * through. build() compiles that with the system C compiler into a shared
+ * object, which open() loads with dlopen.
+ *
+ * Native code runs until HALT or until it reaches something it leaves to the
+ * interpreter: REG_PC/REG_FLAGS operands, an address computed at run time
+ * outside memory, a jump out of the decoded program or a store into the
+ * loaded image. It stores REG_PC there and returns, FVM::run() single steps
+ * that instruction and carries on natively, so results are exactly those of
+ * FVM::step(). DIVIDE by zero faults in native code itself, returning
+ * DIVIDE_BY_ZERO with REG_PC at the DIVIDE. Stores go straight to memory once
+ * both pages are dirty, otherwise through FVM::writeUInt16.
+ *
+ * A shared object only matches the image it was translated from, loaded at
+ * the same offset: the image hash baked into it is checked by open() and
+ * again whenever the program is re-decoded.
+ */
+class NativeProgram {
+	public:
+		/* Bumped whenever FVMNativeContext or the translated code's conventions change */
+		static constexpr uint32_t ABI_VERSION = 2;
+		/* Returned by the translated code for a DIVIDE by zero, 0 otherwise */
+		static constexpr uint32_t FAULT_DIVIDE_BY_ZERO = 1;
+
+		NativeProgram() = default;
+		~NativeProgram();
+
+		NativeProgram(const NativeProgram&) = delete;
+		NativeProgram& operator=(const NativeProgram&) = delete;
+
+		/* Hash of the loaded image, its offset and block starts, see the class comment */
+		static uint64_t imageHash(const FVM& vm);
+
+		static RESULT translate(const FVM& vm, std::string& source);
+		static RESULT build(const FVM& vm, const std::filesystem::path& soPath);
+
+		RESULT open(const FVM& vm, const std::filesystem::path& soPath);
+
+		uint64_t hash() const { return image; }
+
+		RESULT run(FVM& vm) const;
+
+	private:
+		using Entry = uint32_t (*)(FVMNativeContext* context);
+
+		void* handle = nullptr;
+		Entry entry = nullptr;
+		uint64_t image = 0;
+
+		static uint32_t writeUInt16(void* vm, uint32_t address, uint32_t value);
+};
+
+#endif
@@ -0,0 +1,860 @@
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+#include "JIT.h"
+#include "X64Emitter.h"
+#include "../FVM.h"
+
+using namespace x64;
+
+/* Host registers holding guest state while native code runs */
+static constexpr REG GUEST_REGISTERS[] = {R8, R9, R10, R11, R12, R13, R14, R15};
+static constexpr REG GUEST_FLAGS = RSI;
+static constexpr REG REGISTER_FILE = RBX;
+static constexpr REG VM = RBP;
+
+static constexpr int8_t PC_OFFSET = static_cast<int8_t>(FVM::REGISTER_PC * sizeof(uint16_t));
+static constexpr int8_t FLAGS_OFFSET = static_cast<int8_t>(FVM::REGISTER_FLAGS * sizeof(uint16_t));
+
+/* Worst case a single instruction can take, dirty page checks and exits included */
+static constexpr size_t MAX_INSTRUCTION_BYTES = 512;
+static constexpr size_t MAX_BLOCK_BYTES = JIT::MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_BYTES;
+static constexpr size_t MAX_TRACE_BYTES = JIT::MAX_TRACE_INSTRUCTIONS * MAX_INSTRUCTION_BYTES;
+
+static constexpr REG guest(const uint8_t index){
+	return GUEST_REGISTERS[index];
+}
+
+static constexpr int8_t registerOffset(const size_t index){
+	return static_cast<int8_t>(index * sizeof(uint16_t));
+}
+
+/**
+ * Called from native code to write guest memory.
+ * @return Non-zero if the write landed inside the loaded image and native code must exit.
+ */
+uint32_t JIT::writeUInt16(FVM* vm, uint32_t address, uint32_t value){
+	vm->writeUInt16(address, static_cast<uint16_t>(value));
+	return vm->programStale ? 1 : 0;
+}
+
+/**
+ * Called from native code on entry for every page it may store to directly.
+ */
+void JIT::markDirty(FVM* vm, uint32_t address){
+	vm->markDirty(address);
+}
+
+static void spill(Emitter& e){
+	for(uint8_t i = 0; i < std::size(GUEST_REGISTERS); i++){
+		e.store16(REGISTER_FILE, registerOffset(i), guest(i));
+	}
+	e.store16(REGISTER_FILE, FLAGS_OFFSET, GUEST_FLAGS);
+}
+
+static void reload(Emitter& e){
+	for(uint8_t i = 0; i < std::size(GUEST_REGISTERS); i++){
+		e.load16(guest(i), REGISTER_FILE, registerOffset(i));
+	}
+	e.load16(GUEST_FLAGS, REGISTER_FILE, FLAGS_OFFSET);
+}
+
+/* Calls a helper with ESI/EDX already set, the result ends up in EAX */
+static void callHelper(Emitter& e, const void* function){
+	e.movRR64(RDI, VM);
+	e.movRI64(RAX, reinterpret_cast<uint64_t>(function));
+	e.callR(RAX);
+}
+
+/* Sets REG_FLAGS the way COMPARE a b does */
+static void emitFlags(Emitter& e, const REG a, const REG b){
+	e.movRI(RAX, FVM::FLAG::EQ | FVM::FLAG::LTE | FVM::FLAG::GTE);
+	e.movRI(RCX, FVM::FLAG::LT | FVM::FLAG::LTE);
+	e.movRI(RDX, FVM::FLAG::GT | FVM::FLAG::GTE);
+	e.cmpRR(a, b);
+	e.cmovRR(BELOW, RAX, RCX);
+	e.cmovRR(ABOVE, RAX, RDX);
+	e.movRR(GUEST_FLAGS, RAX);
+}
+
+/**
+ * The REG_FLAGS bit a conditional jump tests and the host condition that
+ * holds after cmp a, b when that bit would be set by COMPARE a b.
+ * @return False if the opcode is not a conditional jump.
+ */
+static bool branchCondition(const uint8_t opcode, uint16_t& mask, CONDITION& condition){
+	switch(static_cast<BYTECODE>(opcode)){
+		case BYTECODE::JUMPEQ:  mask = FVM::FLAG::EQ;  condition = EQUAL;       return true;
+		case BYTECODE::JUMPLT:  mask = FVM::FLAG::LT;  condition = BELOW;       return true;
+		case BYTECODE::JUMPGT:  mask = FVM::FLAG::GT;  condition = ABOVE;       return true;
+		case BYTECODE::JUMPLTE: mask = FVM::FLAG::LTE; condition = BELOW_EQUAL; return true;
+		case BYTECODE::JUMPGTE: mask = FVM::FLAG::GTE; condition = ABOVE_EQUAL; return true;
+		default: return false;
+	}
+}
+
+/**
+ * Whether an instruction overwrites a guest register.
+ * @param instruction The decoded instruction, its handler slot unfused.
+ * @param index The register index.
+ */
+static bool writesRegister(const FVM::DecodedInstruction& instruction, const uint8_t index){
+	switch(static_cast<BYTECODE>(FVM::unfusedOpcode(instruction.opcode))){
+		case BYTECODE::MOVELR:
+		case BYTECODE::MOVEMR:
+		case BYTECODE::MOVEIMR:
+		case BYTECODE::INCREMENT:
+		case BYTECODE::DECREMENT:
+		case BYTECODE::NOT:
+		case BYTECODE::SHIFTLEFT:
+		case BYTECODE::SHIFTRIGHT:
+			return instruction.regA == index;
+		case BYTECODE::MOVERR:
+		case BYTECODE::MOVEIRR:
+		case BYTECODE::ADD:
+		case BYTECODE::SUBTRACT:
+		case BYTECODE::MULTIPLY:
+		case BYTECODE::AND:
+		case BYTECODE::OR:
+		case BYTECODE::XOR:
+			return instruction.regB == index;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Whether native code stores straight into guest memory for an instruction:
+ * it stores to a constant address outside the loaded image, so the store can
+ * neither make the program stale nor miss the bounds verifyProgram() checked.
+ * Every other store goes through JIT::writeUInt16.
+ */
+bool JIT::storesDirectly(const FVM& vm, const uint32_t index){
+	const FVM::DecodedInstruction& instruction = vm.program[index];
+	switch(static_cast<BYTECODE>(FVM::unfusedOpcode(instruction.opcode))){
+		case BYTECODE::MOVELM:
+		case BYTECODE::MOVERM:
+		case BYTECODE::MOVEIRM:
+			return !(static_cast<size_t>(instruction.address) + 1 >= vm.programBegin && instruction.address < vm.programEnd);
+		default:
+			return false;
+	}
+}
+
+/* Whether an instruction may leave native code because it wrote into the loaded image */
+bool JIT::mayExitStale(const FVM& vm, const uint32_t index){
+	const FVM::DecodedInstruction& instruction = vm.program[index];
+	switch(static_cast<BYTECODE>(FVM::unfusedOpcode(instruction.opcode))){
+		case BYTECODE::MOVELIR:
+			return true;
+		case BYTECODE::MOVELM:
+		case BYTECODE::MOVERM:
+		case BYTECODE::MOVEIRM:
+			return !storesDirectly(vm, index);
+		default:
+			return false;
+	}
+}
+
+JIT::JIT(){
+	void* mapping = mmap(nullptr, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mapping == MAP_FAILED){
+		SPDLOG_ERROR("Could not map the JIT code cache, running interpreted");
+		return;
+	}
+	code = static_cast<uint8_t*>(mapping);
+
+	emitTrampoline();
+	setWritable(false);
+}
+
+JIT::~JIT(){
+	if(code != nullptr){
+		munmap(code, CODE_CACHE_SIZE);
+	}
+}
+
+/**
+ * Toggles the code cache between writable and executable, never both.
+ * @param writable Whether the cache is about to be written.
+ */
+void JIT::setWritable(const bool writable){
+	mprotect(code, CODE_CACHE_SIZE, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+}
+
+/**
+ * Emits the entry trampoline and the shared exit stub at the start of the cache.
+ * The trampoline saves the callee-saved registers, loads the guest registers
+ * and jumps into a block. The exit stub stores them back and returns.
+ */
+void JIT::emitTrampoline(){
+	Emitter e(code, CODE_CACHE_SIZE);
+
+	e.push(RBX);
+	e.push(RBP);
+	e.push(R12);
+	e.push(R13);
+	e.push(R14);
+	e.push(R15);
+	// Six pushes and the return address leave the stack 8 bytes off alignment for calls
+	e.subRSP(8);
+
+	e.movRR64(REGISTER_FILE, RDI);
+	e.movRR64(VM, RSI);
+	reload(e);
+	e.jmpR(RDX);
+
+	exitStub = e.offset();
+	spill(e);
+	e.addRSP(8);
+	e.pop(R15);
+	e.pop(R14);
+	e.pop(R13);
+	e.pop(R12);
+	e.pop(RBP);
+	e.pop(RBX);
+	e.ret();
+
+	trampolineEnd = e.offset();
+	codeUsed = trampolineEnd;
+	entry = reinterpret_cast<Entry>(code);
+}
+
+/**
+ * Drops all native code, sizes the lookup tables for a freshly decoded
+ * program and marks the target of every backward jump as a loop head.
+ * @param vm The VM whose program was decoded.
+ */
+void JIT::reset(const FVM& vm){
+	const size_t programSize = vm.program.size();
+	blocks.assign(programSize, nullptr);
+	counters.assign(programSize, 0);
+	uncompilable.assign(programSize, false);
+	loopHeads.assign(programSize, false);
+	traces = 0;
+
+	uint16_t mask = 0;
+	CONDITION condition = EQUAL;
+	for(uint32_t i = 0; i < vm.programResolve; i++){
+		const FVM::DecodedInstruction& instruction = vm.program[i];
+		bool jump = instruction.opcode == static_cast<uint8_t>(BYTECODE::JUMP) || branchCondition(instruction.opcode, mask, condition);
+		if(jump && instruction.target <= i){
+			loopHeads[instruction.target] = true;
+		}
+	}
+	flush();
+}
+
+/**
+ * Empties the code cache but keeps the hotness counters.
+ */
+void JIT::flush(){
+	std::fill(blocks.begin(), blocks.end(), nullptr);
+	pendingExits.clear();
+	codeUsed = trampolineEnd;
+}
+
+bool JIT::execute(FVM& vm, uint32_t index){
+	if(code == nullptr){
+		return false;
+	}
+
+	bool ran = false;
+	while(index < blocks.size() && index != vm.programResolve){
+		const uint8_t* native = blocks[index];
+
+		if(native == nullptr && loopHeads[index]){
+			if(++counters[index] < TRACE_THRESHOLD){
+				break;
+			}
+
+			// Recording runs the iteration it records, so the VM has moved on either way
+			std::vector<TraceStep> trace;
+			bool closed = false;
+			bool recorded = recordTrace(vm, index, trace, closed);
+			ran = ran || !trace.empty();
+			if(recorded && !trace.empty() && compileTrace(vm, trace, closed) != nullptr){
+				index = vm.programLookup(vm.registers[FVM::REGISTER_PC]);
+				continue;
+			}
+
+			// Loops that cannot be traced are left to the block tier
+			loopHeads[index] = false;
+			counters[index] = 0;
+			if(!trace.empty()){
+				break;
+			}
+		}
+
+		if(native == nullptr){
+			if(uncompilable[index] || ++counters[index] < HOT_THRESHOLD){
+				break;
+			}
+
+			native = compile(vm, index);
+			if(native == nullptr){
+				uncompilable[index] = true;
+				break;
+			}
+		}
+
+		entry(vm.registers.data(), &vm, native);
+		ran = true;
+
+		// Native code returns on HALT, on a write into the image or at code that is not compiled yet
+		if(vm.programStale || (vm.registers[FVM::REGISTER_FLAGS] & FVM::FLAG::HLT) != 0){
+			break;
+		}
+		index = vm.programLookup(vm.registers[FVM::REGISTER_PC]);
+	}
+	return ran;
+}
+
+/**
+ * Whether the compilers can translate a decoded instruction.
+ * Native code only comes from verified programs, so address operands are
+ * known to be inside memory. Native code does not check the addresses held in
+ * registers or memory, those accesses are only compiled when every 16-bit
+ * address is inside memory.
+ * @param vm The VM the instruction belongs to.
+ * @param instruction The decoded instruction.
+ * @return True if native code can be emitted for it.
+ */
+static bool isCompilable(const FVM& vm, const FVM::DecodedInstruction& instruction){
+	// REG_PC and REG_FLAGS operands are left to the interpreter
+	if(instruction.regA >= FVM::REGISTER_PC || instruction.regB >= FVM::REGISTER_PC){
+		return false;
+	}
+
+	// Superinstructions are compiled as their separate halves
+	const uint8_t opcode = FVM::unfusedOpcode(instruction.opcode);
+	switch(static_cast<BYTECODE>(opcode)){
+		case BYTECODE::DIVIDE:
+			return false;
+		case BYTECODE::MOVELIR:
+		case BYTECODE::MOVEIRR:
+		case BYTECODE::MOVEIRM:
+		case BYTECODE::MOVEIMR:
+			return vm.MEMORY_SIZE > UINT16_MAX + 1;
+		default:
+			return opcode < FVM::OPCODE_COUNT;
+	}
+}
+
+/**
+ * Makes room for new native code, flushing the cache when it is full, and
+ * makes the cache writable.
+ * @param bytes The most the code about to be emitted can take.
+ * @return False if the code cannot fit even in an empty cache.
+ */
+bool JIT::reserve(const size_t bytes){
+	if(trampolineEnd + bytes > CODE_CACHE_SIZE){
+		return false;
+	}
+	if(codeUsed + bytes > CODE_CACHE_SIZE){
+		SPDLOG_INFO("JIT code cache full, flushing");
+		flush();
+	}
+	setWritable(true);
+	return true;
+}
+
+/**
+ * Publishes freshly emitted code as the native code of a program index and
+ * chains every exit that was waiting for it.
+ * @param e The emitter the code was written with.
+ * @param start Offset of the code in the cache.
+ * @param index The decoded program index it starts at.
+ * @return The native code, or nullptr if it overflowed the cache.
+ */
+const uint8_t* JIT::finish(Emitter& e, const size_t start, const uint32_t index){
+	if(e.overflowed()){
+		SPDLOG_ERROR("JIT code overflowed the code cache");
+		flush();
+		setWritable(false);
+		return nullptr;
+	}
+
+	codeUsed = e.offset();
+	blocks[index] = code + start;
+
+	auto pending = pendingExits.find(index);
+	if(pending != pendingExits.end()){
+		for(size_t site : pending->second){
+			e.patch(site, start);
+		}
+		pendingExits.erase(pending);
+	}
+
+	setWritable(false);
+	return blocks[index];
+}
+
+/**
+ * Emits the entry check that marks every page the code stores to directly
+ * as dirty, so snapshot()/restore() see those stores. Marking a page the
+ * code then never reaches only costs restore() a copy.
+ * @param e The emitter, positioned at the start of the code.
+ * @param vm The VM the code is compiled for.
+ * @param indices Decoded program indices of the instructions in the code.
+ */
+void JIT::emitDirtyPages(Emitter& e, const FVM& vm, const std::vector<uint32_t>& indices){
+	std::vector<size_t> pages;
+	for(uint32_t index : indices){
+		const FVM::DecodedInstruction& instruction = vm.program[index];
+		if(storesDirectly(vm, index)){
+			pages.push_back(instruction.address / FVM::PAGE_SIZE);
+			pages.push_back((static_cast<size_t>(instruction.address) + 1) / FVM::PAGE_SIZE);
+		}
+	}
+	std::sort(pages.begin(), pages.end());
+	pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+	for(size_t page : pages){
+		e.movRI64(RAX, reinterpret_cast<uint64_t>(vm.pageDirty.data() + page));
+		e.cmp8I(RAX, 0, 0);
+		size_t dirty = e.jcc(NOT_EQUAL);
+		spill(e);
+		e.movRI(RSI, static_cast<uint32_t>(page * FVM::PAGE_SIZE));
+		callHelper(e, reinterpret_cast<const void*>(&JIT::markDirty));
+		reload(e);
+		e.patch(dirty, e.offset());
+	}
+}
+
+/**
+ * Leaves native code for the instruction at pc, chaining straight into its
+ * native code when there is some, or once there is.
+ * @param flags A COMPARE whose REG_FLAGS have to be computed first.
+ */
+void JIT::emitExit(Emitter& e, const FVM& vm, const PendingFlags& flags, const uint16_t pc, const uint32_t target){
+	if(flags.pending){
+		emitFlags(e, guest(flags.regA), guest(flags.regB));
+	}
+	e.store16I(REGISTER_FILE, PC_OFFSET, pc);
+	size_t site = e.jmp();
+	bool chainable = target != vm.programResolve && target < blocks.size();
+	if(chainable && blocks[target] != nullptr){
+		e.patch(site, static_cast<size_t>(blocks[target] - code));
+	}else{
+		e.patch(site, exitStub);
+		if(chainable){
+			pendingExits[target].push_back(site);
+		}
+	}
+}
+
+/**
+ * Emits a compilable instruction other than HALT, COMPARE and the jumps.
+ * @param e The emitter.
+ * @param vm The VM whose decoded program is compiled.
+ * @param index The decoded program index of the instruction.
+ * @param flags A COMPARE whose REG_FLAGS have to be computed before leaving native code.
+ */
+void JIT::emitOperation(Emitter& e, const FVM& vm, const uint32_t index, const PendingFlags& flags){
+	const FVM::DecodedInstruction& instruction = vm.program[index];
+	const uint64_t memory = reinterpret_cast<uint64_t>(vm.memory.data());
+	const REG a = guest(instruction.regA);
+	const REG b = guest(instruction.regB);
+
+	// After a write helper: leave native code if the write hit the loaded image
+	auto exitIfStale = [&](){
+		e.testRR(RAX, RAX);
+		size_t fresh = e.jcc(EQUAL);
+		if(flags.pending){
+			emitFlags(e, guest(flags.regA), guest(flags.regB));
+		}
+		e.store16I(REGISTER_FILE, PC_OFFSET, instruction.nextPC);
+		e.patch(e.jmp(), exitStub);
+		e.patch(fresh, e.offset());
+	};
+
+	// Points RAX at guest memory, plus a zero extended register holding an address
+	auto address = [&](const REG offset){
+		e.movRI64(RAX, memory);
+		e.addRR64(RAX, offset);
+	};
+
+	switch(static_cast<BYTECODE>(FVM::unfusedOpcode(instruction.opcode))){
+		default:
+			break;
+
+		case BYTECODE::MOVELR:
+			e.movRI(a, instruction.literal);
+			break;
+
+		case BYTECODE::MOVERR:
+			e.movRR(b, a);
+			break;
+
+		case BYTECODE::MOVELM:
+			if(storesDirectly(vm, index)){
+				e.movRI64(RAX, memory + instruction.address);
+				e.store16I(RAX, 0, instruction.literal);
+			}else{
+				spill(e);
+				e.movRI(RSI, instruction.address);
+				e.movRI(RDX, instruction.literal);
+				callHelper(e, reinterpret_cast<const void*>(&JIT::writeUInt16));
+				reload(e);
+				exitIfStale();
+			}
+			break;
+
+		case BYTECODE::MOVERM:
+			if(storesDirectly(vm, index)){
+				e.movRI64(RAX, memory + instruction.address);
+				e.store16(RAX, 0, a);
+			}else{
+				spill(e);
+				e.movRR(RDX, a);
+				e.movRI(RSI, instruction.address);
+				callHelper(e, reinterpret_cast<const void*>(&JIT::writeUInt16));
+				reload(e);
+				exitIfStale();
+			}
+			break;
+
+		case BYTECODE::MOVEMR:
+			e.movRI64(RAX, memory + instruction.address);
+			e.load16(a, RAX, 0);
+			break;
+
+		case BYTECODE::MOVELIR:
+			spill(e);
+			e.movRR(RSI, a);
+			e.movRI(RDX, instruction.literal);
+			callHelper(e, reinterpret_cast<const void*>(&JIT::writeUInt16));
+			reload(e);
+			exitIfStale();
+			break;
+
+		case BYTECODE::MOVEIRR:
+			address(a);
+			e.load16(b, RAX, 0);
+			break;
+
+		case BYTECODE::MOVEIRM:
+			address(a);
+			e.load16(RCX, RAX, 0);
+			if(storesDirectly(vm, index)){
+				e.movRI64(RAX, memory + instruction.address);
+				e.store16(RAX, 0, RCX);
+			}else{
+				spill(e);
+				e.movRR(RDX, RCX);
+				e.movRI(RSI, instruction.address);
+				callHelper(e, reinterpret_cast<const void*>(&JIT::writeUInt16));
+				reload(e);
+				exitIfStale();
+			}
+			break;
+
+		case BYTECODE::MOVEIMR:
+			e.movRI64(RAX, memory + instruction.address);
+			e.load16(RCX, RAX, 0);
+			address(RCX);
+			e.load16(a, RAX, 0);
+			break;
+
+		case BYTECODE::ADD:
+			e.addRR(b, a);
+			e.movzx16RR(b, b);
+			break;
+
+		case BYTECODE::SUBTRACT:
+			e.movRR(RAX, a);
+			e.subRR(RAX, b);
+			e.movzx16RR(b, RAX);
+			break;
+
+		case BYTECODE::MULTIPLY:
+			e.imulRR(b, a);
+			e.movzx16RR(b, b);
+			break;
+
+		case BYTECODE::INCREMENT:
+			e.incR(a);
+			e.movzx16RR(a, a);
+			break;
+
+		case BYTECODE::DECREMENT:
+			e.decR(a);
+			e.movzx16RR(a, a);
+			break;
+
+		case BYTECODE::AND:
+			e.andRR(b, a);
+			break;
+
+		case BYTECODE::OR:
+			e.orRR(b, a);
+			break;
+
+		case BYTECODE::XOR:
+			e.xorRR(b, a);
+			break;
+
+		case BYTECODE::NOT:
+			e.notR(a);
+			e.movzx16RR(a, a);
+			break;
+
+		case BYTECODE::SHIFTLEFT:
+			if(instruction.literal >= 16){
+				e.movRI(a, 0);
+			}else{
+				e.shlRI(a, static_cast<uint8_t>(instruction.literal));
+				e.movzx16RR(a, a);
+			}
+			break;
+
+		case BYTECODE::SHIFTRIGHT:
+			if(instruction.literal >= 16){
+				e.movRI(a, 0);
+			}else{
+				e.shrRI(a, static_cast<uint8_t>(instruction.literal));
+			}
+			break;
+	}
+}
+
+/**
+ * Compiles the basic block starting at a decoded program index.
+ * @param vm The VM whose decoded program is compiled, REG_PC holds the block's address.
+ * @param index The decoded program index of the first instruction.
+ * @return The block's native code, or nullptr if its first instruction is not compilable.
+ */
+const uint8_t* JIT::compile(FVM& vm, const uint32_t index){
+	const std::vector<FVM::DecodedInstruction>& program = vm.program;
+	const uint32_t resolve = vm.programResolve;
+
+	if(!isCompilable(vm, program[index])){
+		return nullptr;
+	}
+
+	// The block runs up to its first jump or HALT, or up to what cannot be compiled
+	std::vector<uint32_t> indices;
+	uint16_t endPC = vm.registers[FVM::REGISTER_PC];
+	uint32_t end = index;
+	bool terminated = false;
+	while(indices.size() < MAX_BLOCK_INSTRUCTIONS && end != resolve && isCompilable(vm, program[end])){
+		const FVM::DecodedInstruction& instruction = program[end];
+		indices.push_back(end);
+		uint16_t mask = 0;
+		CONDITION condition = EQUAL;
+		const uint8_t opcode = FVM::unfusedOpcode(instruction.opcode);
+		if(opcode == static_cast<uint8_t>(BYTECODE::HALT) || opcode == static_cast<uint8_t>(BYTECODE::JUMP) || branchCondition(opcode, mask, condition)){
+			terminated = true;
+			break;
+		}
+		endPC = instruction.nextPC;
+		end = instruction.next;
+	}
+
+	if(!reserve(MAX_BLOCK_BYTES)){
+		return nullptr;
+	}
+
+	Emitter e(code, CODE_CACHE_SIZE, codeUsed);
+	const size_t start = e.offset();
+	const PendingFlags none;
+	emitDirtyPages(e, vm, indices);
+
+	uint16_t pc = vm.registers[FVM::REGISTER_PC];
+	for(uint32_t i : indices){
+		const FVM::DecodedInstruction& instruction = program[i];
+		uint16_t mask = 0;
+		CONDITION condition = EQUAL;
+
+		switch(static_cast<BYTECODE>(FVM::unfusedOpcode(instruction.opcode))){
+			case BYTECODE::HALT:
+				e.orRI(GUEST_FLAGS, FVM::FLAG::HLT);
+				emitExit(e, vm, none, pc, resolve);
+				break;
+
+			case BYTECODE::COMPARE:
+				emitFlags(e, guest(instruction.regA), guest(instruction.regB));
+				break;
+
+			case BYTECODE::JUMP:
+				emitExit(e, vm, none, instruction.address, instruction.target);
+				break;
+
+			default:
+				if(branchCondition(instruction.opcode, mask, condition)){
+					e.testRI(GUEST_FLAGS, mask);
+					size_t notTaken = e.jcc(EQUAL);
+					emitExit(e, vm, none, instruction.address, instruction.target);
+					e.patch(notTaken, e.offset());
+					emitExit(e, vm, none, instruction.nextPC, instruction.next);
+				}else{
+					emitOperation(e, vm, i, none);
+				}
+				break;
+		}
+		pc = instruction.nextPC;
+	}
+
+	if(!terminated){
+		emitExit(e, vm, none, endPC, end);
+	}
+
+	return finish(e, start, index);
+}
+
+/**
+ * Records the path the interpreter takes from a loop head by single stepping
+ * the VM, until it is back at the head, at another loop head, at HALT, at
+ * something the compilers cannot translate or at MAX_TRACE_INSTRUCTIONS.
+ * @param vm The VM, REG_PC at the loop head. It is left wherever recording stopped.
+ * @param head The decoded program index of the loop head.
+ * @param trace Receives every instruction executed while recording.
+ * @param closed Set if the trace ends back at the head.
+ * @return False if the trace must be thrown away: a step failed or wrote into
+ *         the loaded image, or the trace neither ends back at the head nor at
+ *         another loop head.
+ */
+bool JIT::recordTrace(FVM& vm, const uint32_t head, std::vector<TraceStep>& trace, bool& closed){
+	closed = false;
+	uint32_t index = head;
+	while(trace.size() < MAX_TRACE_INSTRUCTIONS){
+		const FVM::DecodedInstruction& instruction = vm.program[index];
+		if(!isCompilable(vm, instruction) || FVM::unfusedOpcode(instruction.opcode) == static_cast<uint8_t>(BYTECODE::HALT) || (index != head && loopHeads[index])){
+			break;
+		}
+
+		if(vm.step() != RESULT_CODE::SUCCESS){
+			return false;
+		}
+		trace.push_back({index, vm.registers[FVM::REGISTER_PC] == instruction.address});
+		if(vm.programStale){
+			return false;
+		}
+
+		index = vm.programLookup(vm.registers[FVM::REGISTER_PC]);
+		if(index == vm.programResolve){
+			break;
+		}
+		if(index == head){
+			closed = true;
+			break;
+		}
+	}
+
+	// A trace that runs into code the compilers leave alone would exit every iteration, blocks do better there
+	return closed || (index != vm.programResolve && loopHeads[index]);
+}
+
+/**
+ * Compiles a recorded trace as one straight line of native code.
+ * Conditional jumps turn into guards that leave through a side exit, placed
+ * after the trace, whenever the outcome differs from the recorded one.
+ * COMPARE only computes REG_FLAGS when its registers are about to change or
+ * native code is about to be left. A closed trace jumps back to its start,
+ * where REG_FLAGS is only computed if the trace can read or leave before its
+ * first COMPARE.
+ * @param vm The VM, REG_PC where the trace ends.
+ * @param trace The instructions recorded by recordTrace(), starting at the loop head.
+ * @param closed Whether the trace ends back at the loop head.
+ * @return The trace's native code, or nullptr if it could not be compiled.
+ */
+const uint8_t* JIT::compileTrace(FVM& vm, const std::vector<TraceStep>& trace, const bool closed){
+	const std::vector<FVM::DecodedInstruction>& program = vm.program;
+	const uint32_t head = trace.front().index;
+
+	std::vector<uint32_t> indices;
+	for(const TraceStep& step : trace){
+		indices.push_back(step.index);
+	}
+
+	// Whether REG_FLAGS as left by the end of an iteration can still be read, or seen from outside
+	bool flagsLiveAtHead = true;
+	for(const TraceStep& step : trace){
+		const FVM::DecodedInstruction& instruction = program[step.index];
+		uint16_t mask = 0;
+		CONDITION condition = EQUAL;
+		if(FVM::unfusedOpcode(instruction.opcode) == static_cast<uint8_t>(BYTECODE::COMPARE)){
+			flagsLiveAtHead = false;
+			break;
+		}
+		if(branchCondition(instruction.opcode, mask, condition) || mayExitStale(vm, step.index)){
+			break;
+		}
+	}
+
+	if(!reserve(MAX_TRACE_BYTES)){
+		return nullptr;
+	}
+
+	Emitter e(code, CODE_CACHE_SIZE, codeUsed);
+	const size_t start = e.offset();
+	emitDirtyPages(e, vm, indices);
+	const size_t loop = e.offset();
+
+	struct SideExit {
+		size_t site;
+		PendingFlags flags;
+		uint16_t pc;
+		uint32_t target;
+	};
+	std::vector<SideExit> sideExits;
+	PendingFlags flags;
+
+	for(const TraceStep& step : trace){
+		const FVM::DecodedInstruction& instruction = program[step.index];
+		const uint8_t opcode = FVM::unfusedOpcode(instruction.opcode);
+		uint16_t mask = 0;
+		CONDITION condition = EQUAL;
+
+		if(opcode == static_cast<uint8_t>(BYTECODE::COMPARE)){
+			flags = {true, instruction.regA, instruction.regB};
+		}else if(opcode == static_cast<uint8_t>(BYTECODE::JUMP)){
+			// The trace simply carries on at the target
+		}else if(branchCondition(opcode, mask, condition)){
+			size_t site = 0;
+			if(flags.pending){
+				e.cmpRR(guest(flags.regA), guest(flags.regB));
+				site = e.jcc(step.taken ? negate(condition) : condition);
+			}else{
+				e.testRI(GUEST_FLAGS, mask);
+				site = e.jcc(step.taken ? EQUAL : NOT_EQUAL);
+			}
+			if(step.taken){
+				sideExits.push_back({site, flags, instruction.nextPC, instruction.next});
+			}else{
+				sideExits.push_back({site, flags, instruction.address, instruction.target});
+			}
+		}else{
+			if(flags.pending && (writesRegister(instruction, flags.regA) || writesRegister(instruction, flags.regB))){
+				emitFlags(e, guest(flags.regA), guest(flags.regB));
+				flags.pending = false;
+			}
+			emitOperation(e, vm, step.index, flags);
+		}
+	}
+
+	if(closed){
+		if(flags.pending && flagsLiveAtHead){
+			emitFlags(e, guest(flags.regA), guest(flags.regB));
+		}
+		e.patch(e.jmp(), loop);
+	}else{
+		const uint16_t endPC = vm.registers[FVM::REGISTER_PC];
+		emitExit(e, vm, flags, endPC, vm.programLookup(endPC));
+	}
+
+	for(const SideExit& sideExit : sideExits){
+		e.patch(sideExit.site, e.offset());
+		emitExit(e, vm, sideExit.flags, sideExit.pc, sideExit.target);
+	}
+
+	const uint8_t* native = finish(e, start, head);
+	if(native != nullptr){
+		traces++;
+	}
+	return native;
+}
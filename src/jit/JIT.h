@@ -0,0 +1,135 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class FVM;
+
+namespace x64 {
+	class Emitter;
+}
+
+#ifndef FVM_JIT_THRESHOLD
+	#define FVM_JIT_THRESHOLD 16
+#endif
+
+#ifndef FVM_JIT_TRACE_THRESHOLD
+	#define FVM_JIT_TRACE_THRESHOLD 8
+#endif
+
+/**
+ * Basic block and trace JIT tiers for x86-64, compiled in with FVM_JIT.
+ *
+ * The interpreter counts taken jumps per target in the decoded program. Once a
+ * target is hot its basic block, the straight-line run of decoded
+ * instructions up to a JUMP/JUMPxx/HALT, is compiled to native code.
+ * Guest REG_0..REG_7 live in R8D..R15D and REG_FLAGS in ESI for as long as
+ * native code runs. Block exits store the PC and jump to a shared exit stub,
+ * and are patched to jump straight into the target block once it is compiled.
+ *
+ * Targets of backward jumps are loop heads and get a trace instead. Once a
+ * loop head is hot the interpreter single steps one iteration from it and
+ * records the path taken, across blocks, until it is back at the head. The
+ * trace is compiled as one straight line: every conditional jump becomes a
+ * guard on the outcome that was recorded, with a side exit back to the
+ * interpreter or into native code for the other way, and the end of the
+ * trace jumps back to its start. A COMPARE in a trace only computes REG_FLAGS
+ * where something can read them, a guard compares the registers directly.
+ * Recording stops early at another loop head, so nested loops are one trace
+ * per loop chained through their exits.
+ *
+ * Anything the compilers do not handle (DIVIDE, REG_PC/REG_FLAGS operands,
+ * instructions outside the decoded stream) ends the block or trace and is
+ * left to the interpreter. Loads and stores to constant addresses outside the
+ * loaded image access guest memory directly, native code marks the pages it
+ * may store to dirty on entry. Other stores call back into
+ * FVM::writeUInt16 and leave native code as soon as one lands inside the
+ * loaded image.
+ */
+class JIT {
+	public:
+		static constexpr uint32_t HOT_THRESHOLD = FVM_JIT_THRESHOLD;
+		static constexpr uint32_t TRACE_THRESHOLD = FVM_JIT_TRACE_THRESHOLD;
+		static constexpr size_t CODE_CACHE_SIZE = 1 << 20;
+		static constexpr size_t MAX_BLOCK_INSTRUCTIONS = 64;
+		static constexpr size_t MAX_TRACE_INSTRUCTIONS = 128;
+
+		JIT();
+		~JIT();
+
+		JIT(const JIT&) = delete;
+		JIT& operator=(const JIT&) = delete;
+
+		/**
+		 * Runs native code from a decoded program index, compiling it first if it
+		 * just became hot, and keeps running native code from wherever that exits
+		 * to for as long as there is some.
+		 * @return Whether the VM ran. REG_PC then holds the address to resume at.
+		 */
+		bool execute(FVM& vm, uint32_t index);
+
+		/* Drops all native code and finds the loop heads, called whenever the program is re-decoded */
+		void reset(const FVM& vm);
+
+		bool available() const { return code != nullptr; }
+
+		/* Number of traces compiled since the last reset() */
+		size_t traceCount() const { return traces; }
+
+	private:
+		using Entry = void (*)(uint16_t* registers, FVM* vm, const uint8_t* block);
+
+		/* One instruction of a recorded trace and, for conditional jumps, whether it was taken */
+		struct TraceStep {
+			uint32_t index;
+			bool taken;
+		};
+
+		/* The COMPARE whose REG_FLAGS a trace has not computed yet, if any */
+		struct PendingFlags {
+			bool pending = false;
+			uint8_t regA = 0;
+			uint8_t regB = 0;
+		};
+
+		/* Native code for a decoded program index, a block or a trace, nullptr if not compiled */
+		std::vector<const uint8_t*> blocks;
+		std::vector<uint32_t> counters;
+		std::vector<bool> uncompilable;
+		/* Targets of backward jumps, which get a trace rather than a block */
+		std::vector<bool> loopHeads;
+		size_t traces = 0;
+
+		/* Exit jumps waiting for the block at a program index to be compiled */
+		std::unordered_map<uint32_t, std::vector<size_t>> pendingExits;
+
+		uint8_t* code = nullptr;
+		size_t codeUsed = 0;
+		size_t trampolineEnd = 0;
+		size_t exitStub = 0;
+		Entry entry = nullptr;
+
+		static uint32_t writeUInt16(FVM* vm, uint32_t address, uint32_t value);
+		static void markDirty(FVM* vm, uint32_t address);
+		static bool storesDirectly(const FVM& vm, const uint32_t index);
+		static bool mayExitStale(const FVM& vm, const uint32_t index);
+
+		void emitTrampoline();
+		void flush();
+		const uint8_t* compile(FVM& vm, const uint32_t index);
+		bool recordTrace(FVM& vm, const uint32_t head, std::vector<TraceStep>& trace, bool& closed);
+		const uint8_t* compileTrace(FVM& vm, const std::vector<TraceStep>& trace, const bool closed);
+		void setWritable(bool writable);
+
+		/* Shared by both tiers, see JIT.cpp */
+		bool reserve(const size_t bytes);
+		const uint8_t* finish(x64::Emitter& e, const size_t start, const uint32_t index);
+		void emitDirtyPages(x64::Emitter& e, const FVM& vm, const std::vector<uint32_t>& indices);
+		void emitExit(x64::Emitter& e, const FVM& vm, const PendingFlags& flags, const uint16_t pc, const uint32_t target);
+		void emitOperation(x64::Emitter& e, const FVM& vm, const uint32_t index, const PendingFlags& flags);
+};
+
+#endif
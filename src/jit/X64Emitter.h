@@ -0,0 +1,248 @@
+#ifndef X64_EMITTER_H
+#define X64_EMITTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Minimal x86-64 machine code emitter used by the JIT.
+ * Only the handful of encodings the block and trace compilers need are provided.
+ * Register operands are host register numbers (RAX = 0 ... R15 = 15), all
+ * arithmetic is 32-bit and memory operands are [base + disp8], where base
+ * must not be RSP or R12 since those would need a SIB byte.
+ */
+namespace x64 {
+
+	enum REG : uint8_t {
+		RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15,
+	};
+
+	/* Condition codes after an unsigned compare, flipping the low bit negates one */
+	enum CONDITION : uint8_t {
+		BELOW = 0x2,
+		ABOVE_EQUAL = 0x3,
+		EQUAL = 0x4,
+		NOT_EQUAL = 0x5,
+		BELOW_EQUAL = 0x6,
+		ABOVE = 0x7,
+	};
+
+	constexpr CONDITION negate(const CONDITION condition){
+		return static_cast<CONDITION>(condition ^ 1);
+	}
+
+	class Emitter {
+		public:
+			Emitter(uint8_t* buffer, size_t capacity, size_t position = 0) : buffer(buffer), capacity(capacity), position(position) {}
+
+			size_t offset() const { return position; }
+			uint8_t* pointer() const { return buffer + position; }
+			bool overflowed() const { return position > capacity; }
+
+			void emit8(uint8_t value){
+				if(position < capacity){
+					buffer[position] = value;
+				}
+				position++;
+			}
+
+			void emit16(uint16_t value){ emitBytes(&value, sizeof(value)); }
+			void emit32(uint32_t value){ emitBytes(&value, sizeof(value)); }
+			void emit64(uint64_t value){ emitBytes(&value, sizeof(value)); }
+
+			/* ---- Register to register, 32-bit ---- */
+
+			void movRR(REG dst, REG src){ aluRR(0x89, dst, src); }
+			void addRR(REG dst, REG src){ aluRR(0x01, dst, src); }
+			void subRR(REG dst, REG src){ aluRR(0x29, dst, src); }
+			void andRR(REG dst, REG src){ aluRR(0x21, dst, src); }
+			void orRR(REG dst, REG src){ aluRR(0x09, dst, src); }
+			void xorRR(REG dst, REG src){ aluRR(0x31, dst, src); }
+			/* Sets flags from lhs - rhs */
+			void cmpRR(REG lhs, REG rhs){ aluRR(0x39, lhs, rhs); }
+
+			void imulRR(REG dst, REG src){
+				rex(false, dst, src);
+				emit8(0x0F);
+				emit8(0xAF);
+				modrm(3, dst, src);
+			}
+
+			void cmovRR(CONDITION condition, REG dst, REG src){
+				rex(false, dst, src);
+				emit8(0x0F);
+				emit8(0x40 | condition);
+				modrm(3, dst, src);
+			}
+
+			/* Zero extends the low 16 bits of src into dst */
+			void movzx16RR(REG dst, REG src){
+				rex(false, dst, src);
+				emit8(0x0F);
+				emit8(0xB7);
+				modrm(3, dst, src);
+			}
+
+			void movRR64(REG dst, REG src){
+				rex(true, src, dst);
+				emit8(0x89);
+				modrm(3, src, dst);
+			}
+
+			void addRR64(REG dst, REG src){
+				rex(true, src, dst);
+				emit8(0x01);
+				modrm(3, src, dst);
+			}
+
+			/* ---- Register and immediate ---- */
+
+			void movRI(REG dst, uint32_t immediate){
+				if(dst >= R8){
+					emit8(0x41);
+				}
+				emit8(0xB8 | (dst & 7));
+				emit32(immediate);
+			}
+
+			void movRI64(REG dst, uint64_t immediate){
+				emit8(0x48 | (dst >= R8 ? 1 : 0));
+				emit8(0xB8 | (dst & 7));
+				emit64(immediate);
+			}
+
+			void orRI(REG dst, uint32_t immediate){ unaryR(0x81, 1, dst); emit32(immediate); }
+			void testRI(REG dst, uint32_t immediate){ unaryR(0xF7, 0, dst); emit32(immediate); }
+			void shlRI(REG dst, uint8_t count){ unaryR(0xC1, 4, dst); emit8(count); }
+			void shrRI(REG dst, uint8_t count){ unaryR(0xC1, 5, dst); emit8(count); }
+			void incR(REG dst){ unaryR(0xFF, 0, dst); }
+			void decR(REG dst){ unaryR(0xFF, 1, dst); }
+			void notR(REG dst){ unaryR(0xF7, 2, dst); }
+			void testRR(REG lhs, REG rhs){ aluRR(0x85, lhs, rhs); }
+
+			/* ---- 16-bit memory at [base + disp8] ---- */
+
+			void store16(REG base, int8_t displacement, REG src){
+				emit8(0x66);
+				rex(false, src, base);
+				emit8(0x89);
+				modrm(1, src, base);
+				emit8(static_cast<uint8_t>(displacement));
+			}
+
+			void store16I(REG base, int8_t displacement, uint16_t immediate){
+				emit8(0x66);
+				rex(false, RAX, base);
+				emit8(0xC7);
+				modrm(1, RAX, base);
+				emit8(static_cast<uint8_t>(displacement));
+				emit16(immediate);
+			}
+
+			void load16(REG dst, REG base, int8_t displacement){
+				rex(false, dst, base);
+				emit8(0x0F);
+				emit8(0xB7);
+				modrm(1, dst, base);
+				emit8(static_cast<uint8_t>(displacement));
+			}
+
+			/* cmp byte [base + disp8], imm8 */
+			void cmp8I(REG base, int8_t displacement, uint8_t immediate){
+				rex(false, 0, base);
+				emit8(0x80);
+				modrm(1, 7, base);
+				emit8(static_cast<uint8_t>(displacement));
+				emit8(immediate);
+			}
+
+			/* ---- Stack and control flow ---- */
+
+			void push(REG reg){
+				if(reg >= R8){
+					emit8(0x41);
+				}
+				emit8(0x50 | (reg & 7));
+			}
+
+			void pop(REG reg){
+				if(reg >= R8){
+					emit8(0x41);
+				}
+				emit8(0x58 | (reg & 7));
+			}
+
+			void subRSP(uint8_t amount){ emit8(0x48); emit8(0x83); emit8(0xEC); emit8(amount); }
+			void addRSP(uint8_t amount){ emit8(0x48); emit8(0x83); emit8(0xC4); emit8(amount); }
+
+			void callR(REG target){ unaryR(0xFF, 2, target); }
+			void jmpR(REG target){ unaryR(0xFF, 4, target); }
+			void ret(){ emit8(0xC3); }
+
+			/* Emits jmp rel32 and returns the offset of the rel32 so it can be patched */
+			size_t jmp(){
+				emit8(0xE9);
+				size_t site = position;
+				emit32(0);
+				return site;
+			}
+
+			/* Emits jcc rel32 and returns the offset of the rel32 so it can be patched */
+			size_t jcc(CONDITION condition){
+				emit8(0x0F);
+				emit8(0x80 | condition);
+				size_t site = position;
+				emit32(0);
+				return site;
+			}
+
+			/* Points a rel32 emitted by jmp() or jcc() at a buffer offset */
+			void patch(size_t site, size_t target){
+				int32_t relative = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(site + 4));
+				if(site + 4 <= capacity){
+					std::memcpy(buffer + site, &relative, sizeof(relative));
+				}
+			}
+
+		private:
+			void emitBytes(const void* bytes, size_t count){
+				const uint8_t* data = static_cast<const uint8_t*>(bytes);
+				for(size_t i = 0; i < count; i++){
+					emit8(data[i]);
+				}
+			}
+
+			void rex(bool wide, uint8_t reg, uint8_t rm){
+				uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+				if(prefix != 0x40){
+					emit8(prefix);
+				}
+			}
+
+			void modrm(uint8_t mod, uint8_t reg, uint8_t rm){
+				emit8(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+			}
+
+			/* op r/m32, r32 */
+			void aluRR(uint8_t opcode, REG rm, REG reg){
+				rex(false, reg, rm);
+				emit8(opcode);
+				modrm(3, reg, rm);
+			}
+
+			/* op /extension r/m32 */
+			void unaryR(uint8_t opcode, uint8_t extension, REG rm){
+				rex(false, 0, rm);
+				emit8(opcode);
+				modrm(3, extension, rm);
+			}
+
+			uint8_t* buffer;
+			size_t capacity;
+			size_t position;
+	};
+}
+
+#endif
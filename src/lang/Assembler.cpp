@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+#include "../ByteCode.h"
+#include "Assembler.h"
+
+static bool isSpace(const char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Cuts the next whitespace separated token off the front of a line.
+ * A ';' ends the line.
+ * @param line The rest of the line, advanced past the token.
+ * @return The token, empty at the end of the line.
+ */
+static std::string_view nextToken(std::string_view& line){
+	size_t begin = 0;
+	while(begin < line.size() && isSpace(line[begin])){
+		begin++;
+	}
+	if(begin == line.size() || line[begin] == ';'){
+		line = std::string_view();
+		return std::string_view();
+	}
+
+	size_t end = begin;
+	while(end < line.size() && !isSpace(line[end]) && line[end] != ';'){
+		end++;
+	}
+
+	std::string_view token = line.substr(begin, end - begin);
+	line.remove_prefix(end);
+	return token;
+}
+
+static std::string_view stripHexPrefix(std::string_view token){
+	if(token.size() > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')){
+		token.remove_prefix(2);
+	}
+	return token;
+}
+
+/* Whether a token is written as a number, whether or not it fits in 16 bits */
+static bool isNumber(std::string_view token){
+	token = stripHexPrefix(token);
+	return !token.empty() && std::all_of(token.begin(), token.end(), [](char c){ return std::isxdigit(static_cast<unsigned char>(c)) != 0; });
+}
+
+/**
+ * Parses a hexadecimal literal, optionally prefixed with 0x.
+ * @param token The token to parse.
+ * @param value Set to the parsed value.
+ * @return Whether the whole token is a number that fits in 16 bits.
+ */
+static bool parseNumber(std::string_view token, uint16_t& value){
+	token = stripHexPrefix(token);
+
+	uint32_t parsed = 0;
+	std::from_chars_result result = std::from_chars(token.data(), token.data() + token.size(), parsed, 16);
+	if(result.ec != std::errc() || result.ptr != token.data() + token.size() || parsed > 0xFFFF){
+		return false;
+	}
+	value = static_cast<uint16_t>(parsed);
+	return true;
+}
+
+/**
+ * Splits a label reference of the form label+offset.
+ * @param name The reference, cut down to the label name.
+ * @param offset Set to the hexadecimal offset, 0 if there is none.
+ * @return Whether the offset, if any, is a number that fits in 16 bits.
+ */
+static bool splitOffset(std::string_view& name, uint16_t& offset){
+	size_t plus = name.find('+');
+	if(plus == std::string_view::npos){
+		return true;
+	}
+
+	std::string_view number = name.substr(plus + 1);
+	name = name.substr(0, plus);
+	return isNumber(number) && parseNumber(number, offset);
+}
+
+static void putUInt16(uint8_t* out, const uint16_t value){
+	out[0] = static_cast<uint8_t>(value & 0xFF);
+	out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+/**
+ * Assembles a funasm source into bytecode.
+ * @param source The source text. Only needs to live until assemble() returns.
+ * @return RESULT_CODE SUCCESS, or UNKNOWN_INSTRUCTION, INCORRECT_NUM_ARGS,
+ * INVALID_ARGUMENT or UNDEFINED_LABEL for the first error, see errorLine().
+ */
+RESULT Assembler::assemble(std::string_view source){
+	RESULT result = assembleChunk(source, 1);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+	return resolveFixups();
+}
+
+/**
+ * Assembles a funasm source on several threads, see the class description.
+ * The result is the same as assemble() would produce. Sources too small to
+ * give every thread MIN_CHUNK_SIZE bytes use fewer threads.
+ * @param source The source text. Only needs to live until assembleParallel() returns.
+ * @param threads The maximum number of threads to use.
+ * @return RESULT_CODE SUCCESS, or the error of the earliest failing line, see errorLine().
+ */
+RESULT Assembler::assembleParallel(std::string_view source, const size_t threads){
+	size_t chunkCount = std::clamp<size_t>(source.size() / MIN_CHUNK_SIZE, 1, std::max<size_t>(threads, 1));
+	if(chunkCount == 1){
+		return assemble(source);
+	}
+
+	// Split at line boundaries, counting lines so every chunk reports absolute line numbers
+	std::vector<std::string_view> pieces;
+	std::vector<size_t> firstLines;
+	size_t begin = 0;
+	size_t line = 1;
+	for(size_t i = 0; i < chunkCount; i++){
+		size_t end = source.size();
+		if(i + 1 < chunkCount){
+			end = source.find('\n', std::max(begin, source.size() * (i + 1) / chunkCount));
+			end = end == std::string_view::npos ? source.size() : end + 1;
+		}
+		pieces.push_back(source.substr(begin, end - begin));
+		firstLines.push_back(line);
+		line += static_cast<size_t>(std::count(pieces.back().begin(), pieces.back().end(), '\n'));
+		begin = end;
+	}
+
+	std::vector<Assembler> chunks(chunkCount);
+	std::vector<RESULT> results(chunkCount, RESULT_CODE::SUCCESS);
+	std::vector<std::thread> workers;
+	for(size_t i = 0; i < chunkCount; i++){
+		workers.emplace_back([&, i]{
+			chunks[i].deferLabels = true;
+			results[i] = chunks[i].assembleChunk(pieces[i], firstLines[i]);
+		});
+	}
+	for(std::thread& worker : workers){
+		worker.join();
+	}
+
+	for(size_t i = 0; i < chunkCount; i++){
+		if(results[i] != RESULT_CODE::SUCCESS){
+			failedLine = chunks[i].failedLine;
+			return results[i];
+		}
+	}
+
+	// Lay the chunks out one after another and rebase everything they recorded
+	used = 0;
+	for(const Assembler& chunk : chunks){
+		used += chunk.used;
+	}
+	output.assign(used, 0);
+	labels.clear();
+	fixups.clear();
+	blocks.assign(1, 0);
+	targets.clear();
+	failedLine = 0;
+
+	size_t base = 0;
+	for(Assembler& chunk : chunks){
+		std::copy(chunk.output.begin(), chunk.output.begin() + static_cast<std::ptrdiff_t>(chunk.used), output.begin() + static_cast<std::ptrdiff_t>(base));
+
+		for(const auto& [name, label] : chunk.labels){
+			if(!labels.emplace(name, Label{base + label.address, label.line}).second){
+				return fail(RESULT_CODE::INVALID_ARGUMENT, label.line, "Duplicate label", name);
+			}
+		}
+		for(const Fixup& fixup : chunk.fixups){
+			fixups.push_back({base + fixup.at, fixup.line, fixup.label, fixup.offset, fixup.branch});
+		}
+		// Every chunk starts its list with its own offset 0, which is not a block start
+		for(size_t j = 1; j < chunk.blocks.size(); j++){
+			blocks.push_back(base + chunk.blocks[j]);
+		}
+		targets.insert(targets.end(), chunk.targets.begin(), chunk.targets.end());
+
+		base += chunk.used;
+	}
+
+	return resolveFixups();
+}
+
+/**
+ * Assembles lines into a fresh output buffer, leaving forward references as fixups.
+ * @param source The lines to assemble.
+ * @param firstLine The line number of the first line, for error messages.
+ * @return RESULT_CODE SUCCESS, or the error of the first failing line.
+ */
+RESULT Assembler::assembleChunk(std::string_view source, const size_t firstLine){
+	// No statement encodes to more bytes than it has characters: a mnemonic
+	// is at least two characters for the opcode byte, and every argument at
+	// least two with its separator for at most two bytes.
+	output.assign(source.size(), 0);
+	used = 0;
+	labels.clear();
+	fixups.clear();
+	blocks.assign(1, 0);
+	targets.clear();
+	failedLine = 0;
+
+	size_t lineNumber = firstLine;
+	while(!source.empty()){
+		const char* newline = static_cast<const char*>(std::memchr(source.data(), '\n', source.size()));
+		size_t lineLength = newline != nullptr ? static_cast<size_t>(newline - source.data()) : source.size();
+
+		RESULT result = assembleLine(source.substr(0, lineLength), lineNumber);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+
+		source.remove_prefix(newline != nullptr ? lineLength + 1 : lineLength);
+		lineNumber++;
+	}
+
+	output.resize(used);
+	return RESULT_CODE::SUCCESS;
+}
+
+std::vector<uint8_t> Assembler::releaseBytecode(){
+	used = 0;
+	return std::move(output);
+}
+
+std::vector<uint16_t> Assembler::blockStarts() const {
+	std::vector<uint16_t> starts;
+	for(size_t block : blocks){
+		if(block < used && block <= 0xFFFF){
+			starts.push_back(static_cast<uint16_t>(block));
+		}
+	}
+	for(uint16_t target : targets){
+		if(target < used){
+			starts.push_back(target);
+		}
+	}
+	return starts;
+}
+
+RESULT Assembler::assembleLine(std::string_view line, const size_t lineNumber){
+	std::string_view token = nextToken(line);
+	if(token.empty()){
+		return RESULT_CODE::SUCCESS;
+	}
+
+	if(token.back() == ':'){
+		std::string_view name = token.substr(0, token.size() - 1);
+		if(name.empty() || isNumber(name) || name.find('+') != std::string_view::npos || BYTECODE_INFO::objectFromName(name) != nullptr){
+			return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Invalid label name", name);
+		}
+		if(!labels.emplace(name, Label{used, lineNumber}).second){
+			return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Duplicate label", name);
+		}
+
+		token = nextToken(line);
+		if(token.empty()){
+			return RESULT_CODE::SUCCESS;
+		}
+	}
+
+	const BYTECODE_INFO::BYTECODE_OBJECT* object = BYTECODE_INFO::objectFromName(token);
+	if(object == nullptr || object->isRegister){
+		return fail(RESULT_CODE::UNKNOWN_INSTRUCTION, lineNumber, "Unknown instruction", token);
+	}
+
+	bool branch = object->bytecode >= BYTECODE::JUMP && object->bytecode <= BYTECODE::JUMPGTE;
+	uint8_t* out = output.data() + used;
+	*out++ = static_cast<uint8_t>(object->bytecode);
+
+	for(size_t i = 0; i < object->argCount; i++){
+		std::string_view argument = nextToken(line);
+		if(argument.empty()){
+			return fail(RESULT_CODE::INCORRECT_NUM_ARGS, lineNumber, "Missing argument to", token);
+		}
+
+		switch(object->args[i]){
+			case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
+				{
+					const BYTECODE_INFO::BYTECODE_OBJECT* registerObject = BYTECODE_INFO::objectFromName(argument);
+					if(registerObject == nullptr || !registerObject->isRegister){
+						return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Expected a register", argument);
+					}
+					*out++ = static_cast<uint8_t>(registerObject->bytecode);
+					break;
+				}
+			case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
+			case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
+				{
+					uint16_t value = 0;
+					bool pending = false;
+					if(isNumber(argument)){
+						if(!parseNumber(argument, value)){
+							return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Number is out of 16 bit range", argument);
+						}
+					}else{
+						std::string_view name = argument;
+						uint16_t offset = 0;
+						if(!splitOffset(name, offset)){
+							return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Invalid label offset", argument);
+						}
+
+						std::unordered_map<std::string_view, Label>::const_iterator label = labels.find(name);
+						if(deferLabels || label == labels.end()){
+							fixups.push_back({static_cast<size_t>(out - output.data()), lineNumber, name, offset, branch});
+							pending = true;
+						}else if(label->second.address + offset > 0xFFFF){
+							return fail(RESULT_CODE::INVALID_ARGUMENT, lineNumber, "Label is out of 16 bit range", argument);
+						}else{
+							value = static_cast<uint16_t>(label->second.address + offset);
+						}
+					}
+					if(branch && !pending){
+						targets.push_back(value);
+					}
+					putUInt16(out, value);
+					out += 2;
+					break;
+				}
+			case BYTECODE_INFO::ARGUMENT_TYPE::NONE:
+				break;
+		}
+	}
+
+	if(!nextToken(line).empty()){
+		return fail(RESULT_CODE::INCORRECT_NUM_ARGS, lineNumber, "Too many arguments to", token);
+	}
+
+	used += object->length;
+	if(branch || object->bytecode == BYTECODE::HALT){
+		blocks.push_back(used);
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+/* Patches every forward reference now that all labels are known */
+RESULT Assembler::resolveFixups(){
+	for(const Fixup& fixup : fixups){
+		std::unordered_map<std::string_view, Label>::const_iterator label = labels.find(fixup.label);
+		if(label == labels.end()){
+			return fail(RESULT_CODE::UNDEFINED_LABEL, fixup.line, "Undefined label", fixup.label);
+		}
+		if(label->second.address + fixup.offset > 0xFFFF){
+			return fail(RESULT_CODE::INVALID_ARGUMENT, fixup.line, "Label is out of 16 bit range", fixup.label);
+		}
+
+		uint16_t value = static_cast<uint16_t>(label->second.address + fixup.offset);
+		putUInt16(output.data() + fixup.at, value);
+		if(fixup.branch){
+			targets.push_back(value);
+		}
+	}
+	fixups.clear();
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Assembler::fail(const RESULT& result, const size_t lineNumber, std::string_view message, std::string_view token){
+	failedLine = lineNumber;
+	SPDLOG_ERROR("Line " + std::to_string(lineNumber) + ": " + std::string(message) + " '" + std::string(token) + "'");
+	return result;
+}
@@ -0,0 +1,82 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../ResultCode.h"
+
+/**
+ * Single pass funasm assembler.
+ *
+ * Every line holds at most one statement:
+ *   [label:] [MNEMONIC [argument [argument]]] [; comment]
+ * Literal and address arguments are hexadecimal numbers, with or without a
+ * 0x prefix, or the name of a label, optionally followed by a hexadecimal
+ * offset as in label+2. Label names may not be valid numbers, mnemonics or
+ * register names. A reference to a label that is defined later
+ * is written as zero and patched once the whole source has been read.
+ *
+ * Tokens are string_views into the source and bytecode is written straight
+ * into an output buffer sized for the whole source up front, so nothing is
+ * allocated per line. Only label definitions and forward references
+ * allocate.
+ *
+ * assembleParallel() splits large sources at line boundaries and assembles
+ * the chunks on separate threads, each into its own buffer and label table
+ * with every label reference left as a fixup. A final pass places the chunks
+ * one after another, merges their labels and patches all fixups.
+ */
+class Assembler {
+	public:
+		/* Sources are only split into chunks of at least this many bytes */
+		static constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+		RESULT assemble(std::string_view source);
+		RESULT assembleParallel(std::string_view source, const size_t threads);
+
+		/* The assembled bytecode, valid after a successful assemble() */
+		std::vector<uint8_t> releaseBytecode();
+
+		/* Basic block starts for FBCImage::setBlocks(): address 0, branch targets and the addresses after branches and HALT */
+		std::vector<uint16_t> blockStarts() const;
+
+		/* 1-based line of the error assemble() stopped at, 0 after success */
+		size_t errorLine() const { return failedLine; }
+
+	private:
+		struct Label {
+			size_t address;
+			size_t line;
+		};
+
+		struct Fixup {
+			size_t at;
+			size_t line;
+			std::string_view label;
+			uint16_t offset;
+			bool branch;
+		};
+
+		std::vector<uint8_t> output;
+		size_t used = 0;
+
+		std::unordered_map<std::string_view, Label> labels;
+		std::vector<Fixup> fixups;
+		/* Block starts as offsets into output, and branch targets as written */
+		std::vector<size_t> blocks;
+		std::vector<uint16_t> targets;
+		size_t failedLine = 0;
+
+		/* Leaves every label reference as a fixup, for chunks of a parallel assembly */
+		bool deferLabels = false;
+
+		RESULT assembleChunk(std::string_view source, const size_t firstLine);
+		RESULT assembleLine(std::string_view line, const size_t lineNumber);
+		RESULT resolveFixups();
+		RESULT fail(const RESULT& result, const size_t lineNumber, std::string_view message, std::string_view token);
+};
+
+#endif
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+#include "spdlog/spdlog.h"
+
+#include "../ByteCode.h"
+#include "CodeGenerator.h"
+
+using ir::OP;
+using ir::Value;
+using ir::VReg;
+
+static constexpr std::array<std::string_view, 8> REGISTER_NAMES = {
+	"REG_0", "REG_1", "REG_2", "REG_3", "REG_4", "REG_5", "REG_6", "REG_7"
+};
+
+static std::string hex(const uint16_t value){
+	char text[8];
+	std::snprintf(text, sizeof(text), "0x%X", static_cast<unsigned>(value));
+	return text;
+}
+
+static std::string label(const uint32_t block){
+	return "L" + std::to_string(block);
+}
+
+/* Where the store stub with this index jumps back to */
+static std::string stubReturn(const size_t stub){
+	return "R" + std::to_string(stub);
+}
+
+/**
+ * Allocates registers for a function and writes it out as funasm.
+ * @param function Optimized IR, blocks are laid out in order.
+ * @param funasm The assembly is appended to it.
+ * @return RESULT_CODE SUCCESS, or INVALID_ARGUMENT for a shift by a variable amount, too many spills or too many
+ * stores through computed addresses, see errorLine().
+ */
+RESULT CodeGenerator::generate(const ir::Function& function, std::string& funasm){
+	this->function = &function;
+	failedLine = 0;
+	stubs.clear();
+
+	buildIntervals();
+	if(allocate(7)){
+		scratch = spillScratch = 7;
+	}else{
+		allocate(6);
+		scratch = 7;
+		spillScratch = 6;
+	}
+
+	RESULT result = assignSlots();
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	std::string body;
+	out = &body;
+	std::vector<bool> targeted(function.blocks.size(), false);
+	for(const ir::Block& block : function.blocks){
+		for(uint32_t successor : block.successors()){
+			targeted[successor] = true;
+		}
+	}
+
+	for(uint32_t i = 0; i < function.blocks.size(); i++){
+		if(targeted[i]){
+			body += label(i) + ":\n";
+		}
+		for(const ir::Instruction& instruction : function.blocks[i].instructions){
+			if((result = generateInstruction(instruction, i + 1)) != RESULT_CODE::SUCCESS){
+				return result;
+			}
+		}
+	}
+
+	// Every store stub is written before the program can get to it
+	out = &funasm;
+	for(size_t i = 0; i < stubs.size(); i++){
+		const uint16_t stub = static_cast<uint16_t>(STUB_BASE + i * STUB_SIZE);
+		const uint16_t reg = static_cast<uint16_t>(static_cast<uint8_t>(BYTECODE::REG_0) + stubs[i]);
+		emit("MOVELM", hex(static_cast<uint16_t>(static_cast<uint8_t>(BYTECODE::MOVERM) | reg << 8)), hex(stub));
+		emit("MOVELM", hex(static_cast<uint8_t>(BYTECODE::JUMP)), hex(static_cast<uint16_t>(stub + 4)));
+		emit("MOVELM", stubReturn(i), hex(static_cast<uint16_t>(stub + 5)));
+	}
+	funasm += body;
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Numbers the instructions in layout order and computes the interval each
+ * virtual register is live over. An instruction reads its operands at
+ * position 2n and writes its result at 2n + 1, so a result can take the
+ * register of an operand that dies there.
+ */
+void CodeGenerator::buildIntervals(){
+	intervals.assign(function->vregCount(), Interval());
+	ir::Liveness liveness = ir::computeLiveness(*function);
+
+	auto extend = [this](const VReg vreg, const size_t position){
+		intervals[vreg].start = std::min(intervals[vreg].start, position);
+		intervals[vreg].end = std::max(intervals[vreg].end, position);
+	};
+
+	size_t index = 0;
+	for(size_t b = 0; b < function->blocks.size(); b++){
+		const std::vector<ir::Instruction>& instructions = function->blocks[b].instructions;
+		const size_t first = index;
+		const size_t last = index + instructions.size() - 1;
+		for(VReg v = 0; v < function->vregCount(); v++){
+			if(liveness.in[b][v]){
+				extend(v, 2 * first);
+			}
+			if(liveness.out[b][v]){
+				extend(v, 2 * last + 1);
+			}
+		}
+
+		for(const ir::Instruction& instruction : instructions){
+			for(size_t operand = 0; operand < instruction.operandCount(); operand++){
+				const Value& value = operand == 0 ? instruction.a : instruction.b;
+				if(!value.isConstant()){
+					extend(value.vreg, 2 * index);
+				}
+			}
+
+			if(instruction.dest != ir::NO_VREG){
+				extend(instruction.dest, 2 * index + 1);
+				std::vector<VReg>& hints = intervals[instruction.dest].hints;
+				bool binary = instruction.operandCount() > 1 && instruction.op != OP::SHIFTLEFT && instruction.op != OP::SHIFTRIGHT;
+				if(binary && !instruction.b.isConstant()){
+					// The ALU writes its second register
+					hints.push_back(instruction.b.vreg);
+				}
+				if(!instruction.a.isConstant() && (!binary || (instruction.op != OP::SUBTRACT && instruction.op != OP::DIVIDE))){
+					hints.push_back(instruction.a.vreg);
+				}
+			}
+			index++;
+		}
+	}
+}
+
+/**
+ * Linear scan register allocation.
+ * @param allocatable Registers REG_0 up to, not including, this one are handed out.
+ * @return Whether every interval got a register.
+ */
+bool CodeGenerator::allocate(const uint8_t allocatable){
+	registers.assign(function->vregCount(), SPILLED);
+	spilled = 0;
+
+	std::vector<VReg> order;
+	for(VReg v = 0; v < intervals.size(); v++){
+		if(intervals[v].start != SIZE_MAX){
+			order.push_back(v);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [this](VReg a, VReg b){ return intervals[a].start < intervals[b].start; });
+
+	std::vector<VReg> active;
+	std::array<bool, 8> taken{};
+	for(VReg v : order){
+		const Interval& interval = intervals[v];
+		std::erase_if(active, [&](VReg other){
+			if(intervals[other].end < interval.start){
+				taken[registers[other]] = false;
+				return true;
+			}
+			return false;
+		});
+
+		int chosen = SPILLED;
+		for(VReg hint : interval.hints){
+			if(registers[hint] != SPILLED && !taken[registers[hint]]){
+				chosen = registers[hint];
+				break;
+			}
+		}
+		for(uint8_t reg = 0; reg < allocatable && chosen == SPILLED; reg++){
+			if(!taken[reg]){
+				chosen = reg;
+			}
+		}
+
+		if(chosen == SPILLED){
+			// Spill whichever of the live intervals stays live the longest
+			auto furthest = std::max_element(active.begin(), active.end(), [this](VReg a, VReg b){ return intervals[a].end < intervals[b].end; });
+			spilled++;
+			if(furthest == active.end() || intervals[*furthest].end <= interval.end){
+				continue;
+			}
+			chosen = registers[*furthest];
+			registers[*furthest] = SPILLED;
+			active.erase(furthest);
+		}
+
+		registers[v] = chosen;
+		taken[chosen] = true;
+		active.push_back(v);
+	}
+	return spilled == 0;
+}
+
+/* Gives every spilled virtual register a memory slot, sharing slots between intervals that do not overlap */
+RESULT CodeGenerator::assignSlots(){
+	slots.assign(function->vregCount(), 0);
+
+	std::vector<VReg> order;
+	for(VReg v = 0; v < intervals.size(); v++){
+		if(intervals[v].start != SIZE_MAX && registers[v] == SPILLED){
+			order.push_back(v);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [this](VReg a, VReg b){ return intervals[a].start < intervals[b].start; });
+
+	/* The interval last given each slot */
+	std::vector<VReg> holders;
+	for(VReg v : order){
+		size_t slot = 0;
+		while(slot < holders.size() && intervals[holders[slot]].end >= intervals[v].start){
+			slot++;
+		}
+		if(slot == holders.size()){
+			if(slot == SPILL_SLOTS){
+				return fail("Too many variables live at once", 0);
+			}
+			holders.push_back(v);
+		}
+		holders[slot] = v;
+		slots[v] = slot;
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+void CodeGenerator::emit(std::string_view mnemonic, std::string_view first, std::string_view second){
+	std::string& text = *out;
+	text += "\t";
+	text += mnemonic;
+	if(!first.empty()){
+		text += " ";
+		text += first;
+	}
+	if(!second.empty()){
+		text += " ";
+		text += second;
+	}
+	text += "\n";
+}
+
+bool CodeGenerator::isIn(const Value& value, const uint8_t reg) const {
+	return !value.isConstant() && registers[value.vreg] == reg;
+}
+
+std::string CodeGenerator::slotAddress(const VReg vreg) const {
+	return hex(static_cast<uint16_t>(SPILL_BASE + 2 * slots[vreg]));
+}
+
+/**
+ * Gets a value into some register.
+ * @param value The value to read.
+ * @param fallback The scratch register constants and spilled values are loaded into.
+ * @return The register holding the value.
+ */
+uint8_t CodeGenerator::use(const Value& value, const uint8_t fallback){
+	if(!value.isConstant() && registers[value.vreg] != SPILLED){
+		return static_cast<uint8_t>(registers[value.vreg]);
+	}
+	load(value, fallback);
+	return fallback;
+}
+
+/* Gets a value into a particular register, nothing to do if it is already there */
+void CodeGenerator::load(const Value& value, const uint8_t reg){
+	if(value.isConstant()){
+		emit("MOVELR", hex(value.number), REGISTER_NAMES[reg]);
+	}else if(registers[value.vreg] == SPILLED){
+		emit("MOVEMR", slotAddress(value.vreg), REGISTER_NAMES[reg]);
+	}else if(registers[value.vreg] != reg){
+		emit("MOVERR", REGISTER_NAMES[registers[value.vreg]], REGISTER_NAMES[reg]);
+	}
+}
+
+/* The register a result is computed into, scratch when it is spilled */
+uint8_t CodeGenerator::target(const VReg vreg) const {
+	return registers[vreg] == SPILLED ? spillScratch : static_cast<uint8_t>(registers[vreg]);
+}
+
+/* Stores a result computed into target() if it lives in memory */
+void CodeGenerator::writeBack(const VReg vreg, const uint8_t reg){
+	if(registers[vreg] == SPILLED){
+		emit("MOVERM", REGISTER_NAMES[reg], slotAddress(vreg));
+	}
+}
+
+RESULT CodeGenerator::generateInstruction(const ir::Instruction& instruction, const uint32_t next){
+	const VReg dest = instruction.dest;
+	const Value& a = instruction.a;
+	const Value& b = instruction.b;
+
+	switch(instruction.op){
+		case OP::MOVE:
+			if(registers[dest] != SPILLED){
+				load(a, static_cast<uint8_t>(registers[dest]));
+			}else if(a.isConstant()){
+				emit("MOVELM", hex(a.number), slotAddress(dest));
+			}else if(registers[a.vreg] != SPILLED || slots[a.vreg] != slots[dest]){
+				emit("MOVERM", REGISTER_NAMES[use(a, scratch)], slotAddress(dest));
+			}
+			return RESULT_CODE::SUCCESS;
+
+		case OP::NOT:
+		case OP::SHIFTLEFT:
+		case OP::SHIFTRIGHT:
+		case OP::ADD:
+			{
+				std::string_view mnemonic = instruction.op == OP::NOT ? "NOT" : instruction.op == OP::SHIFTLEFT ? "SHIFTLEFT" : "SHIFTRIGHT";
+				if(instruction.op == OP::ADD){
+					if(!b.isConstant(1) && !b.isConstant(0xFFFF)){
+						generateBinary(instruction);
+						return RESULT_CODE::SUCCESS;
+					}
+					mnemonic = b.number == 1 ? "INCREMENT" : "DECREMENT";
+				}else if(instruction.op != OP::NOT && !b.isConstant()){
+					return fail("Shift amounts have to be constant", instruction.line);
+				}
+
+				uint8_t reg = target(dest);
+				load(a, reg);
+				if(instruction.op == OP::SHIFTLEFT || instruction.op == OP::SHIFTRIGHT){
+					emit(mnemonic, REGISTER_NAMES[reg], hex(b.number));
+				}else{
+					emit(mnemonic, REGISTER_NAMES[reg]);
+				}
+				writeBack(dest, reg);
+				return RESULT_CODE::SUCCESS;
+			}
+
+		case OP::SUBTRACT:
+		case OP::MULTIPLY:
+		case OP::DIVIDE:
+		case OP::AND:
+		case OP::OR:
+		case OP::XOR:
+			generateBinary(instruction);
+			return RESULT_CODE::SUCCESS;
+
+		case OP::LOAD:
+			{
+				uint8_t reg = target(dest);
+				if(a.isConstant()){
+					emit("MOVEMR", hex(a.number), REGISTER_NAMES[reg]);
+				}else{
+					emit("MOVEIRR", REGISTER_NAMES[use(a, scratch)], REGISTER_NAMES[reg]);
+				}
+				writeBack(dest, reg);
+				return RESULT_CODE::SUCCESS;
+			}
+
+		case OP::STORE:
+			if(a.isConstant()){
+				if(b.isConstant()){
+					emit("MOVELM", hex(b.number), hex(a.number));
+				}else{
+					emit("MOVERM", REGISTER_NAMES[use(b, scratch)], hex(a.number));
+				}
+			}else{
+				uint8_t address = use(a, scratch);
+				if(b.isConstant()){
+					emit("MOVELIR", hex(b.number), REGISTER_NAMES[address]);
+				}else{
+					// Write the address over the operand of the MOVERM in this store's stub and run it
+					if(stubs.size() == STUB_SLOTS){
+						return fail("Too many stores through computed addresses", instruction.line);
+					}
+					uint8_t value = use(b, address == scratch ? spillScratch : scratch);
+					const uint16_t stub = static_cast<uint16_t>(STUB_BASE + stubs.size() * STUB_SIZE);
+					emit("MOVERM", REGISTER_NAMES[address], hex(static_cast<uint16_t>(stub + 2)));
+					emit("JUMP", hex(stub));
+					*out += stubReturn(stubs.size()) + ":\n";
+					stubs.push_back(value);
+				}
+			}
+			return RESULT_CODE::SUCCESS;
+
+		case OP::BRANCH:
+			generateBranch(instruction, next);
+			return RESULT_CODE::SUCCESS;
+
+		case OP::JUMP:
+			if(instruction.target != next){
+				emit("JUMP", label(instruction.target));
+			}
+			return RESULT_CODE::SUCCESS;
+
+		case OP::HALT:
+			emit("HALT");
+			return RESULT_CODE::SUCCESS;
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Emits an ALU instruction for dest = a op b. The FVM computes
+ * regB = regA op regB, so b is brought into the register dest is computed
+ * in, unless a already sits there and the operands can be swapped.
+ */
+void CodeGenerator::generateBinary(const ir::Instruction& instruction){
+	static constexpr std::array<std::string_view, 8> MNEMONICS = {
+		"", "ADD", "SUBTRACT", "MULTIPLY", "DIVIDE", "AND", "OR", "XOR"
+	};
+	const std::string_view mnemonic = MNEMONICS[static_cast<size_t>(instruction.op)];
+	const bool commutative = instruction.op != OP::SUBTRACT && instruction.op != OP::DIVIDE;
+
+	Value a = instruction.a;
+	Value b = instruction.b;
+	uint8_t reg = target(instruction.dest);
+	if(!isIn(b, reg) && isIn(a, reg)){
+		if(commutative){
+			std::swap(a, b);
+		}else{
+			// a dies here and gave its register to the result, b cannot go there yet
+			reg = scratch;
+		}
+	}
+
+	load(b, reg);
+	emit(mnemonic, REGISTER_NAMES[use(a, scratch)], REGISTER_NAMES[reg]);
+
+	if(registers[instruction.dest] == SPILLED){
+		writeBack(instruction.dest, reg);
+	}else if(reg != registers[instruction.dest]){
+		emit("MOVERR", REGISTER_NAMES[reg], REGISTER_NAMES[registers[instruction.dest]]);
+	}
+}
+
+/**
+ * Emits a COMPARE and the jumps for a BRANCH, falling through to the next
+ * block where possible. There is no jump on not equal, so != jumps on
+ * equal to the other side.
+ */
+void CodeGenerator::generateBranch(const ir::Instruction& instruction, const uint32_t next){
+	uint32_t target = instruction.target;
+	uint32_t otherwise = instruction.otherwise;
+	if(instruction.a.isConstant() && instruction.b.isConstant()){
+		uint32_t taken = ir::evaluate(instruction.condition, instruction.a.number, instruction.b.number) ? target : otherwise;
+		if(taken != next){
+			emit("JUMP", label(taken));
+		}
+		return;
+	}
+
+	uint8_t a = use(instruction.a, scratch);
+	uint8_t b = use(instruction.b, a == scratch ? spillScratch : scratch);
+	emit("COMPARE", REGISTER_NAMES[a], REGISTER_NAMES[b]);
+
+	ir::CONDITION condition = instruction.condition;
+	if(condition == ir::CONDITION::NE){
+		std::swap(target, otherwise);
+		condition = ir::CONDITION::EQ;
+	}
+
+	// Jump on the inverse condition when the taken side is the next block
+	if(target == next && condition != ir::CONDITION::EQ){
+		std::swap(target, otherwise);
+		switch(condition){
+			case ir::CONDITION::LT:  condition = ir::CONDITION::GTE; break;
+			case ir::CONDITION::GT:  condition = ir::CONDITION::LTE; break;
+			case ir::CONDITION::LTE: condition = ir::CONDITION::GT; break;
+			case ir::CONDITION::GTE: condition = ir::CONDITION::LT; break;
+			default: break;
+		}
+	}
+
+	static constexpr std::array<std::string_view, 6> JUMPS = {
+		"JUMPEQ", "", "JUMPLT", "JUMPGT", "JUMPLTE", "JUMPGTE"
+	};
+	// Only == can still be left jumping to the next block, to skip the jump after it
+	emit(JUMPS[static_cast<size_t>(condition)], label(target));
+	if(otherwise != next){
+		emit("JUMP", label(otherwise));
+	}
+}
+
+RESULT CodeGenerator::fail(std::string_view message, const size_t line){
+	failedLine = line;
+	SPDLOG_ERROR("Line " + std::to_string(line) + ": " + std::string(message));
+	return RESULT_CODE::INVALID_ARGUMENT;
+}
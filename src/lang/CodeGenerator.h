@@ -0,0 +1,95 @@
+#ifndef CODE_GENERATOR_H
+#define CODE_GENERATOR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../ResultCode.h"
+#include "IR.h"
+
+/**
+ * Lowers optimized IR to funasm.
+ *
+ * Virtual registers are assigned to REG_0 up to REG_6 by linear scan over
+ * live intervals, REG_7 being kept free as scratch for constants and
+ * spilled values. When a function needs more registers than that the
+ * allocation is redone without REG_6, which becomes a second scratch
+ * register, and the intervals ending last are spilled to two byte slots
+ * from SPILL_BASE up. Programs should leave that memory alone.
+ *
+ * Each interval prefers the register of an operand that dies where it is
+ * defined, so copies coalesce away and the two address ALU instructions,
+ * which overwrite their second register, mostly need no extra moves.
+ *
+ * The FVM can only store a register to an address held in another
+ * register by patching the address operand of a MOVERM, so that is how a
+ * store with both address and value unknown at compile time is emitted.
+ * Patching the program itself would make the VM re-decode it and drop its
+ * native code on every such store, so each of these stores gets a stub of
+ * STUB_SIZE bytes from STUB_BASE up instead, outside the program: a MOVERM
+ * and a JUMP back. The program writes the stubs when it starts, then each
+ * store patches the address into its stub and jumps there. That costs two
+ * jumps and two instructions the VM steps one at a time with every check,
+ * as they are outside the verified program, and native code is left for
+ * the two. Programs should leave this memory alone too.
+ */
+class CodeGenerator {
+	public:
+		static constexpr uint16_t SPILL_BASE = 0xFF00;
+		static constexpr size_t SPILL_SLOTS = 128;
+		static constexpr size_t STUB_SIZE = 8;
+		static constexpr size_t STUB_SLOTS = 128;
+		static constexpr uint16_t STUB_BASE = SPILL_BASE - STUB_SLOTS * STUB_SIZE;
+
+		RESULT generate(const ir::Function& function, std::string& funasm);
+
+		/* The number of virtual registers the last generate() spilled to memory */
+		size_t spillCount() const { return spilled; }
+
+		/* 1-based source line of the error generate() stopped at, 0 after success */
+		size_t errorLine() const { return failedLine; }
+
+	private:
+		static constexpr int SPILLED = -1;
+
+		struct Interval {
+			size_t start = SIZE_MAX;
+			size_t end = 0;
+			/* Virtual registers whose register this one would like, best first */
+			std::vector<ir::VReg> hints;
+		};
+
+		const ir::Function* function = nullptr;
+		std::vector<Interval> intervals;
+		/* The register of each virtual register, or SPILLED */
+		std::vector<int> registers;
+		std::vector<size_t> slots;
+		size_t spilled = 0;
+		uint8_t scratch = 7;
+		uint8_t spillScratch = 7;
+		/* The value register of each store stub, see the class comment */
+		std::vector<uint8_t> stubs;
+		size_t failedLine = 0;
+		std::string* out = nullptr;
+
+		void buildIntervals();
+		bool allocate(const uint8_t allocatable);
+		RESULT assignSlots();
+
+		void emit(std::string_view mnemonic, std::string_view first = std::string_view(), std::string_view second = std::string_view());
+		bool isIn(const ir::Value& value, const uint8_t reg) const;
+		std::string slotAddress(const ir::VReg vreg) const;
+		uint8_t use(const ir::Value& value, const uint8_t fallback);
+		void load(const ir::Value& value, const uint8_t reg);
+		uint8_t target(const ir::VReg vreg) const;
+		void writeBack(const ir::VReg vreg, const uint8_t reg);
+
+		RESULT generateInstruction(const ir::Instruction& instruction, const uint32_t next);
+		void generateBinary(const ir::Instruction& instruction);
+		void generateBranch(const ir::Instruction& instruction, const uint32_t next);
+		RESULT fail(std::string_view message, const size_t line);
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include <cstdlib>
+
+#include "spdlog/spdlog.h"
+
+#include "../ByteCode.h"
+#include "../FBCImage.h"
+#include "../Files.h"
+#include "../Hash.h"
+#include "CompileCache.h"
+#include "Compiler.h"
+#include "SourceFile.h"
+
+std::filesystem::path CompileCache::defaultDirectory(){
+	if(const char* configured = std::getenv("FVM_CACHE_DIR")){
+		return std::filesystem::path(configured);
+	}
+	if(const char* cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome != nullptr && *cacheHome != '\0'){
+		return std::filesystem::path(cacheHome) / "fvm";
+	}
+	if(const char* home = std::getenv("HOME"); home != nullptr && *home != '\0'){
+		return std::filesystem::path(home) / ".cache" / "fvm";
+	}
+	std::error_code error;
+	std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+	return error ? std::filesystem::path() : temp / "fvm-cache";
+}
+
+/**
+ * Derives the cache key of a source.
+ * @param source The source text.
+ * @param extension The extension of the source file, which decides how it is compiled.
+ * @return The key, 16 hex digits.
+ */
+std::string CompileCache::key(std::string_view source, std::string_view extension){
+	// 64 bits wide, so a few thousand cached programs never collide
+	const uint32_t versions[] = {BYTECODE_INFO::TABLE_HASH, FBCImage::VERSION, Compiler::VERSION};
+	uint64_t value = fnv1a(versions, sizeof(versions));
+	value = fnv1a(extension.data(), extension.size(), value);
+	const uint64_t size = source.size();
+	value = fnv1a(&size, sizeof(size), value);
+	value = fnv1a(source.data(), source.size(), value);
+
+	static constexpr char HEX[] = "0123456789abcdef";
+	std::string text(16, '0');
+	for(size_t i = 0; i < text.size(); i++){
+		text[text.size() - 1 - i] = HEX[(value >> (4 * i)) & 0xF];
+	}
+	return text;
+}
+
+std::string CompileCache::key(const std::filesystem::path& sourcePath){
+	SourceFile source;
+	if(source.open(sourcePath) != RESULT_CODE::SUCCESS){
+		return std::string();
+	}
+	return key(source.text(), sourcePath.extension().string());
+}
+
+/**
+ * Copies a cached image out of the cache.
+ * @param key The key of the source, see key().
+ * @param fbcPath Where to put the image, replacing what is there without touching VMs that have it mapped.
+ * @return Whether the cache had a well-formed image for the key.
+ */
+bool CompileCache::fetch(const std::string& key, const std::filesystem::path& fbcPath) const {
+	if(!isEnabled() || key.empty()){
+		return false;
+	}
+
+	std::filesystem::path entry = entryPath(key);
+	std::error_code error;
+	if(!std::filesystem::exists(entry, error)){
+		return false;
+	}
+
+	// A damaged entry is dropped and recompiled rather than handed to the loader
+	FBCImage image;
+	if(image.read(entry) != RESULT_CODE::SUCCESS){
+		SPDLOG_WARN("Dropping damaged cache entry " + entry.string());
+		std::filesystem::remove(entry, error);
+		return false;
+	}
+
+	return replaceFile(fbcPath, [&entry](const std::filesystem::path& temporary){
+		std::error_code error;
+		std::filesystem::copy_file(entry, temporary, std::filesystem::copy_options::overwrite_existing, error);
+		return error ? RESULT_CODE::FILE_NOT_FOUND : RESULT_CODE::SUCCESS;
+	}) == RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Adds a freshly compiled image to the cache.
+ * @param key The key of the source it was compiled from, see key().
+ * @param fbcPath The compiled image.
+ * @return RESULT_CODE SUCCESS, also when the cache is disabled, or FILE_NOT_FOUND if the entry cannot be written.
+ */
+RESULT CompileCache::store(const std::string& key, const std::filesystem::path& fbcPath) const {
+	if(!isEnabled() || key.empty()){
+		return RESULT_CODE::SUCCESS;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	RESULT result = replaceFile(entryPath(key), [&fbcPath](const std::filesystem::path& temporary){
+		std::error_code error;
+		std::filesystem::copy_file(fbcPath, temporary, std::filesystem::copy_options::overwrite_existing, error);
+		return error ? RESULT_CODE::FILE_NOT_FOUND : RESULT_CODE::SUCCESS;
+	});
+	if(result != RESULT_CODE::SUCCESS){
+		SPDLOG_WARN("Could not cache " + fbcPath.filename().string());
+	}
+	return result;
+}
@@ -0,0 +1,47 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "../ResultCode.h"
+
+/**
+ * A persistent on-disk cache of compiled .fbc images, addressed by content.
+ *
+ * The key of a source hashes its bytes together with its language, the
+ * opcode table (BYTECODE_INFO::TABLE_HASH), the .fbc format version and
+ * Compiler::VERSION, so a change to any of them misses rather than handing
+ * back stale bytecode. Entries are written to a temporary file and renamed
+ * into place, so processes sharing a cache see whole images or none.
+ */
+class CompileCache {
+	public:
+		/* An empty directory disables the cache, every fetch() misses and store() does nothing */
+		explicit CompileCache(std::filesystem::path directory) : directory(std::move(directory)) {}
+
+		/**
+		 * FVM_CACHE_DIR if set, an empty value disabling the cache, otherwise
+		 * fvm under XDG_CACHE_HOME or ~/.cache, or the temp directory.
+		 */
+		static std::filesystem::path defaultDirectory();
+
+		bool isEnabled() const { return !directory.empty(); }
+
+		/* 16 hex digit key of a source in the language named by its extension, ".funlang" or ".funasm" */
+		static std::string key(std::string_view source, std::string_view extension);
+		/* Key of a source file, empty if it cannot be read */
+		static std::string key(const std::filesystem::path& sourcePath);
+
+		bool fetch(const std::string& key, const std::filesystem::path& fbcPath) const;
+		RESULT store(const std::string& key, const std::filesystem::path& fbcPath) const;
+
+		std::filesystem::path entryPath(const std::string& key) const { return directory / (key + ".fbc"); }
+
+	private:
+		std::filesystem::path directory;
+};
+
+#endif
@@ -1,90 +1,96 @@
 #include <filesystem>
 #include <fstream>
-#include <sstream>
 #include <vector>
 
 #include "spdlog/spdlog.h"
 
 #include "../ResultCode.h"
-#include "../ByteCode.h"
+#include "../FBCImage.h"
+#include "../FVM.h"
+#include "Assembler.h"
+#include "CodeGenerator.h"
 #include "Compiler.h"
+#include "Lexer.h"
+#include "Optimizer.h"
+#include "Parser.h"
+#include "SourceFile.h"
 
 RESULT Compiler::compileFunasmToBytecode(std::filesystem::path asmPath) {
-    std::ifstream fileStream(asmPath);
-
-    if (!fileStream.is_open()) {
-        return RESULT_CODE::FILE_NOT_FOUND;
+    SourceFile source;
+    RESULT result = source.open(asmPath);
+    if (result != RESULT_CODE::SUCCESS) {
+        return result;
     }
 
-	std::ostringstream bytecodeStream(std::ostringstream::ate);
-
-    std::string line;
-    while (std::getline(fileStream, line)) {
-        std::istringstream lineStream(line);
-        std::vector<std::string> tokens;
-        std::string token;
-
-        // Split the line into tokens (instruction and arguments)
-        while(std::getline(lineStream, token, ' ')) {
-            if(!token.empty()) {
-                tokens.push_back(token);
-            }
-        }
-
-        if(tokens.empty()) {
-            continue; // Skip empty lines
-        }
-			
-		BYTECODE_INFO::BYTECODE_OBJECT bytecodeObj = BYTECODE_INFO::OBJECT_FROM_NAME_MAP.at(tokens[0]);
-		
-		// Emit instruction bytecode
-		bytecodeStream << static_cast<uint8_t>(bytecodeObj.bytecode);
+    Assembler assembler;
+    result = assembler.assembleParallel(source.text(), threads);
+    if (result != RESULT_CODE::SUCCESS) {
+        SPDLOG_ERROR("Could not assemble " + asmPath.filename().string());
+        return result;
+    }
 
-		// Retrieve arguments
-		if(tokens.size() - 1 != bytecodeObj.args.size()){
-			return RESULT_CODE::INCORRECT_NUM_ARGS;	
-		}
+	// Write bytecode to a file
+	std::filesystem::path bcFilePath = asmPath;
+	bcFilePath.replace_extension(".fbc");
 
-		// Emit arguments bytecode
-		for(int i = 1; i < tokens.size(); i++){
-			auto argToken = tokens[i];
-			auto argType = bytecodeObj.args[i - 1];
-			switch(argType){
-				case BYTECODE_INFO::ARGUMENT_TYPE::REGISTER:
-					// Emit register
-					bytecodeStream << static_cast<uint8_t>(BYTECODE_INFO::OBJECT_FROM_NAME_MAP.at(argToken).bytecode);
-					break;
-				case BYTECODE_INFO::ARGUMENT_TYPE::ADDRESS:
-				case BYTECODE_INFO::ARGUMENT_TYPE::LITERAL:
-					// Convert the hexadecimal string to an unsigned integer
-					uint16_t value = static_cast<uint16_t>(std::stoul(argToken, nullptr, 16));
+    // A single code section at address 0, programs can address the full 16 bit space.
+    // One page more, so a 16-bit access at any address is inside memory and the JIT
+    // compiles accesses through addresses held in registers or memory
+    FBCImage image;
+    image.entry = 0;
+    image.memorySize = 0x10000 + FVM::PAGE_SIZE;
+    image.setBlocks(assembler.blockStarts());
+    image.addSection(FBCImage::SECTION_TYPE::CODE, 0, assembler.releaseBytecode());
 
-					// Convert to bytes
-					uint8_t highByte = (value >> 8) & 0xFF; 
-					uint8_t lowByte = value & 0xFF;
-					
-					// Emit address or literal, little endian
-					bytecodeStream << lowByte << highByte;
-					break;
-			}
-		}
-		
+    return image.write(bcFilePath);
+}
 
+/**
+ * Compiles a funlang file to a .funasm file next to it.
+ * @param langPath The funlang source.
+ * @return RESULT_CODE SUCCESS, or the error of the stage that failed.
+ */
+RESULT Compiler::compileFunlangToFunasm(std::filesystem::path langPath) {
+    SourceFile source;
+    RESULT result = source.open(langPath);
+    if (result != RESULT_CODE::SUCCESS) {
+        return result;
+    }
 
-	}
+    std::string funasm = "; Compiled from " + langPath.filename().string() + "\n";
+    result = compileFunlang(source.text(), funasm);
+    if (result != RESULT_CODE::SUCCESS) {
+        SPDLOG_ERROR("Could not compile " + langPath.filename().string());
+        return result;
+    }
 
-    fileStream.close();
+    std::filesystem::path asmPath = langPath;
+    asmPath.replace_extension(".funasm");
+    std::ofstream file(asmPath, std::ios::binary);
+    if (!file.write(funasm.data(), static_cast<std::streamsize>(funasm.size()))) {
+        SPDLOG_ERROR("Could not write " + asmPath.string());
+        return RESULT_CODE::FILE_NOT_FOUND;
+    }
+    return RESULT_CODE::SUCCESS;
+}
 
-	// Write bytecode to a file
-	std::filesystem::path bcFilePath = asmPath;
-	bcFilePath.replace_extension(".fbc");
+RESULT Compiler::compileFunlang(std::string_view source, std::string& funasm) {
+    Lexer lexer;
+    RESULT result = lexer.tokenize(source);
+    if (result != RESULT_CODE::SUCCESS) {
+        return result;
+    }
 
-    std::ofstream outFileStream(bcFilePath);
-	std::string bytecodeString = bytecodeStream.str(); 
-    outFileStream.write(bytecodeString.data(), bytecodeString.size());
+    ir::Function function;
+    Parser parser;
+    result = parser.parse(lexer.getTokens(), function);
+    if (result != RESULT_CODE::SUCCESS) {
+        return result;
+    }
 
+    Optimizer optimizer;
+    optimizer.optimize(function);
 
-    return RESULT_CODE::SUCCESS; // Assuming SUCCESS is a result code
+    CodeGenerator generator;
+    return generator.generate(function, funasm);
 }
-
-
@@ -1,13 +1,26 @@
+#include <cstdint>
 #include <filesystem>
+#include <string>
+#include <string_view>
 
 #include "../ResultCode.h"
 
 class Compiler{
 	public:
-		Compiler() {}
+		/* Bump whenever the same source would compile to different bytecode, it invalidates CompileCache entries */
+		static constexpr uint32_t VERSION = 2;
+
+		/* Large sources are assembled on up to this many threads, see Assembler::assembleParallel() */
+		Compiler(size_t threads = 1) : threads(threads) {}
 		RESULT compileFunasmToBytecode(std::filesystem::path filePath);
+		RESULT compileFunlangToFunasm(std::filesystem::path filePath);
+
+		/* Lexes, parses, optimizes and generates funasm for a funlang source */
+		static RESULT compileFunlang(std::string_view source, std::string& funasm);
 	private:
 
+		size_t threads;
+
 		std::filesystem::path filePath;
 
 };
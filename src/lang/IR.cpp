@@ -0,0 +1,180 @@
+#include <array>
+#include <utility>
+
+#include "IR.h"
+
+namespace ir {
+
+	static constexpr std::array<std::string_view, 16> OP_NAMES = {
+		"move", "add", "subtract", "multiply", "divide", "and", "or", "xor",
+		"shiftleft", "shiftright", "not", "load", "store", "branch", "jump", "halt"
+	};
+
+	static constexpr std::array<std::string_view, 6> CONDITION_NAMES = {
+		"==", "!=", "<", ">", "<=", ">="
+	};
+
+	size_t Instruction::operandCount() const {
+		switch(op){
+			case OP::MOVE:
+			case OP::NOT:
+			case OP::LOAD:
+				return 1;
+			case OP::JUMP:
+			case OP::HALT:
+				return 0;
+			default:
+				return 2;
+		}
+	}
+
+	std::vector<uint32_t> Block::successors() const {
+		const Instruction& last = terminator();
+		switch(last.op){
+			case OP::BRANCH:
+				return {last.target, last.otherwise};
+			case OP::JUMP:
+				return {last.target};
+			default:
+				return {};
+		}
+	}
+
+	VReg Function::newVReg(std::string_view name){
+		names.emplace_back(name);
+		return static_cast<VReg>(names.size() - 1);
+	}
+
+	size_t Function::instructionCount() const {
+		size_t count = 0;
+		for(const Block& block : blocks){
+			count += block.instructions.size();
+		}
+		return count;
+	}
+
+	/* Formats the function one instruction per line, for debugging and tests */
+	std::string Function::toString() const {
+		auto value = [this](const Value& operand){
+			if(operand.isConstant()){
+				return std::to_string(operand.number);
+			}
+			std::string text = "%" + std::to_string(operand.vreg);
+			if(!names[operand.vreg].empty()){
+				text += "(" + names[operand.vreg] + ")";
+			}
+			return text;
+		};
+
+		std::string text;
+		for(size_t i = 0; i < blocks.size(); i++){
+			text += "block" + std::to_string(i) + ":\n";
+			for(const Instruction& instruction : blocks[i].instructions){
+				text += "\t";
+				if(instruction.dest != NO_VREG){
+					text += value(Value::of(instruction.dest)) + " = ";
+				}
+				text += OP_NAMES[static_cast<size_t>(instruction.op)];
+				switch(instruction.op){
+					case OP::BRANCH:
+						text += " " + value(instruction.a) + " " + std::string(CONDITION_NAMES[static_cast<size_t>(instruction.condition)]) + " " + value(instruction.b);
+						text += " block" + std::to_string(instruction.target) + " block" + std::to_string(instruction.otherwise);
+						break;
+					case OP::JUMP:
+						text += " block" + std::to_string(instruction.target);
+						break;
+					default:
+						if(instruction.operandCount() > 0){
+							text += " " + value(instruction.a);
+						}
+						if(instruction.operandCount() > 1){
+							text += " " + value(instruction.b);
+						}
+						break;
+				}
+				text += "\n";
+			}
+		}
+		return text;
+	}
+
+	/**
+	 * Solves liveness backwards over the control flow graph until nothing changes.
+	 * @param function The function, with terminated blocks.
+	 * @return Per block bitsets indexed by virtual register.
+	 */
+	Liveness computeLiveness(const Function& function){
+		const size_t blockCount = function.blocks.size();
+		Liveness liveness;
+		liveness.in.assign(blockCount, std::vector<bool>(function.vregCount(), false));
+		liveness.out.assign(blockCount, std::vector<bool>(function.vregCount(), false));
+
+		bool changed = true;
+		while(changed){
+			changed = false;
+			for(size_t i = blockCount; i-- > 0;){
+				std::vector<bool> live(function.vregCount(), false);
+				for(uint32_t successor : function.blocks[i].successors()){
+					for(size_t v = 0; v < live.size(); v++){
+						live[v] = live[v] || liveness.in[successor][v];
+					}
+				}
+				liveness.out[i] = live;
+
+				const std::vector<Instruction>& instructions = function.blocks[i].instructions;
+				for(auto instruction = instructions.rbegin(); instruction != instructions.rend(); instruction++){
+					if(instruction->dest != NO_VREG){
+						live[instruction->dest] = false;
+					}
+					if(instruction->operandCount() > 0 && !instruction->a.isConstant()){
+						live[instruction->a.vreg] = true;
+					}
+					if(instruction->operandCount() > 1 && !instruction->b.isConstant()){
+						live[instruction->b.vreg] = true;
+					}
+				}
+
+				if(live != liveness.in[i]){
+					liveness.in[i] = std::move(live);
+					changed = true;
+				}
+			}
+		}
+		return liveness;
+	}
+
+	bool evaluate(const OP op, const uint16_t a, const uint16_t b, uint16_t& result){
+		switch(op){
+			case OP::MOVE:       result = a; return true;
+			case OP::ADD:        result = static_cast<uint16_t>(a + b); return true;
+			case OP::SUBTRACT:   result = static_cast<uint16_t>(a - b); return true;
+			case OP::MULTIPLY:   result = static_cast<uint16_t>(a * b); return true;
+			case OP::DIVIDE:
+				if(b == 0){
+					return false;
+				}
+				result = static_cast<uint16_t>(a / b);
+				return true;
+			case OP::AND:        result = a & b; return true;
+			case OP::OR:         result = a | b; return true;
+			case OP::XOR:        result = a ^ b; return true;
+			case OP::SHIFTLEFT:  result = b >= 16 ? 0 : static_cast<uint16_t>(a << b); return true;
+			case OP::SHIFTRIGHT: result = b >= 16 ? 0 : static_cast<uint16_t>(a >> b); return true;
+			case OP::NOT:        result = static_cast<uint16_t>(~a); return true;
+			default:
+				return false;
+		}
+	}
+
+	bool evaluate(const CONDITION condition, const uint16_t a, const uint16_t b){
+		switch(condition){
+			case CONDITION::EQ:  return a == b;
+			case CONDITION::NE:  return a != b;
+			case CONDITION::LT:  return a < b;
+			case CONDITION::GT:  return a > b;
+			case CONDITION::LTE: return a <= b;
+			case CONDITION::GTE: return a >= b;
+		}
+		return false;
+	}
+}
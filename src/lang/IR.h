@@ -0,0 +1,124 @@
+#ifndef IR_H
+#define IR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The intermediate representation funlang is optimized in before it is
+ * lowered to funasm.
+ *
+ * A function is a list of basic blocks, blocks[0] being the entry. Values
+ * live in an unbounded set of 16 bit virtual registers, each funlang
+ * variable being one and every intermediate result getting a fresh one.
+ * Instructions are three address code whose operands are either a virtual
+ * register or a constant. Every block ends in exactly one terminator,
+ * BRANCH, JUMP or HALT, and holds none before that.
+ */
+namespace ir {
+
+	using VReg = uint32_t;
+	constexpr VReg NO_VREG = UINT32_MAX;
+
+	enum class OP : uint8_t {
+		MOVE,       // dest = a
+		ADD,        // dest = a + b
+		SUBTRACT,   // dest = a - b
+		MULTIPLY,   // dest = a * b
+		DIVIDE,     // dest = a / b
+		AND,        // dest = a & b
+		OR,         // dest = a | b
+		XOR,        // dest = a ^ b
+		SHIFTLEFT,  // dest = a << b
+		SHIFTRIGHT, // dest = a >> b
+		NOT,        // dest = ~a
+		LOAD,       // dest = mem[a]
+		STORE,      // mem[a] = b
+		BRANCH,     // if a <condition> b goto target else goto otherwise
+		JUMP,       // goto target
+		HALT
+	};
+
+	/* Unsigned comparisons of a BRANCH */
+	enum class CONDITION : uint8_t {
+		EQ,
+		NE,
+		LT,
+		GT,
+		LTE,
+		GTE
+	};
+
+	struct Value {
+		/* NO_VREG for a constant */
+		VReg vreg = NO_VREG;
+		uint16_t number = 0;
+
+		bool isConstant() const { return vreg == NO_VREG; }
+		bool isConstant(const uint16_t value) const { return vreg == NO_VREG && number == value; }
+
+		static Value constant(const uint16_t number) { return Value{NO_VREG, number}; }
+		static Value of(const VReg vreg) { return Value{vreg, 0}; }
+
+		bool operator==(const Value& other) const { return vreg == other.vreg && (vreg != NO_VREG || number == other.number); }
+	};
+
+	struct Instruction {
+		OP op;
+		/* The register written, NO_VREG for STORE and terminators */
+		VReg dest = NO_VREG;
+		Value a{};
+		Value b{};
+		CONDITION condition = CONDITION::EQ;
+		/* Successor blocks */
+		uint32_t target = 0;
+		uint32_t otherwise = 0;
+		/* Source line, for error messages */
+		size_t line = 0;
+
+		bool isTerminator() const { return op == OP::BRANCH || op == OP::JUMP || op == OP::HALT; }
+		/* Whether the instruction does more than compute dest, so it stays even when dest is unused */
+		bool hasSideEffects() const { return op == OP::STORE || isTerminator(); }
+		/* The number of value operands read, a first then b */
+		size_t operandCount() const;
+	};
+
+	struct Block {
+		std::vector<Instruction> instructions;
+
+		const Instruction& terminator() const { return instructions.back(); }
+		Instruction& terminator() { return instructions.back(); }
+		std::vector<uint32_t> successors() const;
+	};
+
+	struct Function {
+		std::vector<Block> blocks;
+		/* The funlang variable of each virtual register, empty for temporaries */
+		std::vector<std::string> names;
+
+		VReg newVReg(std::string_view name = std::string_view());
+		size_t vregCount() const { return names.size(); }
+		/* Instructions over all blocks */
+		size_t instructionCount() const;
+		std::string toString() const;
+	};
+
+	/* The virtual registers live on entry to and exit from each block */
+	struct Liveness {
+		std::vector<std::vector<bool>> in;
+		std::vector<std::vector<bool>> out;
+	};
+
+	Liveness computeLiveness(const Function& function);
+
+	/**
+	 * Evaluates an arithmetic instruction on constants the way the FVM does.
+	 * @return False if the operation cannot be folded, a division by zero or an OP that is not arithmetic.
+	 */
+	bool evaluate(const OP op, const uint16_t a, const uint16_t b, uint16_t& result);
+	bool evaluate(const CONDITION condition, const uint16_t a, const uint16_t b);
+}
+
+#endif
@@ -1,18 +1,299 @@
-#include <regex>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+#include "spdlog/spdlog.h"
 
-#include <fstream>
 #include "Lexer.h"
 
-std::vector<lexer::Token> Lexer::tokenize(){
-	std::fstream fileStream(filePath.native(), std::fstream::in);
+using lexer::TOKEN_TYPE;
+
+struct Keyword {
+	std::string_view text;
+	TOKEN_TYPE type;
+};
+
+static constexpr std::array<Keyword, 6> KEYWORDS = {{
+	{"var", TOKEN_TYPE::VAR},
+	{"if", TOKEN_TYPE::IF},
+	{"else", TOKEN_TYPE::ELSE},
+	{"while", TOKEN_TYPE::WHILE},
+	{"halt", TOKEN_TYPE::HALT},
+	{"mem", TOKEN_TYPE::MEM},
+}};
+
+/* Operators and punctuation, two character ones first so they win over their prefixes */
+static constexpr std::array<Keyword, 24> SYMBOLS = {{
+	{"<<", TOKEN_TYPE::SHIFT_LEFT},
+	{">>", TOKEN_TYPE::SHIFT_RIGHT},
+	{"==", TOKEN_TYPE::EQUAL},
+	{"!=", TOKEN_TYPE::NOT_EQUAL},
+	{"<=", TOKEN_TYPE::LESS_EQUAL},
+	{">=", TOKEN_TYPE::GREATER_EQUAL},
+	{"(", TOKEN_TYPE::LEFT_PAREN},
+	{")", TOKEN_TYPE::RIGHT_PAREN},
+	{"{", TOKEN_TYPE::LEFT_BRACE},
+	{"}", TOKEN_TYPE::RIGHT_BRACE},
+	{"[", TOKEN_TYPE::LEFT_BRACKET},
+	{"]", TOKEN_TYPE::RIGHT_BRACKET},
+	{";", TOKEN_TYPE::SEMICOLON},
+	{"=", TOKEN_TYPE::ASSIGN},
+	{"+", TOKEN_TYPE::PLUS},
+	{"-", TOKEN_TYPE::MINUS},
+	{"*", TOKEN_TYPE::STAR},
+	{"/", TOKEN_TYPE::SLASH},
+	{"&", TOKEN_TYPE::AMPERSAND},
+	{"|", TOKEN_TYPE::PIPE},
+	{"^", TOKEN_TYPE::CARET},
+	{"~", TOKEN_TYPE::TILDE},
+	{"<", TOKEN_TYPE::LESS},
+	{">", TOKEN_TYPE::GREATER},
+}};
+
+/* The single character symbol each byte starts, END for none */
+static constexpr std::array<TOKEN_TYPE, 256> SINGLE_SYMBOLS = []{
+	std::array<TOKEN_TYPE, 256> table{};
+	table.fill(TOKEN_TYPE::END);
+	for(const Keyword& symbol : SYMBOLS){
+		if(symbol.text.size() == 1){
+			table[static_cast<uint8_t>(symbol.text[0])] = symbol.type;
+		}
+	}
+	return table;
+}();
+
+static bool isDigit(const char c){
+	return c >= '0' && c <= '9';
+}
+
+/* Character classes of a block of source, bit i standing for byte i */
+namespace {
+	struct Masks {
+		/* ' ', '\t' and '\r' */
+		uint32_t blank;
+		uint32_t newline;
+		/* Letters, digits and '_', anything an identifier or number continues with */
+		uint32_t word;
+	};
+
+#if defined(__AVX2__)
+	constexpr size_t BLOCK = 32;
+
+	inline Masks classifyBlock(const char* bytes){
+		const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+		auto equal = [&](const char value){ return _mm256_cmpeq_epi8(c, _mm256_set1_epi8(value)); };
+		// Signed compares, so bytes from 0x80 up are below every range
+		auto between = [](const __m256i v, const char low, const char high){
+			return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(low - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(high + 1)), v));
+		};
+		const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+		const __m256i blank = _mm256_or_si256(_mm256_or_si256(equal(' '), equal('\t')), equal('\r'));
+		const __m256i word = _mm256_or_si256(_mm256_or_si256(between(lower, 'a', 'z'), between(c, '0', '9')), equal('_'));
+		return {
+			static_cast<uint32_t>(_mm256_movemask_epi8(blank)),
+			static_cast<uint32_t>(_mm256_movemask_epi8(equal('\n'))),
+			static_cast<uint32_t>(_mm256_movemask_epi8(word)),
+		};
+	}
+#elif defined(__SSE2__)
+	constexpr size_t BLOCK = 16;
+
+	inline Masks classifyBlock(const char* bytes){
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+		auto equal = [&](const char value){ return _mm_cmpeq_epi8(c, _mm_set1_epi8(value)); };
+		// Signed compares, so bytes from 0x80 up are below every range
+		auto between = [](const __m128i v, const char low, const char high){
+			return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(low - 1))), _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(high + 1))));
+		};
+		const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+		const __m128i blank = _mm_or_si128(_mm_or_si128(equal(' '), equal('\t')), equal('\r'));
+		const __m128i word = _mm_or_si128(_mm_or_si128(between(lower, 'a', 'z'), between(c, '0', '9')), equal('_'));
+		return {
+			static_cast<uint32_t>(_mm_movemask_epi8(blank)),
+			static_cast<uint32_t>(_mm_movemask_epi8(equal('\n'))),
+			static_cast<uint32_t>(_mm_movemask_epi8(word)),
+		};
+	}
+#else
+	constexpr size_t BLOCK = 16;
+
+	inline Masks classifyBlock(const char* bytes){
+		Masks masks{0, 0, 0};
+		for(size_t i = 0; i < BLOCK; i++){
+			const char c = bytes[i];
+			const char lower = static_cast<char>(c | 0x20);
+			masks.blank |= static_cast<uint32_t>(c == ' ' || c == '\t' || c == '\r') << i;
+			masks.newline |= static_cast<uint32_t>(c == '\n') << i;
+			masks.word |= static_cast<uint32_t>((lower >= 'a' && lower <= 'z') || isDigit(c) || c == '_') << i;
+		}
+		return masks;
+	}
+#endif
 
-	/* fileStream.open(); */
-		
-	while(!fileStream.eof()){
+	/* The lowest count bits, count up to 32 */
+	inline uint32_t lowBits(const size_t count){
+		return static_cast<uint32_t>((uint64_t(1) << count) - 1);
+	}
 
-	
+	/**
+	 * Classifies the block of source starting at position. Past the end of the
+	 * source every class is empty, so runs stop there.
+	 */
+	inline Masks classify(std::string_view source, const size_t position){
+		if(position + BLOCK <= source.size()){
+			return classifyBlock(source.data() + position);
+		}
+		char padded[BLOCK] = {};
+		std::memcpy(padded, source.data() + position, source.size() - position);
+		return classifyBlock(padded);
+	}
 
+	/**
+	 * An upper bound on the tokens in source, END included: every run of word
+	 * characters and every other character that is not whitespace starts at
+	 * most one token.
+	 */
+	size_t countTokens(std::string_view source){
+		size_t count = 1;
+		uint32_t carry = 0;
+		for(size_t position = 0; position < source.size(); position += BLOCK){
+			const Masks masks = classify(source, position);
+			const uint32_t valid = lowBits(std::min(BLOCK, source.size() - position));
+			const uint32_t wordStarts = masks.word & ~((masks.word << 1) | carry);
+			const uint32_t others = ~(masks.word | masks.blank | masks.newline) & valid;
+			count += static_cast<size_t>(std::popcount(wordStarts) + std::popcount(others));
+			carry = (masks.word >> (BLOCK - 1)) & 1;
+		}
+		return count;
 	}
-	return std::vector<lexer::Token>();
 }
 
+/**
+ * Tokenizes a funlang source, replacing the tokens of any earlier call.
+ * @param source The source text. Tokens point into it, so it has to outlive them.
+ * @return RESULT_CODE SUCCESS, or INVALID_ARGUMENT for the first bad character or number, see errorLine().
+ */
+RESULT Lexer::tokenize(std::string_view source){
+	tokens.clear();
+	tokens.reserve(countTokens(source));
+	failedLine = 0;
+
+	uint32_t line = 1;
+	size_t lineStart = 0;
+	size_t position = 0;
+
+	auto fail = [&](const std::string& message, std::string_view text){
+		failedLine = line;
+		SPDLOG_ERROR("Line " + std::to_string(line) + ": " + message + ": " + std::string(text));
+		return RESULT_CODE::INVALID_ARGUMENT;
+	};
+
+	// Skips whitespace a block at a time, counting the newlines skipped over
+	auto skipWhitespace = [&](){
+		while(true){
+			const Masks masks = classify(source, position);
+			const size_t skipped = static_cast<size_t>(std::countr_zero(~(masks.blank | masks.newline)));
+			const uint32_t newlines = masks.newline & lowBits(std::min(skipped, BLOCK));
+			if(newlines != 0){
+				line += static_cast<uint32_t>(std::popcount(newlines));
+				lineStart = position + static_cast<size_t>(32 - std::countl_zero(newlines));
+			}
+			if(skipped < BLOCK){
+				position += skipped;
+				return;
+			}
+			position += BLOCK;
+		}
+	};
+
+	// The end of the run of word characters starting at position
+	auto wordEnd = [&](size_t end){
+		while(true){
+			const size_t run = static_cast<size_t>(std::countr_zero(~classify(source, end).word));
+			if(run < BLOCK){
+				return end + run;
+			}
+			end += BLOCK;
+		}
+	};
+
+	while(true){
+		skipWhitespace();
+		if(position >= source.size()){
+			break;
+		}
+
+		const char c = source[position];
+		if(c == '/' && position + 1 < source.size() && source[position + 1] == '/'){
+			const void* newline = std::memchr(source.data() + position, '\n', source.size() - position);
+			position = newline != nullptr ? static_cast<size_t>(static_cast<const char*>(newline) - source.data()) : source.size();
+			continue;
+		}
+
+		lexer::Token token{std::string_view(), line, static_cast<uint32_t>(position - lineStart + 1), 0, TOKEN_TYPE::END};
+		const size_t begin = position;
+
+		if(isDigit(c)){
+			int base = 10;
+			size_t digits = position;
+			if(c == '0' && position + 1 < source.size() && (source[position + 1] == 'x' || source[position + 1] == 'X')){
+				base = 16;
+				digits += 2;
+			}
+			position = wordEnd(position);
+			token.text = source.substr(begin, position - begin);
+			token.tokenType = TOKEN_TYPE::NUMBER;
+
+			uint32_t value = 0;
+			std::from_chars_result parsed = std::from_chars(source.data() + digits, source.data() + position, value, base);
+			if(digits >= position || parsed.ec != std::errc() || parsed.ptr != source.data() + position || value > 0xFFFF){
+				return fail("Invalid 16 bit number", token.text);
+			}
+			token.value = static_cast<uint16_t>(value);
+		}else if(c == '_' || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')){
+			position = wordEnd(position);
+			token.text = source.substr(begin, position - begin);
+			token.tokenType = TOKEN_TYPE::IDENTIFIER;
+			for(const Keyword& keyword : KEYWORDS){
+				if(keyword.text == token.text){
+					token.tokenType = keyword.type;
+					break;
+				}
+			}
+		}else{
+			if(c == '<' || c == '>' || c == '=' || c == '!'){
+				std::string_view pair = source.substr(position, 2);
+				for(size_t i = 0; i < SYMBOLS.size() && SYMBOLS[i].text.size() == 2; i++){
+					if(SYMBOLS[i].text == pair){
+						token.tokenType = SYMBOLS[i].type;
+						break;
+					}
+				}
+			}
+			size_t length = 2;
+			if(token.tokenType == TOKEN_TYPE::END){
+				token.tokenType = SINGLE_SYMBOLS[static_cast<uint8_t>(c)];
+				length = 1;
+			}
+			if(token.tokenType == TOKEN_TYPE::END){
+				return fail("Unexpected character", source.substr(position, 1));
+			}
+			token.text = source.substr(position, length);
+			position += length;
+		}
+
+		tokens.push_back(token);
+	}
+
+	tokens.push_back({std::string_view(), line, static_cast<uint32_t>(position - lineStart + 1), 0, TOKEN_TYPE::END});
+	return RESULT_CODE::SUCCESS;
+}
@@ -0,0 +1,592 @@
+#include <bit>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "Optimizer.h"
+
+using ir::OP;
+using ir::Value;
+using ir::VReg;
+
+void Optimizer::optimize(ir::Function& function){
+	for(size_t round = 0; round < MAX_ROUNDS; round++){
+		bool changed = simplifyControlFlow(function);
+		changed |= propagateConstants(function);
+		changed |= propagateCopies(function);
+		changed |= forwardStores(function);
+		changed |= eliminateDeadStores(function);
+		changed |= eliminateDeadCode(function);
+		if(!changed){
+			break;
+		}
+	}
+}
+
+static ir::Instruction jumpTo(const uint32_t target, const size_t line){
+	ir::Instruction jump{OP::JUMP};
+	jump.target = target;
+	jump.line = line;
+	return jump;
+}
+
+static std::vector<bool> reachableBlocks(const ir::Function& function){
+	std::vector<bool> reachable(function.blocks.size(), false);
+	std::vector<uint32_t> pending{0};
+	reachable[0] = true;
+	while(!pending.empty()){
+		uint32_t block = pending.back();
+		pending.pop_back();
+		for(uint32_t successor : function.blocks[block].successors()){
+			if(!reachable[successor]){
+				reachable[successor] = true;
+				pending.push_back(successor);
+			}
+		}
+	}
+	return reachable;
+}
+
+/* Drops blocks that cannot be reached from the entry, keeping the others in order */
+static bool removeUnreachable(ir::Function& function){
+	std::vector<bool> reachable = reachableBlocks(function);
+	std::vector<uint32_t> renumbered(function.blocks.size(), 0);
+	std::vector<ir::Block> blocks;
+	for(size_t i = 0; i < function.blocks.size(); i++){
+		if(reachable[i]){
+			renumbered[i] = static_cast<uint32_t>(blocks.size());
+			blocks.push_back(std::move(function.blocks[i]));
+		}
+	}
+
+	bool changed = blocks.size() != function.blocks.size();
+	for(ir::Block& block : blocks){
+		block.terminator().target = renumbered[block.terminator().target];
+		block.terminator().otherwise = renumbered[block.terminator().otherwise];
+	}
+	function.blocks = std::move(blocks);
+	return changed;
+}
+
+bool Optimizer::simplifyControlFlow(ir::Function& function){
+	bool changed = removeUnreachable(function);
+	std::vector<ir::Block>& blocks = function.blocks;
+
+	for(ir::Block& block : blocks){
+		ir::Instruction& last = block.terminator();
+		if(last.op == OP::BRANCH && (last.target == last.otherwise || (last.a.isConstant() && last.b.isConstant()))){
+			bool taken = last.target == last.otherwise || ir::evaluate(last.condition, last.a.number, last.b.number);
+			last = jumpTo(taken ? last.target : last.otherwise, last.line);
+			changed = true;
+		}
+	}
+
+	// Jump straight past blocks that hold nothing but a jump
+	auto forward = [&blocks](uint32_t target){
+		for(size_t hops = 0; hops < blocks.size(); hops++){
+			const ir::Block& block = blocks[target];
+			if(block.instructions.size() != 1 || block.terminator().op != OP::JUMP || block.terminator().target == target){
+				break;
+			}
+			target = block.terminator().target;
+		}
+		return target;
+	};
+	for(ir::Block& block : blocks){
+		ir::Instruction& last = block.terminator();
+		if(last.op == OP::HALT){
+			continue;
+		}
+
+		uint32_t target = forward(last.target);
+		uint32_t otherwise = last.op == OP::BRANCH ? forward(last.otherwise) : last.otherwise;
+		if(target != last.target || otherwise != last.otherwise){
+			last.target = target;
+			last.otherwise = otherwise;
+			changed = true;
+		}
+
+		// A jump to a lone HALT might as well halt
+		if(last.op == OP::JUMP && blocks[target].instructions.size() == 1 && blocks[target].terminator().op == OP::HALT){
+			last.op = OP::HALT;
+			changed = true;
+		}
+	}
+
+	// Append blocks to their only predecessor when it jumps straight to them
+	std::vector<bool> reachable = reachableBlocks(function);
+	std::vector<size_t> predecessors(blocks.size(), 0);
+	for(size_t i = 0; i < blocks.size(); i++){
+		if(!reachable[i]){
+			continue;
+		}
+		for(uint32_t successor : blocks[i].successors()){
+			predecessors[successor]++;
+		}
+	}
+	for(uint32_t i = 0; i < blocks.size(); i++){
+		while(reachable[i] && blocks[i].terminator().op == OP::JUMP){
+			uint32_t target = blocks[i].terminator().target;
+			if(target == i || target == 0 || predecessors[target] != 1){
+				break;
+			}
+
+			blocks[i].instructions.pop_back();
+			std::vector<ir::Instruction>& merged = blocks[target].instructions;
+			blocks[i].instructions.insert(blocks[i].instructions.end(), merged.begin(), merged.end());
+			// Left unreachable, removed below
+			merged.assign(1, jumpTo(target, 0));
+			changed = true;
+		}
+	}
+
+	return removeUnreachable(function) || changed;
+}
+
+namespace {
+	/* What propagateConstants() knows about a virtual register at a point */
+	struct Lattice {
+		bool constant;
+		uint16_t value;
+
+		bool operator==(const Lattice& other) const { return constant == other.constant && (!constant || value == other.value); }
+	};
+
+	constexpr Lattice VARYING = {false, 0};
+}
+
+static Lattice lookup(const std::vector<Lattice>& state, const Value& value){
+	return value.isConstant() ? Lattice{true, value.number} : state[value.vreg];
+}
+
+static void transfer(std::vector<Lattice>& state, const ir::Instruction& instruction){
+	if(instruction.dest == ir::NO_VREG){
+		return;
+	}
+
+	Lattice a = lookup(state, instruction.a);
+	Lattice b = instruction.operandCount() > 1 ? lookup(state, instruction.b) : Lattice{true, 0};
+	Lattice result = VARYING;
+	if(instruction.op != OP::LOAD && a.constant && b.constant && ir::evaluate(instruction.op, a.value, b.value, result.value)){
+		result.constant = true;
+	}
+	state[instruction.dest] = result;
+}
+
+static ir::CONDITION mirrored(const ir::CONDITION condition){
+	switch(condition){
+		case ir::CONDITION::LT:  return ir::CONDITION::GT;
+		case ir::CONDITION::GT:  return ir::CONDITION::LT;
+		case ir::CONDITION::LTE: return ir::CONDITION::GTE;
+		case ir::CONDITION::GTE: return ir::CONDITION::LTE;
+		default:                 return condition;
+	}
+}
+
+static bool isCommutative(const OP op){
+	return op == OP::ADD || op == OP::MULTIPLY || op == OP::AND || op == OP::OR || op == OP::XOR;
+}
+
+/**
+ * Folds an instruction whose operands are constants, applies algebraic
+ * identities and swaps in cheaper operations. Constants are moved to the b
+ * operand of commutative operations and branches, which is where the code
+ * generator handles them best.
+ * @return Whether the instruction changed.
+ */
+static bool simplify(ir::Instruction& instruction){
+	auto become = [&instruction](const Value& value){
+		instruction.op = OP::MOVE;
+		instruction.a = value;
+		instruction.b = Value();
+		return true;
+	};
+
+	const OP op = instruction.op;
+	Value& a = instruction.a;
+	Value& b = instruction.b;
+
+	if(op == OP::MOVE || op == OP::LOAD || op == OP::STORE || op == OP::JUMP || op == OP::HALT){
+		return false;
+	}
+
+	if(op == OP::BRANCH){
+		if(a.isConstant() && !b.isConstant()){
+			std::swap(a, b);
+			instruction.condition = mirrored(instruction.condition);
+			return true;
+		}
+		if(!a.isConstant() && a == b){
+			// Both sides are the same value, leave simplifyControlFlow() to fold it
+			a = b = Value::constant(0);
+			return true;
+		}
+		// Against 0 or 0xFFFF, == and != are ordered comparisons, which can be inverted to fall through either way
+		if(b.isConstant(0) && (instruction.condition == ir::CONDITION::EQ || instruction.condition == ir::CONDITION::NE)){
+			instruction.condition = instruction.condition == ir::CONDITION::EQ ? ir::CONDITION::LTE : ir::CONDITION::GT;
+			return true;
+		}
+		if(b.isConstant(0xFFFF) && (instruction.condition == ir::CONDITION::EQ || instruction.condition == ir::CONDITION::NE)){
+			instruction.condition = instruction.condition == ir::CONDITION::EQ ? ir::CONDITION::GTE : ir::CONDITION::LT;
+			return true;
+		}
+		return false;
+	}
+
+	uint16_t result = 0;
+	if(a.isConstant() && (op == OP::NOT || b.isConstant()) && ir::evaluate(op, a.number, b.number, result)){
+		return become(Value::constant(result));
+	}
+	if(op == OP::NOT){
+		return false;
+	}
+
+	bool swapped = false;
+	if(isCommutative(op) && a.isConstant() && !b.isConstant()){
+		std::swap(a, b);
+		swapped = true;
+	}
+
+	switch(op){
+		case OP::ADD:
+			if(b.isConstant(0)){
+				return become(a);
+			}
+			break;
+		case OP::SUBTRACT:
+			if(b.isConstant()){
+				instruction.op = OP::ADD;
+				b.number = static_cast<uint16_t>(-b.number);
+				simplify(instruction);
+				return true;
+			}
+			if(a == b){
+				return become(Value::constant(0));
+			}
+			break;
+		case OP::MULTIPLY:
+			if(b.isConstant(0)){
+				return become(Value::constant(0));
+			}
+			if(b.isConstant(1)){
+				return become(a);
+			}
+			if(b.isConstant() && std::has_single_bit(b.number)){
+				instruction.op = OP::SHIFTLEFT;
+				b.number = static_cast<uint16_t>(std::countr_zero(b.number));
+				return true;
+			}
+			break;
+		case OP::DIVIDE:
+			if(b.isConstant(1)){
+				return become(a);
+			}
+			if(b.isConstant() && std::has_single_bit(b.number)){
+				instruction.op = OP::SHIFTRIGHT;
+				b.number = static_cast<uint16_t>(std::countr_zero(b.number));
+				return true;
+			}
+			break;
+		case OP::AND:
+			if(b.isConstant(0)){
+				return become(Value::constant(0));
+			}
+			if(b.isConstant(0xFFFF) || a == b){
+				return become(a);
+			}
+			break;
+		case OP::OR:
+			if(b.isConstant(0xFFFF)){
+				return become(Value::constant(0xFFFF));
+			}
+			if(b.isConstant(0) || a == b){
+				return become(a);
+			}
+			break;
+		case OP::XOR:
+			if(b.isConstant(0)){
+				return become(a);
+			}
+			if(a == b){
+				return become(Value::constant(0));
+			}
+			break;
+		case OP::SHIFTLEFT:
+		case OP::SHIFTRIGHT:
+			if(a.isConstant(0) || (b.isConstant() && b.number >= 16)){
+				return become(Value::constant(0));
+			}
+			if(b.isConstant(0)){
+				return become(a);
+			}
+			break;
+		default:
+			break;
+	}
+	return swapped;
+}
+
+bool Optimizer::propagateConstants(ir::Function& function){
+	const size_t blockCount = function.blocks.size();
+	std::vector<std::vector<Lattice>> in(blockCount);
+	std::vector<std::vector<Lattice>> out(blockCount);
+	std::vector<bool> visited(blockCount, false);
+	std::vector<std::vector<uint32_t>> predecessors(blockCount);
+	for(uint32_t i = 0; i < blockCount; i++){
+		for(uint32_t successor : function.blocks[i].successors()){
+			predecessors[successor].push_back(i);
+		}
+	}
+
+	// Optimistic: predecessors not visited yet are left out of the meet, back edges catch up on later rounds
+	bool changed = true;
+	while(changed){
+		changed = false;
+		for(size_t i = 0; i < blockCount; i++){
+			std::vector<Lattice> state;
+			if(i == 0){
+				state.assign(function.vregCount(), VARYING);
+			}
+			for(uint32_t p : predecessors[i]){
+				if(!visited[p]){
+					continue;
+				}
+				if(state.empty()){
+					state = out[p];
+					continue;
+				}
+				for(size_t v = 0; v < state.size(); v++){
+					if(!(state[v] == out[p][v])){
+						state[v] = VARYING;
+					}
+				}
+			}
+			if(state.empty()){
+				continue;
+			}
+
+			in[i] = state;
+			for(const ir::Instruction& instruction : function.blocks[i].instructions){
+				transfer(state, instruction);
+			}
+			if(!visited[i] || state != out[i]){
+				visited[i] = true;
+				out[i] = std::move(state);
+				changed = true;
+			}
+		}
+	}
+
+	bool rewritten = false;
+	for(size_t i = 0; i < blockCount; i++){
+		if(!visited[i]){
+			continue;
+		}
+
+		std::vector<Lattice>& state = in[i];
+		for(ir::Instruction& instruction : function.blocks[i].instructions){
+			for(size_t operand = 0; operand < instruction.operandCount(); operand++){
+				Value& value = operand == 0 ? instruction.a : instruction.b;
+				if(!value.isConstant() && state[value.vreg].constant){
+					value = Value::constant(state[value.vreg].value);
+					rewritten = true;
+				}
+			}
+			rewritten |= simplify(instruction);
+			transfer(state, instruction);
+		}
+	}
+	return rewritten;
+}
+
+bool Optimizer::propagateCopies(ir::Function& function){
+	bool changed = false;
+
+	// A temporary used once, by the instruction that next overwrites a variable, can be computed in the
+	// variable instead: t = a * 3; x = t + 1 becomes x = a * 3; x = x + 1, and a copy x = t goes away.
+	// Done first, forwarding copies to later uses would give temporaries more than one use.
+	std::vector<size_t> uses(function.vregCount(), 0);
+	std::vector<size_t> definitions(function.vregCount(), 0);
+	for(const ir::Block& block : function.blocks){
+		for(const ir::Instruction& instruction : block.instructions){
+			for(size_t i = 0; i < instruction.operandCount(); i++){
+				const Value& operand = i == 0 ? instruction.a : instruction.b;
+				if(!operand.isConstant()){
+					uses[operand.vreg]++;
+				}
+			}
+			if(instruction.dest != ir::NO_VREG){
+				definitions[instruction.dest]++;
+			}
+		}
+	}
+
+	auto reads = [](const ir::Instruction& instruction, const VReg vreg){
+		return (instruction.operandCount() > 0 && instruction.a == Value::of(vreg))
+			|| (instruction.operandCount() > 1 && instruction.b == Value::of(vreg));
+	};
+
+	for(ir::Block& block : function.blocks){
+		std::vector<ir::Instruction>& instructions = block.instructions;
+		for(size_t i = 0; i < instructions.size(); i++){
+			ir::Instruction& user = instructions[i];
+			const VReg variable = user.dest;
+			if(variable == ir::NO_VREG){
+				continue;
+			}
+
+			for(size_t operand = 0; operand < user.operandCount(); operand++){
+				Value& value = operand == 0 ? user.a : user.b;
+				const Value& other = operand == 0 ? user.b : user.a;
+				if(value.isConstant() || value.vreg == variable || (user.operandCount() > 1 && other == Value::of(variable))){
+					continue;
+				}
+				const VReg temporary = value.vreg;
+				if(!function.names[temporary].empty() || uses[temporary] != 1 || definitions[temporary] != 1){
+					continue;
+				}
+
+				size_t definition = i;
+				while(definition-- > 0 && instructions[definition].dest != temporary){
+					if(instructions[definition].dest == variable || reads(instructions[definition], variable)){
+						break;
+					}
+				}
+				if(definition == SIZE_MAX || instructions[definition].dest != temporary){
+					continue;
+				}
+
+				instructions[definition].dest = variable;
+				value = Value::of(variable);
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	for(ir::Block& block : function.blocks){
+		// Virtual registers that currently hold the same value as another one
+		std::unordered_map<VReg, VReg> copies;
+		for(ir::Instruction& instruction : block.instructions){
+			for(size_t i = 0; i < instruction.operandCount(); i++){
+				Value& operand = i == 0 ? instruction.a : instruction.b;
+				auto copy = operand.isConstant() ? copies.end() : copies.find(operand.vreg);
+				if(copy != copies.end()){
+					operand = Value::of(copy->second);
+					changed = true;
+				}
+			}
+
+			if(instruction.dest == ir::NO_VREG){
+				continue;
+			}
+			copies.erase(instruction.dest);
+			std::erase_if(copies, [&instruction](const auto& copy){ return copy.second == instruction.dest; });
+			if(instruction.op == OP::MOVE && !instruction.a.isConstant() && instruction.a.vreg != instruction.dest){
+				copies.emplace(instruction.dest, instruction.a.vreg);
+			}
+		}
+	}
+	return changed;
+}
+
+bool Optimizer::forwardStores(ir::Function& function){
+	bool changed = false;
+
+	for(ir::Block& block : function.blocks){
+		// The value each constant address is known to hold
+		std::unordered_map<uint16_t, Value> known;
+		for(ir::Instruction& instruction : block.instructions){
+			if(instruction.op == OP::LOAD && instruction.a.isConstant()){
+				auto value = known.find(instruction.a.number);
+				if(value != known.end()){
+					instruction.op = OP::MOVE;
+					instruction.a = value->second;
+					changed = true;
+				}
+			}
+
+			if(instruction.dest != ir::NO_VREG){
+				std::erase_if(known, [&instruction](const auto& value){ return value.second == Value::of(instruction.dest); });
+			}
+
+			if(instruction.op == OP::LOAD && instruction.a.isConstant()){
+				known[instruction.a.number] = Value::of(instruction.dest);
+			}else if(instruction.op == OP::STORE){
+				if(!instruction.a.isConstant()){
+					known.clear();
+				}else{
+					// Words are stored at byte addresses, so a store also changes half of each neighbour
+					const uint16_t address = instruction.a.number;
+					known.erase(static_cast<uint16_t>(address - 1));
+					known.erase(static_cast<uint16_t>(address + 1));
+					known[address] = instruction.b;
+				}
+			}
+		}
+	}
+	return changed;
+}
+
+bool Optimizer::eliminateDeadStores(ir::Function& function){
+	bool changed = false;
+
+	for(ir::Block& block : function.blocks){
+		// Constant addresses stored to further down the block before anything could read them
+		std::unordered_set<uint16_t> overwritten;
+		std::vector<ir::Instruction> kept;
+		for(auto instruction = block.instructions.rbegin(); instruction != block.instructions.rend(); instruction++){
+			if(instruction->op == OP::STORE && instruction->a.isConstant()){
+				if(!overwritten.insert(instruction->a.number).second){
+					changed = true;
+					continue;
+				}
+			}else if(instruction->op == OP::LOAD){
+				if(instruction->a.isConstant()){
+					// A word load also reads half of each neighbouring address
+					const uint16_t address = instruction->a.number;
+					overwritten.erase(static_cast<uint16_t>(address - 1));
+					overwritten.erase(address);
+					overwritten.erase(static_cast<uint16_t>(address + 1));
+				}else{
+					overwritten.clear();
+				}
+			}
+			kept.push_back(*instruction);
+		}
+		block.instructions.assign(kept.rbegin(), kept.rend());
+	}
+	return changed;
+}
+
+bool Optimizer::eliminateDeadCode(ir::Function& function){
+	bool changed = false;
+	ir::Liveness liveness = ir::computeLiveness(function);
+
+	for(size_t i = 0; i < function.blocks.size(); i++){
+		std::vector<bool>& live = liveness.out[i];
+		std::vector<ir::Instruction> kept;
+		const std::vector<ir::Instruction>& instructions = function.blocks[i].instructions;
+		for(auto instruction = instructions.rbegin(); instruction != instructions.rend(); instruction++){
+			bool unused = instruction->dest != ir::NO_VREG && !instruction->hasSideEffects() && !live[instruction->dest];
+			bool selfMove = instruction->op == OP::MOVE && instruction->a == Value::of(instruction->dest);
+			if(unused || selfMove){
+				changed = true;
+				continue;
+			}
+
+			if(instruction->dest != ir::NO_VREG){
+				live[instruction->dest] = false;
+			}
+			for(size_t operand = 0; operand < instruction->operandCount(); operand++){
+				const Value& value = operand == 0 ? instruction->a : instruction->b;
+				if(!value.isConstant()){
+					live[value.vreg] = true;
+				}
+			}
+			kept.push_back(*instruction);
+		}
+		function.blocks[i].instructions.assign(kept.rbegin(), kept.rend());
+	}
+	return changed;
+}
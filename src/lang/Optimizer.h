@@ -0,0 +1,35 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "IR.h"
+
+/**
+ * Machine independent clean up of the IR the Parser emits.
+ *
+ * optimize() repeats every pass until none of them changes anything, as
+ * each one opens up work for the others: folding a branch condition makes
+ * blocks unreachable, dropping them leaves copies to propagate, which leaves
+ * definitions dead. Each pass returns whether it changed the function.
+ */
+class Optimizer {
+	public:
+		/* Upper bound on rounds of optimize(), the passes usually settle in a few */
+		static constexpr size_t MAX_ROUNDS = 32;
+
+		void optimize(ir::Function& function);
+
+		/* Folds constant branches, threads jumps, merges straight line blocks and drops unreachable ones */
+		bool simplifyControlFlow(ir::Function& function);
+		/* Propagates constants through the whole function, folds and strength reduces arithmetic */
+		bool propagateConstants(ir::Function& function);
+		/* Replaces uses of copies within a block and writes single use temporaries straight into their variable */
+		bool propagateCopies(ir::Function& function);
+		/* Replaces loads of constant addresses with the value last stored to or loaded from them within a block */
+		bool forwardStores(ir::Function& function);
+		/* Drops stores to constant addresses that are overwritten later in the block without being read */
+		bool eliminateDeadStores(ir::Function& function);
+		/* Drops definitions of virtual registers that are never read */
+		bool eliminateDeadCode(ir::Function& function);
+};
+
+#endif
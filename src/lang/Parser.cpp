@@ -1,3 +1,411 @@
+#include <array>
+#include <string>
 
+#include "spdlog/spdlog.h"
 
+#include "Parser.h"
 
+using lexer::TOKEN_TYPE;
+using ir::OP;
+using ir::Value;
+
+struct BinaryOperator {
+	TOKEN_TYPE token;
+	OP op;
+	size_t level;
+};
+
+/* Binary operators by precedence level, loosest binding first */
+static constexpr size_t BINARY_LEVELS = 6;
+static constexpr std::array<BinaryOperator, 9> BINARY_OPERATORS = {{
+	{TOKEN_TYPE::PIPE, OP::OR, 0},
+	{TOKEN_TYPE::CARET, OP::XOR, 1},
+	{TOKEN_TYPE::AMPERSAND, OP::AND, 2},
+	{TOKEN_TYPE::SHIFT_LEFT, OP::SHIFTLEFT, 3},
+	{TOKEN_TYPE::SHIFT_RIGHT, OP::SHIFTRIGHT, 3},
+	{TOKEN_TYPE::PLUS, OP::ADD, 4},
+	{TOKEN_TYPE::MINUS, OP::SUBTRACT, 4},
+	{TOKEN_TYPE::STAR, OP::MULTIPLY, 5},
+	{TOKEN_TYPE::SLASH, OP::DIVIDE, 5},
+}};
+
+struct Relation {
+	TOKEN_TYPE token;
+	ir::CONDITION condition;
+};
+
+static constexpr std::array<Relation, 6> RELATIONS = {{
+	{TOKEN_TYPE::EQUAL, ir::CONDITION::EQ},
+	{TOKEN_TYPE::NOT_EQUAL, ir::CONDITION::NE},
+	{TOKEN_TYPE::LESS, ir::CONDITION::LT},
+	{TOKEN_TYPE::GREATER, ir::CONDITION::GT},
+	{TOKEN_TYPE::LESS_EQUAL, ir::CONDITION::LTE},
+	{TOKEN_TYPE::GREATER_EQUAL, ir::CONDITION::GTE},
+}};
+
+/**
+ * Parses a token list into a function of IR.
+ * @param tokens Tokens from Lexer::tokenize(), ending with an END token.
+ * @param function Replaced with the parsed program.
+ * @return RESULT_CODE SUCCESS, or INVALID_ARGUMENT for the first syntax or name error, see errorLine().
+ */
+RESULT Parser::parse(const std::vector<lexer::Token>& tokens, ir::Function& function){
+	this->tokens = &tokens;
+	this->function = &function;
+	position = 0;
+	failedLine = 0;
+	function = ir::Function();
+	scopes.assign(1, {});
+	current = newBlock();
+
+	if(tokens.empty() || tokens.back().tokenType != TOKEN_TYPE::END){
+		return fail("Token list is not terminated", lexer::Token{std::string_view(), 0, 0, 0, TOKEN_TYPE::END});
+	}
+
+	while(peek().tokenType != TOKEN_TYPE::END){
+		RESULT result = parseStatement();
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+	}
+
+	// Emitted rather than terminate()d, nothing follows that would fill a fresh block
+	emit({OP::HALT, ir::NO_VREG, {}, {}, ir::CONDITION::EQ, 0, 0, peek().lineNumber});
+	return RESULT_CODE::SUCCESS;
+}
+
+bool Parser::accept(const TOKEN_TYPE type){
+	if(peek().tokenType != type){
+		return false;
+	}
+	position++;
+	return true;
+}
+
+RESULT Parser::expect(const TOKEN_TYPE type, std::string_view what){
+	if(!accept(type)){
+		return fail("Expected " + std::string(what), peek());
+	}
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Parser::fail(std::string_view message, const lexer::Token& token){
+	failedLine = token.lineNumber;
+	std::string found = token.tokenType == TOKEN_TYPE::END ? "end of file" : std::string(token.text);
+	SPDLOG_ERROR("Line " + std::to_string(token.lineNumber) + ": " + std::string(message) + ", found " + found);
+	return RESULT_CODE::INVALID_ARGUMENT;
+}
+
+uint32_t Parser::newBlock(){
+	function->blocks.emplace_back();
+	return static_cast<uint32_t>(function->blocks.size() - 1);
+}
+
+void Parser::emit(ir::Instruction instruction){
+	function->blocks[current].instructions.push_back(instruction);
+}
+
+/* Ends the current block, statements after it go into a fresh one */
+void Parser::terminate(ir::Instruction instruction){
+	emit(instruction);
+	current = newBlock();
+}
+
+Value Parser::emitOperation(const OP op, const Value& a, const Value& b, const size_t line){
+	ir::VReg dest = function->newVReg();
+	emit({op, dest, a, b, ir::CONDITION::EQ, 0, 0, line});
+	return Value::of(dest);
+}
+
+RESULT Parser::parseStatement(){
+	const lexer::Token& token = peek();
+	RESULT result = RESULT_CODE::SUCCESS;
+
+	switch(token.tokenType){
+		case TOKEN_TYPE::VAR:
+			return parseDeclaration();
+		case TOKEN_TYPE::IF:
+			return parseIf();
+		case TOKEN_TYPE::WHILE:
+			return parseWhile();
+		case TOKEN_TYPE::HALT:
+			position++;
+			if((result = expect(TOKEN_TYPE::SEMICOLON, "';'")) != RESULT_CODE::SUCCESS){
+				return result;
+			}
+			// Anything up to the end of the enclosing body is unreachable and left for the Optimizer to drop
+			terminate({OP::HALT, ir::NO_VREG, {}, {}, ir::CONDITION::EQ, 0, 0, token.lineNumber});
+			return RESULT_CODE::SUCCESS;
+		case TOKEN_TYPE::MEM:
+			{
+				position++;
+				Value address;
+				Value value;
+				if((result = expect(TOKEN_TYPE::LEFT_BRACKET, "'['")) != RESULT_CODE::SUCCESS
+					|| (result = parseExpression(address)) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::RIGHT_BRACKET, "']'")) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::ASSIGN, "'='")) != RESULT_CODE::SUCCESS
+					|| (result = parseExpression(value)) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::SEMICOLON, "';'")) != RESULT_CODE::SUCCESS){
+					return result;
+				}
+				emit({OP::STORE, ir::NO_VREG, address, value, ir::CONDITION::EQ, 0, 0, token.lineNumber});
+				return RESULT_CODE::SUCCESS;
+			}
+		case TOKEN_TYPE::IDENTIFIER:
+			{
+				Value variable;
+				Value value;
+				if((result = parsePrimary(variable)) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::ASSIGN, "'='")) != RESULT_CODE::SUCCESS
+					|| (result = parseExpression(value)) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::SEMICOLON, "';'")) != RESULT_CODE::SUCCESS){
+					return result;
+				}
+				emit({OP::MOVE, variable.vreg, value, {}, ir::CONDITION::EQ, 0, 0, token.lineNumber});
+				return RESULT_CODE::SUCCESS;
+			}
+		default:
+			return fail("Expected a statement", token);
+	}
+}
+
+RESULT Parser::parseBody(){
+	RESULT result = expect(TOKEN_TYPE::LEFT_BRACE, "'{'");
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	scopes.emplace_back();
+	while(!accept(TOKEN_TYPE::RIGHT_BRACE)){
+		if(peek().tokenType == TOKEN_TYPE::END){
+			return fail("Expected '}'", peek());
+		}
+		if((result = parseStatement()) != RESULT_CODE::SUCCESS){
+			return result;
+		}
+	}
+	scopes.pop_back();
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Parser::parseDeclaration(){
+	const size_t line = peek().lineNumber;
+	position++;
+
+	const lexer::Token& name = peek();
+	RESULT result = expect(TOKEN_TYPE::IDENTIFIER, "a variable name");
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	Value value = Value::constant(0);
+	if(accept(TOKEN_TYPE::ASSIGN) && (result = parseExpression(value)) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+	if((result = expect(TOKEN_TYPE::SEMICOLON, "';'")) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	// Declared after the initializer, which still sees any outer variable of the same name
+	ir::VReg variable = function->newVReg(name.text);
+	if(!scopes.back().emplace(name.text, variable).second){
+		return fail("Variable is already declared", name);
+	}
+	emit({OP::MOVE, variable, value, {}, ir::CONDITION::EQ, 0, 0, line});
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Parser::parseIf(){
+	position++;
+
+	ir::Instruction branch{OP::BRANCH};
+	RESULT result = RESULT_CODE::SUCCESS;
+	if((result = expect(TOKEN_TYPE::LEFT_PAREN, "'('")) != RESULT_CODE::SUCCESS
+		|| (result = parseCondition(branch)) != RESULT_CODE::SUCCESS
+		|| (result = expect(TOKEN_TYPE::RIGHT_PAREN, "')'")) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	// terminate() opens the block the branch enters
+	uint32_t branchBlock = current;
+	branch.target = static_cast<uint32_t>(function->blocks.size());
+	terminate(branch);
+
+	if((result = parseBody()) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	uint32_t thenEnd = current;
+	uint32_t elseEnd = branchBlock;
+	if(accept(TOKEN_TYPE::ELSE)){
+		function->blocks[branchBlock].terminator().otherwise = current = newBlock();
+		if((result = peek().tokenType == TOKEN_TYPE::IF ? parseIf() : parseBody()) != RESULT_CODE::SUCCESS){
+			return result;
+		}
+		elseEnd = current;
+	}
+
+	// Both arms meet in a block of their own
+	uint32_t join = newBlock();
+	ir::Instruction skip{OP::JUMP};
+	skip.target = join;
+	skip.line = branch.line;
+	function->blocks[thenEnd].instructions.push_back(skip);
+	if(elseEnd == branchBlock){
+		function->blocks[branchBlock].terminator().otherwise = join;
+	}else{
+		function->blocks[elseEnd].instructions.push_back(skip);
+	}
+	current = join;
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Parser::parseWhile(){
+	position++;
+
+	RESULT result = expect(TOKEN_TYPE::LEFT_PAREN, "'('");
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	// The condition is parsed once for the guard and once more for the test at the bottom of the body
+	size_t conditionStart = position;
+	ir::Instruction guard{OP::BRANCH};
+	if((result = parseCondition(guard)) != RESULT_CODE::SUCCESS
+		|| (result = expect(TOKEN_TYPE::RIGHT_PAREN, "')'")) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	// terminate() opens the block the guard enters
+	uint32_t guardBlock = current;
+	uint32_t body = guard.target = static_cast<uint32_t>(function->blocks.size());
+	terminate(guard);
+
+	if((result = parseBody()) != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	size_t bodyEnd = position;
+	position = conditionStart;
+	ir::Instruction test{OP::BRANCH};
+	parseCondition(test);
+	position = bodyEnd;
+
+	test.target = body;
+	test.otherwise = function->blocks[guardBlock].terminator().otherwise = static_cast<uint32_t>(function->blocks.size());
+	terminate(test);
+	return RESULT_CODE::SUCCESS;
+}
+
+/**
+ * Parses a condition into the operands of a BRANCH, emitting the code that computes them.
+ * @param branch Its a, b, condition and line are set.
+ */
+RESULT Parser::parseCondition(ir::Instruction& branch){
+	branch.line = peek().lineNumber;
+
+	RESULT result = parseExpression(branch.a);
+	if(result != RESULT_CODE::SUCCESS){
+		return result;
+	}
+
+	for(const Relation& relation : RELATIONS){
+		if(accept(relation.token)){
+			branch.condition = relation.condition;
+			return parseExpression(branch.b);
+		}
+	}
+
+	branch.condition = ir::CONDITION::NE;
+	branch.b = Value::constant(0);
+	return RESULT_CODE::SUCCESS;
+}
+
+RESULT Parser::parseExpression(Value& value){
+	return parseBinary(value, 0);
+}
+
+RESULT Parser::parseBinary(Value& value, const size_t level){
+	if(level == BINARY_LEVELS){
+		return parseUnary(value);
+	}
+
+	RESULT result = parseBinary(value, level + 1);
+	while(result == RESULT_CODE::SUCCESS){
+		const lexer::Token& token = peek();
+		const BinaryOperator* found = nullptr;
+		for(const BinaryOperator& binary : BINARY_OPERATORS){
+			if(binary.level == level && binary.token == token.tokenType){
+				found = &binary;
+			}
+		}
+		if(found == nullptr){
+			break;
+		}
+
+		position++;
+		Value right;
+		if((result = parseBinary(right, level + 1)) == RESULT_CODE::SUCCESS){
+			value = emitOperation(found->op, value, right, token.lineNumber);
+		}
+	}
+	return result;
+}
+
+RESULT Parser::parseUnary(Value& value){
+	const lexer::Token& token = peek();
+	if(!accept(TOKEN_TYPE::MINUS) && !accept(TOKEN_TYPE::TILDE)){
+		return parsePrimary(value);
+	}
+
+	RESULT result = parseUnary(value);
+	if(result == RESULT_CODE::SUCCESS){
+		value = token.tokenType == TOKEN_TYPE::MINUS
+			? emitOperation(OP::SUBTRACT, Value::constant(0), value, token.lineNumber)
+			: emitOperation(OP::NOT, value, Value(), token.lineNumber);
+	}
+	return result;
+}
+
+RESULT Parser::parsePrimary(Value& value){
+	const lexer::Token& token = peek();
+	RESULT result = RESULT_CODE::SUCCESS;
+
+	switch(token.tokenType){
+		case TOKEN_TYPE::NUMBER:
+			position++;
+			value = Value::constant(token.value);
+			return RESULT_CODE::SUCCESS;
+		case TOKEN_TYPE::IDENTIFIER:
+			position++;
+			for(auto scope = scopes.rbegin(); scope != scopes.rend(); scope++){
+				auto variable = scope->find(token.text);
+				if(variable != scope->end()){
+					value = Value::of(variable->second);
+					return RESULT_CODE::SUCCESS;
+				}
+			}
+			return fail("Undeclared variable", token);
+		case TOKEN_TYPE::MEM:
+			{
+				position++;
+				Value address;
+				if((result = expect(TOKEN_TYPE::LEFT_BRACKET, "'['")) != RESULT_CODE::SUCCESS
+					|| (result = parseExpression(address)) != RESULT_CODE::SUCCESS
+					|| (result = expect(TOKEN_TYPE::RIGHT_BRACKET, "']'")) != RESULT_CODE::SUCCESS){
+					return result;
+				}
+				value = emitOperation(OP::LOAD, address, Value(), token.lineNumber);
+				return RESULT_CODE::SUCCESS;
+			}
+		case TOKEN_TYPE::LEFT_PAREN:
+			position++;
+			if((result = parseExpression(value)) != RESULT_CODE::SUCCESS){
+				return result;
+			}
+			return expect(TOKEN_TYPE::RIGHT_PAREN, "')'");
+		default:
+			return fail("Expected an expression", token);
+	}
+}
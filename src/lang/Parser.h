@@ -1,29 +1,88 @@
-/**
- * 
-	<program> ::= <statement> | <statement> <program>
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
-	<statement> ::= <operation> | <operation> <argument> | <operation> <argument> <argument>
+#include "../ResultCode.h"
+#include "IR.h"
+#include "Lexer.h"
 
-	<operation> ::= "AddressOf" | "Load" | "Store" | "Jump" | "JumpC" | "Add" | "Subtract" | "Multiply" | "Divide"
+/**
+ * Recursive descent parser from funlang tokens straight to IR.
+ *
+	<program>    ::= { <statement> }
 
-	<argument> ::= <register> | <type>
+	<statement>  ::= "var" <identifier> [ "=" <expression> ] ";"
+	               | <identifier> "=" <expression> ";"
+	               | "mem" "[" <expression> "]" "=" <expression> ";"
+	               | <if>
+	               | "while" "(" <condition> ")" <body>
+	               | "halt" ";"
 
-	<register> ::= "REG_A" | "REG_B" | "REG_PC"
+	<if>         ::= "if" "(" <condition> ")" <body> [ "else" ( <body> | <if> ) ]
+	<body>       ::= "{" { <statement> } "}"
+	<condition>  ::= <expression> [ <relation> <expression> ]
+	<relation>   ::= "==" | "!=" | "<" | ">" | "<=" | ">="
 
-	<type> ::= <place> | <pointer> | <bool> | <int> | <uint>
+	<expression> ::= <xor> { "|" <xor> }
+	<xor>        ::= <and> { "^" <and> }
+	<and>        ::= <shift> { "&" <shift> }
+	<shift>      ::= <sum> { ( "<<" | ">>" ) <sum> }
+	<sum>        ::= <product> { ( "+" | "-" ) <product> }
+	<product>    ::= <unary> { ( "*" | "/" ) <unary> }
+	<unary>      ::= ( "-" | "~" ) <unary> | <primary>
+	<primary>    ::= <number> | <identifier> | "mem" "[" <expression> "]" | "(" <expression> ")"
+ *
+ * Every value is an unsigned 16 bit integer and comparisons are unsigned.
+ * Variables are scoped to the body they are declared in, start at 0 unless
+ * initialized and must be declared before use. A condition without a
+ * relation is true when the expression is not 0. The program halts after
+ * its last statement.
+ *
+ * The IR is emitted naively, one fresh temporary per operation, and left
+ * for the Optimizer to clean up. Loops are emitted rotated, a guard in front
+ * and the condition tested again at the bottom of the body, so an iteration
+ * costs a single conditional jump.
+ */
+class Parser {
+	public:
+		RESULT parse(const std::vector<lexer::Token>& tokens, ir::Function& function);
 
-	<place> ::= "PLACE(" <number> ")"
-	<pointer> ::= "POINTER(" <number> ")"
-	<bool> ::= "TRUE" | "FALSE"
-	<int> ::= <signed_number>
-	<uint> ::= <number>
+		/* 1-based line of the error parse() stopped at, 0 after success */
+		size_t errorLine() const { return failedLine; }
 
-	<number> ::= <digit> | <digit> <number>
-	<signed_number> ::= <number> | "-" <number>
-	<digit> ::= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9"
+	private:
+		const std::vector<lexer::Token>* tokens = nullptr;
+		size_t position = 0;
+		ir::Function* function = nullptr;
+		/* The block statements are emitted into, never terminated */
+		uint32_t current = 0;
+		/* Innermost scope last */
+		std::vector<std::unordered_map<std::string_view, ir::VReg>> scopes;
+		size_t failedLine = 0;
 
- */
+		const lexer::Token& peek() const { return (*tokens)[position]; }
+		bool accept(const lexer::TOKEN_TYPE type);
+		RESULT expect(const lexer::TOKEN_TYPE type, std::string_view what);
+		RESULT fail(std::string_view message, const lexer::Token& token);
 
-class Parser {
+		uint32_t newBlock();
+		void emit(ir::Instruction instruction);
+		void terminate(ir::Instruction instruction);
+		ir::Value emitOperation(const ir::OP op, const ir::Value& a, const ir::Value& b, const size_t line);
 
+		RESULT parseStatement();
+		RESULT parseBody();
+		RESULT parseDeclaration();
+		RESULT parseIf();
+		RESULT parseWhile();
+		RESULT parseCondition(ir::Instruction& branch);
+		RESULT parseExpression(ir::Value& value);
+		RESULT parseBinary(ir::Value& value, const size_t level);
+		RESULT parseUnary(ir::Value& value);
+		RESULT parsePrimary(ir::Value& value);
 };
+
+#endif
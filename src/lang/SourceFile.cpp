@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iterator>
+
+#include "spdlog/spdlog.h"
+
+#include "SourceFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define SOURCE_FILE_MMAP
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+SourceFile::~SourceFile(){
+	close();
+}
+
+/**
+ * Maps a file, replacing whatever was open before.
+ * @param path The file to open.
+ * @return RESULT_CODE SUCCESS, or FILE_NOT_FOUND if the file cannot be read.
+ */
+RESULT SourceFile::open(const std::filesystem::path& path){
+	close();
+
+	std::error_code error;
+	size_t size = static_cast<size_t>(std::filesystem::file_size(path, error));
+	if(error){
+		SPDLOG_ERROR("Could not open source: " + path.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+
+#ifdef SOURCE_FILE_MMAP
+	if(size > 0){
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0){
+			SPDLOG_ERROR("Could not open source: " + path.string());
+			return RESULT_CODE::FILE_NOT_FOUND;
+		}
+
+		void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(mapping != MAP_FAILED){
+			madvise(mapping, size, MADV_SEQUENTIAL);
+			mapped = static_cast<const char*>(mapping);
+			length = size;
+			return RESULT_CODE::SUCCESS;
+		}
+	}
+#endif
+
+	std::ifstream fileStream(path, std::ios::binary);
+	if(!fileStream.is_open()){
+		SPDLOG_ERROR("Could not open source: " + path.string());
+		return RESULT_CODE::FILE_NOT_FOUND;
+	}
+	buffer.assign(std::istreambuf_iterator<char>(fileStream), std::istreambuf_iterator<char>());
+	return RESULT_CODE::SUCCESS;
+}
+
+void SourceFile::close(){
+#ifdef SOURCE_FILE_MMAP
+	if(mapped != nullptr){
+		munmap(const_cast<char*>(mapped), length);
+	}
+#endif
+	mapped = nullptr;
+	length = 0;
+	buffer.clear();
+}
@@ -0,0 +1,34 @@
+#ifndef SOURCE_FILE_H
+#define SOURCE_FILE_H
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "../ResultCode.h"
+
+/**
+ * A source file mapped read-only into memory, so tokens can be string_views
+ * into it without copying. Falls back to reading the file into a string
+ * where mmap is not available, and for empty files.
+ */
+class SourceFile {
+	public:
+		SourceFile() = default;
+		~SourceFile();
+
+		SourceFile(const SourceFile&) = delete;
+		SourceFile& operator=(const SourceFile&) = delete;
+
+		RESULT open(const std::filesystem::path& path);
+		void close();
+
+		std::string_view text() const { return mapped != nullptr ? std::string_view(mapped, length) : std::string_view(buffer); }
+
+	private:
+		const char* mapped = nullptr;
+		size_t length = 0;
+		std::string buffer;
+};
+
+#endif
@@ -19,15 +19,19 @@
 
 #include <iostream>
 #include <filesystem>
+#include <thread>
 #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
 
 #include "spdlog/spdlog.h"
 
 #include "FVM.h"
-#include "lang/Lexer.h"
+#include "FBCImage.h"
+#include "lang/CompileCache.h"
 #include "lang/Compiler.h"
 #include "ResultCode.h"
-
+#ifdef FVM_AOT
+	#include "aot/NativeProgram.h"
+#endif
 
 
 RESULT run(int argc, char** argv){
@@ -38,12 +42,16 @@ RESULT run(int argc, char** argv){
 	bool compile_funlang = false;
 	bool compile_funasm = false;
 	bool execute_fbc = false;
+	bool native = false;
 
 	/* Parse arguments */
-	if(argc == 1){
-		std::cout << "Usage: FVM [program_file] <memory (MB)>" << std::endl;
+	if(argc == 3 && std::string(argv[2]) == "--native"){
+		native = true;
+	}
+	if(argc == 1 || (argc == 3 && !native)){
+		std::cout << "Usage: FVM [program_file] <--native>" << std::endl;
 		return RESULT_CODE::CLI_ERROR;
-	}else if(argc == 2){
+	}else if(argc == 2 || native){
 		programPath = std::filesystem::path(argv[1]);
 		
 		// Check if the file exists and is not a directory
@@ -88,23 +96,88 @@ RESULT run(int argc, char** argv){
 	size_t MEMORY_SIZE =  MEMORY_SIZE_MB * 1024 * 1024 / sizeof(uint16_t);
 	
 
+	/* Sources compiled before come straight out of the cache */
+	CompileCache cache(CompileCache::defaultDirectory());
+	std::string cacheKey;
+	std::filesystem::path fbcPath = programPath;
+	fbcPath.replace_extension(".fbc");
+	if((compile_funlang || compile_funasm) && cache.isEnabled()){
+		cacheKey = CompileCache::key(programPath);
+		if(cache.fetch(cacheKey, fbcPath)){
+			SPDLOG_INFO("Using cached bytecode for " + programPath.filename().string());
+			compile_funlang = false;
+			compile_funasm = false;
+		}
+	}
+
 	if(compile_funlang){
 		SPDLOG_INFO("Compiling funlang file: " + programPath.filename().string());	
-		Lexer lexer = Lexer(programPath);
-		lexer.tokenize();	
+		Compiler compiler(std::thread::hardware_concurrency());
+		RESULT result = compiler.compileFunlangToFunasm(programPath);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+
+		// Carry on with the generated funasm
+		programPath.replace_extension(".funasm");
+		compile_funasm = true;
 	}
 
 	if(compile_funasm){
 		SPDLOG_INFO("Compiling funasm file: " + programPath.filename().string());	
-		Compiler compiler;
-		compiler.compileFunasmToBytecode(programPath);
-	
+		Compiler compiler(std::thread::hardware_concurrency());
+		RESULT result = compiler.compileFunasmToBytecode(programPath);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+		cache.store(cacheKey, fbcPath);
 	}
 
 	if(execute_fbc){
+		/* Images say how much memory they need, raw bytecode gets the default */
+		FBCImage image;
+		if(FBCImage::isImage(programPath) && image.read(programPath) == RESULT_CODE::SUCCESS && image.memorySize > 0){
+			MEMORY_SIZE = image.memorySize;
+		}
+
 		/** Initialize the VM */
 		FVM cvm = FVM(MEMORY_SIZE);
 		cvm.init();	
+
+		SPDLOG_INFO("Executing fbc file: " + programPath.filename().string());
+		RESULT result = cvm.loadBytecode(0, programPath);
+		if(result != RESULT_CODE::SUCCESS){
+			return result;
+		}
+
+		/* Native code is built next to the .fbc once and reused while it matches */
+		if(native){
+			std::filesystem::path soPath = programPath;
+			soPath.replace_extension(".so");
+			#ifdef FVM_AOT
+				if(cvm.attachNative(soPath) != RESULT_CODE::SUCCESS){
+					if(NativeProgram::build(cvm, soPath) != RESULT_CODE::SUCCESS || cvm.attachNative(soPath) != RESULT_CODE::SUCCESS){
+						SPDLOG_WARN("Running " + programPath.filename().string() + " interpreted");
+					}
+				}
+			#else
+				SPDLOG_WARN("Built without FVM_AOT, running " + programPath.filename().string() + " interpreted");
+			#endif
+		}
+
+		result = cvm.run();
+		#ifdef FVM_PROFILE
+			SPDLOG_INFO(cvm.profile.report(16));
+		#endif
+		if(result != RESULT_CODE::SUCCESS){
+			#ifdef FVM_TRACE
+				std::filesystem::path tracePath = programPath;
+				tracePath.replace_extension(".fvmtrace");
+				cvm.trace.writeTo(tracePath);
+				SPDLOG_ERROR("Last instructions before the fault, full trace in " + tracePath.filename().string() + ":\n" + cvm.trace.toString(16));
+			#endif
+			return result;
+		}
 	}
 
 	return RESULT_CODE::SUCCESS;
@@ -0,0 +1,266 @@
+#ifdef FVM_AOT
+
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "FVMTestUtils.h"
+#include "aot/NativeProgram.h"
+
+/**
+ * Runs every program interpreted and through a shared object built from it,
+ * and expects the same result, registers and memory. Skipped where there is
+ * no C compiler.
+ */
+class FVMTestAOT : public ::testing::Test{
+protected:
+    std::filesystem::path directory;
+    std::unique_ptr<FVM> interpreted;
+    std::unique_ptr<FVM> native;
+
+    virtual void SetUp() {
+        if(std::system("cc --version > /dev/null 2>&1") != 0){
+            GTEST_SKIP() << "No C compiler";
+        }
+        directory = std::filesystem::temp_directory_path() / ("FVMTestAOT_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        createVMs(0x10001);
+    }
+
+    virtual void TearDown() {
+        native.reset();
+        if(!directory.empty()){
+            std::filesystem::remove_all(directory);
+        }
+    }
+
+    void createVMs(const size_t memorySize) {
+        interpreted = std::make_unique<FVM>(memorySize);
+        interpreted->init();
+        interpreted->jitEnabled = false;
+
+        native = std::make_unique<FVM>(memorySize);
+        native->init();
+        native->jitEnabled = false;
+    }
+
+    /* Loads the program into both VMs and attaches native code built from it */
+    void load(const std::vector<uint8_t>& bytecode) {
+        ASSERT_EQ(interpreted->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+        ASSERT_EQ(native->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+
+        std::filesystem::path soPath = directory / "program.so";
+        ASSERT_EQ(NativeProgram::build(*native, soPath).value, RESULT_CODE::SUCCESS.value);
+        ASSERT_EQ(native->attachNative(soPath).value, RESULT_CODE::SUCCESS.value);
+        EXPECT_TRUE(native->hasNative());
+    }
+
+    void runBoth(const RESULT& expected = RESULT_CODE::SUCCESS) {
+        EXPECT_EQ(interpreted->run().value, expected.value);
+        EXPECT_EQ(native->run().value, expected.value);
+
+        EXPECT_EQ(interpreted->registers, native->registers);
+        EXPECT_EQ(interpreted->memory, native->memory);
+    }
+};
+
+TEST_F(FVMTestAOT, MatchesInterpreter){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(500) << BYTECODE::REG_0;           // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04 zero
+    bytecode << BYTECODE::MOVELR << uint16_t(0x2000) << BYTECODE::REG_2;        // 0x08 pointer
+    bytecode << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_6;             // 0x0C
+    // loop: 0x10
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_3;         // 0x10
+    bytecode << BYTECODE::MULTIPLY << BYTECODE::REG_6 << BYTECODE::REG_3;       // 0x13
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_5;             // 0x16
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_3 << BYTECODE::REG_5;         // 0x1A
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_5 << uint16_t(0x3000);        // 0x1D
+    bytecode << BYTECODE::MOVELIR << uint16_t(0xBEEF) << BYTECODE::REG_2;       // 0x21
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_2 << BYTECODE::REG_4;        // 0x25
+    bytecode << BYTECODE::ADD << BYTECODE::REG_5 << BYTECODE::REG_4;            // 0x28
+    bytecode << BYTECODE::MOVEIRM << BYTECODE::REG_2 << uint16_t(0x3002);       // 0x2B
+    bytecode << BYTECODE::MOVELM << uint16_t(0x2000) << uint16_t(0x3004);       // 0x2F
+    bytecode << BYTECODE::MOVEIMR << uint16_t(0x3004) << BYTECODE::REG_7;       // 0x34
+    bytecode << BYTECODE::SHIFTLEFT << BYTECODE::REG_4 << uint16_t(3);          // 0x38
+    bytecode << BYTECODE::SHIFTRIGHT << BYTECODE::REG_7 << uint16_t(16);        // 0x3C
+    bytecode << BYTECODE::XOR << BYTECODE::REG_4 << BYTECODE::REG_7;            // 0x40
+    bytecode << BYTECODE::NOT << BYTECODE::REG_7;                               // 0x43
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x45
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x47
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x49
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x4B
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x10);                             // 0x4E
+    bytecode << BYTECODE::HALT;                                                 // 0x51
+
+    load(bytecode);
+    native->snapshot();
+    runBoth();
+
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(native->readUInt16(0x2000 + 2 * 499), 0xBEEF);
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_PC), 0x51);
+
+    // Stores native code made itself are undone like any other
+    ASSERT_EQ(native->restore().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(native->readUInt16(0x3000), 0);
+    EXPECT_EQ(native->readUInt16(0x2000 + 2 * 499), 0);
+}
+
+TEST_F(FVMTestAOT, LeavesRegisterPCAndFlagsOperandsToInterpreter){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(5) << BYTECODE::REG_0;             // 0x00
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_PC << BYTECODE::REG_1;        // 0x04
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_FLAGS;     // 0x07 sets EQ
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x11);                             // 0x0A
+    bytecode << BYTECODE::MOVELR << uint16_t(99) << BYTECODE::REG_2;            // 0x0D skipped
+    bytecode << BYTECODE::HALT;                                                 // 0x11
+
+    load(bytecode);
+    runBoth();
+
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_1), 0x04);
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_2), 0);
+}
+
+TEST_F(FVMTestAOT, FaultsLikeInterpreter){
+    createVMs(0x1000);
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(0x0FF0) << BYTECODE::REG_0;        // 0x00
+    // loop: 0x04, reads past the end of memory on its last iteration
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x04
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                         // 0x07
+    bytecode << BYTECODE::JUMP << uint16_t(0x04);                               // 0x09
+
+    load(bytecode);
+    runBoth(RESULT_CODE::BAD_ADDRESS);
+
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_0), 0x0FFF);
+}
+
+TEST_F(FVMTestAOT, DivideByZeroFaults){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(300) << BYTECODE::REG_0;           // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(1000) << BYTECODE::REG_6;          // 0x04
+    // loop: 0x08, divides by the counter until it reaches zero
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_5;         // 0x08
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_6 << BYTECODE::REG_5;         // 0x0B
+    bytecode << BYTECODE::ADD << BYTECODE::REG_5 << BYTECODE::REG_4;            // 0x0E
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x11
+    bytecode << BYTECODE::JUMP << uint16_t(0x08);                               // 0x13
+
+    load(bytecode);
+    runBoth(RESULT_CODE::DIVIDE_BY_ZERO);
+
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_PC), 0x0B);
+}
+
+TEST_F(FVMTestAOT, SelfModifyingProgramFallsBackToInterpreter){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(100) << BYTECODE::REG_0;           // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04
+    // loop: 0x08
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x08 operand rewritten below
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x0A
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x0C
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                             // 0x0F
+    // Retarget the INCREMENT at REG_3 and run the loop body once more
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_0;             // 0x12
+    bytecode << BYTECODE::MOVELM << uint16_t(static_cast<uint16_t>(BYTECODE::REG_3) << 8 | static_cast<uint16_t>(BYTECODE::INCREMENT)) << uint16_t(0x08); // 0x16
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_3 << BYTECODE::REG_1;        // 0x1B
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x08);                             // 0x1E
+    bytecode << BYTECODE::HALT;                                                 // 0x21
+
+    load(bytecode);
+    runBoth();
+
+    EXPECT_FALSE(native->hasNative());
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_2), 100);
+    EXPECT_EQ(native->getRegister(BYTECODE::REG_3), 1);
+}
+
+TEST_F(FVMTestAOT, RefusesCodeBuiltFromAnotherProgram){
+    std::vector<uint8_t> first;
+    first << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_0;
+    first << BYTECODE::HALT;
+
+    std::vector<uint8_t> second;
+    second << BYTECODE::MOVELR << uint16_t(2) << BYTECODE::REG_0;
+    second << BYTECODE::HALT;
+
+    load(first);
+    std::filesystem::path soPath = directory / "program.so";
+
+    ASSERT_EQ(interpreted->loadBytecode(0, second).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(interpreted->attachNative(soPath).value, RESULT_CODE::NATIVE_MISMATCH.value);
+    EXPECT_FALSE(interpreted->hasNative());
+
+    // Native code only runs while the program it was built from is loaded
+    ASSERT_EQ(native->loadBytecode(0, second).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_FALSE(native->hasNative());
+    ASSERT_EQ(native->loadBytecode(0, first).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_TRUE(native->hasNative());
+}
+
+TEST_F(FVMTestAOT, BuildsAtPathsShellsWouldMisread){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_0;
+    bytecode << BYTECODE::HALT;
+    ASSERT_EQ(native->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+
+    // Handed to the compiler as they are, never through a shell
+    std::filesystem::path weird = directory / "a \"b$(touch injected)`touch injected` 'c";
+    std::filesystem::create_directories(weird);
+    std::filesystem::path soPath = weird / "program.so";
+    ASSERT_EQ(NativeProgram::build(*native, soPath).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(native->attachNative(soPath).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_FALSE(std::filesystem::exists("injected"));
+    EXPECT_FALSE(std::filesystem::exists(weird / "injected"));
+}
+
+TEST_F(FVMTestAOT, ConcurrentBuildsOfOneTarget){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_0;
+    bytecode << BYTECODE::HALT;
+    ASSERT_EQ(native->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+
+    std::filesystem::path soPath = directory / "program.so";
+    std::vector<RESULT> results(4, RESULT_CODE::UNSPECIFIED_FAILURE);
+    std::vector<std::thread> builders;
+    for(size_t i = 0; i < results.size(); i++){
+        builders.emplace_back([&, i]{ results[i] = NativeProgram::build(*native, soPath); });
+    }
+    for(std::thread& builder : builders){
+        builder.join();
+    }
+
+    for(const RESULT& result : results){
+        EXPECT_EQ(result.value, RESULT_CODE::SUCCESS.value);
+    }
+    EXPECT_EQ(native->attachNative(soPath).value, RESULT_CODE::SUCCESS.value);
+
+    // Only the shared object and its source are left behind
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator()), 2);
+}
+
+TEST_F(FVMTestAOT, FailedBuildLeavesNothingBehind){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::HALT;
+    ASSERT_EQ(native->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+
+    setenv("FVM_CC", "false", 1);
+    RESULT result = NativeProgram::build(*native, directory / "program.so");
+    unsetenv("FVM_CC");
+
+    EXPECT_EQ(result.value, RESULT_CODE::NATIVE_BUILD_FAILED.value);
+    EXPECT_TRUE(std::filesystem::is_empty(directory));
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <string>
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "lang/Assembler.h"
+#include "FVMTestUtils.h"
+
+TEST(FVMTestAssembler, MatchesHandEncodedBytecode){
+    std::vector<uint8_t> expected;
+    expected << BYTECODE::MOVELR << uint16_t(5) << BYTECODE::REG_0;         // 0x00
+    expected << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    expected << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    expected << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    expected << BYTECODE::JUMPGT << uint16_t(0x08);                         // 0x0D
+    expected << BYTECODE::HALT;                                             // 0x10
+
+    Assembler assembler;
+    ASSERT_EQ(assembler.assemble(
+        "MOVELR 0005 REG_0\n"
+        "  MOVELR 0x0 REG_1 ; comment\r\n"
+        "\n"
+        "DECREMENT\tREG_0\n"
+        "COMPARE REG_0 REG_1\n"
+        "JUMPGT 8\n"
+        "HALT").value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(assembler.releaseBytecode(), expected);
+}
+
+TEST(FVMTestAssembler, ResolvesForwardAndBackwardLabels){
+    Assembler assembler;
+    ASSERT_EQ(assembler.assemble(
+        "        MOVELR count REG_0\n"
+        "        MOVELR 0 REG_1\n"
+        "loop:   COMPARE REG_0 REG_1\n"
+        "        JUMPEQ done\n"
+        "        DECREMENT REG_0\n"
+        "        JUMP loop\n"
+        "done:\n"
+        "        HALT\n"
+        "count:  HALT\n").value, RESULT_CODE::SUCCESS.value);
+
+    std::vector<uint16_t> blocks = assembler.blockStarts();
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    EXPECT_EQ(blocks, (std::vector<uint16_t>{0x00, 0x08, 0x0E, 0x13, 0x14}));
+
+    FVM vm(0x100);
+    vm.init();
+    vm.loadBytecode(0, assembler.releaseBytecode());
+    EXPECT_EQ(vm.run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm.getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(vm.getRegister(BYTECODE::REG_PC), 0x13);
+}
+
+TEST(FVMTestAssembler, AddsOffsetsToLabels){
+    std::vector<uint8_t> expected;
+    expected << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x06);     // 0x00
+    expected << BYTECODE::MOVERM << BYTECODE::REG_1 << uint16_t(0x04);     // 0x04
+    expected << BYTECODE::HALT;                                             // 0x08
+
+    Assembler assembler;
+    ASSERT_EQ(assembler.assemble(
+        "        MOVERM REG_0 patch+2\n"
+        "patch:  MOVERM REG_1 patch+0x0\n"
+        "        HALT\n").value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(assembler.releaseBytecode(), expected);
+
+    EXPECT_EQ(assembler.assemble("JUMP end+\nend: HALT\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(assembler.assemble("a+1: HALT\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(assembler.assemble("JUMP end+FFFF\nend: HALT\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+}
+
+TEST(FVMTestAssembler, ReportsErrorsWithLineNumbers){
+    Assembler assembler;
+
+    EXPECT_EQ(assembler.assemble("HALT\nFROB REG_0\n").value, RESULT_CODE::UNKNOWN_INSTRUCTION.value);
+    EXPECT_EQ(assembler.errorLine(), size_t(2));
+
+    EXPECT_EQ(assembler.assemble("INCREMENT\n").value, RESULT_CODE::INCORRECT_NUM_ARGS.value);
+    EXPECT_EQ(assembler.assemble("INCREMENT REG_0 REG_1\n").value, RESULT_CODE::INCORRECT_NUM_ARGS.value);
+    EXPECT_EQ(assembler.assemble("INCREMENT 5\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(assembler.assemble("MOVELR 10000 REG_0\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(assembler.assemble("top:\ntop: HALT\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(assembler.assemble("beef: HALT\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+
+    EXPECT_EQ(assembler.assemble("HALT\n\nJUMP nowhere\n").value, RESULT_CODE::UNDEFINED_LABEL.value);
+    EXPECT_EQ(assembler.errorLine(), size_t(3));
+}
+
+/* A source large enough to be split, with labels referenced across chunks in both directions */
+static std::string largeSource(const size_t blockCount){
+    std::string padding(600, '-');
+    std::string source;
+    for(size_t i = 0; i < blockCount; i++){
+        source += "blk" + std::to_string(i) + ": INCREMENT REG_0 ; " + padding + "\n";
+        source += "    JUMPLT blk" + std::to_string(i * 7919 % blockCount) + "\n";
+    }
+    source += "    HALT\n";
+    return source;
+}
+
+static std::vector<uint16_t> sortedBlocks(const Assembler& assembler){
+    std::vector<uint16_t> blocks = assembler.blockStarts();
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    return blocks;
+}
+
+TEST(FVMTestAssembler, ParallelMatchesSerial){
+    std::string source = largeSource(2000);
+    ASSERT_GT(source.size(), 4 * Assembler::MIN_CHUNK_SIZE);
+
+    Assembler serial;
+    Assembler parallel;
+    ASSERT_EQ(serial.assemble(source).value, RESULT_CODE::SUCCESS.value);
+    ASSERT_EQ(parallel.assembleParallel(source, 4).value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(sortedBlocks(parallel), sortedBlocks(serial));
+    EXPECT_EQ(parallel.releaseBytecode(), serial.releaseBytecode());
+}
+
+TEST(FVMTestAssembler, ParallelReportsAbsoluteLines){
+    std::string source = largeSource(2000);
+    source += "    FROB REG_0\n";
+
+    Assembler parallel;
+    EXPECT_EQ(parallel.assembleParallel(source, 4).value, RESULT_CODE::UNKNOWN_INSTRUCTION.value);
+    EXPECT_EQ(parallel.errorLine(), size_t(4002));
+
+    source = largeSource(2000) + "blk5: HALT\n";
+    EXPECT_EQ(parallel.assembleParallel(source, 4).value, RESULT_CODE::INVALID_ARGUMENT.value);
+}
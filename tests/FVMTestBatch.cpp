@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "FVMBatch.h"
+#include "FVMTestUtils.h"
+
+/**
+ * Runs a program over many lanes and checks every lane against a scalar FVM
+ * started from the same registers.
+ */
+class FVMTestBatch : public ::testing::Test{
+protected:
+    static constexpr size_t LANES = 37;
+    static constexpr size_t MEMORY_SIZE = 512;
+
+    std::unique_ptr<FVMBatch> batch;
+
+    virtual void SetUp() {
+        batch = std::make_unique<FVMBatch>(LANES, MEMORY_SIZE);
+        batch->init();
+    }
+
+    void expectMatchesScalar(const std::vector<uint8_t>& bytecode, const std::vector<uint16_t>& inputs) {
+        for(size_t lane = 0; lane < LANES; lane++){
+            FVM fvm(MEMORY_SIZE);
+            fvm.init();
+            fvm.loadBytecode(0, bytecode);
+            fvm.getRegister(BYTECODE::REG_0) = inputs[lane];
+            EXPECT_EQ(fvm.run().value, batch->laneResult(lane).value);
+
+            for(size_t r = 0; r < FVM::REGISTER_COUNT; r++){
+                EXPECT_EQ(fvm.registers[r], batch->getRegister(lane, static_cast<BYTECODE>(static_cast<uint8_t>(BYTECODE::REG_0) + r)))
+                    << "lane " << lane << " register " << r;
+            }
+            EXPECT_TRUE(std::equal(fvm.memory.begin(), fvm.memory.end(), batch->laneMemory(lane))) << "lane " << lane;
+        }
+    }
+};
+
+TEST_F(FVMTestBatch, DivergentLoopsMatchScalar){
+    std::vector<uint8_t> bytecode;
+
+    // Counts Collatz steps from REG_0 down to 1 into REG_1
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_3;         // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_4;         // 0x04
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_6;         // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_3;    // 0x0C loop
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x2F);                         // 0x0F
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_2;     // 0x12
+    bytecode << BYTECODE::AND << BYTECODE::REG_3 << BYTECODE::REG_2;        // 0x15
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_2 << BYTECODE::REG_4;    // 0x18
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x26);                         // 0x1B
+    bytecode << BYTECODE::MULTIPLY << BYTECODE::REG_6 << BYTECODE::REG_0;   // 0x1E odd
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x21
+    bytecode << BYTECODE::JUMP << uint16_t(0x2A);                           // 0x23
+    bytecode << BYTECODE::SHIFTRIGHT << BYTECODE::REG_0 << uint16_t(1);     // 0x26 even
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_1;                     // 0x2A
+    bytecode << BYTECODE::JUMP << uint16_t(0x0C);                           // 0x2C
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_1 << uint16_t(0x100);     // 0x2F done
+    bytecode << BYTECODE::HALT;                                             // 0x33
+
+    std::vector<uint16_t> inputs;
+    for(size_t lane = 0; lane < LANES; lane++){
+        inputs.push_back(static_cast<uint16_t>(lane + 1));
+    }
+
+    ASSERT_EQ(batch->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+    for(size_t lane = 0; lane < LANES; lane++){
+        batch->getRegister(lane, BYTECODE::REG_0) = inputs[lane];
+    }
+    EXPECT_EQ(batch->run().value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(batch->getRegister(26, BYTECODE::REG_1), 111);
+    expectMatchesScalar(bytecode, inputs);
+}
+
+TEST_F(FVMTestBatch, SelfModifyingLanesFinishOnScalarFVM){
+    std::vector<uint8_t> bytecode;
+
+    // Lanes with a non-zero REG_0 patch the literal loaded into REG_5
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x00
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x04
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x0E);                         // 0x07
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x0F);      // 0x0A
+    bytecode << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_5;         // 0x0E
+    bytecode << BYTECODE::HALT;                                             // 0x12
+
+    std::vector<uint16_t> inputs;
+    for(size_t lane = 0; lane < LANES; lane++){
+        inputs.push_back(static_cast<uint16_t>(lane % 3 == 0 ? 0 : lane * 100));
+    }
+
+    ASSERT_EQ(batch->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+    for(size_t lane = 0; lane < LANES; lane++){
+        batch->getRegister(lane, BYTECODE::REG_0) = inputs[lane];
+    }
+    EXPECT_EQ(batch->run().value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(batch->getRegister(0, BYTECODE::REG_5), 7);
+    EXPECT_EQ(batch->getRegister(1, BYTECODE::REG_5), 100);
+    expectMatchesScalar(bytecode, inputs);
+}
+
+TEST_F(FVMTestBatch, OutOfRangeLaneAddressesFault){
+    std::vector<uint8_t> bytecode;
+
+    // Reads and then writes at the address in REG_0, past the end of memory in some lanes
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x00
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_1;                     // 0x03
+    bytecode << BYTECODE::MOVELIR << uint16_t(0xABCD) << BYTECODE::REG_0;   // 0x05
+    bytecode << BYTECODE::HALT;                                             // 0x09
+
+    std::vector<uint16_t> inputs;
+    for(size_t lane = 0; lane < LANES; lane++){
+        inputs.push_back(static_cast<uint16_t>(0x40 + lane * 14));
+    }
+    inputs[0] = MEMORY_SIZE - 1;
+    inputs[1] = MEMORY_SIZE - 2;
+
+    ASSERT_EQ(batch->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+    for(size_t lane = 0; lane < LANES; lane++){
+        batch->getRegister(lane, BYTECODE::REG_0) = inputs[lane];
+    }
+    EXPECT_EQ(batch->run().value, RESULT_CODE::BAD_ADDRESS.value);
+
+    EXPECT_EQ(batch->laneResult(0).value, RESULT_CODE::BAD_ADDRESS.value);
+    EXPECT_EQ(batch->laneResult(1).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(batch->laneResult(LANES - 1).value, RESULT_CODE::BAD_ADDRESS.value);
+    expectMatchesScalar(bytecode, inputs);
+}
+
+TEST_F(FVMTestBatch, ZeroLaneDivisorFaults){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(1000) << BYTECODE::REG_1;      // 0x00
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_1 << BYTECODE::REG_0;     // 0x04
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x100);     // 0x07
+    bytecode << BYTECODE::HALT;                                             // 0x0B
+
+    std::vector<uint16_t> inputs;
+    for(size_t lane = 0; lane < LANES; lane++){
+        inputs.push_back(static_cast<uint16_t>(lane % 4));
+    }
+
+    ASSERT_EQ(batch->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+    for(size_t lane = 0; lane < LANES; lane++){
+        batch->getRegister(lane, BYTECODE::REG_0) = inputs[lane];
+    }
+    EXPECT_EQ(batch->run().value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+
+    EXPECT_EQ(batch->laneResult(0).value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+    EXPECT_EQ(batch->getRegister(0, BYTECODE::REG_PC), 0x04);
+    EXPECT_EQ(batch->laneResult(1).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(batch->getRegister(3, BYTECODE::REG_0), 333);
+    expectMatchesScalar(bytecode, inputs);
+}
@@ -0,0 +1,105 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <gtest/gtest.h>
+#include "FBCImage.h"
+#include "FVM.h"
+#include "FVMTestUtils.h"
+#include "lang/CompileCache.h"
+#include "lang/Compiler.h"
+
+static void writeFile(const std::filesystem::path& path, const std::string& text){
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+}
+
+static std::string readFile(const std::filesystem::path& path){
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+TEST(FVMTestCompileCache, KeysDependOnContentAndLanguage){
+    std::string key = CompileCache::key("MOVELR 1 REG_0\nHALT\n", ".funasm");
+    EXPECT_EQ(key.size(), size_t(16));
+    EXPECT_EQ(key, CompileCache::key("MOVELR 1 REG_0\nHALT\n", ".funasm"));
+    EXPECT_NE(key, CompileCache::key("MOVELR 2 REG_0\nHALT\n", ".funasm"));
+    EXPECT_NE(key, CompileCache::key("MOVELR 1 REG_0\nHALT\n", ".funlang"));
+    EXPECT_NE(CompileCache::key("", ".funasm"), CompileCache::key("", ".funlang"));
+}
+
+TEST(FVMTestCompileCache, StoresAndFetchesImages){
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "FVMTestCompileCache";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::path asmPath = directory / "program.funasm";
+    std::filesystem::path fbcPath = directory / "program.fbc";
+    writeFile(asmPath, "MOVELR 7 REG_0\nHALT\n");
+
+    CompileCache cache(directory / "cache");
+    std::string key = CompileCache::key(asmPath);
+    ASSERT_FALSE(key.empty());
+    EXPECT_FALSE(cache.fetch(key, fbcPath));
+
+    ASSERT_EQ(Compiler().compileFunasmToBytecode(asmPath).value, RESULT_CODE::SUCCESS.value);
+    std::string compiled = readFile(fbcPath);
+    ASSERT_EQ(cache.store(key, fbcPath).value, RESULT_CODE::SUCCESS.value);
+
+    std::filesystem::remove(fbcPath);
+    ASSERT_TRUE(cache.fetch(key, fbcPath));
+    EXPECT_EQ(readFile(fbcPath), compiled);
+    EXPECT_TRUE(FBCImage::isImage(fbcPath));
+
+    // A damaged entry misses and is dropped
+    writeFile(cache.entryPath(key), "FBC");
+    EXPECT_FALSE(cache.fetch(key, fbcPath));
+    EXPECT_FALSE(std::filesystem::exists(cache.entryPath(key)));
+
+    // Disabled caches never hit
+    CompileCache disabled{std::filesystem::path()};
+    EXPECT_FALSE(disabled.isEnabled());
+    EXPECT_EQ(disabled.store(key, fbcPath).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_FALSE(disabled.fetch(key, fbcPath));
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(FVMTestCompileCache, FetchKeepsMappedImageIntact){
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "FVMTestCompileCacheMapped";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::path fbcPath = directory / "program.fbc";
+    std::filesystem::path otherPath = directory / "other.fbc";
+
+    // Whole pages so the running VM maps the section from the file
+    std::vector<uint8_t> code;
+    code << BYTECODE::JUMP << uint16_t(0x1000);
+    code.resize(0x1000);
+    code << BYTECODE::INCREMENT << BYTECODE::REG_0 << BYTECODE::HALT;
+    code.resize(0x2000);
+
+    FBCImage running;
+    running.memorySize = 0x4000;
+    running.addSection(FBCImage::SECTION_TYPE::CODE, 0, code);
+    ASSERT_EQ(running.write(fbcPath).value, RESULT_CODE::SUCCESS.value);
+
+    FBCImage cached;
+    cached.addSection(FBCImage::SECTION_TYPE::CODE, 0, std::vector<uint8_t>{static_cast<uint8_t>(BYTECODE::HALT)});
+    ASSERT_EQ(cached.write(otherPath).value, RESULT_CODE::SUCCESS.value);
+
+    CompileCache cache(directory / "cache");
+    std::string key = CompileCache::key("HALT\n", ".funasm");
+    ASSERT_EQ(cache.store(key, otherPath).value, RESULT_CODE::SUCCESS.value);
+
+    FVM vm(0x4000);
+    vm.init();
+    ASSERT_EQ(vm.loadBytecode(0, fbcPath).value, RESULT_CODE::SUCCESS.value);
+
+    // The fetched image replaces the file, the VM keeps running the one it loaded
+    ASSERT_TRUE(cache.fetch(key, fbcPath));
+    EXPECT_EQ(readFile(fbcPath), readFile(otherPath));
+    EXPECT_EQ(vm.run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm.getRegister(BYTECODE::REG_0), 1);
+    EXPECT_TRUE(std::equal(code.begin(), code.end(), vm.memory.begin()));
+
+    std::filesystem::remove_all(directory);
+}
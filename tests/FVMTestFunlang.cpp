@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "lang/Assembler.h"
+#include "lang/CodeGenerator.h"
+#include "lang/Compiler.h"
+#include "lang/Lexer.h"
+#include "lang/Optimizer.h"
+#include "lang/Parser.h"
+
+/* Compiles funlang down to funasm, failing the test on errors */
+static std::string compile(const std::string& source){
+    std::string funasm;
+    EXPECT_EQ(Compiler::compileFunlang(source, funasm).value, RESULT_CODE::SUCCESS.value);
+    return funasm;
+}
+
+/* Compiles, assembles and runs funlang in a VM with the full 16 bit address space */
+static std::unique_ptr<FVM> run(const std::string& source){
+    Assembler assembler;
+    EXPECT_EQ(assembler.assemble(compile(source)).value, RESULT_CODE::SUCCESS.value);
+
+    std::unique_ptr<FVM> vm = std::make_unique<FVM>(0x10000);
+    vm->init();
+    vm->loadBytecode(0, assembler.releaseBytecode());
+    EXPECT_EQ(vm->run().value, RESULT_CODE::SUCCESS.value);
+    return vm;
+}
+
+static size_t countLines(const std::string& funasm, const std::string& prefix){
+    size_t count = 0;
+    for(size_t line = 0; line < funasm.size(); line = funasm.find('\n', line) + 1){
+        count += funasm.compare(line, prefix.size(), prefix) == 0 ? 1 : 0;
+    }
+    return count;
+}
+
+TEST(FVMTestFunlang, RunsArithmeticAndControlFlow){
+    std::unique_ptr<FVM> vm = run(
+        "// Sum, factorial and a few operators\n"
+        "var i = 1;\n"
+        "var sum = 0;\n"
+        "var factorial = 1;\n"
+        "while (i <= 8) {\n"
+        "    sum = sum + i;\n"
+        "    factorial = factorial * i;\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "mem[0x100] = sum;\n"
+        "mem[0x102] = factorial;\n"
+        "mem[0x104] = (sum - 40) / 3 << 4 | 1;\n"
+        "mem[0x106] = ~sum & 0xFF ^ -1;\n"
+        "var kind = 0;\n"
+        "if (sum < 30) { kind = 1; } else if (sum == 36) { kind = 2; } else { kind = 3; }\n"
+        "mem[0x108] = kind;\n"
+        "var n = 27;\n"
+        "var steps = 0;\n"
+        "while (n != 1) {\n"
+        "    if ((n & 1) == 0) { n = n >> 1; } else { n = 3 * n + 1; }\n"
+        "    steps = steps + 1;\n"
+        "}\n"
+        "mem[0x10A] = steps;\n");
+
+    EXPECT_EQ(vm->readUInt16(0x100), 36);
+    EXPECT_EQ(vm->readUInt16(0x102), 40320);
+    EXPECT_EQ(vm->readUInt16(0x104), uint16_t(((36 - 40) & 0xFFFF) / 3 << 4 | 1));
+    EXPECT_EQ(vm->readUInt16(0x106), uint16_t((~36 & 0xFF) ^ 0xFFFF));
+    EXPECT_EQ(vm->readUInt16(0x108), 2);
+    EXPECT_EQ(vm->readUInt16(0x10A), 111);
+}
+
+TEST(FVMTestFunlang, FoldsConstantsAwayEntirely){
+    std::string funasm = compile(
+        "var a = 6;\n"
+        "var b = a * 7;\n"
+        "var unused = b / 0;\n"
+        "if (b > 40) { mem[0x100] = b + 1; } else { mem[0x100] = 0; }\n"
+        "while (a > 100) { a = a + 1; }\n");
+
+    EXPECT_EQ(funasm, "\tMOVELM 0x2B 0x100\n\tHALT\n");
+}
+
+TEST(FVMTestFunlang, KeepsLoopsTight){
+    std::string funasm = compile(
+        "var i = 0;\n"
+        "var sum = 0;\n"
+        "while (i < 100) {\n"
+        "    var t = i * 4;\n"
+        "    sum = sum + t;\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "mem[0x100] = sum;\n");
+
+    // Copies and temporaries coalesce, i * 4 becomes a shift and the loop is rotated to end in a single jump
+    EXPECT_EQ(funasm,
+        "\tMOVELR 0x0 REG_0\n"
+        "\tMOVELR 0x0 REG_1\n"
+        "L1:\n"
+        "\tMOVERR REG_0 REG_2\n"
+        "\tSHIFTLEFT REG_2 0x2\n"
+        "\tADD REG_2 REG_1\n"
+        "\tINCREMENT REG_0\n"
+        "\tMOVELR 0x64 REG_7\n"
+        "\tCOMPARE REG_0 REG_7\n"
+        "\tJUMPLT L1\n"
+        "L2:\n"
+        "\tMOVERM REG_1 0x100\n"
+        "\tHALT\n");
+}
+
+TEST(FVMTestFunlang, ForwardsStoresAndDropsOverwrittenOnes){
+    std::string funasm = compile(
+        "var x = mem[0x200];\n"
+        "mem[0x100] = 1;\n"
+        "mem[0x100] = x;\n"
+        "var y = mem[0x100] + mem[0x200];\n"
+        "mem[0x102] = y;\n");
+
+    // One load of 0x200, none of 0x100, and the first store to 0x100 is gone
+    EXPECT_EQ(countLines(funasm, "\tMOVEMR"), 1);
+    EXPECT_EQ(countLines(funasm, "\tMOVELM"), 0);
+    EXPECT_EQ(countLines(funasm, "\tMOVERM"), 2);
+}
+
+TEST(FVMTestFunlang, KeepsOverlappingWordsApart){
+    // Stores and loads at neighbouring byte addresses share a byte, so none of them can be forwarded or dropped
+    std::unique_ptr<FVM> vm = run(
+        "mem[0x8000] = 0;\n"
+        "mem[0x8001] = 0xE168;\n"
+        "mem[0x100] = mem[0x8000];\n"
+        "mem[0x9000] = 1;\n"
+        "var x = mem[0x8FFF];\n"
+        "mem[0x9000] = 2;\n"
+        "mem[0x102] = x;\n"
+        "mem[0xA000] = 0x1234;\n"
+        "mem[0x9FFF] = 0xABCD;\n"
+        "mem[0x104] = mem[0xA000];\n");
+
+    EXPECT_EQ(vm->readUInt16(0x100), vm->readUInt16(0x8000));
+    EXPECT_EQ(vm->readUInt16(0x100), 0x6800);
+    EXPECT_EQ(vm->readUInt16(0x102), 0x100);
+    EXPECT_EQ(vm->readUInt16(0x104), vm->readUInt16(0xA000));
+    EXPECT_EQ(vm->readUInt16(0x104), 0x12AB);
+}
+
+TEST(FVMTestFunlang, StoresThroughComputedAddresses){
+    std::unique_ptr<FVM> vm = run(
+        "var i = 0;\n"
+        "var value = 7;\n"
+        "while (i < 16) {\n"
+        "    mem[0x1000 + i * 2] = value;\n"
+        "    value = value * 3 + i;\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "var sum = 0;\n"
+        "i = 0;\n"
+        "while (i < 16) {\n"
+        "    sum = sum + mem[0x1000 + i * 2];\n"
+        "    mem[0x2000 + i * 2] = 5;\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "mem[0x100] = sum;\n");
+
+    uint16_t value = 7;
+    uint16_t sum = 0;
+    for(uint16_t i = 0; i < 16; i++){
+        EXPECT_EQ(vm->readUInt16(0x1000 + i * 2), value);
+        EXPECT_EQ(vm->readUInt16(0x2000 + i * 2), 5);
+        sum = static_cast<uint16_t>(sum + value);
+        value = static_cast<uint16_t>(value * 3 + i);
+    }
+    EXPECT_EQ(vm->readUInt16(0x100), sum);
+}
+
+TEST(FVMTestFunlang, StoresThroughComputedAddressesLeaveTheProgramAlone){
+    Assembler assembler;
+    ASSERT_EQ(assembler.assemble(compile(
+        "var i = 0;\n"
+        "var value = 1;\n"
+        "while (i < 3000) {\n"
+        "    mem[0x1000 + (i & 0x3FF) * 2] = value;\n"
+        "    value = value * 5 + i;\n"
+        "    i = i + 1;\n"
+        "}\n")).value, RESULT_CODE::SUCCESS.value);
+    std::vector<uint8_t> bytecode = assembler.releaseBytecode();
+
+    FVM vm(0x10000);
+    vm.init();
+    vm.loadBytecode(0, bytecode);
+    EXPECT_EQ(vm.run().value, RESULT_CODE::SUCCESS.value);
+
+    // The stores went through a stub outside the program, which is still the one that was loaded
+    EXPECT_TRUE(vm.isVerified());
+    EXPECT_TRUE(std::equal(bytecode.begin(), bytecode.end(), vm.memory.begin()));
+    uint16_t value = 1;
+    std::vector<uint16_t> expected(0x400);
+    for(uint16_t i = 0; i < 3000; i++){
+        expected[i & 0x3FF] = value;
+        value = static_cast<uint16_t>(value * 5 + i);
+    }
+    for(uint16_t i = 0; i < 0x400; i++){
+        EXPECT_EQ(vm.readUInt16(0x1000 + i * 2), expected[i]);
+    }
+}
+
+TEST(FVMTestFunlang, SpillsWhenRegistersRunOut){
+    std::string source = "var i = 0;\n";
+    for(int v = 0; v < 12; v++){
+        source += "var v" + std::to_string(v) + " = " + std::to_string(v + 1) + ";\n";
+    }
+    source += "while (i < 10) {\n";
+    for(int v = 0; v < 12; v++){
+        source += "    v" + std::to_string(v) + " = v" + std::to_string(v) + " * 3 + v" + std::to_string((v + 1) % 12) + ";\n";
+    }
+    source += "    i = i + 1;\n}\n";
+    for(int v = 0; v < 12; v++){
+        source += "mem[" + std::to_string(0x100 + 2 * v) + "] = v" + std::to_string(v) + ";\n";
+    }
+
+    Lexer lexer;
+    ASSERT_EQ(lexer.tokenize(source).value, RESULT_CODE::SUCCESS.value);
+    ir::Function function;
+    Parser parser;
+    ASSERT_EQ(parser.parse(lexer.getTokens(), function).value, RESULT_CODE::SUCCESS.value);
+    Optimizer().optimize(function);
+    CodeGenerator generator;
+    std::string funasm;
+    ASSERT_EQ(generator.generate(function, funasm).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_GT(generator.spillCount(), 0);
+
+    std::unique_ptr<FVM> vm = run(source);
+    std::vector<uint16_t> values(12);
+    for(int v = 0; v < 12; v++){
+        values[v] = static_cast<uint16_t>(v + 1);
+    }
+    for(int i = 0; i < 10; i++){
+        for(int v = 0; v < 12; v++){
+            values[v] = static_cast<uint16_t>(values[v] * 3 + values[(v + 1) % 12]);
+        }
+    }
+    for(int v = 0; v < 12; v++){
+        EXPECT_EQ(vm->readUInt16(0x100 + 2 * v), values[v]);
+    }
+}
+
+TEST(FVMTestFunlang, ParsedBlocksEndInOneTerminator){
+    const std::vector<std::string> sources = {
+        "var a = 1;\nmem[0x100] = a;\n",
+        "var a = 3;\nwhile (a > 0) { a = a - 1; }\n",
+        "var a = 3;\nif (a == 3) { mem[0x100] = 1; } else { halt; }\n",
+        "var a = 3;\nhalt;\n",
+    };
+
+    for(const std::string& source : sources){
+        Lexer lexer;
+        ASSERT_EQ(lexer.tokenize(source).value, RESULT_CODE::SUCCESS.value);
+        ir::Function function;
+        ASSERT_EQ(Parser().parse(lexer.getTokens(), function).value, RESULT_CODE::SUCCESS.value);
+
+        for(const ir::Block& block : function.blocks){
+            ASSERT_FALSE(block.instructions.empty()) << source;
+            EXPECT_TRUE(block.terminator().isTerminator()) << source;
+            EXPECT_EQ(std::count_if(block.instructions.begin(), block.instructions.end(),
+                                    [](const ir::Instruction& instruction){ return instruction.isTerminator(); }), 1) << source;
+        }
+
+        // Unoptimized IR is just as valid to generate code from
+        std::string funasm;
+        EXPECT_EQ(CodeGenerator().generate(function, funasm).value, RESULT_CODE::SUCCESS.value) << source;
+    }
+}
+
+TEST(FVMTestFunlang, TokenizesAcrossBlockBoundaries){
+    // Identifiers, numbers and whitespace runs of every length up to a few vector blocks, so runs start and end at every block offset
+    std::string source;
+    std::vector<lexer::Token> expected;
+    uint32_t line = 1;
+    size_t lineStart = 0;
+    auto add = [&](const std::string& text, lexer::TOKEN_TYPE type, uint16_t value){
+        expected.push_back({std::string_view(), line, static_cast<uint32_t>(source.size() - lineStart + 1), value, type});
+        source += text;
+    };
+    for(size_t length = 1; length <= 70; length++){
+        add("_" + std::string(length - 1, static_cast<char>('a' + length % 26)), lexer::TOKEN_TYPE::IDENTIFIER, 0);
+        source += std::string(length % 37, ' ');
+        add(length % 2 == 0 ? "<=" : "=", length % 2 == 0 ? lexer::TOKEN_TYPE::LESS_EQUAL : lexer::TOKEN_TYPE::ASSIGN, 0);
+        source += length % 3 == 0 ? "\t// comment { ;\r\n" : "\r\n";
+        line++;
+        lineStart = source.size();
+        source += std::string(length % 5, '\n');
+        line += static_cast<uint32_t>(length % 5);
+        lineStart = source.size();
+        std::string number = std::string(length % 40, '0') + std::to_string(length * 900);
+        add(number, lexer::TOKEN_TYPE::NUMBER, static_cast<uint16_t>(length * 900));
+        source += std::string(length % 3 + 1, '\t');
+        add("while", lexer::TOKEN_TYPE::WHILE, 0);
+        add("~", lexer::TOKEN_TYPE::TILDE, 0);
+    }
+
+    Lexer lexer;
+    ASSERT_EQ(lexer.tokenize(source).value, RESULT_CODE::SUCCESS.value);
+    const std::vector<lexer::Token>& tokens = lexer.getTokens();
+    ASSERT_EQ(tokens.size(), expected.size() + 1);
+    for(size_t i = 0; i < expected.size(); i++){
+        EXPECT_EQ(tokens[i].tokenType, expected[i].tokenType) << "token " << i;
+        EXPECT_EQ(tokens[i].lineNumber, expected[i].lineNumber) << "token " << i;
+        EXPECT_EQ(tokens[i].charNumber, expected[i].charNumber) << "token " << i;
+        EXPECT_EQ(tokens[i].value, expected[i].value) << "token " << i;
+    }
+    EXPECT_EQ(tokens.back().tokenType, lexer::TOKEN_TYPE::END);
+    EXPECT_EQ(tokens.back().lineNumber, line);
+}
+
+TEST(FVMTestFunlang, ReportsErrorsWithLineNumbers){
+    Lexer lexer;
+    EXPECT_EQ(lexer.tokenize("var a = 1;\nvar b = 0x10000;\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(lexer.errorLine(), size_t(2));
+    EXPECT_EQ(lexer.tokenize("var a = 1;\n\nvar b = a $ 2;\n").value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(lexer.errorLine(), size_t(3));
+
+    Parser parser;
+    ir::Function function;
+    ASSERT_EQ(lexer.tokenize("var a = 1;\nif (a) { var b = 2; }\na = b;\n").value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(parser.parse(lexer.getTokens(), function).value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(parser.errorLine(), size_t(3));
+    ASSERT_EQ(lexer.tokenize("var a = 1;\nwhile (a < 2) {\na = a + 1;").value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(parser.parse(lexer.getTokens(), function).value, RESULT_CODE::INVALID_ARGUMENT.value);
+    EXPECT_EQ(parser.errorLine(), size_t(3));
+
+    std::string funasm;
+    EXPECT_EQ(Compiler::compileFunlang("var a = mem[0];\nvar b = 1 << a;\nmem[2] = b;\n", funasm).value, RESULT_CODE::INVALID_ARGUMENT.value);
+}
@@ -1,10 +1,12 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <gtest/gtest.h>
 #include "FVM.h" 
-
-std::vector<uint8_t>& operator<<(std::vector<uint8_t>& vec, BYTECODE code) {
-    vec.push_back(static_cast<uint8_t>(code));
-    return vec;
-}
+#include "FBCImage.h"
+#include "lang/Compiler.h"
+#include "FVMTestUtils.h"
 
 
 class FVMTest : public ::testing::Test{
@@ -24,8 +26,8 @@ protected:
 /** COMPARE */
 
 TEST_F(FVMTest, CompareInstructionLessThan){
-    fvm->REG_0 = 5; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 5; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -34,12 +36,12 @@ TEST_F(FVMTest, CompareInstructionLessThan){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::LT, FVM::FLAG::LT);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::LT, FVM::FLAG::LT);
 }
 
 TEST_F(FVMTest, CompareInstructionGreaterThan){
-    fvm->REG_0 = 10;
-    fvm->REG_1 = 5; 
+    fvm->getRegister(BYTECODE::REG_0) = 10;
+    fvm->getRegister(BYTECODE::REG_1) = 5; 
     
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -48,12 +50,12 @@ TEST_F(FVMTest, CompareInstructionGreaterThan){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::GT, FVM::FLAG::GT);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::GT, FVM::FLAG::GT);
 }
 
 TEST_F(FVMTest, CompareInstructionLessThanOrEqual_LT){
-    fvm->REG_0 = 5; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 5; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -62,12 +64,12 @@ TEST_F(FVMTest, CompareInstructionLessThanOrEqual_LT){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::LTE, FVM::FLAG::LTE);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::LTE, FVM::FLAG::LTE);
 }
 
 TEST_F(FVMTest, CompareInstructionLessThanOrEqual_EQ){
-    fvm->REG_0 = 10; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 10; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -76,12 +78,12 @@ TEST_F(FVMTest, CompareInstructionLessThanOrEqual_EQ){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::LTE, FVM::FLAG::LTE);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::LTE, FVM::FLAG::LTE);
 }
 
 TEST_F(FVMTest, CompareInstructionGreaterThanOrEqual_GT){
-    fvm->REG_0 = 15; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 15; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -90,12 +92,12 @@ TEST_F(FVMTest, CompareInstructionGreaterThanOrEqual_GT){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::GTE, FVM::FLAG::GTE);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::GTE, FVM::FLAG::GTE);
 }
 
 TEST_F(FVMTest, CompareInstructionGreaterThanOrEqual_EQ){
-    fvm->REG_0 = 10; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 10; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -104,13 +106,13 @@ TEST_F(FVMTest, CompareInstructionGreaterThanOrEqual_EQ){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::GTE, FVM::FLAG::GTE);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::GTE, FVM::FLAG::GTE);
 }
 
 
 TEST_F(FVMTest, CompareInstructionEqual){
-    fvm->REG_0 = 10; 
-    fvm->REG_1 = 10;
+    fvm->getRegister(BYTECODE::REG_0) = 10; 
+    fvm->getRegister(BYTECODE::REG_1) = 10;
 
     std::vector<uint8_t> bytecode;
     bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
@@ -119,18 +121,177 @@ TEST_F(FVMTest, CompareInstructionEqual){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_FLAGS & FVM::FLAG::EQ, FVM::FLAG::EQ);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::EQ, FVM::FLAG::EQ);
+}
+
+
+/** MOVE */
+
+TEST_F(FVMTest, MoveRegisterToRegisterInstruction){
+    std::vector<uint8_t> bytecode;
+
+    fvm->getRegister(BYTECODE::REG_5) = 0x1234;
+
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_5 << BYTECODE::REG_4;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_4), 0x1234);
+    EXPECT_EQ(fvm->registers[FVM::registerIndex(static_cast<uint8_t>(BYTECODE::REG_5))], 0x1234);
+}
+
+TEST_F(FVMTest, MoveLiteralToMemoryInstruction){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELM << uint16_t(0xBEEF) << uint16_t(0x30);
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->readUInt16(0x30), 0xBEEF);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
 }
 
+TEST_F(FVMTest, MoveIndirectRegisterToMemoryInstruction){
+    std::vector<uint8_t> bytecode;
+
+    fvm->writeUInt16(0x30, 0x1234);
+    fvm->getRegister(BYTECODE::REG_0) = 0x30;
+
+    bytecode << BYTECODE::MOVEIRM << BYTECODE::REG_0 << uint16_t(0x34);
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->readUInt16(0x34), 0x1234);
+}
+
+TEST_F(FVMTest, MoveIndirectMemoryToRegisterInstruction){
+    std::vector<uint8_t> bytecode;
+
+    fvm->writeUInt16(0x30, 0x34);
+    fvm->writeUInt16(0x34, 0x1234);
+
+    bytecode << BYTECODE::MOVEIMR << uint16_t(0x30) << BYTECODE::REG_0;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0x1234);
+}
+
+TEST_F(FVMTest, SelfModifyingCodeIsRedecoded){
+    std::vector<uint8_t> bytecode;
+
+    // Overwrite the operand of the INCREMENT below so it targets REG_1
+    bytecode << BYTECODE::MOVELM << uint16_t(static_cast<uint16_t>(BYTECODE::REG_1) << 8 | static_cast<uint16_t>(BYTECODE::INCREMENT)) << uint16_t(0x05);
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 1);
+}
 
 /** JUMP */
 
+TEST_F(FVMTest, ConditionalJumpLoop){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(5) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                         // 0x0D
+    bytecode << BYTECODE::HALT;                                             // 0x10
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x10);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::HLT, FVM::FLAG::HLT);
+}
+
+TEST_F(FVMTest, StepExecutesSingleInstruction){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->step();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 2);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::HLT, 0);
+}
+
+TEST_F(FVMTest, BudgetedRunResumesWhereItStopped){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(5) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                         // 0x0D
+    bytecode << BYTECODE::HALT;                                             // 0x10
+
+    fvm->loadBytecode(0, bytecode);
+
+    EXPECT_EQ(fvm->run(0).value, RESULT_CODE::BUDGET_EXHAUSTED.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x00);
+
+    EXPECT_EQ(fvm->run(3).value, RESULT_CODE::BUDGET_EXHAUSTED.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 4);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x0A);
+
+    // Stops between the halves of the fused COMPARE/JUMPGT pair
+    EXPECT_EQ(fvm->run(1).value, RESULT_CODE::BUDGET_EXHAUSTED.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x0D);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::GT, FVM::FLAG::GT);
+
+    size_t slices = 1;
+    while(fvm->run(1).value == RESULT_CODE::BUDGET_EXHAUSTED.value){
+        slices++;
+    }
+    EXPECT_EQ(slices, 14);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x10);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::HLT, FVM::FLAG::HLT);
+
+    EXPECT_EQ(fvm->run(0).value, RESULT_CODE::SUCCESS.value);
+}
+
+TEST_F(FVMTest, BudgetedRunBoundsInfiniteLoop){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x00
+    bytecode << BYTECODE::JUMP << uint16_t(0x00);                           // 0x02
+
+    fvm->loadBytecode(0, bytecode);
+
+    EXPECT_EQ(fvm->run(1000).value, RESULT_CODE::BUDGET_EXHAUSTED.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 500);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x00);
+}
+
 
 TEST_F(FVMTest, AddInstruction){
     std::vector<uint8_t> bytecode;
 
-    fvm->REG_0 = 2; 
-    fvm->REG_1 = 2;
+    fvm->getRegister(BYTECODE::REG_0) = 2; 
+    fvm->getRegister(BYTECODE::REG_1) = 2;
 
     bytecode << BYTECODE::ADD << BYTECODE::REG_0 << BYTECODE::REG_1;    
 
@@ -138,6 +299,570 @@ TEST_F(FVMTest, AddInstruction){
 
     fvm->run();
 
-    EXPECT_EQ(fvm->REG_1, 4);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 4);
+}
+
+TEST_F(FVMTest, DivideByZeroFaults){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_0 << BYTECODE::REG_1;     // 0x04
+    bytecode << BYTECODE::HALT;                                             // 0x07
+
+    fvm->loadBytecode(0, bytecode);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x04);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 0);
+
+    // Stepping faults the same way and leaves the PC at the DIVIDE
+    EXPECT_EQ(fvm->step().value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x04);
+
+    fvm->getRegister(BYTECODE::REG_1) = 2;
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 3);
+}
+
+
+/** SUPERINSTRUCTIONS */
+
+TEST_F(FVMTest, FusedPairsMatchSingleStepping){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELM << uint16_t(3) << uint16_t(0x30);          // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(10) << BYTECODE::REG_1;        // 0x05
+    bytecode << BYTECODE::MOVEMR << uint16_t(0x30) << BYTECODE::REG_2;      // 0x09 MOVEMR + ADD
+    bytecode << BYTECODE::ADD << BYTECODE::REG_2 << BYTECODE::REG_3;        // 0x0D
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x10 INCREMENT + COMPARE
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x12 COMPARE + JUMPLT
+    bytecode << BYTECODE::JUMPLT << uint16_t(0x09);                         // 0x15
+    bytecode << BYTECODE::HALT;                                             // 0x18
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->run();
+
+    FVM stepped(64);
+    stepped.init();
+    stepped.loadBytecode(0, bytecode);
+    while((stepped.getRegister(BYTECODE::REG_FLAGS) & FVM::FLAG::HLT) == 0){
+        ASSERT_EQ(stepped.step().value, RESULT_CODE::SUCCESS.value);
+    }
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_3), 30);
+    EXPECT_EQ(fvm->registers, stepped.registers);
+}
+
+TEST_F(FVMTest, JumpIntoFusedPair){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::JUMP << uint16_t(0x0A);                           // 0x04 into the pair, flags are clear
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x07 COMPARE + JUMPGT
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x13);                         // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x13);                         // 0x0D
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                     // 0x10
+    bytecode << BYTECODE::HALT;                                             // 0x12
+    bytecode << BYTECODE::HALT;                                             // 0x13
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->run();
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_2), 1);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x12);
 }
 
+/** SNAPSHOT */
+
+TEST_F(FVMTest, RestoreReturnsToSnapshot){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(0x1234) << BYTECODE::REG_0;    // 0x00
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x30);      // 0x04
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_1;                     // 0x08
+    bytecode << BYTECODE::HALT;                                             // 0x0A
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->getRegister(BYTECODE::REG_1) = 5;
+    fvm->snapshot();
+    std::vector<uint8_t> memory(fvm->memory.begin(), fvm->memory.end());
+
+    for(int i = 0; i < 3; i++){
+        EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 6);
+        EXPECT_EQ(fvm->readUInt16(0x30), 0x1234);
+
+        EXPECT_EQ(fvm->restore().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0);
+        EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 5);
+        EXPECT_EQ(fvm->getRegister(BYTECODE::REG_FLAGS), 0);
+        EXPECT_TRUE(std::equal(memory.begin(), memory.end(), fvm->memory.begin()));
+    }
+}
+
+TEST_F(FVMTest, RestoreRedecodesModifiedProgram){
+    std::vector<uint8_t> bytecode;
+
+    // Rewrites the INCREMENT at 0x05 to target REG_1 after it ran once
+    bytecode << BYTECODE::JUMP << uint16_t(0x05);                           // 0x00
+    bytecode << BYTECODE::NOT << BYTECODE::REG_7;                           // 0x03
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x05
+    bytecode << BYTECODE::MOVELM << uint16_t(static_cast<uint16_t>(BYTECODE::REG_1) << 8 | static_cast<uint16_t>(BYTECODE::INCREMENT)) << uint16_t(0x05); // 0x07
+    bytecode << BYTECODE::HALT;                                             // 0x0C
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->snapshot();
+
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->restore().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_1), 0);
+}
+
+TEST_F(FVMTest, RestoreCopiesOnlyDirtyPages){
+    FVM vm(4 * FVM::PAGE_SIZE);
+    vm.init();
+    vm.snapshot();
+
+    vm.writeUInt16(2 * FVM::PAGE_SIZE + 10, 0xBEEF);
+    vm.memory[3 * FVM::PAGE_SIZE] = 0x42; // bypasses dirty tracking
+
+    EXPECT_EQ(vm.restore().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm.readUInt16(2 * FVM::PAGE_SIZE + 10), 0);
+    EXPECT_EQ(vm.memory[3 * FVM::PAGE_SIZE], 0x42);
+}
+
+TEST_F(FVMTest, RestoreWithoutSnapshotFails){
+    EXPECT_FALSE(fvm->hasSnapshot());
+    EXPECT_EQ(fvm->restore().value, RESULT_CODE::NO_SNAPSHOT.value);
+}
+
+/** MEMORY */
+
+TEST_F(FVMTest, SparseMemoryCommitsOnlyWrittenPages){
+    const size_t size = 64 * 1024 * 1024;
+    FVM vm(size, GuestMemory::BACKING::SPARSE);
+    ASSERT_EQ(vm.init().value, RESULT_CODE::SUCCESS.value);
+
+    if(vm.memory.backing() != GuestMemory::BACKING::SPARSE){
+        GTEST_SKIP() << "No sparse memory on this platform";
+    }
+
+    vm.writeUInt16(0x100, 0xBEEF);
+    vm.writeUInt16(size - 2, 0xCAFE);
+    EXPECT_EQ(vm.readUInt16(0x100), 0xBEEF);
+    EXPECT_EQ(vm.readUInt16(size / 2), 0);
+    EXPECT_LT(vm.memory.residentBytes(), size_t(1024 * 1024));
+
+    ASSERT_EQ(vm.init().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm.readUInt16(0x100), 0);
+    EXPECT_EQ(vm.readUInt16(size - 2), 0);
+}
+
+TEST_F(FVMTest, DenseAndSparseMemoryRunAlike){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(0x200) << BYTECODE::REG_0;    // 0x00
+    bytecode << BYTECODE::MOVELIR << uint16_t(0x4242) << BYTECODE::REG_0;   // 0x04
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x08
+    bytecode << BYTECODE::HALT;                                             // 0x0B
+
+    FVM dense(0x400, GuestMemory::BACKING::DENSE);
+    FVM sparse(0x400, GuestMemory::BACKING::SPARSE);
+    for(FVM* vm : {&dense, &sparse}){
+        vm->init();
+        vm->loadBytecode(0, bytecode);
+        EXPECT_EQ(vm->run().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(vm->getRegister(BYTECODE::REG_1), 0x4242);
+    }
+    EXPECT_TRUE(dense.memory == sparse.memory);
+}
+
+/** VERIFIER */
+
+TEST_F(FVMTest, VerifierAcceptsWellFormedProgram){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x30);      // 0x04
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x04);                         // 0x0D
+    bytecode << BYTECODE::HALT;                                             // 0x10
+
+    fvm->loadBytecode(0, bytecode);
+
+    EXPECT_TRUE(fvm->isVerified());
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->readUInt16(0x30), 1);
+}
+
+TEST_F(FVMTest, VerifierRejectsUnsafePrograms){
+    std::vector<uint8_t> badRegister;
+    badRegister << BYTECODE::MOVERR << BYTECODE::REG_0 << uint8_t(0xEE);
+    fvm->loadBytecode(0, badRegister);
+    EXPECT_FALSE(fvm->isVerified());
+
+    std::vector<uint8_t> misalignedJump;
+    misalignedJump << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_0;
+    misalignedJump << BYTECODE::JUMP << uint16_t(0x01);
+    fvm->init();
+    fvm->loadBytecode(0, misalignedJump);
+    EXPECT_FALSE(fvm->isVerified());
+
+    std::vector<uint8_t> outsideMemory;
+    outsideMemory << BYTECODE::MOVEMR << uint16_t(0x3F) << BYTECODE::REG_0;
+    fvm->init();
+    fvm->loadBytecode(0, outsideMemory);
+    EXPECT_FALSE(fvm->isVerified());
+
+    fvm->init();
+    fvm->loadBytecode(0, std::vector<uint8_t>{0xFF});
+    EXPECT_FALSE(fvm->isVerified());
+}
+
+TEST_F(FVMTest, CheckedPathFaultsOnBadAddresses){
+    std::vector<uint8_t> direct;
+    direct << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_0;           // 0x00
+    direct << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x1000);      // 0x04
+    fvm->loadBytecode(0, direct);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::BAD_ADDRESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x04);
+
+    // Verified, but the address only exists at run time
+    std::vector<uint8_t> indirect;
+    indirect << BYTECODE::MOVELR << uint16_t(0x3F) << BYTECODE::REG_0;      // 0x00
+    indirect << BYTECODE::MOVEIRR << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x04
+    fvm->init();
+    fvm->loadBytecode(0, indirect);
+    EXPECT_TRUE(fvm->isVerified());
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::BAD_ADDRESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x04);
+
+    std::vector<uint8_t> runaway;
+    runaway << BYTECODE::JUMP << uint16_t(0x8000);
+    fvm->init();
+    fvm->loadBytecode(0, runaway);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::BAD_ADDRESS.value);
+    EXPECT_EQ(fvm->step().value, RESULT_CODE::BAD_ADDRESS.value);
+}
+
+TEST_F(FVMTest, VerifiedProgramLeavingTheStreamRunsChecked){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(0x20) << BYTECODE::REG_PC;     // 0x00
+    bytecode << BYTECODE::HALT;                                             // 0x04
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->writeUInt8(0x20, static_cast<uint8_t>(BYTECODE::INCREMENT));
+    fvm->writeUInt8(0x21, static_cast<uint8_t>(BYTECODE::REG_0));
+    fvm->writeUInt8(0x22, static_cast<uint8_t>(BYTECODE::MOVERM));
+    fvm->writeUInt8(0x23, static_cast<uint8_t>(BYTECODE::REG_0));
+    fvm->writeUInt16(0x24, 0x40);
+
+    EXPECT_TRUE(fvm->isVerified());
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::BAD_ADDRESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x22);
+}
+
+TEST_F(FVMTest, VerifiedProgramJumpsOutOfTheImageAndBack){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(5) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::JUMP << uint16_t(0x30);                           // 0x04
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_0 << uint16_t(0x20);      // 0x07
+    bytecode << BYTECODE::HALT;                                             // 0x0B
+
+    fvm->loadBytecode(0, bytecode);
+    fvm->writeUInt8(0x30, static_cast<uint8_t>(BYTECODE::INCREMENT));
+    fvm->writeUInt8(0x31, static_cast<uint8_t>(BYTECODE::REG_0));
+    fvm->writeUInt8(0x32, static_cast<uint8_t>(BYTECODE::JUMP));
+    fvm->writeUInt16(0x33, 0x07);
+    fvm->snapshot();
+
+    // Leaving the image is not the same as jumping into the middle of an instruction
+    EXPECT_TRUE(fvm->isVerified());
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->readUInt16(0x20), 6);
+
+    // The instructions stepped outside the image count against the budget too
+    fvm->restore();
+    EXPECT_EQ(fvm->run(4).value, RESULT_CODE::BUDGET_EXHAUSTED.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x07);
+    EXPECT_EQ(fvm->run(2).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->readUInt16(0x20), 6);
+}
+
+/** LOADING */
+
+static std::filesystem::path writeProgram(const std::string& name, const std::vector<uint8_t>& bytecode){
+    std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+    std::ofstream fileStream(path, std::ios::binary);
+    fileStream.write(reinterpret_cast<const char*>(bytecode.data()), static_cast<std::streamsize>(bytecode.size()));
+    return path;
+}
+
+static std::vector<uint8_t> readProgram(const std::filesystem::path& path){
+    std::ifstream fileStream(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+}
+
+TEST_F(FVMTest, LoadBytecodeFromFile){
+    std::vector<uint8_t> bytecode;
+
+    // Spans more than one page so the first page can be mapped from the file
+    bytecode << BYTECODE::JUMP << uint16_t(0x1000);                         // 0x0000
+    bytecode.resize(0x1000);
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x1000
+    bytecode << BYTECODE::MOVELM << uint16_t(0xABCD) << uint16_t(0x10);     // 0x1002
+    bytecode << BYTECODE::HALT;                                             // 0x1007
+
+    std::filesystem::path path = writeProgram("FVMTestLoadBytecodeFromFile.fbc", bytecode);
+
+    FVM first(0x2000);
+    FVM second(0x2000);
+    for(FVM* vm : {&first, &second}){
+        vm->init();
+        ASSERT_EQ(vm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+    }
+
+    EXPECT_TRUE(std::equal(bytecode.begin(), bytecode.end(), first.memory.begin()));
+    EXPECT_EQ(first.run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(first.getRegister(BYTECODE::REG_0), 1);
+    EXPECT_EQ(first.readUInt16(0x10), 0xABCD);
+
+    // Writes stay private to the VM that made them
+    EXPECT_EQ(second.readUInt16(0x10), 0);
+    EXPECT_EQ(readProgram(path), bytecode);
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, LoadBytecodeFromFileAtUnalignedOffset){
+    std::vector<uint8_t> bytecode(0x1800, 0x5A);
+    std::filesystem::path path = writeProgram("FVMTestLoadBytecodeFromFileAtUnalignedOffset.fbc", bytecode);
+
+    FVM vm(0x2000);
+    vm.init();
+    ASSERT_EQ(vm.loadBytecode(3, path).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm.memory[2], 0);
+    EXPECT_TRUE(std::equal(bytecode.begin(), bytecode.end(), vm.memory.begin() + 3));
+    EXPECT_EQ(vm.memory[3 + bytecode.size()], 0);
+
+    EXPECT_EQ(vm.loadBytecode(0x1000, path).value, RESULT_CODE::BAD_OFFSET.value);
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, LoadBytecodeFromMissingFile){
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FVMTestLoadBytecodeFromMissingFile.fbc";
+    std::filesystem::remove(path);
+    EXPECT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::FILE_NOT_FOUND.value);
+}
+
+TEST_F(FVMTest, LoadImageSectionsAndEntry){
+    std::vector<uint8_t> code;
+
+    code << BYTECODE::MOVEMR << uint16_t(0x40) << BYTECODE::REG_0;          // 0x1000
+    code << BYTECODE::INCREMENT << BYTECODE::REG_0;                         // 0x1004
+    code << BYTECODE::HALT;                                                 // 0x1006
+    code.resize(0x1010);
+
+    FBCImage image;
+    image.entry = 0x1000;
+    image.memorySize = 0x4000;
+    image.addSection(FBCImage::SECTION_TYPE::DATA, 0x40, {0x34, 0x12});
+    image.addSection(FBCImage::SECTION_TYPE::CODE, 0x1000, code);
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FVMTestLoadImageSectionsAndEntry.fbc";
+    ASSERT_EQ(image.write(path).value, RESULT_CODE::SUCCESS.value);
+    ASSERT_TRUE(FBCImage::isImage(path));
+
+    // The VM only has 64 bytes, the image asks for more
+    ASSERT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->MEMORY_SIZE, size_t(0x4000));
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x1000);
+
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0x1235);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x1006);
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, RewritingMappedImageKeepsRunningVM){
+    std::vector<uint8_t> code;
+
+    // Whole pages so the section is mapped from the file
+    code << BYTECODE::JUMP << uint16_t(0x1000);                             // 0x0000
+    code.resize(0x1000);
+    code << BYTECODE::INCREMENT << BYTECODE::REG_0;                         // 0x1000
+    code << BYTECODE::HALT;                                                 // 0x1002
+    code.resize(0x2000);
+
+    FBCImage image;
+    image.memorySize = 0x4000;
+    image.addSection(FBCImage::SECTION_TYPE::CODE, 0, code);
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FVMTestRewritingMappedImageKeepsRunningVM.fbc";
+    ASSERT_EQ(image.write(path).value, RESULT_CODE::SUCCESS.value);
+    ASSERT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+
+    // A recompile replaces the file, the VM keeps the image it loaded
+    FBCImage smaller;
+    smaller.addSection(FBCImage::SECTION_TYPE::CODE, 0, std::vector<uint8_t>{static_cast<uint8_t>(BYTECODE::HALT)});
+    ASSERT_EQ(smaller.write(path).value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
+    EXPECT_TRUE(std::equal(code.begin(), code.end(), fvm->memory.begin()));
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, LoadImageRejectsCorruptImages){
+    std::vector<uint8_t> code;
+    code << BYTECODE::INCREMENT << BYTECODE::REG_0 << BYTECODE::HALT;
+
+    FBCImage image;
+    image.addSection(FBCImage::SECTION_TYPE::CODE, 0, code);
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FVMTestLoadImageRejectsCorruptImages.fbc";
+    ASSERT_EQ(image.write(path).value, RESULT_CODE::SUCCESS.value);
+    std::vector<uint8_t> file = readProgram(path);
+
+    std::vector<uint8_t> flipped = file;
+    flipped.back() ^= 0x01;
+    writeProgram(path.filename().string(), flipped);
+    EXPECT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::BAD_IMAGE.value);
+
+    std::vector<uint8_t> truncated(file.begin(), file.end() - 1);
+    writeProgram(path.filename().string(), truncated);
+    EXPECT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::BAD_IMAGE.value);
+
+    std::vector<uint8_t> newer = file;
+    newer[4] = FBCImage::VERSION + 1;
+    writeProgram(path.filename().string(), newer);
+    EXPECT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::BAD_IMAGE.value);
+
+    writeProgram(path.filename().string(), file);
+    EXPECT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 1);
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, LoadImageDecodesAlongBlocks){
+    std::vector<uint8_t> code;
+
+    code << BYTECODE::JUMP << uint16_t(0x05);                               // 0x00
+    code << BYTECODE::MOVELR << BYTECODE::MOVELR;                           // 0x03 data
+    code << BYTECODE::INCREMENT << BYTECODE::REG_0;                         // 0x05
+    code << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x07
+    code << BYTECODE::JUMPLT << uint16_t(0x05);                             // 0x0A
+    code << BYTECODE::HALT;                                                 // 0x0D
+
+    FBCImage image;
+    image.addSection(FBCImage::SECTION_TYPE::CODE, 0, code);
+    image.setBlocks({0x00, 0x03, 0x05, 0x0D});
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FVMTestLoadImageDecodesAlongBlocks.fbc";
+    ASSERT_EQ(image.write(path).value, RESULT_CODE::SUCCESS.value);
+
+    ASSERT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+    fvm->getRegister(BYTECODE::REG_1) = 3;
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 3);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x0D);
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(FVMTest, CompiledFunasmIsAnImage){
+    std::filesystem::path asmPath = std::filesystem::temp_directory_path() / "FVMTestCompiledFunasmIsAnImage.funasm";
+    {
+        std::ofstream asmStream(asmPath);
+        asmStream << "MOVELR 0005 REG_0\n";
+        asmStream << "MOVELR 0000 REG_1\n";
+        asmStream << "DECREMENT REG_0\n";
+        asmStream << "COMPARE REG_0 REG_1\n";
+        asmStream << "JUMPGT 0008\n";
+        asmStream << "HALT\n";
+    }
+
+    Compiler compiler;
+    ASSERT_EQ(compiler.compileFunasmToBytecode(asmPath).value, RESULT_CODE::SUCCESS.value);
+
+    std::filesystem::path path = asmPath;
+    path.replace_extension(".fbc");
+    FBCImage image;
+    ASSERT_EQ(image.read(path).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(image.blocks, (std::vector<uint16_t>{0x00, 0x08, 0x10}));
+    // Room for a 16-bit access at 0xFFFF
+    EXPECT_GT(image.memorySize, 0x10000u);
+
+    ASSERT_EQ(fvm->loadBytecode(0, path).value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_0), 0);
+    EXPECT_EQ(fvm->getRegister(BYTECODE::REG_PC), 0x10);
+
+    std::filesystem::remove(asmPath);
+    std::filesystem::remove(path);
+}
+
+/** TRACE */
+
+#ifdef FVM_TRACE
+TEST_F(FVMTest, TraceRecordsExecutedInstructions){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
+
+    fvm->loadBytecode(0, bytecode);
+
+    fvm->run();
+
+    ASSERT_EQ(fvm->trace.size(), 3);
+    EXPECT_EQ(fvm->trace.fromNewest(0).opcode, static_cast<uint8_t>(BYTECODE::HALT));
+    EXPECT_EQ(fvm->trace.fromNewest(1).opcode, static_cast<uint8_t>(BYTECODE::COMPARE));
+    EXPECT_EQ(fvm->trace.fromNewest(1).pc, 2);
+    EXPECT_EQ(fvm->trace.fromNewest(2).opcode, static_cast<uint8_t>(BYTECODE::INCREMENT));
+}
+#endif
+
+#ifdef FVM_PROFILE
+TEST_F(FVMTest, ProfileCountsOpcodesPCsAndBranches){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_0;         // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x08
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x0A
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                         // 0x0D
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x14);                         // 0x10
+    bytecode << BYTECODE::HALT;                                             // 0x13
+    bytecode << BYTECODE::HALT;                                             // 0x14
+
+    fvm->loadBytecode(0, bytecode);
+
+    ASSERT_EQ(fvm->run().value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(fvm->profile.total(), 13);
+    EXPECT_EQ(fvm->profile.opcodeCount(static_cast<uint8_t>(BYTECODE::MOVELR)), 2);
+    EXPECT_EQ(fvm->profile.opcodeCount(static_cast<uint8_t>(BYTECODE::COMPARE)), 3);
+    EXPECT_EQ(fvm->profile.at(0x08).executed, 3);
+    EXPECT_EQ(fvm->profile.at(0x13).executed, 0);
+    EXPECT_EQ(fvm->profile.at(0x0D).taken, 2);
+    EXPECT_EQ(fvm->profile.at(0x0D).notTaken, 1);
+    EXPECT_EQ(fvm->profile.at(0x10).taken, 1);
+    EXPECT_EQ(fvm->profile.at(0x10).notTaken, 0);
+
+    std::string report = fvm->profile.report(4);
+    EXPECT_NE(report.find("Profile of 13 instructions"), std::string::npos);
+    EXPECT_NE(report.find("taken 2, not taken 1"), std::string::npos);
+
+    fvm->init();
+    EXPECT_EQ(fvm->profile.total(), 0);
+    EXPECT_EQ(fvm->profile.at(0x08).executed, 0);
+}
+#endif
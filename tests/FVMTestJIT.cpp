@@ -0,0 +1,250 @@
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "FVMTestUtils.h"
+
+/* Builds without the JIT, and tracing and profiling builds, keep run() in the interpreter */
+#if defined(FVM_TRACE) || defined(FVM_PROFILE) || !defined(FVM_JIT)
+static constexpr size_t TRACES = 0;
+#else
+static constexpr size_t TRACES = 1;
+#endif
+
+/**
+ * Runs every program twice, once interpreted and once with the JIT, and
+ * expects identical registers and memory afterwards. Memory covers the whole
+ * 16-bit address space so indirect accesses are compiled as well.
+ */
+class FVMTestJIT : public ::testing::Test{
+protected:
+    std::unique_ptr<FVM> interpreted;
+    std::unique_ptr<FVM> compiled;
+
+    virtual void SetUp() {
+        interpreted = std::make_unique<FVM>(0x10001);
+        interpreted->init();
+        interpreted->jitEnabled = false;
+
+        compiled = std::make_unique<FVM>(0x10001);
+        compiled->init();
+    }
+
+    void runBoth(const std::vector<uint8_t>& bytecode) {
+        ASSERT_EQ(interpreted->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+        ASSERT_EQ(compiled->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+        EXPECT_TRUE(compiled->isVerified());
+
+        ASSERT_EQ(interpreted->run().value, RESULT_CODE::SUCCESS.value);
+        ASSERT_EQ(compiled->run().value, RESULT_CODE::SUCCESS.value);
+
+        EXPECT_EQ(interpreted->registers, compiled->registers);
+        EXPECT_EQ(interpreted->memory, compiled->memory);
+    }
+};
+
+TEST_F(FVMTestJIT, ArithmeticLoop){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(1000) << BYTECODE::REG_0;          // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04 zero
+    bytecode << BYTECODE::MOVELR << uint16_t(0x1234) << BYTECODE::REG_2;        // 0x08 accumulator
+    bytecode << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_3;             // 0x0C
+    // loop: 0x10
+    bytecode << BYTECODE::MULTIPLY << BYTECODE::REG_3 << BYTECODE::REG_2;
+    bytecode << BYTECODE::ADD << BYTECODE::REG_0 << BYTECODE::REG_2;
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_2 << BYTECODE::REG_4;
+    bytecode << BYTECODE::SHIFTRIGHT << BYTECODE::REG_4 << uint16_t(3);
+    bytecode << BYTECODE::XOR << BYTECODE::REG_4 << BYTECODE::REG_2;
+    bytecode << BYTECODE::SHIFTLEFT << BYTECODE::REG_4 << uint16_t(5);
+    bytecode << BYTECODE::SUBTRACT << BYTECODE::REG_4 << BYTECODE::REG_5;
+    bytecode << BYTECODE::OR << BYTECODE::REG_2 << BYTECODE::REG_6;
+    bytecode << BYTECODE::AND << BYTECODE::REG_4 << BYTECODE::REG_6;
+    bytecode << BYTECODE::NOT << BYTECODE::REG_7;
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_7;
+    bytecode << BYTECODE::SHIFTLEFT << BYTECODE::REG_3 << uint16_t(16);
+    bytecode << BYTECODE::MOVELR << uint16_t(7) << BYTECODE::REG_3;
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x10);
+    bytecode << BYTECODE::HALT;
+
+    runBoth(bytecode);
+
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_0), 0);
+}
+
+TEST_F(FVMTestJIT, MemoryLoop){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(0x200) << BYTECODE::REG_0;         // 0x00 pointer
+    bytecode << BYTECODE::MOVELR << uint16_t(0x280) << BYTECODE::REG_1;         // 0x04 end
+    bytecode << BYTECODE::MOVELM << uint16_t(0x300) << uint16_t(0x100);         // 0x08 [0x100] = 0x300
+    // loop: 0x0D
+    bytecode << BYTECODE::MOVELIR << uint16_t(0xABCD) << BYTECODE::REG_0;
+    bytecode << BYTECODE::MOVEIRR << BYTECODE::REG_0 << BYTECODE::REG_2;
+    bytecode << BYTECODE::ADD << BYTECODE::REG_0 << BYTECODE::REG_2;
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_2 << uint16_t(0x300);
+    bytecode << BYTECODE::MOVEIMR << uint16_t(0x100) << BYTECODE::REG_3;
+    bytecode << BYTECODE::MOVEIRM << BYTECODE::REG_0 << uint16_t(0x302);
+    bytecode << BYTECODE::MOVEMR << uint16_t(0x302) << BYTECODE::REG_4;
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;
+    bytecode << BYTECODE::JUMPLT << uint16_t(0x0D);
+    bytecode << BYTECODE::HALT;
+
+    runBoth(bytecode);
+
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_4), 0xABCD);
+}
+
+TEST_F(FVMTestJIT, ConditionalJumpsAndDivide){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(300) << BYTECODE::REG_0;           // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(150) << BYTECODE::REG_1;           // 0x04 midpoint
+    bytecode << BYTECODE::MOVELR << uint16_t(3) << BYTECODE::REG_6;             // 0x08 divisor
+    // loop: 0x0C
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x0C
+    bytecode << BYTECODE::JUMPGTE << uint16_t(0x18);                            // 0x0F
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x12 below midpoint
+    bytecode << BYTECODE::JUMP << uint16_t(0x1A);                               // 0x14
+    bytecode << BYTECODE::HALT;                                                 // 0x17 never reached
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_3;                         // 0x18 at or above midpoint
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_5;         // 0x1A
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_6 << BYTECODE::REG_5;         // 0x1D
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x20
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_7;             // 0x22
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_7;        // 0x26
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x2F);                             // 0x29
+    bytecode << BYTECODE::JUMP << uint16_t(0x0C);                               // 0x2C
+    bytecode << BYTECODE::HALT;                                                 // 0x2F
+
+    runBoth(bytecode);
+
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_2), 149);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_3), 151);
+}
+
+TEST_F(FVMTestJIT, DivideByZeroInHotLoopFaults){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(300) << BYTECODE::REG_0;           // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(1000) << BYTECODE::REG_6;          // 0x04
+    // loop: 0x08, divides by the counter until it reaches zero
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_5;         // 0x08
+    bytecode << BYTECODE::DIVIDE << BYTECODE::REG_6 << BYTECODE::REG_5;         // 0x0B
+    bytecode << BYTECODE::ADD << BYTECODE::REG_5 << BYTECODE::REG_4;            // 0x0E
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x11
+    bytecode << BYTECODE::JUMP << uint16_t(0x08);                               // 0x13
+
+    ASSERT_EQ(interpreted->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+    ASSERT_EQ(compiled->loadBytecode(0, bytecode).value, RESULT_CODE::SUCCESS.value);
+
+    EXPECT_EQ(interpreted->run().value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+    EXPECT_EQ(compiled->run().value, RESULT_CODE::DIVIDE_BY_ZERO.value);
+
+    EXPECT_EQ(interpreted->registers, compiled->registers);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_PC), 0x0B);
+}
+
+TEST_F(FVMTestJIT, SelfModifyingLoopLeavesNativeCode){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(100) << BYTECODE::REG_0;           // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04
+    // loop: 0x08
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x08 operand rewritten below
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x0A
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x0C
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                             // 0x0F
+    // Retarget the INCREMENT at REG_3 and run the loop body once more
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_0;             // 0x12
+    bytecode << BYTECODE::MOVELM << uint16_t(static_cast<uint16_t>(BYTECODE::REG_3) << 8 | static_cast<uint16_t>(BYTECODE::INCREMENT)) << uint16_t(0x08); // 0x16
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_3 << BYTECODE::REG_1;        // 0x1B
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x08);                             // 0x1E
+    bytecode << BYTECODE::HALT;                                                 // 0x21
+
+    runBoth(bytecode);
+
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_2), 100);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_3), 1);
+}
+
+TEST_F(FVMTestJIT, TracesLoopWithBranches){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(1000) << BYTECODE::REG_0;          // 0x00 counter
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04 zero
+    bytecode << BYTECODE::MOVELR << uint16_t(1) << BYTECODE::REG_6;             // 0x08 mask
+    // loop: 0x0C, the branch flips every iteration so both guards exit
+    bytecode << BYTECODE::MOVERR << BYTECODE::REG_0 << BYTECODE::REG_5;         // 0x0C
+    bytecode << BYTECODE::AND << BYTECODE::REG_6 << BYTECODE::REG_5;            // 0x0F
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_5 << BYTECODE::REG_1;        // 0x12
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x1D);                             // 0x15
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_2;                         // 0x18 odd
+    bytecode << BYTECODE::JUMP << uint16_t(0x1F);                               // 0x1A
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_3;                         // 0x1D even
+    bytecode << BYTECODE::ADD << BYTECODE::REG_0 << BYTECODE::REG_4;            // 0x1F
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x22
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x24
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x0C);                             // 0x27
+    bytecode << BYTECODE::HALT;                                                 // 0x2A
+
+    runBoth(bytecode);
+
+    EXPECT_GE(compiled->jitTraceCount(), TRACES);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_2), 500);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_3), 500);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_4), 500500 & 0xFFFF);
+}
+
+/* Outer loop of 40 around an inner loop of 50 accumulating into [0x4000] */
+static std::vector<uint8_t> nestedLoops(){
+    std::vector<uint8_t> bytecode;
+
+    bytecode << BYTECODE::MOVELR << uint16_t(40) << BYTECODE::REG_0;            // 0x00 outer counter
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;             // 0x04 zero
+    // outer: 0x08
+    bytecode << BYTECODE::MOVELR << uint16_t(50) << BYTECODE::REG_2;            // 0x08 inner counter
+    // inner: 0x0C
+    bytecode << BYTECODE::MOVEMR << uint16_t(0x4000) << BYTECODE::REG_3;        // 0x0C
+    bytecode << BYTECODE::ADD << BYTECODE::REG_2 << BYTECODE::REG_3;            // 0x10
+    bytecode << BYTECODE::MOVERM << BYTECODE::REG_3 << uint16_t(0x4000);        // 0x13
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_4;                         // 0x17
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_2;                         // 0x19
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_2 << BYTECODE::REG_1;        // 0x1B
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x0C);                             // 0x1E
+    bytecode << BYTECODE::MOVELM << uint16_t(0x1234) << uint16_t(0x5002);       // 0x21
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                         // 0x26
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;        // 0x28
+    bytecode << BYTECODE::JUMPGT << uint16_t(0x08);                             // 0x2B
+    bytecode << BYTECODE::HALT;                                                 // 0x2E
+
+    return bytecode;
+}
+
+TEST_F(FVMTestJIT, TracesNestedLoops){
+    runBoth(nestedLoops());
+
+    EXPECT_GE(compiled->jitTraceCount(), 2 * TRACES);
+    EXPECT_EQ(compiled->readUInt16(0x4000), 40 * 1275);
+    EXPECT_EQ(compiled->readUInt16(0x5002), 0x1234);
+    EXPECT_EQ(compiled->getRegister(BYTECODE::REG_4), 2000);
+}
+
+TEST_F(FVMTestJIT, RestoreUndoesTracedStores){
+    ASSERT_EQ(compiled->loadBytecode(0, nestedLoops()).value, RESULT_CODE::SUCCESS.value);
+    compiled->snapshot();
+
+    // The second run reuses the native code, which has to mark its pages dirty again
+    for(int run = 0; run < 2; run++){
+        ASSERT_EQ(compiled->run().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(compiled->readUInt16(0x4000), 40 * 1275);
+        EXPECT_EQ(compiled->readUInt16(0x5002), 0x1234);
+
+        ASSERT_EQ(compiled->restore().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(compiled->readUInt16(0x4000), 0);
+        EXPECT_EQ(compiled->readUInt16(0x5002), 0);
+    }
+    EXPECT_GE(compiled->jitTraceCount(), 2 * TRACES);
+}
@@ -0,0 +1,103 @@
+#include <thread>
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "FVMLoop.h"
+#include "FVMTestUtils.h"
+
+static std::unique_ptr<FVM> loadedVM(const std::vector<uint8_t>& bytecode){
+    std::unique_ptr<FVM> vm = std::make_unique<FVM>(64);
+    vm->init();
+    vm->loadBytecode(0, bytecode);
+    return vm;
+}
+
+/* Runs a guest and records the order in which guests finished */
+static FVMLoop::Task guest(FVMLoop& loop, FVM& vm, std::vector<size_t>& finished, const size_t id){
+    RESULT result = co_await loop.execute(vm);
+    finished.push_back(id);
+    co_return result;
+}
+
+TEST(FVMTestLoop, InterleavesManyGuestsOnOneThread){
+    FVMLoop loop(64);
+
+    std::vector<std::unique_ptr<FVM>> vms;
+    std::vector<FVMLoop::Task> tasks;
+    std::vector<size_t> finished;
+    for(size_t i = 0; i < 500; i++){
+        // The first guest runs far longer than all the others
+        vms.push_back(loadedVM(countdown(i == 0 ? 20000 : static_cast<uint16_t>(i))));
+        tasks.push_back(guest(loop, *vms.back(), finished, i));
+    }
+    for(FVMLoop::Task& task : tasks){
+        loop.spawn(task);
+    }
+    EXPECT_EQ(loop.pending(), 500);
+
+    loop.run();
+
+    EXPECT_EQ(loop.pending(), 0);
+    ASSERT_EQ(finished.size(), 500);
+    EXPECT_EQ(finished.back(), 0);
+    for(size_t i = 0; i < tasks.size(); i++){
+        EXPECT_TRUE(tasks[i].done());
+        EXPECT_EQ(tasks[i].result().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_EQ(vms[i]->getRegister(BYTECODE::REG_PC), 0x13);
+    }
+}
+
+TEST(FVMTestLoop, ReportsFaults){
+    FVMLoop loop;
+    std::unique_ptr<FVM> vm = loadedVM(std::vector<uint8_t>{0xFF});
+    std::vector<size_t> finished;
+
+    FVMLoop::Task task = guest(loop, *vm, finished, 0);
+    loop.spawn(task);
+    loop.run();
+
+    EXPECT_EQ(task.result().value, RESULT_CODE::UNIMPLEMENTED_INSTRUCTION.value);
+}
+
+/* Runs a guest twice, handing it a value from the host in between */
+static FVMLoop::Task resumedGuest(FVMLoop& loop, FVM& vm, FVMLoop::Event& input, const uint16_t& value){
+    RESULT result = co_await loop.execute(vm);
+    if(result != RESULT_CODE::SUCCESS){
+        co_return result;
+    }
+
+    co_await input;
+    vm.getRegister(BYTECODE::REG_0) = value;
+    vm.getRegister(BYTECODE::REG_PC) = 0x01;
+    vm.getRegister(BYTECODE::REG_FLAGS) = 0;
+    co_return co_await loop.execute(vm);
+}
+
+TEST(FVMTestLoop, EventResumesWaitingGuest){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::HALT;                                             // 0x00
+    bytecode << BYTECODE::INCREMENT << BYTECODE::REG_0;                     // 0x01
+    bytecode << BYTECODE::HALT;                                             // 0x03
+
+    FVMLoop loop;
+    FVMLoop::Event input(loop);
+    std::unique_ptr<FVM> vm = loadedVM(bytecode);
+    uint16_t value = 0;
+
+    FVMLoop::Task task = resumedGuest(loop, *vm, input, value);
+    loop.spawn(task);
+
+    EXPECT_EQ(loop.poll(), 1);
+    EXPECT_EQ(loop.poll(), 0);
+    EXPECT_FALSE(task.done());
+
+    std::thread host([&]{
+        value = 41;
+        input.set();
+    });
+    loop.run();
+    host.join();
+
+    ASSERT_TRUE(task.done());
+    EXPECT_EQ(task.result().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_EQ(vm->getRegister(BYTECODE::REG_0), 42);
+}
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+#include "FVM.h"
+#include "FVMPool.h"
+#include "FVMTestUtils.h"
+
+TEST(FVMTestPool, RunsManyProgramsToCompletion){
+    FVMPool pool(4, 64);
+
+    std::vector<FVMPool::Task> tasks;
+    for(uint16_t i = 0; i < 200; i++){
+        tasks.push_back(pool.submit(countdown(static_cast<uint16_t>(i * 7)), 64));
+    }
+
+    for(FVMPool::Task& task : tasks){
+        EXPECT_EQ(task.await().value, RESULT_CODE::SUCCESS.value);
+        EXPECT_TRUE(task.ready());
+        EXPECT_EQ(task.vm().getRegister(BYTECODE::REG_0), 0);
+        EXPECT_EQ(task.vm().getRegister(BYTECODE::REG_PC), 0x13);
+    }
+}
+
+TEST(FVMTestPool, ReportsFailures){
+    FVMPool pool(2);
+
+    FVMPool::Task unimplemented = pool.submit(std::vector<uint8_t>{0xFF}, 64);
+    FVMPool::Task tooLarge = pool.submit(countdown(1), 8);
+    FVMPool::Task missing = pool.submit(std::filesystem::path("does/not/exist.fbc"), 64);
+
+    EXPECT_EQ(unimplemented.await().value, RESULT_CODE::UNIMPLEMENTED_INSTRUCTION.value);
+    EXPECT_EQ(tooLarge.await().value, RESULT_CODE::OUT_OF_MEMORY.value);
+    EXPECT_EQ(missing.await().value, RESULT_CODE::FILE_NOT_FOUND.value);
+}
+
+TEST(FVMTestPool, LongRunningProgramsDoNotBlockOthers){
+    std::vector<uint8_t> forever;
+    forever << BYTECODE::JUMP << uint16_t(0x00);
+
+    std::unique_ptr<FVMPool> pool = std::make_unique<FVMPool>(1, 100);
+    FVMPool::Task spinning = pool->submit(forever, 64);
+    FVMPool::Task quick = pool->submit(countdown(500), 64);
+
+    EXPECT_EQ(quick.await().value, RESULT_CODE::SUCCESS.value);
+    EXPECT_FALSE(spinning.ready());
+
+    pool.reset();
+    EXPECT_EQ(spinning.await().value, RESULT_CODE::CANCELLED.value);
+}
@@ -0,0 +1,32 @@
+#ifndef FVM_TEST_UTILS_H
+#define FVM_TEST_UTILS_H
+
+#include <cstdint>
+#include <vector>
+#include "ByteCode.h"
+
+inline std::vector<uint8_t>& operator<<(std::vector<uint8_t>& vec, BYTECODE code) {
+    vec.push_back(static_cast<uint8_t>(code));
+    return vec;
+}
+
+inline std::vector<uint8_t>& operator<<(std::vector<uint8_t>& vec, uint16_t value) {
+    vec.push_back(static_cast<uint8_t>(value & 0xFF));
+    vec.push_back(static_cast<uint8_t>(value >> 8));
+    return vec;
+}
+
+/* Counts REG_0 down from count to 0, then halts */
+inline std::vector<uint8_t> countdown(uint16_t count){
+    std::vector<uint8_t> bytecode;
+    bytecode << BYTECODE::MOVELR << count << BYTECODE::REG_0;              // 0x00
+    bytecode << BYTECODE::MOVELR << uint16_t(0) << BYTECODE::REG_1;         // 0x04
+    bytecode << BYTECODE::COMPARE << BYTECODE::REG_0 << BYTECODE::REG_1;    // 0x08
+    bytecode << BYTECODE::JUMPEQ << uint16_t(0x13);                         // 0x0B
+    bytecode << BYTECODE::DECREMENT << BYTECODE::REG_0;                     // 0x0E
+    bytecode << BYTECODE::JUMP << uint16_t(0x08);                           // 0x10
+    bytecode << BYTECODE::HALT;                                             // 0x13
+    return bytecode;
+}
+
+#endif